@@ -0,0 +1,664 @@
+/*
+Copyright 2025 Amini Allight
+
+This file is part of netpw.
+
+netpw is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+netpw is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with netpw. If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "constants.h"
+#include "tools.h"
+#include "server.h"
+#include "client.h"
+#include "coding.h"
+#include "cryptography.h"
+#include "packet.h"
+#include "error_handling.h"
+#include "lockfree_spsc_queue.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/resource.h>
+
+/*
+ * runs a server and several clients in one process over loopback
+ * a synthetic source stands in for the capture stream and paced consumers stand in for the playback streams
+ */
+
+#define NETPW_BENCH_MAX_CONFIGS 16
+#define NETPW_BENCH_GENERATION_RING 65536
+
+enum signal_type
+{
+    NETPW_SIGNAL_TONE,
+    NETPW_SIGNAL_NOISE,
+    NETPW_SIGNAL_SILENCE
+};
+
+struct receiver
+{
+    struct client* client;
+    struct coding_context* coding_ctx;
+    struct lockfree_spsc_queue* queue;
+    uint64_t received;
+    uint32_t* latencies;
+    int latency_count;
+    int latency_capacity;
+    uint64_t queue_total;
+    int queue_max;
+    int queue_samples;
+    int underruns;
+    /* set once the first audio arrives */
+    int primed;
+    /* only used by the consumer, set once the jitter margin has queued */
+    int started;
+    pthread_t thread;
+};
+
+static int frequency = 48000;
+static int channels = 2;
+static int depth = 16;
+static double duration = 5;
+static enum signal_type signal_type = NETPW_SIGNAL_TONE;
+static int paced = 1;
+static int jitter_margin = 1;
+static unsigned short base_port = 18000;
+static int buffer_sizes[NETPW_BENCH_MAX_CONFIGS] = { 128, 256, 512, 1024 };
+static int buffer_size_count = 4;
+static int client_counts[NETPW_BENCH_MAX_CONFIGS] = { 1, 4, 16 };
+static int client_count_count = 3;
+static enum crypto_profile crypto_profiles[NETPW_BENCH_MAX_CONFIGS] = { NETPW_CRYPTO_PROFILE_AUTO };
+static int crypto_profile_count = 1;
+static int coding_argc = 0;
+static char** coding_argv = NULL;
+
+static char* privkey;
+static char* cert;
+static FILE* results;
+
+/* state of the current run */
+static struct server* server = NULL;
+static struct coding_context* coding_ctx = NULL;
+static struct receiver* receivers = NULL;
+static int receiver_count = 0;
+static int buffer_size = 0;
+static enum crypto_profile crypto_profile = NETPW_CRYPTO_PROFILE_AUTO;
+static int connected = 0;
+static int running = 0;
+static uint64_t packets = 0;
+static uint64_t generation_times[NETPW_BENCH_GENERATION_RING];
+
+static int stride()
+{
+    return channels * (depth / 8);
+}
+
+static void on_compressor_read(void* userdata, const unsigned char* data, int size)
+{
+    server_send(server, 0, NETPW_PACKET_AUDIO, data, size);
+    __atomic_fetch_add(&packets, 1, __ATOMIC_RELAXED);
+}
+
+static void on_audio_read(void* userdata, const unsigned char* data, int size)
+{
+    if (coding_ctx)
+    {
+        coding_send(coding_ctx, data, size);
+    }
+    else
+    {
+        server_send(server, 0, NETPW_PACKET_AUDIO, data, size);
+        __atomic_fetch_add(&packets, 1, __ATOMIC_RELAXED);
+    }
+}
+
+static void receiver_deliver(struct receiver* receiver, const unsigned char* data, int size)
+{
+    int quantum_size = buffer_size * stride();
+    uint64_t now = get_time();
+
+    /* every quantum boundary crossed by this delivery completes a generated quantum */
+    uint64_t first = receiver->received / quantum_size;
+    receiver->received += size;
+    uint64_t last = receiver->received / quantum_size;
+
+    uint64_t i;
+    for (i = first; i < last; i++)
+    {
+        if (receiver->latency_count < receiver->latency_capacity)
+        {
+            uint64_t generated = __atomic_load_n(&generation_times[i % NETPW_BENCH_GENERATION_RING], __ATOMIC_ACQUIRE);
+            receiver->latencies[receiver->latency_count++] = (now - generated) / 1000;
+        }
+    }
+
+    lockfree_spsc_queue_push(receiver->queue, data, size);
+    __atomic_store_n(&receiver->primed, 1, __ATOMIC_RELEASE);
+}
+
+static void on_decompressor_read(void* userdata, const unsigned char* data, int size)
+{
+    receiver_deliver(userdata, data, size);
+}
+
+static void on_network_read(void* userdata, int type, const unsigned char* data, int size)
+{
+    struct receiver* receiver = userdata;
+
+    if (type != NETPW_PACKET_AUDIO)
+    {
+        return;
+    }
+
+    if (receiver->coding_ctx)
+    {
+        coding_send(receiver->coding_ctx, data, size);
+    }
+    else
+    {
+        receiver_deliver(receiver, data, size);
+    }
+}
+
+static void on_server_read(void* userdata, int type, const unsigned char* data, int size)
+{
+}
+
+static void* on_connect(void* userdata, const char* name)
+{
+    __atomic_fetch_add(&connected, 1, __ATOMIC_RELEASE);
+
+    return NULL;
+}
+
+/*
+ * stands in for a playback stream, pulling one quantum per period
+ * like a playback stream it waits for its jitter margin to queue first, otherwise the phase between producer and consumer alone would underrun
+ */
+static void* receiver_consume(void* arg)
+{
+    struct receiver* receiver = arg;
+
+    int quantum_size = buffer_size * stride();
+    unsigned char* quantum = malloc(quantum_size);
+    uint64_t period = (uint64_t)buffer_size * 1000000000 / frequency;
+
+    uint64_t deadline = get_time();
+
+    while (__atomic_load_n(&running, __ATOMIC_ACQUIRE))
+    {
+        deadline += period;
+        sleep_until(deadline);
+
+        if (!receiver->started)
+        {
+            receiver->started = __atomic_load_n(&receiver->primed, __ATOMIC_ACQUIRE)
+                && lockfree_spsc_queue_size(receiver->queue) >= (jitter_margin + 1) * quantum_size;
+
+            if (!receiver->started)
+            {
+                continue;
+            }
+
+            /* periods are counted from here so that the margin isn't eaten by the wait */
+            deadline = get_time();
+        }
+
+        int queue_size = lockfree_spsc_queue_size(receiver->queue);
+
+        receiver->queue_total += queue_size;
+        receiver->queue_max = max(receiver->queue_max, queue_size);
+        receiver->queue_samples++;
+
+        if (lockfree_spsc_queue_pull(receiver->queue, quantum, quantum_size) < quantum_size)
+        {
+            receiver->underruns++;
+        }
+    }
+
+    free(quantum);
+
+    return NULL;
+}
+
+static void generate(unsigned char* data, uint64_t first_frame, int frames)
+{
+    static uint32_t noise_state = 1;
+
+    double full_scale = pow(2, depth - 1) - 1;
+
+    int i;
+    for (i = 0; i < frames; i++)
+    {
+        double x;
+
+        switch (signal_type)
+        {
+        default :
+        case NETPW_SIGNAL_TONE :
+            x = 0.5 * sin(2 * M_PI * 440 * (double)(first_frame + i) / frequency);
+            break;
+        case NETPW_SIGNAL_NOISE :
+            noise_state ^= noise_state << 13;
+            noise_state ^= noise_state >> 17;
+            noise_state ^= noise_state << 5;
+            x = 0.5 * ((double)noise_state / UINT32_MAX * 2 - 1);
+            break;
+        case NETPW_SIGNAL_SILENCE :
+            x = 0;
+            break;
+        }
+
+        int32_t sample = x * full_scale;
+
+        int channel;
+        for (channel = 0; channel < channels; channel++)
+        {
+            unsigned char* out = data + (i * channels + channel) * (depth / 8);
+
+            int byte;
+            for (byte = 0; byte < depth / 8; byte++)
+            {
+                out[byte] = (sample >> (byte * 8)) & 0xff;
+            }
+        }
+    }
+}
+
+static int compare_u32(const void* a, const void* b)
+{
+    uint32_t x = *(const uint32_t*)a;
+    uint32_t y = *(const uint32_t*)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static double cpu_time()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1000000.0 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1000000.0;
+}
+
+static void run(int run_index, int run_buffer_size, int run_client_count, enum crypto_profile run_crypto_profile, int use_coding)
+{
+    int result;
+
+    unsigned short port = base_port + run_index;
+
+    buffer_size = run_buffer_size;
+    crypto_profile = run_crypto_profile;
+    receiver_count = run_client_count;
+    connected = 0;
+    packets = 0;
+    memset(generation_times, 0, sizeof(generation_times));
+
+    server = server_init("127.0.0.1", port, NULL, cert, privkey, crypto_profile, NULL, NULL, NULL, 0, on_server_read, on_connect, NULL, NULL);
+
+    if (use_coding)
+    {
+        coding_ctx = coding_init_audio_encoder(frequency, channels, depth, coding_argc, coding_argv, on_compressor_read, NULL);
+    }
+
+    int expected_quanta = duration * frequency / buffer_size + 1;
+
+    receivers = calloc(receiver_count, sizeof(struct receiver));
+
+    int i;
+    for (i = 0; i < receiver_count; i++)
+    {
+        struct receiver* receiver = &receivers[i];
+
+        CHECK_ERROR_FATAL(lockfree_spsc_queue_init(&receiver->queue));
+        receiver->latency_capacity = expected_quanta * 2;
+        receiver->latencies = malloc(receiver->latency_capacity * sizeof(uint32_t));
+
+        if (use_coding)
+        {
+            receiver->coding_ctx = coding_init_audio_decoder(frequency, channels, depth, coding_argc, coding_argv, on_decompressor_read, receiver);
+        }
+
+        receiver->client = client_init("127.0.0.1", port, NULL, NULL, NULL, crypto_profile, NULL, on_network_read, receiver);
+    }
+
+    while (__atomic_load_n(&connected, __ATOMIC_ACQUIRE) < receiver_count)
+    {
+        usleep(1000);
+    }
+
+    running = 1;
+
+    for (i = 0; i < receiver_count; i++)
+    {
+        CHECK_ERROR_FATAL(pthread_create(&receivers[i].thread, NULL, receiver_consume, &receivers[i]));
+    }
+
+    int quantum_size = buffer_size * stride();
+    unsigned char* quantum = malloc(quantum_size);
+    uint64_t period = (uint64_t)buffer_size * 1000000000 / frequency;
+
+    double start_cpu = cpu_time();
+    uint64_t start = get_time();
+
+    uint64_t deadline = start;
+    uint64_t quanta = 0;
+
+    while (get_time() - start < duration * 1000000000)
+    {
+        if (paced)
+        {
+            deadline += period;
+            sleep_until(deadline);
+        }
+
+        __atomic_store_n(&generation_times[quanta % NETPW_BENCH_GENERATION_RING], get_time(), __ATOMIC_RELEASE);
+        generate(quantum, quanta * buffer_size, buffer_size);
+        on_audio_read(NULL, quantum, quantum_size);
+        quanta++;
+    }
+
+    double elapsed = (get_time() - start) / 1000000000.0;
+    double cpu = cpu_time() - start_cpu;
+
+    /* the consumers stop with the source, past it they would only count the end of the stream as underruns */
+    __atomic_store_n(&running, 0, __ATOMIC_RELEASE);
+
+    /* let in-flight data drain before tearing down */
+    usleep(200000);
+
+    uint32_t* latencies = NULL;
+    int latency_count = 0;
+    uint64_t queue_total = 0;
+    int queue_samples = 0;
+    int queue_max = 0;
+    int underruns = 0;
+
+    for (i = 0; i < receiver_count; i++)
+    {
+        struct receiver* receiver = &receivers[i];
+
+        CHECK_ERROR(pthread_join(receiver->thread, NULL));
+        client_destroy(receiver->client);
+
+        if (receiver->coding_ctx)
+        {
+            coding_destroy(receiver->coding_ctx);
+        }
+
+        latencies = realloc(latencies, (latency_count + receiver->latency_count) * sizeof(uint32_t));
+        memcpy(latencies + latency_count, receiver->latencies, receiver->latency_count * sizeof(uint32_t));
+        latency_count += receiver->latency_count;
+
+        queue_total += receiver->queue_total;
+        queue_samples += receiver->queue_samples;
+        queue_max = max(queue_max, receiver->queue_max);
+        underruns += receiver->underruns;
+
+        lockfree_spsc_queue_destroy(receiver->queue);
+        free(receiver->latencies);
+    }
+
+    server_destroy(server);
+
+    if (coding_ctx)
+    {
+        coding_destroy(coding_ctx);
+        coding_ctx = NULL;
+    }
+
+    qsort(latencies, latency_count, sizeof(uint32_t), compare_u32);
+
+    double percentiles[4] = { 0, 0, 0, 0 };
+
+    if (latency_count)
+    {
+        percentiles[0] = latencies[latency_count / 2] / 1000.0;
+        percentiles[1] = latencies[latency_count * 9 / 10] / 1000.0;
+        percentiles[2] = latencies[latency_count * 99 / 100] / 1000.0;
+        percentiles[3] = latencies[latency_count - 1] / 1000.0;
+    }
+
+    fprintf(
+        results,
+        "%i\t%i\t%s\t%s\t%.0f\t%.2f\t%.3f\t%.3f\t%.3f\t%.3f\t%.0f\t%i\t%i\n",
+        buffer_size,
+        receiver_count,
+        crypto_profile_name(crypto_profile),
+        use_coding ? "ffmpeg" : "pcm",
+        packets / elapsed,
+        cpu / elapsed * 100 / receiver_count,
+        percentiles[0],
+        percentiles[1],
+        percentiles[2],
+        percentiles[3],
+        queue_samples ? (double)queue_total / queue_samples : 0,
+        queue_max,
+        underruns
+    );
+    fflush(results);
+
+    free(latencies);
+    free(quantum);
+    free(receivers);
+}
+
+static int parse_list(const char* text, int* values)
+{
+    int count = 0;
+
+    char* copy = strdup(text);
+    char* save;
+    char* token;
+
+    for (token = strtok_r(copy, ",", &save); token && count < NETPW_BENCH_MAX_CONFIGS; token = strtok_r(NULL, ",", &save))
+    {
+        values[count++] = atoi(token);
+    }
+
+    free(copy);
+
+    return count;
+}
+
+static int parse_crypto_profiles(const char* text, enum crypto_profile* values)
+{
+    int count = 0;
+
+    char* copy = strdup(text);
+    char* save;
+    char* token;
+
+    for (token = strtok_r(copy, ",", &save); token && count < NETPW_BENCH_MAX_CONFIGS; token = strtok_r(NULL, ",", &save))
+    {
+        values[count] = crypto_profile_from_name(token);
+
+        if (values[count] == NETPW_CRYPTO_PROFILE_NONE)
+        {
+            fprintf(stderr, "unsupported crypto profile: %s\n", token);
+            exit(1);
+        }
+
+        count++;
+    }
+
+    free(copy);
+
+    return count;
+}
+
+static void display_help()
+{
+    fprintf(stderr, "usage: netpw_loopback_bench [options...] [-- coding-options...]\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "-b values\t--buffers values\tSpecify a comma-separated list of buffer sizes in samples per channel.\n");
+    fprintf(stderr, "-n values\t--clients values\tSpecify a comma-separated list of client counts.\n");
+    fprintf(stderr, "-x values\t--crypto values\t\tSpecify a comma-separated list of crypto profiles, plaintext included.\n");
+    fprintf(stderr, "-t value\t--duration value\tSpecify the duration of each run in seconds.\n");
+    fprintf(stderr, "-s value\t--signal value\t\tSpecify the synthetic signal, one of tone, noise or silence.\n");
+    fprintf(stderr, "-u\t\t--unpaced\t\tGenerate quanta as fast as possible instead of in real time.\n");
+    fprintf(stderr, "-m value\t--margin value\t\tSpecify how many quanta each consumer lets queue before it starts pulling, as a playback stream's jitter margin. Defaults to 1.\n");
+    fprintf(stderr, "-p value\t--port value\t\tSpecify the first loopback port to use.\n");
+    fprintf(stderr, "-f value\t--frequency value\tSpecify the audio sampling frequency.\n");
+    fprintf(stderr, "-c value\t--channels value\tSpecify the audio channel count.\n");
+    fprintf(stderr, "-d value\t--depth value\t\tSpecify the audio sample depth in bits.\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "If coding options are given each configuration is run once uncompressed and once through FFmpeg.\n");
+}
+
+static void parse_arguments(int argc, char** argv)
+{
+    static const struct option options[] = {
+        { "buffers", required_argument, NULL, 'b' },
+        { "clients", required_argument, NULL, 'n' },
+        { "crypto", required_argument, NULL, 'x' },
+        { "duration", required_argument, NULL, 't' },
+        { "signal", required_argument, NULL, 's' },
+        { "unpaced", no_argument, NULL, 'u' },
+        { "margin", required_argument, NULL, 'm' },
+        { "port", required_argument, NULL, 'p' },
+        { "frequency", required_argument, NULL, 'f' },
+        { "channels", required_argument, NULL, 'c' },
+        { "depth", required_argument, NULL, 'd' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    int result;
+
+    while (1)
+    {
+        result = getopt_long(argc, argv, "b:n:x:t:s:um:p:f:c:d:h", options, NULL);
+
+        if (result < 0)
+        {
+            break;
+        }
+
+        switch (result)
+        {
+        case 'b' :
+            buffer_size_count = parse_list(optarg, buffer_sizes);
+            break;
+        case 'n' :
+            client_count_count = parse_list(optarg, client_counts);
+            break;
+        case 'x' :
+            crypto_profile_count = parse_crypto_profiles(optarg, crypto_profiles);
+            break;
+        case 't' :
+            duration = atof(optarg);
+            break;
+        case 's' :
+            if (strcmp(optarg, "noise") == 0)
+            {
+                signal_type = NETPW_SIGNAL_NOISE;
+            }
+            else if (strcmp(optarg, "silence") == 0)
+            {
+                signal_type = NETPW_SIGNAL_SILENCE;
+            }
+            else
+            {
+                signal_type = NETPW_SIGNAL_TONE;
+            }
+            break;
+        case 'u' :
+            paced = 0;
+            break;
+        case 'm' :
+            jitter_margin = max(atoi(optarg), 0);
+            break;
+        case 'p' :
+            base_port = atoi(optarg);
+            break;
+        case 'f' :
+            frequency = atoi(optarg);
+            break;
+        case 'c' :
+            channels = atoi(optarg);
+            break;
+        case 'd' :
+            depth = atoi(optarg);
+            break;
+        case 'h' :
+        default :
+            display_help();
+            exit(1);
+        }
+    }
+
+    int i;
+    for (i = 0; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--") == 0)
+        {
+            coding_argc = argc - (i + 1);
+            coding_argv = argv + (i + 1);
+            break;
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    parse_arguments(argc, argv);
+
+    signal(SIGPIPE, SIG_IGN);
+
+    char* public_key;
+    generate_key_pair(NETPW_KEY_TYPE_ED25519, &public_key, &privkey);
+    x509_certificate_from_private_key(privkey, &cert);
+    free(public_key);
+
+    /* the network modules log connections to stdout so results go to stdout and everything else is silenced */
+    fprintf(stderr, "running %i configurations of %.1f s each.\n", buffer_size_count * client_count_count * crypto_profile_count * (coding_argv ? 2 : 1), duration);
+
+    results = fdopen(dup(STDOUT_FILENO), "w");
+    CHECK_POINTER_FATAL(freopen("/dev/null", "w", stdout));
+
+    fprintf(results, "buffer\tclients\tcrypto\tcodec\tpackets_per_second\tcpu_percent_per_stream\tlatency_p50_ms\tlatency_p90_ms\tlatency_p99_ms\tlatency_max_ms\tqueue_mean_bytes\tqueue_max_bytes\tunderruns\n");
+    fflush(results);
+
+    int run_index = 0;
+
+    int i;
+    for (i = 0; i < buffer_size_count; i++)
+    {
+        int j;
+        for (j = 0; j < client_count_count; j++)
+        {
+            int k;
+            for (k = 0; k < crypto_profile_count; k++)
+            {
+                int l;
+                for (l = 0; l < (coding_argv ? 2 : 1); l++)
+                {
+                    run(run_index++, buffer_sizes[i], client_counts[j], crypto_profiles[k], l);
+                }
+            }
+        }
+    }
+
+    fclose(results);
+    free(privkey);
+    free(cert);
+
+    return 0;
+}
@@ -0,0 +1,788 @@
+/*
+Copyright 2025 Amini Allight
+
+This file is part of netpw.
+
+netpw is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+netpw is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with netpw. If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "constants.h"
+#include "tools.h"
+#include "error_handling.h"
+#include "coding.h"
+#include "cryptography.h"
+#include "packet.h"
+#include "silence.h"
+#include "sample_format.h"
+#include "transport.h"
+#include "lockfree_spsc_queue.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <openssl/ssl.h>
+#include <openssl/pem.h>
+
+/*
+ * microbenchmarks for the code that runs once per quantum
+ * each result is the median of several repetitions and is printed as one JSON object per line
+ */
+
+/* in nanoseconds */
+#define NETPW_BENCH_MIN_TIME 50000000
+#define NETPW_BENCH_REPETITIONS 7
+
+typedef void (*benchmark_function)(void* userdata, uint64_t iterations);
+
+static const int chunk_sizes[] = { 64, 256, 1024, 4096, 16384, 65536 };
+static const int record_sizes[] = { 64, 256, 1024, 4096, 16384 };
+static const int depths[] = { 8, 16, 24, 32 };
+static const enum crypto_profile crypto_profiles[] = {
+    NETPW_CRYPTO_PROFILE_AES,
+    NETPW_CRYPTO_PROFILE_CHACHA,
+    NETPW_CRYPTO_PROFILE_INTEGRITY,
+    NETPW_CRYPTO_PROFILE_PLAINTEXT
+};
+static const enum key_type key_types[] = { NETPW_KEY_TYPE_ED25519, NETPW_KEY_TYPE_P256, NETPW_KEY_TYPE_RSA };
+
+static int frequency = 48000;
+static int channels = 2;
+static int buffer_size = 512;
+static const char* filter = NULL;
+static int coding_argc = 0;
+static char** coding_argv = NULL;
+
+static int compare_double(const void* a, const void* b)
+{
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static void benchmark(const char* name, const char* parameter, int size, benchmark_function function, void* userdata)
+{
+    if (filter && !strstr(name, filter))
+    {
+        return;
+    }
+
+    uint64_t iterations = 1;
+
+    /* warms up and picks an iteration count long enough to time reliably */
+    while (1)
+    {
+        uint64_t start = get_time();
+        function(userdata, iterations);
+
+        if (get_time() - start >= NETPW_BENCH_MIN_TIME)
+        {
+            break;
+        }
+
+        iterations *= 2;
+    }
+
+    double samples[NETPW_BENCH_REPETITIONS];
+
+    int i;
+    for (i = 0; i < NETPW_BENCH_REPETITIONS; i++)
+    {
+        uint64_t start = get_time();
+        function(userdata, iterations);
+        samples[i] = (double)(get_time() - start) / iterations;
+    }
+
+    qsort(samples, NETPW_BENCH_REPETITIONS, sizeof(double), compare_double);
+
+    double median = samples[NETPW_BENCH_REPETITIONS / 2];
+
+    printf(
+        "{\"benchmark\":\"%s\",%s\"size\":%i,\"iterations\":%lu,\"ns_per_op\":%.1f,\"min_ns_per_op\":%.1f,\"bytes_per_second\":%.0f}\n",
+        name,
+        parameter ? parameter : "",
+        size,
+        (unsigned long)iterations,
+        median,
+        samples[0],
+        size * 1000000000.0 / median
+    );
+    fflush(stdout);
+}
+
+struct queue_benchmark
+{
+    struct lockfree_spsc_queue* queue;
+    unsigned char* data;
+    int size;
+    int running;
+    pthread_t thread;
+};
+
+static void queue_push_pull(void* userdata, uint64_t iterations)
+{
+    struct queue_benchmark* bench = userdata;
+
+    uint64_t i;
+    for (i = 0; i < iterations; i++)
+    {
+        lockfree_spsc_queue_push(bench->queue, bench->data, bench->size);
+        lockfree_spsc_queue_pull(bench->queue, bench->data, bench->size);
+    }
+}
+
+static void* queue_consume(void* arg)
+{
+    struct queue_benchmark* bench = arg;
+
+    unsigned char* data = malloc(bench->size);
+
+    while (__atomic_load_n(&bench->running, __ATOMIC_ACQUIRE))
+    {
+        lockfree_spsc_queue_pull(bench->queue, data, bench->size);
+    }
+
+    free(data);
+
+    return NULL;
+}
+
+/* the producer side with a consumer on another core, as between the network and playback threads */
+static void queue_push_threaded(void* userdata, uint64_t iterations)
+{
+    struct queue_benchmark* bench = userdata;
+
+    uint64_t i;
+    for (i = 0; i < iterations; i++)
+    {
+        int pushed = 0;
+
+        while (pushed < bench->size)
+        {
+            pushed += lockfree_spsc_queue_push(bench->queue, bench->data + pushed, bench->size - pushed);
+        }
+    }
+}
+
+static void benchmark_queue()
+{
+    int result;
+
+    int i;
+    for (i = 0; i < sizeof(chunk_sizes) / sizeof(int); i++)
+    {
+        struct queue_benchmark bench;
+
+        CHECK_ERROR_FATAL(lockfree_spsc_queue_init(&bench.queue));
+        bench.size = chunk_sizes[i];
+        bench.data = calloc(bench.size, 1);
+
+        benchmark("spsc_queue_push_pull", NULL, bench.size, queue_push_pull, &bench);
+
+        bench.running = 1;
+        CHECK_ERROR_FATAL(pthread_create(&bench.thread, NULL, queue_consume, &bench));
+
+        benchmark("spsc_queue_push_threaded", NULL, bench.size, queue_push_threaded, &bench);
+
+        __atomic_store_n(&bench.running, 0, __ATOMIC_RELEASE);
+        CHECK_ERROR(pthread_join(bench.thread, NULL));
+
+        lockfree_spsc_queue_destroy(bench.queue);
+        free(bench.data);
+    }
+}
+
+struct transport_benchmark
+{
+    enum crypto_profile profile;
+    SSL_CTX* server_context;
+    SSL_CTX* client_context;
+    struct transport* server_transport;
+    struct transport* client_transport;
+    int sockets[2];
+    unsigned char* data;
+    int size;
+    pthread_t thread;
+};
+
+static void* transport_benchmark_connect(void* arg)
+{
+    struct transport_benchmark* bench = arg;
+
+    CHECK_POINTER_FATAL(bench->client_transport = transport_connect(bench->client_context, bench->sockets[1], bench->profile));
+
+    return NULL;
+}
+
+static void* transport_benchmark_drain(void* arg)
+{
+    struct transport_benchmark* bench = arg;
+
+    unsigned char data[NETPW_IO_BUFFER_SIZE * 4];
+
+    while (transport_read(bench->client_transport, data, sizeof(data)) > 0)
+    {
+    }
+
+    return NULL;
+}
+
+static void transport_benchmark_write(void* userdata, uint64_t iterations)
+{
+    struct transport_benchmark* bench = userdata;
+
+    uint64_t i;
+    for (i = 0; i < iterations; i++)
+    {
+        transport_write(bench->server_transport, bench->data, bench->size);
+    }
+}
+
+/* generates an identity of the given type the same way netpw does when no certificate is given */
+static SSL_CTX* server_context_init(enum key_type type)
+{
+    int result;
+
+    char* public_key;
+    char* private_key;
+    char* certificate;
+    generate_key_pair(type, &public_key, &private_key);
+    x509_certificate_from_private_key(private_key, &certificate);
+
+    SSL_CTX* context;
+    CHECK_POINTER_FATAL(context = SSL_CTX_new(TLS_server_method()));
+    SSL_CTX_set_min_proto_version(context, TLS1_3_VERSION);
+
+    BIO* reader;
+    CHECK_POINTER_FATAL(reader = BIO_new_mem_buf(certificate, -1));
+    X509* certificate_object;
+    CHECK_POINTER_FATAL(certificate_object = PEM_read_bio_X509(reader, NULL, NULL, 0));
+    BIO_free_all(reader);
+    CHECK_OK_FATAL(SSL_CTX_use_certificate(context, certificate_object));
+    X509_free(certificate_object);
+
+    CHECK_POINTER_FATAL(reader = BIO_new_mem_buf(private_key, -1));
+    EVP_PKEY* private_key_object;
+    CHECK_POINTER_FATAL(private_key_object = PEM_read_bio_PrivateKey(reader, NULL, NULL, 0));
+    BIO_free_all(reader);
+    CHECK_OK_FATAL(SSL_CTX_use_PrivateKey(context, private_key_object));
+    EVP_PKEY_free(private_key_object);
+
+    free(public_key);
+    free(private_key);
+    free(certificate);
+
+    return context;
+}
+
+static SSL_CTX* client_context_init()
+{
+    SSL_CTX* context;
+    CHECK_POINTER_FATAL(context = SSL_CTX_new(TLS_client_method()));
+    SSL_CTX_set_min_proto_version(context, TLS1_3_VERSION);
+
+    return context;
+}
+
+struct key_benchmark
+{
+    enum key_type type;
+    SSL_CTX* server_context;
+    SSL_CTX* client_context;
+};
+
+static void key_generation(void* userdata, uint64_t iterations)
+{
+    struct key_benchmark* bench = userdata;
+
+    uint64_t i;
+    for (i = 0; i < iterations; i++)
+    {
+        char* public_key;
+        char* private_key;
+        char* certificate;
+        generate_key_pair(bench->type, &public_key, &private_key);
+        x509_certificate_from_private_key(private_key, &certificate);
+
+        free(public_key);
+        free(private_key);
+        free(certificate);
+    }
+}
+
+/* both sides of a full handshake over an in-memory BIO pair, so the key exchange and signature dominate */
+static void tls_handshake(void* userdata, uint64_t iterations)
+{
+    int result;
+
+    struct key_benchmark* bench = userdata;
+
+    uint64_t i;
+    for (i = 0; i < iterations; i++)
+    {
+        SSL* server_ssl;
+        SSL* client_ssl;
+        CHECK_POINTER_FATAL(server_ssl = SSL_new(bench->server_context));
+        CHECK_POINTER_FATAL(client_ssl = SSL_new(bench->client_context));
+
+        BIO* server_bio;
+        BIO* client_bio;
+        CHECK_OK_FATAL(BIO_new_bio_pair(&server_bio, 0, &client_bio, 0));
+        SSL_set_bio(server_ssl, server_bio, server_bio);
+        SSL_set_bio(client_ssl, client_bio, client_bio);
+
+        SSL_set_accept_state(server_ssl);
+        SSL_set_connect_state(client_ssl);
+
+        int server_done = 0;
+        int client_done = 0;
+
+        while (!server_done || !client_done)
+        {
+            if (!client_done)
+            {
+                result = SSL_do_handshake(client_ssl);
+                client_done = result == 1;
+
+                if (result <= 0 && SSL_get_error(client_ssl, result) != SSL_ERROR_WANT_READ)
+                {
+                    fprintf(stderr, "client handshake failed.\n");
+                    exit(1);
+                }
+            }
+
+            if (!server_done)
+            {
+                result = SSL_do_handshake(server_ssl);
+                server_done = result == 1;
+
+                if (result <= 0 && SSL_get_error(server_ssl, result) != SSL_ERROR_WANT_READ)
+                {
+                    fprintf(stderr, "server handshake failed.\n");
+                    exit(1);
+                }
+            }
+        }
+
+        SSL_free(server_ssl);
+        SSL_free(client_ssl);
+    }
+}
+
+static void benchmark_keys()
+{
+    int i;
+    for (i = 0; i < sizeof(key_types) / sizeof(enum key_type); i++)
+    {
+        struct key_benchmark bench;
+
+        bench.type = key_types[i];
+
+        char parameter[64];
+        snprintf(parameter, sizeof(parameter), "\"key_type\":\"%s\",", key_type_name(bench.type));
+
+        benchmark("key_generation", parameter, 0, key_generation, &bench);
+
+        if (filter && !strstr("tls_handshake", filter))
+        {
+            continue;
+        }
+
+        bench.server_context = server_context_init(bench.type);
+        bench.client_context = client_context_init();
+
+        benchmark("tls_handshake", parameter, 0, tls_handshake, &bench);
+
+        SSL_CTX_free(bench.server_context);
+        SSL_CTX_free(bench.client_context);
+    }
+}
+
+static void benchmark_transport(enum crypto_profile profile)
+{
+    int result;
+
+    struct transport_benchmark bench;
+
+    bench.profile = profile;
+    bench.server_context = server_context_init(NETPW_KEY_TYPE_ED25519);
+    bench.client_context = client_context_init();
+    transport_configure(bench.server_context, profile, 1);
+    transport_configure(bench.client_context, profile, 0);
+
+    /* a socket pair keeps the kernel copy in the measurement without the network stack */
+    CHECK_ERRNO_FATAL(socketpair(AF_UNIX, SOCK_STREAM, 0, bench.sockets));
+
+    CHECK_ERROR_FATAL(pthread_create(&bench.thread, NULL, transport_benchmark_connect, &bench));
+    CHECK_POINTER_FATAL(bench.server_transport = transport_accept(bench.server_context, bench.sockets[0], profile, 0));
+    CHECK_ERROR(pthread_join(bench.thread, NULL));
+
+    CHECK_ERROR_FATAL(pthread_create(&bench.thread, NULL, transport_benchmark_drain, &bench));
+
+    char parameter[192];
+    snprintf(
+        parameter,
+        sizeof(parameter),
+        "\"crypto\":\"%s\",\"transport\":\"%s\",",
+        crypto_profile_name(profile),
+        transport_description(bench.server_transport)
+    );
+
+    int i;
+    for (i = 0; i < sizeof(record_sizes) / sizeof(int); i++)
+    {
+        bench.size = record_sizes[i];
+        bench.data = calloc(bench.size, 1);
+
+        benchmark("transport_write", parameter, bench.size, transport_benchmark_write, &bench);
+
+        free(bench.data);
+    }
+
+    shutdown(bench.sockets[0], SHUT_RDWR);
+    CHECK_ERROR(pthread_join(bench.thread, NULL));
+
+    transport_destroy(bench.server_transport);
+    transport_destroy(bench.client_transport);
+    close(bench.sockets[0]);
+    close(bench.sockets[1]);
+    SSL_CTX_free(bench.server_context);
+    SSL_CTX_free(bench.client_context);
+}
+
+struct packet_benchmark
+{
+    struct packet_reader* reader;
+    unsigned char* data;
+    unsigned char* encoded;
+    int size;
+    uint64_t received;
+};
+
+static void on_packet(void* userdata, int type, const unsigned char* data, int size)
+{
+    struct packet_benchmark* bench = userdata;
+
+    bench->received += size;
+}
+
+static void packet_round_trip(void* userdata, uint64_t iterations)
+{
+    struct packet_benchmark* bench = userdata;
+
+    uint64_t i;
+    for (i = 0; i < iterations; i++)
+    {
+        int encoded_size = packet_encode(bench->encoded, NETPW_PACKET_AUDIO, bench->data, bench->size);
+        packet_reader_feed(bench->reader, bench->encoded, encoded_size);
+    }
+}
+
+static void benchmark_packet()
+{
+    int i;
+    for (i = 0; i < sizeof(chunk_sizes) / sizeof(int); i++)
+    {
+        struct packet_benchmark bench;
+
+        bench.size = chunk_sizes[i];
+        bench.data = calloc(bench.size, 1);
+        bench.encoded = malloc(NETPW_PACKET_HEADER_SIZE + bench.size);
+        bench.reader = packet_reader_init(on_packet, &bench);
+        bench.received = 0;
+
+        benchmark("packet_encode_feed", NULL, bench.size, packet_round_trip, &bench);
+
+        packet_reader_destroy(bench.reader);
+        free(bench.data);
+        free(bench.encoded);
+    }
+}
+
+struct sample_benchmark
+{
+    struct silence_detector* detector;
+    unsigned char* data;
+    int size;
+    int depth;
+    float** planes;
+};
+
+static void silence_detect(void* userdata, uint64_t iterations)
+{
+    struct sample_benchmark* bench = userdata;
+
+    uint64_t i;
+    for (i = 0; i < iterations; i++)
+    {
+        silence_detector_process(bench->detector, bench->data, bench->size);
+    }
+}
+
+static void sample_pack(void* userdata, uint64_t iterations)
+{
+    struct sample_benchmark* bench = userdata;
+
+    uint64_t i;
+    for (i = 0; i < iterations; i++)
+    {
+        sample_format_pack((const float* const*)bench->planes, channels, buffer_size, bench->depth, bench->data);
+    }
+}
+
+static void sample_unpack(void* userdata, uint64_t iterations)
+{
+    struct sample_benchmark* bench = userdata;
+
+    uint64_t i;
+    for (i = 0; i < iterations; i++)
+    {
+        sample_format_unpack(bench->data, channels, buffer_size, bench->depth, bench->planes);
+    }
+}
+
+static void benchmark_sample_format()
+{
+    int i;
+    for (i = 0; i < sizeof(depths) / sizeof(int); i++)
+    {
+        struct sample_benchmark bench;
+
+        int depth = depths[i];
+        int sample_size = depth / 8;
+
+        bench.size = buffer_size * channels * sample_size;
+        bench.data = malloc(bench.size);
+
+        /* quiet noise keeps the detector scanning the whole block without ever closing */
+        int j;
+        for (j = 0; j < bench.size; j++)
+        {
+            bench.data[j] = (j % sample_size == sample_size - 1) ? 0 : rand() & 0xff;
+        }
+
+        bench.detector = silence_detector_init(frequency, channels, depth, -120, 0);
+
+        char parameter[64];
+        snprintf(parameter, sizeof(parameter), "\"depth\":%i,", depth);
+
+        benchmark("silence_detect", parameter, bench.size, silence_detect, &bench);
+
+        bench.depth = depth;
+        bench.planes = malloc(channels * sizeof(float*));
+
+        int c;
+        for (c = 0; c < channels; c++)
+        {
+            bench.planes[c] = malloc(buffer_size * sizeof(float));
+
+            for (j = 0; j < buffer_size; j++)
+            {
+                bench.planes[c][j] = 0.5 * sin(2 * M_PI * 440 * j / frequency);
+            }
+        }
+
+        benchmark("sample_pack", parameter, bench.size, sample_pack, &bench);
+        benchmark("sample_unpack", parameter, bench.size, sample_unpack, &bench);
+
+        for (c = 0; c < channels; c++)
+        {
+            free(bench.planes[c]);
+        }
+
+        free(bench.planes);
+        silence_detector_destroy(bench.detector);
+        free(bench.data);
+    }
+}
+
+struct coding_benchmark
+{
+    struct coding_context* encoder;
+    struct coding_context* decoder;
+    unsigned char* data;
+    int size;
+    uint64_t decoded;
+};
+
+static void on_encoded(void* userdata, const unsigned char* data, int size)
+{
+    struct coding_benchmark* bench = userdata;
+
+    coding_send(bench->decoder, data, size);
+}
+
+static void on_decoded(void* userdata, const unsigned char* data, int size)
+{
+    struct coding_benchmark* bench = userdata;
+
+    __atomic_fetch_add(&bench->decoded, size, __ATOMIC_RELAXED);
+}
+
+/* waits for the round trip to catch up, codecs may hold back a few frames so a small shortfall is allowed */
+static void coding_round_trip(void* userdata, uint64_t iterations)
+{
+    struct coding_benchmark* bench = userdata;
+
+    uint64_t target = __atomic_load_n(&bench->decoded, __ATOMIC_RELAXED) + iterations * bench->size - NETPW_QUEUE_SIZE / 16;
+
+    uint64_t i;
+    for (i = 0; i < iterations; i++)
+    {
+        coding_send(bench->encoder, bench->data, bench->size);
+    }
+
+    uint64_t deadline = get_time() + 10000000000;
+
+    while (__atomic_load_n(&bench->decoded, __ATOMIC_RELAXED) < target && get_time() < deadline)
+    {
+        usleep(100);
+    }
+}
+
+static void benchmark_coding()
+{
+    if (!coding_argv)
+    {
+        fprintf(stderr, "no coding options given, skipping the coding round trip.\n");
+        return;
+    }
+
+    /* the round trip cost is dominated by the codec so only the common depth is measured */
+    int depth = 16;
+
+    struct coding_benchmark bench;
+
+    bench.size = buffer_size * channels * (depth / 8);
+    bench.data = malloc(bench.size);
+    bench.decoded = 0;
+
+    int i;
+    for (i = 0; i < bench.size / 2; i++)
+    {
+        int16_t sample = 16384 * sin(2 * M_PI * 440 * (i / channels) / frequency);
+        bench.data[i * 2] = sample & 0xff;
+        bench.data[i * 2 + 1] = (sample >> 8) & 0xff;
+    }
+
+    bench.decoder = coding_init_audio_decoder(frequency, channels, depth, coding_argc, coding_argv, on_decoded, &bench);
+    bench.encoder = coding_init_audio_encoder(frequency, channels, depth, coding_argc, coding_argv, on_encoded, &bench);
+
+    benchmark("coding_round_trip", NULL, bench.size, coding_round_trip, &bench);
+
+    coding_destroy(bench.encoder);
+    coding_destroy(bench.decoder);
+    free(bench.data);
+}
+
+static void display_help()
+{
+    fprintf(stderr, "usage: netpw_bench [options...] [-- coding-options...]\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "-r value\t--run value\t\tOnly run benchmarks whose name contains the value.\n");
+    fprintf(stderr, "-f value\t--frequency value\tSpecify the audio sampling frequency.\n");
+    fprintf(stderr, "-c value\t--channels value\tSpecify the audio channel count.\n");
+    fprintf(stderr, "-b value\t--buffer value\t\tSpecify the audio buffer in samples per channel.\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "The coding round trip is only run if coding options are given.\n");
+}
+
+static void parse_arguments(int argc, char** argv)
+{
+    static const struct option options[] = {
+        { "run", required_argument, NULL, 'r' },
+        { "frequency", required_argument, NULL, 'f' },
+        { "channels", required_argument, NULL, 'c' },
+        { "buffer", required_argument, NULL, 'b' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    int result;
+
+    while (1)
+    {
+        result = getopt_long(argc, argv, "r:f:c:b:h", options, NULL);
+
+        if (result < 0)
+        {
+            break;
+        }
+
+        switch (result)
+        {
+        case 'r' :
+            filter = optarg;
+            break;
+        case 'f' :
+            frequency = atoi(optarg);
+            break;
+        case 'c' :
+            channels = atoi(optarg);
+            break;
+        case 'b' :
+            buffer_size = atoi(optarg);
+            break;
+        case 'h' :
+        default :
+            display_help();
+            exit(1);
+        }
+    }
+
+    int i;
+    for (i = 0; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--") == 0)
+        {
+            coding_argc = argc - (i + 1);
+            coding_argv = argv + (i + 1);
+            break;
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    parse_arguments(argc, argv);
+
+    signal(SIGPIPE, SIG_IGN);
+
+    benchmark_queue();
+    benchmark_packet();
+    benchmark_sample_format();
+
+    if (!filter || strstr("transport_write", filter))
+    {
+        int i;
+        for (i = 0; i < sizeof(crypto_profiles) / sizeof(enum crypto_profile); i++)
+        {
+            benchmark_transport(crypto_profiles[i]);
+        }
+    }
+
+    benchmark_keys();
+
+    if (!filter || strstr("coding_round_trip", filter))
+    {
+        benchmark_coding();
+    }
+
+    return 0;
+}
@@ -0,0 +1,108 @@
+/*
+Copyright 2025 Amini Allight
+
+This file is part of netpw.
+
+netpw is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+netpw is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with netpw. If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "audio_backend.h"
+
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <semaphore.h>
+
+static volatile sig_atomic_t quit = 0;
+static sem_t quit_semaphore;
+
+static void on_quit(int signal)
+{
+    quit = 1;
+    sem_post(&quit_semaphore);
+}
+
+enum audio_backend audio_backend_from_name(const char* name)
+{
+    if (strcmp(name, "pipewire") == 0)
+    {
+#ifdef NETPW_PIPEWIRE
+        return NETPW_AUDIO_BACKEND_PIPEWIRE;
+#else
+        return NETPW_AUDIO_BACKEND_NONE;
+#endif
+    }
+    else if (strcmp(name, "pipewire-dsp") == 0)
+    {
+#ifdef NETPW_PIPEWIRE
+        return NETPW_AUDIO_BACKEND_PIPEWIRE_DSP;
+#else
+        return NETPW_AUDIO_BACKEND_NONE;
+#endif
+    }
+    else if (strcmp(name, "null") == 0)
+    {
+        return NETPW_AUDIO_BACKEND_NULL;
+    }
+    else if (strcmp(name, "file") == 0)
+    {
+        return NETPW_AUDIO_BACKEND_FILE;
+    }
+    else if (strcmp(name, "stdio") == 0)
+    {
+        return NETPW_AUDIO_BACKEND_STDIO;
+    }
+    else
+    {
+        return NETPW_AUDIO_BACKEND_NONE;
+    }
+}
+
+enum audio_backend audio_backend_default()
+{
+#ifdef NETPW_PIPEWIRE
+    return NETPW_AUDIO_BACKEND_PIPEWIRE;
+#else
+    return NETPW_AUDIO_BACKEND_NONE;
+#endif
+}
+
+void audio_backend_catch_signals()
+{
+    sem_init(&quit_semaphore, 0, 0);
+
+    /* no SA_RESTART so that blocking reads return early */
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = on_quit;
+    sigemptyset(&action.sa_mask);
+
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+}
+
+int audio_backend_quit_requested()
+{
+    return quit;
+}
+
+void audio_backend_wait_for_quit()
+{
+    while (!quit)
+    {
+        if (sem_wait(&quit_semaphore) < 0 && errno != EINTR)
+        {
+            break;
+        }
+    }
+}
@@ -0,0 +1,44 @@
+/*
+Copyright 2025 Amini Allight
+
+This file is part of netpw.
+
+netpw is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+netpw is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with netpw. If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef NETPW_AUDIO_BACKEND_H
+#define NETPW_AUDIO_BACKEND_H
+
+enum audio_backend
+{
+    NETPW_AUDIO_BACKEND_NONE,
+    NETPW_AUDIO_BACKEND_PIPEWIRE,
+    /* a filter node with one float port per channel instead of a stream */
+    NETPW_AUDIO_BACKEND_PIPEWIRE_DSP,
+    /* discards output and captures silence, both at real-time rate */
+    NETPW_AUDIO_BACKEND_NULL,
+    /* reads WAV or raw PCM at real-time rate, writes WAV */
+    NETPW_AUDIO_BACKEND_FILE,
+    /* raw PCM on standard input and output */
+    NETPW_AUDIO_BACKEND_STDIO
+};
+
+enum audio_backend audio_backend_from_name(const char* name);
+enum audio_backend audio_backend_default();
+
+/* used by the backends with no event loop of their own to stop on SIGINT and SIGTERM */
+void audio_backend_catch_signals();
+int audio_backend_quit_requested();
+void audio_backend_wait_for_quit();
+
+#endif
@@ -16,130 +16,100 @@ GNU General Public License for more details.
 You should have received a copy of the GNU General Public License
 along with netpw. If not, see <https://www.gnu.org/licenses/>.
 */
-#include "audio_input.h"
+#include "audio_input_backend.h"
 #include "tools.h"
-#include "constants.h"
 #include "error_handling.h"
 
 #include <stdlib.h>
-#define __LOCALE_C_ONLY
-#include <pipewire/pipewire.h>
-#include <spa/param/audio/format-utils.h>
 
-struct audio_input
+struct audio_input* audio_input_init(
+    enum audio_backend backend,
+    const char* path,
+    int frequency,
+    int channels,
+    int depth,
+    int buffer_size,
+    on_data_callback callback,
+    void* userdata
+)
 {
-    struct pw_main_loop* main_loop;
-    struct pw_context* context;
-    struct pw_core* core;
-    struct pw_stream* stream;
-    struct spa_hook hook;
-    on_data_callback callback;
-};
-
-static void audio_input_process(void* userdata)
-{
-    struct audio_input* audio_input = userdata;
+    struct audio_input* audio_input = malloc(sizeof(struct audio_input));
 
-    struct pw_buffer* buffer = pw_stream_dequeue_buffer(audio_input->stream);
+    audio_input->backend_type = backend;
+    audio_input->frequency = frequency;
+    audio_input->channels = channels;
+    audio_input->depth = depth;
+    audio_input->buffer_size = buffer_size;
+    audio_input->callback = callback;
+    audio_input->userdata = userdata;
+    audio_input->capture_time = 0;
+    audio_input->process_time = 0;
 
-    if (!buffer)
+    switch (backend)
     {
-        return;
+    default :
+        fprintf(stderr, "unsupported audio backend.\n");
+        exit(1);
+#ifdef NETPW_PIPEWIRE
+    case NETPW_AUDIO_BACKEND_PIPEWIRE :
+        audio_input->backend = &audio_input_pipewire_backend;
+        break;
+    case NETPW_AUDIO_BACKEND_PIPEWIRE_DSP :
+        audio_input->backend = &audio_input_pipewire_dsp_backend;
+        break;
+#endif
+    case NETPW_AUDIO_BACKEND_NULL :
+    case NETPW_AUDIO_BACKEND_FILE :
+    case NETPW_AUDIO_BACKEND_STDIO :
+        audio_input->backend = &audio_input_file_backend;
+        break;
     }
 
-    audio_input->callback(buffer->buffer->datas[0].data, buffer->buffer->datas[0].chunk->size);
+    audio_input->quanta_metric = metric_counter_init("netpw_capture_quanta_total", "Quanta received from the capture stream.", NULL);
+    audio_input->bytes_metric = metric_counter_init("netpw_capture_bytes_total", "Bytes received from the capture stream.", NULL);
 
-    pw_stream_queue_buffer(audio_input->stream, buffer);
-}
+    trace_watchdog_init(&audio_input->watchdog, "capture process");
 
-static struct pw_stream_events stream_listener = {
-    .version = PW_VERSION_STREAM_EVENTS,
-    .process = audio_input_process
-};
+    audio_input->backend_data = audio_input->backend->init(audio_input, path);
 
-static void on_quit(void* userdata, int signal)
-{
-    struct audio_input* audio_input = userdata;
-    pw_main_loop_quit(audio_input->main_loop);
+    return audio_input;
 }
 
-struct audio_input* audio_input_init(int frequency, int channels, int depth, int buffer_size, on_data_callback callback)
+void audio_input_run(struct audio_input* audio_input)
 {
-    int result;
-
-    struct audio_input* audio_input = malloc(sizeof(struct audio_input));
-
-    unsigned char buffer[1024];
-    struct spa_pod_builder builder = SPA_POD_BUILDER_INIT(buffer, sizeof(buffer));
-
-    struct spa_audio_info_raw info = {
-        .format = identify_spa_format(depth),
-        .rate = frequency,
-        .channels = channels
-    };
-
-    const struct spa_pod* format = spa_format_audio_raw_build(
-        &builder,
-        SPA_PARAM_EnumFormat,
-        &info
-    );
-
-    pw_init(0, NULL);
-
-    CHECK_POINTER_FATAL(audio_input->main_loop = pw_main_loop_new(NULL));
-    pw_loop_add_signal(pw_main_loop_get_loop(audio_input->main_loop), SIGINT, on_quit, audio_input);
-    pw_loop_add_signal(pw_main_loop_get_loop(audio_input->main_loop), SIGTERM, on_quit, audio_input);
-
-    CHECK_POINTER_FATAL(audio_input->context = pw_context_new(pw_main_loop_get_loop(audio_input->main_loop), NULL, 0));
-
-    CHECK_POINTER_FATAL(audio_input->core = pw_context_connect(audio_input->context, NULL, 0));
-
-    struct pw_properties* properties = pw_properties_new(
-        PW_KEY_MEDIA_TYPE, "Audio",
-        PW_KEY_MEDIA_CATEGORY, "Capture",
-        PW_KEY_MEDIA_ROLE, "Network",
-        PW_KEY_APP_NAME, NETPW_PROGRAM_NAME,
-        PW_KEY_APP_ID, NETPW_PROGRAM_NAME,
-        PW_KEY_NODE_NAME, "Capture",
-        PW_KEY_NODE_DESCRIPTION, "Capture",
-        NULL
-    );
+    audio_input->backend->run(audio_input->backend_data);
+}
 
-    pw_properties_setf(properties, PW_KEY_NODE_LATENCY, "%u/%u", buffer_size, frequency);
-    pw_properties_setf(properties, PW_KEY_NODE_RATE, "1/%u", frequency);
+void audio_input_destroy(struct audio_input* audio_input)
+{
+    audio_input->backend->destroy(audio_input->backend_data);
+    metric_destroy(audio_input->quanta_metric);
+    metric_destroy(audio_input->bytes_metric);
+    free(audio_input);
+}
 
-    CHECK_POINTER_FATAL(audio_input->stream = pw_stream_new(audio_input->core, NETPW_PROGRAM_NAME, properties));
+void audio_input_deliver(struct audio_input* audio_input, const unsigned char* data, int size, uint64_t capture_time)
+{
+    trace_watchdog_begin(&audio_input->watchdog);
 
-    pw_stream_add_listener(audio_input->stream, &audio_input->hook, &stream_listener, audio_input);
+    audio_input->process_time = get_time();
+    audio_input->capture_time = capture_time;
 
-    CHECK_ERROR_FATAL(pw_stream_connect(
-        audio_input->stream,
-        PW_DIRECTION_INPUT,
-        PW_ID_ANY,
-        PW_STREAM_FLAG_AUTOCONNECT | PW_STREAM_FLAG_MAP_BUFFERS | PW_STREAM_FLAG_RT_PROCESS,
-        &format,
-        1
-    ));
+    metric_add(audio_input->quanta_metric, 1);
+    metric_add(audio_input->bytes_metric, size);
 
-    audio_input->callback = callback;
+    audio_input->callback(audio_input->userdata, data, size);
 
-    return audio_input;
+    int frames = size / (audio_input->channels * (audio_input->depth / 8));
+    trace_watchdog_end(&audio_input->watchdog, (uint64_t)frames * 1000000000 / audio_input->frequency);
 }
 
-void audio_input_run(struct audio_input* audio_input)
+uint64_t audio_input_capture_time(struct audio_input* audio_input)
 {
-    int result;
-
-    CHECK_ERROR(pw_main_loop_run(audio_input->main_loop));
+    return audio_input->capture_time;
 }
 
-void audio_input_destroy(struct audio_input* audio_input)
+uint64_t audio_input_process_time(struct audio_input* audio_input)
 {
-    pw_stream_disconnect(audio_input->stream);
-    pw_stream_destroy(audio_input->stream);
-    pw_core_disconnect(audio_input->core);
-    pw_context_destroy(audio_input->context);
-    pw_main_loop_destroy(audio_input->main_loop);
-    pw_deinit();
-    free(audio_input);
+    return audio_input->process_time;
 }
@@ -20,11 +20,29 @@ along with netpw. If not, see <https://www.gnu.org/licenses/>.
 #define NETPW_AUDIO_INPUT_H
 
 #include "callback.h"
+#include "audio_backend.h"
+
+#include <stdint.h>
 
 struct audio_input;
 
-struct audio_input* audio_input_init(int frequency, int channels, int depth, int buffer_size, on_data_callback callback);
+/* the path is only used by the file backend */
+struct audio_input* audio_input_init(
+    enum audio_backend backend,
+    const char* path,
+    int frequency,
+    int channels,
+    int depth,
+    int buffer_size,
+    on_data_callback callback,
+    void* userdata
+);
+/* returns when interrupted or when the source runs out */
 void audio_input_run(struct audio_input* audio_input);
 void audio_input_destroy(struct audio_input* audio_input);
 
+/* only valid from inside the data callback, times are monotonic nanoseconds */
+uint64_t audio_input_capture_time(struct audio_input* audio_input);
+uint64_t audio_input_process_time(struct audio_input* audio_input);
+
 #endif
@@ -0,0 +1,60 @@
+/*
+Copyright 2025 Amini Allight
+
+This file is part of netpw.
+
+netpw is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+netpw is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with netpw. If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef NETPW_AUDIO_INPUT_BACKEND_H
+#define NETPW_AUDIO_INPUT_BACKEND_H
+
+#include "audio_input.h"
+#include "metrics.h"
+#include "trace.h"
+
+struct audio_input_backend
+{
+    void* (*init)(struct audio_input* audio_input, const char* path);
+    void (*run)(void* backend_data);
+    void (*destroy)(void* backend_data);
+};
+
+struct audio_input
+{
+    enum audio_backend backend_type;
+    const struct audio_input_backend* backend;
+    void* backend_data;
+    int frequency;
+    int channels;
+    int depth;
+    int buffer_size;
+    on_data_callback callback;
+    void* userdata;
+    uint64_t capture_time;
+    uint64_t process_time;
+    struct metric* quanta_metric;
+    struct metric* bytes_metric;
+    struct trace_watchdog watchdog;
+};
+
+/* called by the backends once per quantum, the capture time is when its first frame was captured */
+void audio_input_deliver(struct audio_input* audio_input, const unsigned char* data, int size, uint64_t capture_time);
+
+#ifdef NETPW_PIPEWIRE
+extern const struct audio_input_backend audio_input_pipewire_backend;
+extern const struct audio_input_backend audio_input_pipewire_dsp_backend;
+#endif
+extern const struct audio_input_backend audio_input_file_backend;
+
+#endif
@@ -0,0 +1,207 @@
+/*
+Copyright 2025 Amini Allight
+
+This file is part of netpw.
+
+netpw is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+netpw is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with netpw. If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "audio_input_backend.h"
+#include "tools.h"
+#include "error_handling.h"
+#include "wav.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+/* how often a blocked read checks whether to quit, in milliseconds */
+#define NETPW_AUDIO_INPUT_POLL_INTERVAL 100
+
+struct audio_input_file
+{
+    struct audio_input* audio_input;
+    /* negative for the null backend */
+    int fd;
+    /* pipes are paced by whatever is writing to them, everything else by the clock */
+    int paced;
+    /* headerless files are taken to be in the stream format already */
+    int wav;
+    unsigned char* buffer;
+    int quantum_size;
+};
+
+static void* audio_input_file_init(struct audio_input* audio_input, const char* path)
+{
+    int result;
+
+    struct audio_input_file* file = malloc(sizeof(struct audio_input_file));
+
+    file->audio_input = audio_input;
+    file->quantum_size = audio_input->buffer_size * audio_input->channels * (audio_input->depth / 8);
+    file->buffer = malloc(file->quantum_size);
+    file->wav = 0;
+
+    switch (audio_input->backend_type)
+    {
+    default :
+    case NETPW_AUDIO_BACKEND_NULL :
+        file->fd = -1;
+        file->paced = 1;
+        break;
+    case NETPW_AUDIO_BACKEND_FILE :
+        if (!path)
+        {
+            fprintf(stderr, "the file audio backend requires a file.\n");
+            exit(1);
+        }
+
+        CHECK_ERRNO_FATAL(file->fd = open(path, O_RDONLY));
+        file->paced = 1;
+
+        int frequency;
+        int channels;
+        int depth;
+        result = wav_read_header(file->fd, &frequency, &channels, &depth);
+
+        if (result < 0)
+        {
+            fprintf(stderr, "unsupported WAV file: %s\n", path);
+            exit(1);
+        }
+        else if (result > 0 && (frequency != audio_input->frequency || channels != audio_input->channels || depth != audio_input->depth))
+        {
+            fprintf(stderr, "WAV file format %i Hz, %i channels, %i bits doesn't match the stream format.\n", frequency, channels, depth);
+            exit(1);
+        }
+
+        file->wav = result > 0;
+        break;
+    case NETPW_AUDIO_BACKEND_STDIO :
+        file->fd = STDIN_FILENO;
+        file->paced = 0;
+        break;
+    }
+
+    audio_backend_catch_signals();
+
+    return file;
+}
+
+/* returns the number of bytes read, short only at the end of the input */
+static int audio_input_file_read(struct audio_input_file* file)
+{
+    int offset = 0;
+
+    while (offset < file->quantum_size && !audio_backend_quit_requested())
+    {
+        struct pollfd poll_fd = {
+            .fd = file->fd,
+            .events = POLLIN
+        };
+
+        if (poll(&poll_fd, 1, NETPW_AUDIO_INPUT_POLL_INTERVAL) <= 0)
+        {
+            continue;
+        }
+
+        int result = read(file->fd, file->buffer + offset, file->quantum_size - offset);
+
+        if (result < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        else if (result <= 0)
+        {
+            break;
+        }
+
+        offset += result;
+    }
+
+    return offset;
+}
+
+static void audio_input_file_run(void* backend_data)
+{
+    struct audio_input_file* file = backend_data;
+    struct audio_input* audio_input = file->audio_input;
+
+    int stride = audio_input->channels * (audio_input->depth / 8);
+    uint64_t period = (uint64_t)audio_input->buffer_size * 1000000000 / audio_input->frequency;
+    uint64_t deadline = get_time();
+
+    trace_thread_name("capture");
+
+    while (!audio_backend_quit_requested())
+    {
+        if (file->paced)
+        {
+            deadline += period;
+
+            if (sleep_until(deadline) != 0)
+            {
+                continue;
+            }
+        }
+
+        int size = file->quantum_size;
+
+        if (file->fd < 0)
+        {
+            memset(file->buffer, 0, size);
+        }
+        else
+        {
+            size = audio_input_file_read(file);
+            size -= size % stride;
+
+            if (file->wav)
+            {
+                wav_convert_samples(file->buffer, size, audio_input->depth);
+            }
+        }
+
+        if (size > 0)
+        {
+            audio_input_deliver(audio_input, file->buffer, size, file->paced ? deadline - period : get_time());
+        }
+
+        if (size < file->quantum_size)
+        {
+            break;
+        }
+    }
+}
+
+static void audio_input_file_destroy(void* backend_data)
+{
+    struct audio_input_file* file = backend_data;
+
+    if (file->fd >= 0 && file->fd != STDIN_FILENO)
+    {
+        close(file->fd);
+    }
+
+    free(file->buffer);
+    free(file);
+}
+
+const struct audio_input_backend audio_input_file_backend = {
+    .init = audio_input_file_init,
+    .run = audio_input_file_run,
+    .destroy = audio_input_file_destroy
+};
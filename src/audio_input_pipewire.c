@@ -0,0 +1,204 @@
+/*
+Copyright 2025 Amini Allight
+
+This file is part of netpw.
+
+netpw is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+netpw is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with netpw. If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "audio_input_backend.h"
+#include "packet.h"
+#include "tools.h"
+#include "constants.h"
+#include "error_handling.h"
+
+#include <stdlib.h>
+#define __LOCALE_C_ONLY
+#include <pipewire/pipewire.h>
+#include <spa/param/audio/format-utils.h>
+#include <spa/param/param.h>
+#include <spa/pod/builder.h>
+
+struct audio_input_pipewire
+{
+    struct audio_input* audio_input;
+    struct pw_main_loop* main_loop;
+    struct pw_context* context;
+    struct pw_core* core;
+    struct pw_stream* stream;
+    struct spa_hook hook;
+};
+
+static void audio_input_pipewire_process(void* userdata)
+{
+    struct audio_input_pipewire* pipewire = userdata;
+
+    struct pw_buffer* buffer = pw_stream_dequeue_buffer(pipewire->stream);
+
+    if (!buffer)
+    {
+        return;
+    }
+
+    struct pw_time time;
+    uint64_t capture_time = get_time();
+
+    /* the delay is how long ago the graph captured the start of this quantum */
+    if (pw_stream_get_time_n(pipewire->stream, &time, sizeof(time)) == 0 && time.rate.denom != 0)
+    {
+        capture_time -= time.delay * 1000000000 * time.rate.num / time.rate.denom;
+    }
+
+    struct spa_data* data = &buffer->buffer->datas[0];
+    uint32_t offset = min(data->chunk->offset, data->maxsize);
+    uint32_t size = min(data->chunk->size, data->maxsize - offset);
+
+    audio_input_deliver(pipewire->audio_input, (unsigned char*)data->data + offset, size, capture_time);
+
+    pw_stream_queue_buffer(pipewire->stream, buffer);
+}
+
+/* asks for buffers holding one quantum of the requested size, each is then sent as one packet */
+static void audio_input_pipewire_param_changed(void* userdata, uint32_t id, const struct spa_pod* param)
+{
+    struct audio_input_pipewire* pipewire = userdata;
+    struct audio_input* audio_input = pipewire->audio_input;
+
+    /* a null format means the stream was disconnected and there is nothing to negotiate */
+    if (id != SPA_PARAM_Format || !param)
+    {
+        return;
+    }
+
+    int stride = audio_input->channels * (audio_input->depth / 8);
+    int max_size = ((NETPW_PACKET_MAX_SIZE - NETPW_PACKET_HEADER_SIZE) / stride) * stride;
+
+    unsigned char buffer[1024];
+    struct spa_pod_builder builder = SPA_POD_BUILDER_INIT(buffer, sizeof(buffer));
+
+    const struct spa_pod* params[1];
+
+    params[0] = spa_pod_builder_add_object(
+        &builder,
+        SPA_TYPE_OBJECT_ParamBuffers, SPA_PARAM_Buffers,
+        SPA_PARAM_BUFFERS_buffers, SPA_POD_CHOICE_RANGE_Int(NETPW_PIPEWIRE_BUFFER_COUNT, 1, NETPW_PIPEWIRE_BUFFER_COUNT),
+        SPA_PARAM_BUFFERS_blocks, SPA_POD_Int(1),
+        SPA_PARAM_BUFFERS_size, SPA_POD_CHOICE_RANGE_Int(min(audio_input->buffer_size * stride, max_size), stride, max_size),
+        SPA_PARAM_BUFFERS_stride, SPA_POD_Int(stride)
+    );
+
+    pw_stream_update_params(pipewire->stream, params, 1);
+}
+
+static struct pw_stream_events stream_listener = {
+    .version = PW_VERSION_STREAM_EVENTS,
+    .param_changed = audio_input_pipewire_param_changed,
+    .process = audio_input_pipewire_process
+};
+
+static void on_quit(void* userdata, int signal)
+{
+    struct audio_input_pipewire* pipewire = userdata;
+    pw_main_loop_quit(pipewire->main_loop);
+}
+
+static void* audio_input_pipewire_init(struct audio_input* audio_input, const char* path)
+{
+    int result;
+
+    struct audio_input_pipewire* pipewire = malloc(sizeof(struct audio_input_pipewire));
+
+    pipewire->audio_input = audio_input;
+
+    unsigned char buffer[1024];
+    struct spa_pod_builder builder = SPA_POD_BUILDER_INIT(buffer, sizeof(buffer));
+
+    struct spa_audio_info_raw info = {
+        .format = identify_spa_format(audio_input->depth),
+        .rate = audio_input->frequency,
+        .channels = audio_input->channels
+    };
+
+    const struct spa_pod* format = spa_format_audio_raw_build(
+        &builder,
+        SPA_PARAM_EnumFormat,
+        &info
+    );
+
+    pw_init(0, NULL);
+
+    CHECK_POINTER_FATAL(pipewire->main_loop = pw_main_loop_new(NULL));
+    pw_loop_add_signal(pw_main_loop_get_loop(pipewire->main_loop), SIGINT, on_quit, pipewire);
+    pw_loop_add_signal(pw_main_loop_get_loop(pipewire->main_loop), SIGTERM, on_quit, pipewire);
+
+    CHECK_POINTER_FATAL(pipewire->context = pw_context_new(pw_main_loop_get_loop(pipewire->main_loop), NULL, 0));
+
+    CHECK_POINTER_FATAL(pipewire->core = pw_context_connect(pipewire->context, NULL, 0));
+
+    struct pw_properties* properties = pw_properties_new(
+        PW_KEY_MEDIA_TYPE, "Audio",
+        PW_KEY_MEDIA_CATEGORY, "Capture",
+        PW_KEY_MEDIA_ROLE, "Network",
+        PW_KEY_APP_NAME, NETPW_PROGRAM_NAME,
+        PW_KEY_APP_ID, NETPW_PROGRAM_NAME,
+        PW_KEY_NODE_NAME, "Capture",
+        PW_KEY_NODE_DESCRIPTION, "Capture",
+        NULL
+    );
+
+    pw_properties_setf(properties, PW_KEY_NODE_LATENCY, "%u/%u", audio_input->buffer_size, audio_input->frequency);
+    pw_properties_setf(properties, PW_KEY_NODE_RATE, "1/%u", audio_input->frequency);
+
+    CHECK_POINTER_FATAL(pipewire->stream = pw_stream_new(pipewire->core, NETPW_PROGRAM_NAME, properties));
+
+    pw_stream_add_listener(pipewire->stream, &pipewire->hook, &stream_listener, pipewire);
+
+    CHECK_ERROR_FATAL(pw_stream_connect(
+        pipewire->stream,
+        PW_DIRECTION_INPUT,
+        PW_ID_ANY,
+        PW_STREAM_FLAG_AUTOCONNECT | PW_STREAM_FLAG_MAP_BUFFERS | PW_STREAM_FLAG_RT_PROCESS,
+        &format,
+        1
+    ));
+
+    return pipewire;
+}
+
+static void audio_input_pipewire_run(void* backend_data)
+{
+    struct audio_input_pipewire* pipewire = backend_data;
+
+    int result;
+
+    CHECK_ERROR(pw_main_loop_run(pipewire->main_loop));
+}
+
+static void audio_input_pipewire_destroy(void* backend_data)
+{
+    struct audio_input_pipewire* pipewire = backend_data;
+
+    pw_stream_disconnect(pipewire->stream);
+    pw_stream_destroy(pipewire->stream);
+    pw_core_disconnect(pipewire->core);
+    pw_context_destroy(pipewire->context);
+    pw_main_loop_destroy(pipewire->main_loop);
+    pw_deinit();
+    free(pipewire);
+}
+
+const struct audio_input_backend audio_input_pipewire_backend = {
+    .init = audio_input_pipewire_init,
+    .run = audio_input_pipewire_run,
+    .destroy = audio_input_pipewire_destroy
+};
@@ -0,0 +1,212 @@
+/*
+Copyright 2025 Amini Allight
+
+This file is part of netpw.
+
+netpw is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+netpw is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with netpw. If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "audio_input_backend.h"
+#include "sample_format.h"
+#include "tools.h"
+#include "constants.h"
+#include "error_handling.h"
+
+#include <stdlib.h>
+#define __LOCALE_C_ONLY
+#include <pipewire/pipewire.h>
+
+/*
+ * a filter node with one 32 bit float port per channel, driven directly by the graph without an adapter in front of it
+ * the ports are packed into the wire format here instead of by PipeWire's converter
+ */
+struct audio_input_pipewire_dsp
+{
+    struct audio_input* audio_input;
+    struct pw_main_loop* main_loop;
+    struct pw_context* context;
+    struct pw_core* core;
+    struct pw_filter* filter;
+    struct spa_hook hook;
+    void** ports;
+    const float** buffers;
+    float* silence;
+    unsigned char* data;
+};
+
+static void audio_input_pipewire_dsp_process(void* userdata, struct spa_io_position* position)
+{
+    struct audio_input_pipewire_dsp* pipewire = userdata;
+    struct audio_input* audio_input = pipewire->audio_input;
+
+    if (!position)
+    {
+        return;
+    }
+
+    int frames = position->clock.duration;
+    int stride = audio_input->channels * (audio_input->depth / 8);
+
+    uint64_t frame_time = 0;
+    uint64_t capture_time = get_time();
+
+    /* the cycle starts once the quantum has been captured and the delay is how much earlier the device captured it */
+    if (position->clock.rate.denom != 0)
+    {
+        frame_time = 1000000000ULL * position->clock.rate.num / position->clock.rate.denom;
+        capture_time = position->clock.nsec - (frames + position->clock.delay) * frame_time;
+    }
+
+    int c;
+    for (c = 0; c < audio_input->channels; c++)
+    {
+        /* unconnected ports have no buffer and read as silence */
+        pipewire->buffers[c] = pw_filter_get_dsp_buffer(pipewire->ports[c], frames);
+    }
+
+    int offset = 0;
+
+    while (offset < frames)
+    {
+        int size = min(frames - offset, NETPW_DSP_MAX_QUANTUM);
+
+        const float* planes[audio_input->channels];
+
+        for (c = 0; c < audio_input->channels; c++)
+        {
+            planes[c] = pipewire->buffers[c] ? pipewire->buffers[c] + offset : pipewire->silence;
+        }
+
+        sample_format_pack(planes, audio_input->channels, size, audio_input->depth, pipewire->data);
+
+        audio_input_deliver(audio_input, pipewire->data, size * stride, capture_time + offset * frame_time);
+
+        offset += size;
+    }
+}
+
+static struct pw_filter_events filter_listener = {
+    .version = PW_VERSION_FILTER_EVENTS,
+    .process = audio_input_pipewire_dsp_process
+};
+
+static void on_quit(void* userdata, int signal)
+{
+    struct audio_input_pipewire_dsp* pipewire = userdata;
+    pw_main_loop_quit(pipewire->main_loop);
+}
+
+static void* audio_input_pipewire_dsp_init(struct audio_input* audio_input, const char* path)
+{
+    int result;
+
+    struct audio_input_pipewire_dsp* pipewire = malloc(sizeof(struct audio_input_pipewire_dsp));
+
+    pipewire->audio_input = audio_input;
+    pipewire->ports = malloc(audio_input->channels * sizeof(void*));
+    pipewire->buffers = malloc(audio_input->channels * sizeof(const float*));
+    pipewire->silence = calloc(NETPW_DSP_MAX_QUANTUM, sizeof(float));
+    pipewire->data = malloc(NETPW_DSP_MAX_QUANTUM * audio_input->channels * (audio_input->depth / 8));
+
+    pw_init(0, NULL);
+
+    CHECK_POINTER_FATAL(pipewire->main_loop = pw_main_loop_new(NULL));
+    pw_loop_add_signal(pw_main_loop_get_loop(pipewire->main_loop), SIGINT, on_quit, pipewire);
+    pw_loop_add_signal(pw_main_loop_get_loop(pipewire->main_loop), SIGTERM, on_quit, pipewire);
+
+    CHECK_POINTER_FATAL(pipewire->context = pw_context_new(pw_main_loop_get_loop(pipewire->main_loop), NULL, 0));
+
+    CHECK_POINTER_FATAL(pipewire->core = pw_context_connect(pipewire->context, NULL, 0));
+
+    /* the media class lets the session manager link the ports by channel position like it would a stream */
+    struct pw_properties* properties = pw_properties_new(
+        PW_KEY_MEDIA_TYPE, "Audio",
+        PW_KEY_MEDIA_CATEGORY, "Capture",
+        PW_KEY_MEDIA_ROLE, "Network",
+        PW_KEY_MEDIA_CLASS, "Stream/Input/Audio",
+        PW_KEY_APP_NAME, NETPW_PROGRAM_NAME,
+        PW_KEY_APP_ID, NETPW_PROGRAM_NAME,
+        PW_KEY_NODE_NAME, "Capture",
+        PW_KEY_NODE_DESCRIPTION, "Capture",
+        NULL
+    );
+
+    pw_properties_setf(properties, PW_KEY_NODE_LATENCY, "%u/%u", audio_input->buffer_size, audio_input->frequency);
+    pw_properties_setf(properties, PW_KEY_NODE_RATE, "1/%u", audio_input->frequency);
+
+    CHECK_POINTER_FATAL(pipewire->filter = pw_filter_new(pipewire->core, NETPW_PROGRAM_NAME, properties));
+
+    pw_filter_add_listener(pipewire->filter, &pipewire->hook, &filter_listener, pipewire);
+
+    int c;
+    for (c = 0; c < audio_input->channels; c++)
+    {
+        char position[16];
+        identify_channel_position(audio_input->channels, c, position, sizeof(position));
+
+        struct pw_properties* port_properties = pw_properties_new(
+            PW_KEY_FORMAT_DSP, "32 bit float mono audio",
+            PW_KEY_AUDIO_CHANNEL, position,
+            NULL
+        );
+
+        pw_properties_setf(port_properties, PW_KEY_PORT_NAME, "input_%s", position);
+
+        CHECK_POINTER_FATAL(pipewire->ports[c] = pw_filter_add_port(
+            pipewire->filter,
+            PW_DIRECTION_INPUT,
+            PW_FILTER_PORT_FLAG_MAP_BUFFERS,
+            0,
+            port_properties,
+            NULL,
+            0
+        ));
+    }
+
+    CHECK_ERROR_FATAL(pw_filter_connect(pipewire->filter, PW_FILTER_FLAG_RT_PROCESS, NULL, 0));
+
+    return pipewire;
+}
+
+static void audio_input_pipewire_dsp_run(void* backend_data)
+{
+    struct audio_input_pipewire_dsp* pipewire = backend_data;
+
+    int result;
+
+    CHECK_ERROR(pw_main_loop_run(pipewire->main_loop));
+}
+
+static void audio_input_pipewire_dsp_destroy(void* backend_data)
+{
+    struct audio_input_pipewire_dsp* pipewire = backend_data;
+
+    /* the ports belong to the filter */
+    pw_filter_disconnect(pipewire->filter);
+    pw_filter_destroy(pipewire->filter);
+    pw_core_disconnect(pipewire->core);
+    pw_context_destroy(pipewire->context);
+    pw_main_loop_destroy(pipewire->main_loop);
+    pw_deinit();
+    free(pipewire->data);
+    free(pipewire->silence);
+    free(pipewire->buffers);
+    free(pipewire->ports);
+    free(pipewire);
+}
+
+const struct audio_input_backend audio_input_pipewire_dsp_backend = {
+    .init = audio_input_pipewire_dsp_init,
+    .run = audio_input_pipewire_dsp_run,
+    .destroy = audio_input_pipewire_dsp_destroy
+};
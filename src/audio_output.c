@@ -16,147 +16,256 @@ GNU General Public License for more details.
 You should have received a copy of the GNU General Public License
 along with netpw. If not, see <https://www.gnu.org/licenses/>.
 */
-#include "audio_output.h"
+#include "audio_output_backend.h"
 #include "tools.h"
-#include "constants.h"
 #include "error_handling.h"
-#include "lockfree_spsc_queue.h"
 
 #include <stdlib.h>
-#define __LOCALE_C_ONLY
-#include <pipewire/pipewire.h>
-#include <spa/param/audio/format-utils.h>
+#include <string.h>
 
-struct audio_output
+static int audio_output_fill(struct audio_output_stream* stream, unsigned char* out_data, int out_size)
 {
-    struct pw_main_loop* main_loop;
-    struct pw_context* context;
-    struct pw_core* core;
-    struct pw_stream* stream;
-    struct spa_hook hook;
-    struct lockfree_spsc_queue* queue;
-    int stride;
-};
-
-static void audio_output_process(void* userdata)
+    int offset = 0;
+
+    while (offset < out_size)
+    {
+        unsigned int head = stream->silence_head;
+        unsigned int tail = __atomic_load_n(&stream->silence_tail, __ATOMIC_ACQUIRE);
+        int limit = out_size - offset;
+
+        if (head != tail)
+        {
+            struct silence_run* run = &stream->silence_runs[head % NETPW_SILENCE_RUN_COUNT];
+
+            if (run->position == stream->pulled)
+            {
+                int silence_size = min(run->size - stream->silence_played, limit);
+
+                memset(out_data + offset, 0, silence_size);
+                metric_add(stream->silence_metric, silence_size);
+                offset += silence_size;
+                stream->silence_played += silence_size;
+
+                if (stream->silence_played == run->size)
+                {
+                    stream->silence_played = 0;
+                    __atomic_store_n(&stream->silence_head, head + 1, __ATOMIC_RELEASE);
+                }
+
+                continue;
+            }
+
+            limit = min(limit, run->position - stream->pulled);
+        }
+
+        int actual_read_size = lockfree_spsc_queue_pull(stream->queue, out_data + offset, limit);
+        offset += actual_read_size;
+        stream->pulled += actual_read_size;
+
+        if (actual_read_size < limit)
+        {
+            break;
+        }
+    }
+
+    return offset;
+}
+
+void audio_output_stream_process(struct audio_output_stream* stream, unsigned char* out_data, int out_size)
 {
-    struct audio_output* audio_output = userdata;
+    trace_watchdog_begin(&stream->watchdog);
+
+    int queue_size = lockfree_spsc_queue_size(stream->queue);
+    metric_set(stream->queue_metric, queue_size);
+    metric_observe(stream->queue_histogram_metric, queue_size);
+    TRACE_COUNTER("playback queue bytes", queue_size);
 
-    struct pw_buffer* buffer = pw_stream_dequeue_buffer(audio_output->stream);
+    uint64_t queue_latency = (uint64_t)(queue_size / stream->stride) * 1000000000 / stream->audio_output->frequency;
+    __atomic_store_n(&stream->queue_latency, queue_latency, __ATOMIC_RELAXED);
 
-    if (!buffer)
+    int actual_read_size = audio_output_fill(stream, out_data, out_size);
+
+    if (actual_read_size < out_size)
     {
-        return;
+        metric_add(stream->zero_filled_metric, out_size - actual_read_size);
+        metric_add(stream->xrun_metric, 1);
     }
 
-    unsigned char* out_data = buffer->buffer->datas[0].data;
-    uint32_t out_size = buffer->buffer->datas[0].maxsize;
-    buffer->buffer->datas[0].chunk->offset = 0;
-    buffer->buffer->datas[0].chunk->stride = audio_output->stride;
-    buffer->buffer->datas[0].chunk->size = out_size;
+    memset(out_data + actual_read_size, 0, out_size - actual_read_size);
 
-    int actual_read_size = lockfree_spsc_queue_pull(audio_output->queue, out_data, out_size);
+    trace_watchdog_end(&stream->watchdog, (uint64_t)(out_size / stream->stride) * 1000000000 / stream->audio_output->frequency);
+}
 
-    memset(out_data + actual_read_size, 0, out_size - actual_read_size);
+struct audio_output* audio_output_init(enum audio_backend backend, const char* path, int frequency, int channels, int depth, int buffer_size)
+{
+    struct audio_output* audio_output = malloc(sizeof(struct audio_output));
 
-    pw_stream_queue_buffer(audio_output->stream, buffer);
+    audio_output->backend_type = backend;
+    audio_output->frequency = frequency;
+    audio_output->channels = channels;
+    audio_output->depth = depth;
+    audio_output->buffer_size = buffer_size;
+
+    switch (backend)
+    {
+    default :
+        fprintf(stderr, "unsupported audio backend.\n");
+        exit(1);
+#ifdef NETPW_PIPEWIRE
+    case NETPW_AUDIO_BACKEND_PIPEWIRE :
+        audio_output->backend = &audio_output_pipewire_backend;
+        break;
+    case NETPW_AUDIO_BACKEND_PIPEWIRE_DSP :
+        audio_output->backend = &audio_output_pipewire_dsp_backend;
+        break;
+#endif
+    case NETPW_AUDIO_BACKEND_NULL :
+    case NETPW_AUDIO_BACKEND_FILE :
+    case NETPW_AUDIO_BACKEND_STDIO :
+        audio_output->backend = &audio_output_file_backend;
+        break;
+    }
+
+    audio_output->backend_data = audio_output->backend->init(audio_output, path);
+
+    return audio_output;
 }
 
-static struct pw_stream_events stream_listener = {
-    .version = PW_VERSION_STREAM_EVENTS,
-    .process = audio_output_process
-};
+void audio_output_run(struct audio_output* audio_output)
+{
+    audio_output->backend->run(audio_output->backend_data);
+}
 
-static void on_quit(void* userdata, int signal)
+void audio_output_destroy(struct audio_output* audio_output)
 {
-    struct audio_output* audio_output = userdata;
-    pw_main_loop_quit(audio_output->main_loop);
+    audio_output->backend->destroy(audio_output->backend_data);
+    free(audio_output);
 }
 
-struct audio_output* audio_output_init(int frequency, int channels, int depth, int buffer_size)
+struct audio_output_stream* audio_output_stream_init(struct audio_output* audio_output, const char* name)
 {
     int result;
 
-    struct audio_output* audio_output = malloc(sizeof(struct audio_output));
+    struct audio_output_stream* stream = malloc(sizeof(struct audio_output_stream));
+
+    stream->audio_output = audio_output;
 
-    unsigned char queue[1024];
-    struct spa_pod_builder builder = SPA_POD_BUILDER_INIT(queue, sizeof(queue));
+    CHECK_ERROR_FATAL(lockfree_spsc_queue_init(&stream->queue));
+    stream->stride = audio_output->channels * (audio_output->depth / 8);
+    stream->silence_head = 0;
+    stream->silence_tail = 0;
+    stream->silence_played = 0;
+    stream->pushed = 0;
+    stream->pulled = 0;
+    stream->queue_latency = 0;
+    stream->playback_latency = 0;
 
-    struct spa_audio_info_raw info = {
-        .format = identify_spa_format(depth),
-        .rate = frequency,
-        .channels = channels
-    };
+    static const uint64_t queue_bounds[] = { 0, 1024, 4096, 16384, 65536, 262144, NETPW_QUEUE_SIZE };
 
-    const struct spa_pod* format = spa_format_audio_raw_build(
-        &builder,
-        SPA_PARAM_EnumFormat,
-        &info
+    char labels[256];
+    snprintf(labels, sizeof(labels), "stream=\"%s\"", name);
+
+    stream->queue_metric = metric_gauge_init("netpw_playback_queue_bytes", "Bytes waiting in the playback queue.", labels);
+    stream->queue_histogram_metric = metric_histogram_init(
+        "netpw_playback_queue_fill_bytes",
+        "Bytes waiting in the playback queue at the start of each quantum.",
+        labels,
+        queue_bounds,
+        sizeof(queue_bounds) / sizeof(uint64_t)
     );
+    stream->zero_filled_metric = metric_counter_init("netpw_playback_zero_filled_bytes_total", "Bytes of playback filled with zeroes because the queue ran dry.", labels);
+    stream->xrun_metric = metric_counter_init("netpw_playback_xruns_total", "Quanta in which the playback queue ran dry.", labels);
+    stream->silence_metric = metric_counter_init("netpw_playback_silence_bytes_total", "Bytes of playback synthesized from silence markers.", labels);
+    stream->dropped_metric = metric_counter_init("netpw_playback_dropped_bytes_total", "Bytes received while the playback queue was full.", labels);
 
-    pw_init(0, NULL);
+    trace_watchdog_init(&stream->watchdog, "playback process");
 
-    CHECK_POINTER_FATAL(audio_output->main_loop = pw_main_loop_new(NULL));
-    pw_loop_add_signal(pw_main_loop_get_loop(audio_output->main_loop), SIGINT, on_quit, audio_output);
-    pw_loop_add_signal(pw_main_loop_get_loop(audio_output->main_loop), SIGTERM, on_quit, audio_output);
+    /* the backend may start processing the stream immediately */
+    stream->backend_data = audio_output->backend->stream_init(audio_output->backend_data, stream, name);
 
-    CHECK_POINTER_FATAL(audio_output->context = pw_context_new(pw_main_loop_get_loop(audio_output->main_loop), NULL, 0));
+    return stream;
+}
 
-    CHECK_POINTER_FATAL(audio_output->core = pw_context_connect(audio_output->context, NULL, 0));
+void audio_output_stream_send(struct audio_output_stream* stream, const unsigned char* data, int size)
+{
+    int pushed = lockfree_spsc_queue_push(stream->queue, data, size);
 
-    struct pw_properties* properties = pw_properties_new(
-        PW_KEY_MEDIA_TYPE, "Audio",
-        PW_KEY_MEDIA_CATEGORY, "Playback",
-        PW_KEY_MEDIA_ROLE, "Network",
-        PW_KEY_APP_NAME, NETPW_PROGRAM_NAME,
-        PW_KEY_APP_ID, NETPW_PROGRAM_NAME,
-        PW_KEY_NODE_NAME, "Playback",
-        PW_KEY_NODE_DESCRIPTION, "Playback",
-        NULL
-    );
+    TRACE_COUNTER("playback queue pushed bytes", pushed);
 
-    pw_properties_setf(properties, PW_KEY_NODE_LATENCY, "%u/%u", buffer_size, frequency);
-    pw_properties_setf(properties, PW_KEY_NODE_RATE, "1/%u", frequency);
+    stream->pushed += pushed;
+
+    if (pushed < size)
+    {
+        metric_add(stream->dropped_metric, size - pushed);
+    }
+}
 
-    CHECK_POINTER_FATAL(audio_output->stream = pw_stream_new(audio_output->core, NETPW_PROGRAM_NAME, properties));
+void audio_output_stream_send_silence(struct audio_output_stream* stream, int frames)
+{
+    unsigned int head = __atomic_load_n(&stream->silence_head, __ATOMIC_ACQUIRE);
+    unsigned int tail = stream->silence_tail;
 
-    pw_stream_add_listener(audio_output->stream, &audio_output->hook, &stream_listener, audio_output);
+    int64_t run_size = (int64_t)frames * stream->stride;
 
-    CHECK_ERROR_FATAL(lockfree_spsc_queue_init(&audio_output->queue));
-    audio_output->stride = channels * (depth / 8);
+    /* callers check markers against the queue size, this only keeps a bad one from reaching the realtime thread */
+    if (run_size < 0 || run_size > NETPW_QUEUE_SIZE)
+    {
+        metric_add(stream->dropped_metric, run_size < 0 ? 0 : run_size);
+        return;
+    }
 
-    CHECK_ERROR_FATAL(pw_stream_connect(
-        audio_output->stream,
-        PW_DIRECTION_OUTPUT,
-        PW_ID_ANY,
-        PW_STREAM_FLAG_AUTOCONNECT | PW_STREAM_FLAG_MAP_BUFFERS | PW_STREAM_FLAG_RT_PROCESS,
-        &format,
-        1
-    ));
+    /* with every run in use the silence is queued as samples instead, so that it keeps its place in the timing */
+    if (tail - head == NETPW_SILENCE_RUN_COUNT)
+    {
+        static const unsigned char zeros[NETPW_IO_BUFFER_SIZE];
 
-    return audio_output;
+        int size = run_size;
+
+        while (size > 0)
+        {
+            int chunk = min(size, NETPW_IO_BUFFER_SIZE);
+            int pushed = lockfree_spsc_queue_push(stream->queue, zeros, chunk);
+
+            stream->pushed += pushed;
+            size -= pushed;
+
+            if (pushed < chunk)
+            {
+                metric_add(stream->dropped_metric, size);
+                break;
+            }
+        }
+
+        return;
+    }
+
+    struct silence_run* run = &stream->silence_runs[tail % NETPW_SILENCE_RUN_COUNT];
+    run->position = stream->pushed;
+    run->size = run_size;
+
+    __atomic_store_n(&stream->silence_tail, tail + 1, __ATOMIC_RELEASE);
 }
 
-void audio_output_send(struct audio_output* audio_output, const unsigned char* data, int size)
+void audio_output_stream_destroy(struct audio_output_stream* stream)
 {
-    lockfree_spsc_queue_push(audio_output->queue, data, size);
+    stream->audio_output->backend->stream_destroy(stream->audio_output->backend_data, stream->backend_data);
+
+    lockfree_spsc_queue_destroy(stream->queue);
+    metric_destroy(stream->queue_metric);
+    metric_destroy(stream->queue_histogram_metric);
+    metric_destroy(stream->zero_filled_metric);
+    metric_destroy(stream->xrun_metric);
+    metric_destroy(stream->silence_metric);
+    metric_destroy(stream->dropped_metric);
+    free(stream);
 }
 
-void audio_output_run(struct audio_output* audio_output)
+uint64_t audio_output_stream_queue_latency(struct audio_output_stream* stream)
 {
-    int result;
-
-    CHECK_ERROR(pw_main_loop_run(audio_output->main_loop));
+    return __atomic_load_n(&stream->queue_latency, __ATOMIC_RELAXED);
 }
 
-void audio_output_destroy(struct audio_output* audio_output)
+uint64_t audio_output_stream_playback_latency(struct audio_output_stream* stream)
 {
-    pw_stream_disconnect(audio_output->stream);
-    lockfree_spsc_queue_destroy(audio_output->queue);
-    pw_stream_destroy(audio_output->stream);
-    pw_core_disconnect(audio_output->core);
-    pw_context_destroy(audio_output->context);
-    pw_main_loop_destroy(audio_output->main_loop);
-    pw_deinit();
-    free(audio_output);
+    return __atomic_load_n(&stream->playback_latency, __ATOMIC_RELAXED);
 }
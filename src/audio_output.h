@@ -19,11 +19,27 @@ along with netpw. If not, see <https://www.gnu.org/licenses/>.
 #ifndef NETPW_AUDIO_OUTPUT_H
 #define NETPW_AUDIO_OUTPUT_H
 
+#include "audio_backend.h"
+
+#include <stdint.h>
+
 struct audio_output;
+struct audio_output_stream;
 
-struct audio_output* audio_output_init(int frequency, int channels, int depth, int buffer_size);
-void audio_output_send(struct audio_output* audio_output, const unsigned char* data, int size);
+/* the path is only used by the file backend */
+struct audio_output* audio_output_init(enum audio_backend backend, const char* path, int frequency, int channels, int depth, int buffer_size);
 void audio_output_run(struct audio_output* audio_output);
 void audio_output_destroy(struct audio_output* audio_output);
 
+/* may be called from any thread, each stream is a separate PipeWire node or is mixed by the other backends */
+struct audio_output_stream* audio_output_stream_init(struct audio_output* audio_output, const char* name);
+void audio_output_stream_send(struct audio_output_stream* stream, const unsigned char* data, int size);
+/* silence is played in order with the data sent around it without being queued */
+void audio_output_stream_send_silence(struct audio_output_stream* stream, int frames);
+void audio_output_stream_destroy(struct audio_output_stream* stream);
+
+/* as of the latest quantum, in nanoseconds */
+uint64_t audio_output_stream_queue_latency(struct audio_output_stream* stream);
+uint64_t audio_output_stream_playback_latency(struct audio_output_stream* stream);
+
 #endif
@@ -0,0 +1,89 @@
+/*
+Copyright 2025 Amini Allight
+
+This file is part of netpw.
+
+netpw is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+netpw is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with netpw. If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef NETPW_AUDIO_OUTPUT_BACKEND_H
+#define NETPW_AUDIO_OUTPUT_BACKEND_H
+
+#include "audio_output.h"
+#include "constants.h"
+#include "lockfree_spsc_queue.h"
+#include "metrics.h"
+#include "trace.h"
+
+struct audio_output_backend
+{
+    void* (*init)(struct audio_output* audio_output, const char* path);
+    void (*run)(void* backend_data);
+    void (*destroy)(void* backend_data);
+    void* (*stream_init)(void* backend_data, struct audio_output_stream* stream, const char* name);
+    void (*stream_destroy)(void* backend_data, void* stream_data);
+};
+
+struct audio_output
+{
+    enum audio_backend backend_type;
+    const struct audio_output_backend* backend;
+    void* backend_data;
+    int frequency;
+    int channels;
+    int depth;
+    int buffer_size;
+};
+
+struct silence_run
+{
+    /* in bytes of queued data preceding the silence */
+    uint64_t position;
+    int size;
+};
+
+struct audio_output_stream
+{
+    struct audio_output* audio_output;
+    void* backend_data;
+    uint64_t queue_latency;
+    /* set by the backend */
+    uint64_t playback_latency;
+    struct lockfree_spsc_queue* queue;
+    int stride;
+    /* single producer single consumer, the network side appends and the process callback consumes */
+    struct silence_run silence_runs[NETPW_SILENCE_RUN_COUNT];
+    unsigned int silence_head;
+    unsigned int silence_tail;
+    int silence_played;
+    uint64_t pushed;
+    uint64_t pulled;
+    struct metric* queue_metric;
+    struct metric* queue_histogram_metric;
+    struct metric* zero_filled_metric;
+    struct metric* xrun_metric;
+    struct metric* silence_metric;
+    struct metric* dropped_metric;
+    struct trace_watchdog watchdog;
+};
+
+/* called by the backends once per quantum, fills the whole of the output */
+void audio_output_stream_process(struct audio_output_stream* stream, unsigned char* out_data, int out_size);
+
+#ifdef NETPW_PIPEWIRE
+extern const struct audio_output_backend audio_output_pipewire_backend;
+extern const struct audio_output_backend audio_output_pipewire_dsp_backend;
+#endif
+extern const struct audio_output_backend audio_output_file_backend;
+
+#endif
@@ -0,0 +1,287 @@
+/*
+Copyright 2025 Amini Allight
+
+This file is part of netpw.
+
+netpw is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+netpw is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with netpw. If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "audio_output_backend.h"
+#include "tools.h"
+#include "error_handling.h"
+#include "wav.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+/* unlike PipeWire there is no graph to mix the streams so they are summed into one quantum here */
+struct audio_output_file
+{
+    struct audio_output* audio_output;
+    /* negative for the null backend or after a write failure */
+    int fd;
+    int wav;
+    uint64_t written;
+    pthread_mutex_t lock;
+    struct audio_output_stream** streams;
+    int stream_count;
+    unsigned char* mix;
+    unsigned char* scratch;
+    int quantum_size;
+    int running;
+    pthread_t thread;
+};
+
+static int clamp(int64_t x, int64_t low, int64_t high)
+{
+    return x < low ? low : (x > high ? high : x);
+}
+
+static void audio_output_file_mix(unsigned char* out, const unsigned char* in, int size, int depth)
+{
+    int i;
+
+    switch (depth)
+    {
+    case 8 :
+        for (i = 0; i < size; i++)
+        {
+            ((int8_t*)out)[i] = clamp((int64_t)((int8_t*)out)[i] + ((const int8_t*)in)[i], INT8_MIN, INT8_MAX);
+        }
+        break;
+    case 16 :
+        for (i = 0; i < size / 2; i++)
+        {
+            ((int16_t*)out)[i] = clamp((int64_t)((int16_t*)out)[i] + ((const int16_t*)in)[i], INT16_MIN, INT16_MAX);
+        }
+        break;
+    case 24 :
+        for (i = 0; i < size; i += 3)
+        {
+            int32_t a = (int32_t)((uint32_t)out[i] << 8 | (uint32_t)out[i + 1] << 16 | (uint32_t)out[i + 2] << 24) >> 8;
+            int32_t b = (int32_t)((uint32_t)in[i] << 8 | (uint32_t)in[i + 1] << 16 | (uint32_t)in[i + 2] << 24) >> 8;
+            int32_t sum = clamp((int64_t)a + b, -8388608, 8388607);
+
+            out[i] = sum & 0xff;
+            out[i + 1] = (sum >> 8) & 0xff;
+            out[i + 2] = (sum >> 16) & 0xff;
+        }
+        break;
+    case 32 :
+        for (i = 0; i < size / 4; i++)
+        {
+            ((int32_t*)out)[i] = clamp((int64_t)((int32_t*)out)[i] + ((const int32_t*)in)[i], INT32_MIN, INT32_MAX);
+        }
+        break;
+    }
+}
+
+static void audio_output_file_write(struct audio_output_file* file)
+{
+    int offset = 0;
+
+    if (file->wav)
+    {
+        wav_convert_samples(file->mix, file->quantum_size, file->audio_output->depth);
+    }
+
+    while (file->fd >= 0 && offset < file->quantum_size)
+    {
+        int result = write(file->fd, file->mix + offset, file->quantum_size - offset);
+
+        if (result < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        else if (result < 0)
+        {
+            fprintf(stderr, "audio output write failed, discarding further output: %i\n", errno);
+            file->fd = -1;
+            break;
+        }
+
+        offset += result;
+        file->written += result;
+    }
+}
+
+static void* audio_output_file_clock(void* arg)
+{
+    struct audio_output_file* file = arg;
+    struct audio_output* audio_output = file->audio_output;
+
+    uint64_t period = (uint64_t)audio_output->buffer_size * 1000000000 / audio_output->frequency;
+    uint64_t deadline = get_time();
+
+    trace_thread_name("playback clock");
+
+    while (__atomic_load_n(&file->running, __ATOMIC_ACQUIRE))
+    {
+        deadline += period;
+        sleep_until(deadline);
+
+        memset(file->mix, 0, file->quantum_size);
+
+        pthread_mutex_lock(&file->lock);
+
+        int i;
+        for (i = 0; i < file->stream_count; i++)
+        {
+            if (i == 0)
+            {
+                audio_output_stream_process(file->streams[i], file->mix, file->quantum_size);
+            }
+            else
+            {
+                audio_output_stream_process(file->streams[i], file->scratch, file->quantum_size);
+                audio_output_file_mix(file->mix, file->scratch, file->quantum_size, audio_output->depth);
+            }
+        }
+
+        pthread_mutex_unlock(&file->lock);
+
+        audio_output_file_write(file);
+    }
+
+    return NULL;
+}
+
+static void* audio_output_file_init(struct audio_output* audio_output, const char* path)
+{
+    int result;
+
+    struct audio_output_file* file = malloc(sizeof(struct audio_output_file));
+
+    file->audio_output = audio_output;
+    file->wav = 0;
+    file->written = 0;
+    file->streams = NULL;
+    file->stream_count = 0;
+    file->quantum_size = audio_output->buffer_size * audio_output->channels * (audio_output->depth / 8);
+    file->mix = malloc(file->quantum_size);
+    file->scratch = malloc(file->quantum_size);
+    file->running = 1;
+
+    switch (audio_output->backend_type)
+    {
+    default :
+    case NETPW_AUDIO_BACKEND_NULL :
+        file->fd = -1;
+        break;
+    case NETPW_AUDIO_BACKEND_FILE :
+        if (!path)
+        {
+            fprintf(stderr, "the file audio backend requires a file.\n");
+            exit(1);
+        }
+
+        CHECK_ERRNO_FATAL(file->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644));
+        file->wav = 1;
+
+        /* rewritten with the final size on destruction */
+        unsigned char header[NETPW_WAV_HEADER_SIZE];
+        wav_write_header(header, audio_output->frequency, audio_output->channels, audio_output->depth, 0);
+        CHECK_ERRNO_FATAL(write(file->fd, header, sizeof(header)));
+        break;
+    case NETPW_AUDIO_BACKEND_STDIO :
+        /* status messages are printed to standard output so they are moved out of the way of the samples */
+        CHECK_ERRNO_FATAL(file->fd = dup(STDOUT_FILENO));
+        CHECK_ERRNO_FATAL(dup2(STDERR_FILENO, STDOUT_FILENO));
+        break;
+    }
+
+    audio_backend_catch_signals();
+
+    CHECK_ERROR_FATAL(pthread_mutex_init(&file->lock, NULL));
+    CHECK_ERROR_FATAL(pthread_create(&file->thread, NULL, audio_output_file_clock, file));
+
+    return file;
+}
+
+static void audio_output_file_run(void* backend_data)
+{
+    audio_backend_wait_for_quit();
+}
+
+static void audio_output_file_destroy(void* backend_data)
+{
+    int result;
+
+    struct audio_output_file* file = backend_data;
+
+    __atomic_store_n(&file->running, 0, __ATOMIC_RELEASE);
+    CHECK_ERROR(pthread_join(file->thread, NULL));
+
+    if (file->fd >= 0)
+    {
+        if (file->wav)
+        {
+            unsigned char header[NETPW_WAV_HEADER_SIZE];
+            wav_write_header(header, file->audio_output->frequency, file->audio_output->channels, file->audio_output->depth, file->written);
+            CHECK_ERRNO(pwrite(file->fd, header, sizeof(header), 0));
+        }
+
+        close(file->fd);
+    }
+
+    pthread_mutex_destroy(&file->lock);
+    free(file->streams);
+    free(file->mix);
+    free(file->scratch);
+    free(file);
+}
+
+static void* audio_output_file_stream_init(void* backend_data, struct audio_output_stream* stream, const char* name)
+{
+    struct audio_output_file* file = backend_data;
+
+    pthread_mutex_lock(&file->lock);
+
+    file->streams = realloc(file->streams, (file->stream_count + 1) * sizeof(struct audio_output_stream*));
+    file->streams[file->stream_count++] = stream;
+
+    pthread_mutex_unlock(&file->lock);
+
+    return stream;
+}
+
+static void audio_output_file_stream_destroy(void* backend_data, void* stream_data)
+{
+    struct audio_output_file* file = backend_data;
+
+    pthread_mutex_lock(&file->lock);
+
+    int i;
+    for (i = 0; i < file->stream_count; i++)
+    {
+        if (file->streams[i] == stream_data)
+        {
+            file->streams[i] = file->streams[--file->stream_count];
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&file->lock);
+}
+
+const struct audio_output_backend audio_output_file_backend = {
+    .init = audio_output_file_init,
+    .run = audio_output_file_run,
+    .destroy = audio_output_file_destroy,
+    .stream_init = audio_output_file_stream_init,
+    .stream_destroy = audio_output_file_stream_destroy
+};
@@ -0,0 +1,268 @@
+/*
+Copyright 2025 Amini Allight
+
+This file is part of netpw.
+
+netpw is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+netpw is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with netpw. If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "audio_output_backend.h"
+#include "packet.h"
+#include "tools.h"
+#include "constants.h"
+#include "error_handling.h"
+
+#include <stdlib.h>
+#define __LOCALE_C_ONLY
+#include <pipewire/pipewire.h>
+#include <spa/param/audio/format-utils.h>
+#include <spa/param/param.h>
+#include <spa/pod/builder.h>
+
+struct audio_output_pipewire
+{
+    struct audio_output* audio_output;
+    struct pw_thread_loop* thread_loop;
+    struct pw_context* context;
+    struct pw_core* core;
+    int quit;
+};
+
+struct audio_output_pipewire_stream
+{
+    struct audio_output_stream* stream;
+    struct pw_stream* pw_stream;
+    struct spa_hook hook;
+};
+
+static void audio_output_pipewire_process(void* userdata)
+{
+    struct audio_output_pipewire_stream* pipewire_stream = userdata;
+    struct audio_output_stream* stream = pipewire_stream->stream;
+
+    struct pw_buffer* buffer = pw_stream_dequeue_buffer(pipewire_stream->pw_stream);
+
+    if (!buffer)
+    {
+        return;
+    }
+
+    struct spa_data* data = &buffer->buffer->datas[0];
+    uint32_t frames = data->maxsize / stream->stride;
+
+    /* the graph says how much it will consume this cycle, anything more would only wait in the buffer as latency */
+    if (buffer->requested != 0 && buffer->requested < frames)
+    {
+        frames = buffer->requested;
+    }
+
+    unsigned char* out_data = data->data;
+    uint32_t out_size = frames * stream->stride;
+    data->chunk->offset = 0;
+    data->chunk->stride = stream->stride;
+    data->chunk->size = out_size;
+
+    /* the delay is how long until this quantum reaches the device */
+    struct pw_time time;
+
+    if (pw_stream_get_time_n(pipewire_stream->pw_stream, &time, sizeof(time)) == 0 && time.rate.denom != 0)
+    {
+        uint64_t playback_latency = time.delay * 1000000000 * time.rate.num / time.rate.denom;
+        __atomic_store_n(&stream->playback_latency, playback_latency, __ATOMIC_RELAXED);
+    }
+
+    audio_output_stream_process(stream, out_data, out_size);
+
+    pw_stream_queue_buffer(pipewire_stream->pw_stream, buffer);
+}
+
+/* asks for buffers holding one quantum of the requested size, which is what each packet received carries */
+static void audio_output_pipewire_param_changed(void* userdata, uint32_t id, const struct spa_pod* param)
+{
+    struct audio_output_pipewire_stream* pipewire_stream = userdata;
+    struct audio_output_stream* stream = pipewire_stream->stream;
+
+    /* a null format means the stream was disconnected and there is nothing to negotiate */
+    if (id != SPA_PARAM_Format || !param)
+    {
+        return;
+    }
+
+    int max_size = ((NETPW_PACKET_MAX_SIZE - NETPW_PACKET_HEADER_SIZE) / stream->stride) * stream->stride;
+
+    unsigned char buffer[1024];
+    struct spa_pod_builder builder = SPA_POD_BUILDER_INIT(buffer, sizeof(buffer));
+
+    const struct spa_pod* params[1];
+
+    params[0] = spa_pod_builder_add_object(
+        &builder,
+        SPA_TYPE_OBJECT_ParamBuffers, SPA_PARAM_Buffers,
+        SPA_PARAM_BUFFERS_buffers, SPA_POD_CHOICE_RANGE_Int(NETPW_PIPEWIRE_BUFFER_COUNT, 1, NETPW_PIPEWIRE_BUFFER_COUNT),
+        SPA_PARAM_BUFFERS_blocks, SPA_POD_Int(1),
+        SPA_PARAM_BUFFERS_size, SPA_POD_CHOICE_RANGE_Int(min(stream->audio_output->buffer_size * stream->stride, max_size), stream->stride, max_size),
+        SPA_PARAM_BUFFERS_stride, SPA_POD_Int(stream->stride)
+    );
+
+    pw_stream_update_params(pipewire_stream->pw_stream, params, 1);
+}
+
+static struct pw_stream_events stream_listener = {
+    .version = PW_VERSION_STREAM_EVENTS,
+    .param_changed = audio_output_pipewire_param_changed,
+    .process = audio_output_pipewire_process
+};
+
+static void on_quit(void* userdata, int signal)
+{
+    struct audio_output_pipewire* pipewire = userdata;
+    pipewire->quit = 1;
+    pw_thread_loop_signal(pipewire->thread_loop, false);
+}
+
+static void* audio_output_pipewire_init(struct audio_output* audio_output, const char* path)
+{
+    int result;
+
+    struct audio_output_pipewire* pipewire = malloc(sizeof(struct audio_output_pipewire));
+
+    pipewire->audio_output = audio_output;
+    pipewire->quit = 0;
+
+    pw_init(0, NULL);
+
+    CHECK_POINTER_FATAL(pipewire->thread_loop = pw_thread_loop_new(NETPW_PROGRAM_NAME, NULL));
+    pw_loop_add_signal(pw_thread_loop_get_loop(pipewire->thread_loop), SIGINT, on_quit, pipewire);
+    pw_loop_add_signal(pw_thread_loop_get_loop(pipewire->thread_loop), SIGTERM, on_quit, pipewire);
+
+    CHECK_POINTER_FATAL(pipewire->context = pw_context_new(pw_thread_loop_get_loop(pipewire->thread_loop), NULL, 0));
+
+    pw_thread_loop_lock(pipewire->thread_loop);
+
+    CHECK_ERROR_FATAL(pw_thread_loop_start(pipewire->thread_loop));
+
+    CHECK_POINTER_FATAL(pipewire->core = pw_context_connect(pipewire->context, NULL, 0));
+
+    pw_thread_loop_unlock(pipewire->thread_loop);
+
+    return pipewire;
+}
+
+static void audio_output_pipewire_run(void* backend_data)
+{
+    struct audio_output_pipewire* pipewire = backend_data;
+
+    pw_thread_loop_lock(pipewire->thread_loop);
+
+    while (!pipewire->quit)
+    {
+        pw_thread_loop_wait(pipewire->thread_loop);
+    }
+
+    pw_thread_loop_unlock(pipewire->thread_loop);
+}
+
+static void audio_output_pipewire_destroy(void* backend_data)
+{
+    struct audio_output_pipewire* pipewire = backend_data;
+
+    pw_thread_loop_stop(pipewire->thread_loop);
+    pw_core_disconnect(pipewire->core);
+    pw_context_destroy(pipewire->context);
+    pw_thread_loop_destroy(pipewire->thread_loop);
+    pw_deinit();
+    free(pipewire);
+}
+
+static void* audio_output_pipewire_stream_init(void* backend_data, struct audio_output_stream* stream, const char* name)
+{
+    int result;
+
+    struct audio_output_pipewire* pipewire = backend_data;
+    struct audio_output* audio_output = pipewire->audio_output;
+
+    struct audio_output_pipewire_stream* pipewire_stream = malloc(sizeof(struct audio_output_pipewire_stream));
+
+    pipewire_stream->stream = stream;
+
+    unsigned char buffer[1024];
+    struct spa_pod_builder builder = SPA_POD_BUILDER_INIT(buffer, sizeof(buffer));
+
+    struct spa_audio_info_raw info = {
+        .format = identify_spa_format(audio_output->depth),
+        .rate = audio_output->frequency,
+        .channels = audio_output->channels
+    };
+
+    const struct spa_pod* format = spa_format_audio_raw_build(
+        &builder,
+        SPA_PARAM_EnumFormat,
+        &info
+    );
+
+    struct pw_properties* properties = pw_properties_new(
+        PW_KEY_MEDIA_TYPE, "Audio",
+        PW_KEY_MEDIA_CATEGORY, "Playback",
+        PW_KEY_MEDIA_ROLE, "Network",
+        PW_KEY_APP_NAME, NETPW_PROGRAM_NAME,
+        PW_KEY_APP_ID, NETPW_PROGRAM_NAME,
+        PW_KEY_NODE_NAME, name,
+        PW_KEY_NODE_DESCRIPTION, name,
+        NULL
+    );
+
+    pw_properties_setf(properties, PW_KEY_NODE_LATENCY, "%u/%u", audio_output->buffer_size, audio_output->frequency);
+    pw_properties_setf(properties, PW_KEY_NODE_RATE, "1/%u", audio_output->frequency);
+
+    pw_thread_loop_lock(pipewire->thread_loop);
+
+    CHECK_POINTER_FATAL(pipewire_stream->pw_stream = pw_stream_new(pipewire->core, NETPW_PROGRAM_NAME, properties));
+
+    pw_stream_add_listener(pipewire_stream->pw_stream, &pipewire_stream->hook, &stream_listener, pipewire_stream);
+
+    CHECK_ERROR_FATAL(pw_stream_connect(
+        pipewire_stream->pw_stream,
+        PW_DIRECTION_OUTPUT,
+        PW_ID_ANY,
+        PW_STREAM_FLAG_AUTOCONNECT | PW_STREAM_FLAG_MAP_BUFFERS | PW_STREAM_FLAG_RT_PROCESS,
+        &format,
+        1
+    ));
+
+    pw_thread_loop_unlock(pipewire->thread_loop);
+
+    return pipewire_stream;
+}
+
+static void audio_output_pipewire_stream_destroy(void* backend_data, void* stream_data)
+{
+    struct audio_output_pipewire* pipewire = backend_data;
+    struct audio_output_pipewire_stream* pipewire_stream = stream_data;
+
+    pw_thread_loop_lock(pipewire->thread_loop);
+
+    pw_stream_disconnect(pipewire_stream->pw_stream);
+    pw_stream_destroy(pipewire_stream->pw_stream);
+
+    pw_thread_loop_unlock(pipewire->thread_loop);
+
+    free(pipewire_stream);
+}
+
+const struct audio_output_backend audio_output_pipewire_backend = {
+    .init = audio_output_pipewire_init,
+    .run = audio_output_pipewire_run,
+    .destroy = audio_output_pipewire_destroy,
+    .stream_init = audio_output_pipewire_stream_init,
+    .stream_destroy = audio_output_pipewire_stream_destroy
+};
@@ -0,0 +1,263 @@
+/*
+Copyright 2025 Amini Allight
+
+This file is part of netpw.
+
+netpw is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+netpw is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with netpw. If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "audio_output_backend.h"
+#include "sample_format.h"
+#include "tools.h"
+#include "constants.h"
+#include "error_handling.h"
+
+#include <stdlib.h>
+#define __LOCALE_C_ONLY
+#include <pipewire/pipewire.h>
+
+/*
+ * each stream is a filter node with one 32 bit float port per channel, driven directly by the graph without an adapter after it
+ * the wire format is unpacked into the ports here instead of by PipeWire's converter
+ */
+struct audio_output_pipewire_dsp
+{
+    struct audio_output* audio_output;
+    struct pw_thread_loop* thread_loop;
+    struct pw_context* context;
+    struct pw_core* core;
+    int quit;
+};
+
+struct audio_output_pipewire_dsp_stream
+{
+    struct audio_output_stream* stream;
+    struct pw_filter* filter;
+    struct spa_hook hook;
+    void** ports;
+    float** buffers;
+    float* discard;
+    unsigned char* data;
+};
+
+static void audio_output_pipewire_dsp_process(void* userdata, struct spa_io_position* position)
+{
+    struct audio_output_pipewire_dsp_stream* pipewire_stream = userdata;
+    struct audio_output_stream* stream = pipewire_stream->stream;
+    struct audio_output* audio_output = stream->audio_output;
+
+    if (!position)
+    {
+        return;
+    }
+
+    int frames = position->clock.duration;
+
+    /* the delay is how long until this quantum reaches the device, negative for playback */
+    if (position->clock.rate.denom != 0)
+    {
+        int64_t delay = position->clock.delay < 0 ? -position->clock.delay : position->clock.delay;
+        uint64_t playback_latency = delay * 1000000000 * position->clock.rate.num / position->clock.rate.denom;
+        __atomic_store_n(&stream->playback_latency, playback_latency, __ATOMIC_RELAXED);
+    }
+
+    int c;
+    for (c = 0; c < audio_output->channels; c++)
+    {
+        pipewire_stream->buffers[c] = pw_filter_get_dsp_buffer(pipewire_stream->ports[c], frames);
+    }
+
+    int offset = 0;
+
+    while (offset < frames)
+    {
+        int size = min(frames - offset, NETPW_DSP_MAX_QUANTUM);
+
+        float* planes[audio_output->channels];
+
+        for (c = 0; c < audio_output->channels; c++)
+        {
+            /* ports without a buffer still consume their channel so the others stay in step */
+            planes[c] = pipewire_stream->buffers[c] ? pipewire_stream->buffers[c] + offset : pipewire_stream->discard;
+        }
+
+        audio_output_stream_process(stream, pipewire_stream->data, size * stream->stride);
+
+        sample_format_unpack(pipewire_stream->data, audio_output->channels, size, audio_output->depth, planes);
+
+        offset += size;
+    }
+}
+
+static struct pw_filter_events filter_listener = {
+    .version = PW_VERSION_FILTER_EVENTS,
+    .process = audio_output_pipewire_dsp_process
+};
+
+static void on_quit(void* userdata, int signal)
+{
+    struct audio_output_pipewire_dsp* pipewire = userdata;
+    pipewire->quit = 1;
+    pw_thread_loop_signal(pipewire->thread_loop, false);
+}
+
+static void* audio_output_pipewire_dsp_init(struct audio_output* audio_output, const char* path)
+{
+    int result;
+
+    struct audio_output_pipewire_dsp* pipewire = malloc(sizeof(struct audio_output_pipewire_dsp));
+
+    pipewire->audio_output = audio_output;
+    pipewire->quit = 0;
+
+    pw_init(0, NULL);
+
+    CHECK_POINTER_FATAL(pipewire->thread_loop = pw_thread_loop_new(NETPW_PROGRAM_NAME, NULL));
+    pw_loop_add_signal(pw_thread_loop_get_loop(pipewire->thread_loop), SIGINT, on_quit, pipewire);
+    pw_loop_add_signal(pw_thread_loop_get_loop(pipewire->thread_loop), SIGTERM, on_quit, pipewire);
+
+    CHECK_POINTER_FATAL(pipewire->context = pw_context_new(pw_thread_loop_get_loop(pipewire->thread_loop), NULL, 0));
+
+    pw_thread_loop_lock(pipewire->thread_loop);
+
+    CHECK_ERROR_FATAL(pw_thread_loop_start(pipewire->thread_loop));
+
+    CHECK_POINTER_FATAL(pipewire->core = pw_context_connect(pipewire->context, NULL, 0));
+
+    pw_thread_loop_unlock(pipewire->thread_loop);
+
+    return pipewire;
+}
+
+static void audio_output_pipewire_dsp_run(void* backend_data)
+{
+    struct audio_output_pipewire_dsp* pipewire = backend_data;
+
+    pw_thread_loop_lock(pipewire->thread_loop);
+
+    while (!pipewire->quit)
+    {
+        pw_thread_loop_wait(pipewire->thread_loop);
+    }
+
+    pw_thread_loop_unlock(pipewire->thread_loop);
+}
+
+static void audio_output_pipewire_dsp_destroy(void* backend_data)
+{
+    struct audio_output_pipewire_dsp* pipewire = backend_data;
+
+    pw_thread_loop_stop(pipewire->thread_loop);
+    pw_core_disconnect(pipewire->core);
+    pw_context_destroy(pipewire->context);
+    pw_thread_loop_destroy(pipewire->thread_loop);
+    pw_deinit();
+    free(pipewire);
+}
+
+static void* audio_output_pipewire_dsp_stream_init(void* backend_data, struct audio_output_stream* stream, const char* name)
+{
+    int result;
+
+    struct audio_output_pipewire_dsp* pipewire = backend_data;
+    struct audio_output* audio_output = pipewire->audio_output;
+
+    struct audio_output_pipewire_dsp_stream* pipewire_stream = malloc(sizeof(struct audio_output_pipewire_dsp_stream));
+
+    pipewire_stream->stream = stream;
+    pipewire_stream->ports = malloc(audio_output->channels * sizeof(void*));
+    pipewire_stream->buffers = malloc(audio_output->channels * sizeof(float*));
+    pipewire_stream->discard = malloc(NETPW_DSP_MAX_QUANTUM * sizeof(float));
+    pipewire_stream->data = malloc(NETPW_DSP_MAX_QUANTUM * stream->stride);
+
+    /* the media class lets the session manager link the ports by channel position like it would a stream */
+    struct pw_properties* properties = pw_properties_new(
+        PW_KEY_MEDIA_TYPE, "Audio",
+        PW_KEY_MEDIA_CATEGORY, "Playback",
+        PW_KEY_MEDIA_ROLE, "Network",
+        PW_KEY_MEDIA_CLASS, "Stream/Output/Audio",
+        PW_KEY_APP_NAME, NETPW_PROGRAM_NAME,
+        PW_KEY_APP_ID, NETPW_PROGRAM_NAME,
+        PW_KEY_NODE_NAME, name,
+        PW_KEY_NODE_DESCRIPTION, name,
+        NULL
+    );
+
+    pw_properties_setf(properties, PW_KEY_NODE_LATENCY, "%u/%u", audio_output->buffer_size, audio_output->frequency);
+    pw_properties_setf(properties, PW_KEY_NODE_RATE, "1/%u", audio_output->frequency);
+
+    pw_thread_loop_lock(pipewire->thread_loop);
+
+    CHECK_POINTER_FATAL(pipewire_stream->filter = pw_filter_new(pipewire->core, NETPW_PROGRAM_NAME, properties));
+
+    pw_filter_add_listener(pipewire_stream->filter, &pipewire_stream->hook, &filter_listener, pipewire_stream);
+
+    int c;
+    for (c = 0; c < audio_output->channels; c++)
+    {
+        char position[16];
+        identify_channel_position(audio_output->channels, c, position, sizeof(position));
+
+        struct pw_properties* port_properties = pw_properties_new(
+            PW_KEY_FORMAT_DSP, "32 bit float mono audio",
+            PW_KEY_AUDIO_CHANNEL, position,
+            NULL
+        );
+
+        pw_properties_setf(port_properties, PW_KEY_PORT_NAME, "output_%s", position);
+
+        CHECK_POINTER_FATAL(pipewire_stream->ports[c] = pw_filter_add_port(
+            pipewire_stream->filter,
+            PW_DIRECTION_OUTPUT,
+            PW_FILTER_PORT_FLAG_MAP_BUFFERS,
+            0,
+            port_properties,
+            NULL,
+            0
+        ));
+    }
+
+    CHECK_ERROR_FATAL(pw_filter_connect(pipewire_stream->filter, PW_FILTER_FLAG_RT_PROCESS, NULL, 0));
+
+    pw_thread_loop_unlock(pipewire->thread_loop);
+
+    return pipewire_stream;
+}
+
+static void audio_output_pipewire_dsp_stream_destroy(void* backend_data, void* stream_data)
+{
+    struct audio_output_pipewire_dsp* pipewire = backend_data;
+    struct audio_output_pipewire_dsp_stream* pipewire_stream = stream_data;
+
+    pw_thread_loop_lock(pipewire->thread_loop);
+
+    /* the ports belong to the filter */
+    pw_filter_disconnect(pipewire_stream->filter);
+    pw_filter_destroy(pipewire_stream->filter);
+
+    pw_thread_loop_unlock(pipewire->thread_loop);
+
+    free(pipewire_stream->data);
+    free(pipewire_stream->discard);
+    free(pipewire_stream->buffers);
+    free(pipewire_stream->ports);
+    free(pipewire_stream);
+}
+
+const struct audio_output_backend audio_output_pipewire_dsp_backend = {
+    .init = audio_output_pipewire_dsp_init,
+    .run = audio_output_pipewire_dsp_run,
+    .destroy = audio_output_pipewire_dsp_destroy,
+    .stream_init = audio_output_pipewire_dsp_stream_init,
+    .stream_destroy = audio_output_pipewire_dsp_stream_destroy
+};
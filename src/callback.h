@@ -19,6 +19,11 @@ along with netpw. If not, see <https://www.gnu.org/licenses/>.
 #ifndef NETPW_CALLBACK_H
 #define NETPW_CALLBACK_H
 
-typedef void (*on_data_callback)(const unsigned char*, int);
+typedef void (*on_data_callback)(void*, const unsigned char*, int);
+typedef void (*on_packet_callback)(void*, int, const unsigned char*, int);
+
+/* returns the userdata passed to the data callback for this connection */
+typedef void* (*on_connect_callback)(void*, const char*);
+typedef void (*on_disconnect_callback)(void*, void*);
 
 #endif
@@ -19,12 +19,24 @@ along with netpw. If not, see <https://www.gnu.org/licenses/>.
 #include "client.h"
 #include "error_handling.h"
 #include "constants.h"
+#include "packet.h"
+#include "metrics.h"
+#include "clock_sync.h"
+#include "rate_control.h"
+#include "trace.h"
+#include "tools.h"
+#include "transport.h"
+#include "tcp_tuning.h"
 
 #include <unistd.h>
 #include <stdlib.h>
+#include <string.h>
 #include <arpa/inet.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <sys/un.h>
+#include <linux/sockios.h>
 #include <netdb.h>
 #include <pthread.h>
 #include <openssl/bio.h>
@@ -34,36 +46,129 @@ along with netpw. If not, see <https://www.gnu.org/licenses/>.
 struct client
 {
     SSL_CTX* ssl_context;
-    SSL* ssl;
+    struct transport* transport;
     int socket;
     unsigned char buffer[NETPW_IO_BUFFER_SIZE];
-    on_data_callback callback;
+    struct packet_reader* reader;
+    on_packet_callback callback;
+    void* userdata;
+    struct clock_sync* clock_sync;
+    /* only used by the receive thread, the estimate is copied to available_rate for other threads */
+    struct rate_control* rate_control;
+    uint64_t available_rate;
+    pthread_mutex_t write_lock;
+    /* only used with the write lock held */
+    struct send_budget* send_budget;
+    unsigned char* send_buffer;
+    int send_buffer_size;
     pthread_t thread;
+    struct metric* sent_metric;
+    struct metric* received_metric;
+    struct metric* write_failure_metric;
+    struct metric* backlog_metric;
+    struct metric* rtt_metric;
+    struct metric* available_rate_metric;
+    struct metric* dropped_metric;
 };
 
+static void client_on_packet(void* userdata, int type, const unsigned char* data, int size)
+{
+    struct client* client = userdata;
+
+    uint64_t now = get_time();
+
+    switch (type)
+    {
+    case NETPW_PACKET_PING :
+        if (size == NETPW_PACKET_PING_SIZE)
+        {
+            unsigned char pong[NETPW_PACKET_PONG_SIZE];
+            memcpy(pong, data, NETPW_PACKET_PING_SIZE);
+            packet_write_u64(pong + NETPW_PACKET_PING_SIZE, now);
+
+            client_send(client, NETPW_PACKET_PONG, pong, sizeof(pong));
+        }
+        break;
+    case NETPW_PACKET_PONG :
+        if (size == NETPW_PACKET_PONG_SIZE)
+        {
+            clock_sync_update(client->clock_sync, packet_read_u64(data), packet_read_u64(data + 8), now);
+            metric_set(client->rtt_metric, clock_sync_rtt(client->clock_sync) / 1000);
+
+            client->callback(client->userdata, type, data, size);
+        }
+        break;
+    case NETPW_PACKET_TIMESTAMP :
+        if (size == NETPW_PACKET_TIMESTAMP_SIZE && clock_sync_ready(client->clock_sync))
+        {
+            unsigned char timestamp[NETPW_PACKET_LOCAL_TIMESTAMP_SIZE];
+            clock_sync_localize_timestamp(client->clock_sync, data, timestamp, now);
+
+            client->callback(client->userdata, type, timestamp, sizeof(timestamp));
+        }
+        break;
+    case NETPW_PACKET_REPORT :
+        if (size == NETPW_PACKET_REPORT_SIZE)
+        {
+            int backlog = 0;
+            ioctl(client->socket, SIOCOUTQ, &backlog);
+
+            uint64_t rtt = clock_sync_ready(client->clock_sync) ? clock_sync_rtt(client->clock_sync) : 0;
+            uint64_t rate = rate_control_update(client->rate_control, data, backlog, rtt);
+
+            __atomic_store_n(&client->available_rate, rate, __ATOMIC_RELAXED);
+            metric_set(client->available_rate_metric, rate);
+
+            client->callback(client->userdata, type, data, size);
+        }
+        break;
+    default :
+        client->callback(client->userdata, type, data, size);
+        break;
+    }
+
+    if (clock_sync_ping_due(client->clock_sync, now))
+    {
+        unsigned char ping[NETPW_PACKET_PING_SIZE];
+        packet_write_u64(ping, now);
+
+        client_send(client, NETPW_PACKET_PING, ping, sizeof(ping));
+    }
+
+    unsigned char report[NETPW_PACKET_REPORT_SIZE];
+
+    if (rate_control_report_due(client->rate_control, now, report))
+    {
+        client_send(client, NETPW_PACKET_REPORT, report, sizeof(report));
+    }
+}
+
 static void* client_receive(void* arg)
 {
     struct client* client = arg;
 
     int result;
 
+    trace_thread_name("client receive");
+
     while (1)
     {
-        result = SSL_read(client->ssl, client->buffer, NETPW_IO_BUFFER_SIZE);
+        result = transport_read(client->transport, client->buffer, NETPW_IO_BUFFER_SIZE);
 
         if (result <= 0)
         {
-            if (!BIO_should_retry(SSL_get_rbio(client->ssl)))
-            {
-                break;
-            }
-            else
-            {
-                continue;
-            }
+            break;
         }
 
-        client->callback(client->buffer, result);
+        metric_add(client->received_metric, result);
+        rate_control_receive(client->rate_control, result);
+        TRACE_COUNTER("transport read bytes", result);
+
+        if (packet_reader_feed(client->reader, client->buffer, result))
+        {
+            fprintf(stderr, "received malformed packet.\n");
+            break;
+        }
     }
 
     printf("disconnected.\n");
@@ -71,18 +176,44 @@ static void* client_receive(void* arg)
     return NULL;
 }
 
-struct client* client_init(
-    const char* host,
-    unsigned short port,
-    const char* ca_certificate,
-    const char* certificate,
-    const char* private_key,
-    on_data_callback callback
-)
+/* everything after the connection is up is the same for either kind */
+static void client_start(struct client* client, on_packet_callback callback, void* userdata)
 {
     int result;
 
-    struct client* client = malloc(sizeof(struct client));
+    client->reader = packet_reader_init(client_on_packet, client);
+    client->callback = callback;
+    client->userdata = userdata;
+    client->clock_sync = clock_sync_init();
+    client->rate_control = rate_control_init();
+    client->available_rate = 0;
+    CHECK_ERROR_FATAL(pthread_mutex_init(&client->write_lock, NULL));
+    client->send_buffer = NULL;
+    client->send_buffer_size = 0;
+    client->sent_metric = metric_counter_init("netpw_server_sent_bytes_total", "Bytes sent to the server, including framing.", NULL);
+    client->received_metric = metric_counter_init("netpw_server_received_bytes_total", "Bytes received from the server, including framing.", NULL);
+    client->write_failure_metric = metric_counter_init("netpw_server_write_failures_total", "Writes to the server that failed.", NULL);
+    client->backlog_metric = metric_gauge_init("netpw_server_send_backlog_bytes", "Bytes sent to the server that the kernel has not yet had acknowledged.", NULL);
+    client->rtt_metric = metric_gauge_init("netpw_server_rtt_microseconds", "Latest round trip time to the server.", NULL);
+    client->available_rate_metric = metric_gauge_init("netpw_server_available_bits_per_second", "Estimated rate the connection to the server can carry.", NULL);
+    client->dropped_metric = metric_counter_init("netpw_server_dropped_bytes_total", "Audio not sent to the server because the connection was over the latency budget.", NULL);
+
+    /* further pings are sent as packets arrive */
+    uint64_t now = get_time();
+    clock_sync_ping_due(client->clock_sync, now);
+
+    unsigned char ping[NETPW_PACKET_PING_SIZE];
+    packet_write_u64(ping, now);
+    client_send(client, NETPW_PACKET_PING, ping, sizeof(ping));
+
+    CHECK_ERROR_FATAL(pthread_create(&client->thread, NULL, client_receive, client));
+}
+
+SSL_CTX* client_context_init(const char* ca_certificate, const char* certificate, const char* private_key, enum crypto_profile profile)
+{
+    int result;
+
+    SSL_CTX* context;
 
     SSL_load_error_strings();
     ERR_load_crypto_strings();
@@ -92,10 +223,12 @@ struct client* client_init(
 
     CHECK_POINTER_FATAL(method = TLS_client_method());
 
-    CHECK_POINTER_FATAL(client->ssl_context = SSL_CTX_new(method));
+    CHECK_POINTER_FATAL(context = SSL_CTX_new(method));
+
+    SSL_CTX_set_min_proto_version(context, TLS1_3_VERSION);
+    SSL_CTX_set_max_proto_version(context, 0);
 
-    SSL_CTX_set_min_proto_version(client->ssl_context, TLS1_3_VERSION);
-    SSL_CTX_set_max_proto_version(client->ssl_context, 0);
+    transport_configure(context, profile, 0);
 
     if (ca_certificate)
     {
@@ -111,11 +244,11 @@ struct client* client_init(
 
         CHECK_OK(X509_STORE_add_cert(store, certificate_object));
 
-        SSL_CTX_set_cert_store(client->ssl_context, store);
+        SSL_CTX_set_cert_store(context, store);
 
-        SSL_CTX_set_verify(client->ssl_context, SSL_VERIFY_PEER, NULL);
+        SSL_CTX_set_verify(context, SSL_VERIFY_PEER, NULL);
 
-        SSL_CTX_set_verify_depth(client->ssl_context, 1);
+        SSL_CTX_set_verify_depth(context, 1);
     }
 
     if (certificate && private_key)
@@ -127,7 +260,7 @@ struct client* client_init(
         CHECK_POINTER_FATAL(certificate_object = PEM_read_bio_X509(certificate_reader, NULL, NULL, 0));
         BIO_free_all(certificate_reader);
 
-        CHECK_OK_FATAL(SSL_CTX_use_certificate(client->ssl_context, certificate_object));
+        CHECK_OK_FATAL(SSL_CTX_use_certificate(context, certificate_object));
         X509_free(certificate_object);
 
         BIO* private_key_reader;
@@ -137,16 +270,46 @@ struct client* client_init(
         CHECK_POINTER_FATAL(private_key_object = PEM_read_bio_PrivateKey(private_key_reader, NULL, NULL, 0));
         BIO_free_all(private_key_reader);
 
-        CHECK_OK_FATAL(SSL_CTX_use_PrivateKey(client->ssl_context, private_key_object));
+        CHECK_OK_FATAL(SSL_CTX_use_PrivateKey(context, private_key_object));
         EVP_PKEY_free(private_key_object);
 
-        CHECK_OK_FATAL(SSL_CTX_check_private_key(client->ssl_context));
+        CHECK_OK_FATAL(SSL_CTX_check_private_key(context));
     }
 
-    CHECK_POINTER_FATAL(client->ssl = SSL_new(client->ssl_context));
+    return context;
+}
+
+struct client* client_init(
+    const char* host,
+    unsigned short port,
+    const char* ca_certificate,
+    const char* certificate,
+    const char* private_key,
+    enum crypto_profile profile,
+    const struct tcp_options* tcp,
+    on_packet_callback callback,
+    void* userdata
+)
+{
+    int result;
+
+    struct client* client = malloc(sizeof(struct client));
+
+    client->ssl_context = client_context_init(ca_certificate, certificate, private_key, profile);
 
     CHECK_ERRNO_FATAL(client->socket = socket(AF_INET, SOCK_STREAM, 0));
 
+    struct tcp_options default_tcp;
+
+    if (!tcp)
+    {
+        tcp_options_default(&default_tcp);
+        tcp = &default_tcp;
+    }
+
+    tcp_configure(client->socket, tcp);
+    client->send_budget = send_budget_init(client->socket, tcp->latency_budget);
+
     struct addrinfo* info = NULL;
 
     char port_string[6] = {0};
@@ -156,43 +319,155 @@ struct client* client_init(
     CHECK_ERRNO_FATAL(connect(client->socket, info->ai_addr, info->ai_addrlen));
     freeaddrinfo(info);
 
-    CHECK_OK_FATAL(SSL_set_fd(client->ssl, client->socket));
-    CHECK_SSL_FATAL(SSL_connect(client->ssl), client->ssl);
-    CHECK_SSL_FATAL(SSL_do_handshake(client->ssl), client->ssl);
+    CHECK_POINTER_FATAL(client->transport = transport_connect(client->ssl_context, client->socket, profile));
 
-    if (ca_certificate)
+    SSL* ssl = transport_ssl(client->transport);
+
+    if (ca_certificate && ssl)
     {
         X509* remote_certificate = NULL;
-        CHECK_POINTER_FATAL(remote_certificate = SSL_get1_peer_certificate(client->ssl));
+        CHECK_POINTER_FATAL(remote_certificate = SSL_get1_peer_certificate(ssl));
         X509_free(remote_certificate);
 
-        CHECK_ERROR_FATAL(SSL_get_verify_result(client->ssl));
+        CHECK_ERROR_FATAL(SSL_get_verify_result(ssl));
     }
 
-    printf("connected to [%s]:%i.\n", host, port);
+    printf("connected to [%s]:%i using %s.\n", host, port, transport_description(client->transport));
 
-    client->callback = callback;
+    client_start(client, callback, userdata);
 
-    CHECK_ERROR_FATAL(pthread_create(&client->thread, NULL, client_receive, client));
+    return client;
+}
+
+struct client* client_init_local(const char* path, on_packet_callback callback, void* userdata)
+{
+    int result;
+
+    struct client* client = malloc(sizeof(struct client));
+
+    client->ssl_context = NULL;
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "local socket path %s is too long.\n", path);
+        exit(1);
+    }
+
+    strcpy(addr.sun_path, path);
+
+    CHECK_ERRNO_FATAL(client->socket = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0));
+    CHECK_ERRNO_FATAL(connect(client->socket, (struct sockaddr*)&addr, sizeof(addr)));
+
+    /* nothing queues between processes on one host */
+    client->send_budget = send_budget_init(client->socket, 0);
+
+    CHECK_POINTER_FATAL(client->transport = transport_local_connect(client->socket));
+
+    printf("connected to %s using %s.\n", path, transport_description(client->transport));
+
+    client_start(client, callback, userdata);
 
     return client;
 }
 
-void client_send(struct client* client, const unsigned char* data, int size)
+int client_socket(struct client* client)
+{
+    return client->socket;
+}
+
+uint64_t client_available_rate(struct client* client)
+{
+    return __atomic_load_n(&client->available_rate, __ATOMIC_RELAXED);
+}
+
+static void client_write(struct client* client, int type, const unsigned char* data, int size, int droppable)
 {
     int result;
 
-    CHECK_SSL(SSL_write(client->ssl, data, size), client->ssl);
+    /* pongs are sent from the receive thread */
+    pthread_mutex_lock(&client->write_lock);
+
+    uint64_t now = get_time();
+
+    if (droppable && send_budget_exceeded(client->send_budget, now))
+    {
+        metric_add(client->dropped_metric, NETPW_PACKET_HEADER_SIZE + size);
+        pthread_mutex_unlock(&client->write_lock);
+        return;
+    }
+
+    if (client->send_buffer_size < NETPW_PACKET_HEADER_SIZE + size)
+    {
+        client->send_buffer_size = NETPW_PACKET_HEADER_SIZE + size;
+        client->send_buffer = realloc(client->send_buffer, client->send_buffer_size);
+    }
+
+    int packet_size = packet_encode(client->send_buffer, type, data, size);
+
+    TRACE_BEGIN("transport write");
+    result = transport_write(client->transport, client->send_buffer, packet_size);
+    TRACE_END("transport write");
+
+    send_budget_written(client->send_budget, now);
+
+    if (result > 0)
+    {
+        metric_add(client->sent_metric, result);
+    }
+    else
+    {
+        metric_add(client->write_failure_metric, 1);
+    }
+
+    if (metrics_enabled())
+    {
+        int backlog;
+
+        if (ioctl(client->socket, SIOCOUTQ, &backlog) == 0)
+        {
+            metric_set(client->backlog_metric, backlog);
+        }
+    }
+
+    pthread_mutex_unlock(&client->write_lock);
+}
+
+void client_send(struct client* client, int type, const unsigned char* data, int size)
+{
+    client_write(client, type, data, size, 0);
+}
+
+void client_send_droppable(struct client* client, int type, const unsigned char* data, int size)
+{
+    client_write(client, type, data, size, 1);
 }
 
 void client_destroy(struct client* client)
 {
     int result;
 
-    CHECK_ERRNO(close(client->socket));
+    /* closing alone doesn't wake the receive thread, this fails harmlessly if the peer already left */
+    shutdown(client->socket, SHUT_RDWR);
     CHECK_ERROR(pthread_join(client->thread, NULL));
-    CHECK_SSL(SSL_shutdown(client->ssl), client->ssl);
-    SSL_free(client->ssl);
+    transport_destroy(client->transport);
+    CHECK_ERRNO(close(client->socket));
     SSL_CTX_free(client->ssl_context);
+    packet_reader_destroy(client->reader);
+    clock_sync_destroy(client->clock_sync);
+    rate_control_destroy(client->rate_control);
+    send_budget_destroy(client->send_budget);
+    CHECK_ERROR(pthread_mutex_destroy(&client->write_lock));
+    free(client->send_buffer);
+    metric_destroy(client->sent_metric);
+    metric_destroy(client->received_metric);
+    metric_destroy(client->write_failure_metric);
+    metric_destroy(client->backlog_metric);
+    metric_destroy(client->rtt_metric);
+    metric_destroy(client->available_rate_metric);
+    metric_destroy(client->dropped_metric);
     free(client);
 }
@@ -20,7 +20,12 @@ along with netpw. If not, see <https://www.gnu.org/licenses/>.
 #define NETPW_CLIENT_H
 
 #include "callback.h"
+#include "transport.h"
+#include "tcp_tuning.h"
 
+#include <stdint.h>
+
+/* pongs and reports reach the callback after the client has used them, so that they can be measured as well */
 struct client;
 
 struct client* client_init(
@@ -29,9 +34,23 @@ struct client* client_init(
     const char* ca_certificate,
     const char* certificate,
     const char* private_key,
-    on_data_callback callback
+    enum crypto_profile profile,
+    /* NULL for the defaults */
+    const struct tcp_options* tcp,
+    on_packet_callback callback,
+    void* userdata
 );
-void client_send(struct client* client, const unsigned char* data, int size);
+/* the TLS context client_init connects with, shared by netpw loadtest across its connections */
+SSL_CTX* client_context_init(const char* ca_certificate, const char* certificate, const char* private_key, enum crypto_profile profile);
+/* connects to the Unix socket of a server on the same host and exchanges audio through shared memory instead of TLS */
+struct client* client_init_local(const char* path, on_packet_callback callback, void* userdata);
+/* the TCP socket, or the Unix socket of a local client */
+int client_socket(struct client* client);
+/* estimated from the server's reports in bits per second, zero until there is an estimate */
+uint64_t client_available_rate(struct client* client);
+void client_send(struct client* client, int type, const unsigned char* data, int size);
+/* like client_send, but skipped while the connection is over its latency budget */
+void client_send_droppable(struct client* client, int type, const unsigned char* data, int size);
 void client_destroy(struct client* client);
 
 #endif
@@ -0,0 +1,125 @@
+/*
+Copyright 2025 Amini Allight
+
+This file is part of netpw.
+
+netpw is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+netpw is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with netpw. If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "clock_sync.h"
+#include "constants.h"
+#include "packet.h"
+
+#include <stdlib.h>
+
+struct clock_sample
+{
+    int64_t offset;
+    uint64_t rtt;
+};
+
+struct clock_sync
+{
+    struct clock_sample samples[NETPW_CLOCK_SAMPLE_COUNT];
+    int sample_count;
+    int next_sample;
+    int64_t offset;
+    uint64_t rtt;
+    uint64_t last_ping;
+};
+
+struct clock_sync* clock_sync_init()
+{
+    struct clock_sync* sync = malloc(sizeof(struct clock_sync));
+
+    sync->sample_count = 0;
+    sync->next_sample = 0;
+    sync->offset = 0;
+    sync->rtt = 0;
+    sync->last_ping = 0;
+
+    return sync;
+}
+
+void clock_sync_destroy(struct clock_sync* sync)
+{
+    free(sync);
+}
+
+int clock_sync_ping_due(struct clock_sync* sync, uint64_t now)
+{
+    if (now - sync->last_ping < NETPW_PING_INTERVAL)
+    {
+        return 0;
+    }
+
+    sync->last_ping = now;
+
+    return 1;
+}
+
+void clock_sync_update(struct clock_sync* sync, uint64_t ping_sent, uint64_t ping_received, uint64_t pong_received)
+{
+    struct clock_sample* sample = &sync->samples[sync->next_sample];
+
+    sample->rtt = pong_received - ping_sent;
+    sample->offset = (int64_t)(ping_received - (ping_sent + sample->rtt / 2));
+
+    sync->next_sample = (sync->next_sample + 1) % NETPW_CLOCK_SAMPLE_COUNT;
+
+    if (sync->sample_count < NETPW_CLOCK_SAMPLE_COUNT)
+    {
+        sync->sample_count++;
+    }
+
+    /* the exchange with the least queueing gives the most symmetric paths and so the best offset */
+    int best = 0;
+
+    int i;
+    for (i = 1; i < sync->sample_count; i++)
+    {
+        if (sync->samples[i].rtt < sync->samples[best].rtt)
+        {
+            best = i;
+        }
+    }
+
+    sync->offset = sync->samples[best].offset;
+    sync->rtt = sample->rtt;
+}
+
+int clock_sync_ready(struct clock_sync* sync)
+{
+    return sync->sample_count != 0;
+}
+
+uint64_t clock_sync_to_local(struct clock_sync* sync, uint64_t remote)
+{
+    return remote - sync->offset;
+}
+
+uint64_t clock_sync_rtt(struct clock_sync* sync)
+{
+    return sync->rtt;
+}
+
+void clock_sync_localize_timestamp(struct clock_sync* sync, const unsigned char* remote, unsigned char* local, uint64_t now)
+{
+    int i;
+    for (i = 0; i < NETPW_PACKET_TIMESTAMP_SIZE; i += 8)
+    {
+        packet_write_u64(local + i, clock_sync_to_local(sync, packet_read_u64(remote + i)));
+    }
+
+    packet_write_u64(local + NETPW_PACKET_TIMESTAMP_SIZE, now);
+}
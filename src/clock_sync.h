@@ -0,0 +1,42 @@
+/*
+Copyright 2025 Amini Allight
+
+This file is part of netpw.
+
+netpw is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+netpw is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with netpw. If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef NETPW_CLOCK_SYNC_H
+#define NETPW_CLOCK_SYNC_H
+
+#include <stdint.h>
+
+/* estimates a peer's clock offset and the round trip time from ping/pong exchanges, not thread-safe */
+struct clock_sync;
+
+struct clock_sync* clock_sync_init();
+void clock_sync_destroy(struct clock_sync* sync);
+
+/* returns non-zero if a ping should be sent now */
+int clock_sync_ping_due(struct clock_sync* sync, uint64_t now);
+void clock_sync_update(struct clock_sync* sync, uint64_t ping_sent, uint64_t ping_received, uint64_t pong_received);
+
+/* returns zero until the first pong has been received */
+int clock_sync_ready(struct clock_sync* sync);
+uint64_t clock_sync_to_local(struct clock_sync* sync, uint64_t remote);
+uint64_t clock_sync_rtt(struct clock_sync* sync);
+
+/* rewrites a timestamp packet payload into the local clock and appends the receive time */
+void clock_sync_localize_timestamp(struct clock_sync* sync, const unsigned char* remote, unsigned char* local, uint64_t now);
+
+#endif
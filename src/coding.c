@@ -16,12 +16,17 @@ GNU General Public License for more details.
 You should have received a copy of the GNU General Public License
 along with netpw. If not, see <https://www.gnu.org/licenses/>.
 */
+/* for pipe2 */
+#define _GNU_SOURCE
+
 #include "coding.h"
 #include "error_handling.h"
 #include "tools.h"
 #include "constants.h"
+#include "trace.h"
 
 #include <unistd.h>
+#include <fcntl.h>
 #include <stdlib.h>
 #include <string.h>
 #include <signal.h>
@@ -35,6 +40,7 @@ struct coding_context
     unsigned char buffer[NETPW_IO_BUFFER_SIZE];
     pid_t child;
     on_data_callback callback;
+    void* userdata;
     pthread_t thread;
 };
 
@@ -44,29 +50,34 @@ static void* coding_receive(void* arg)
 
     int result;
 
+    trace_thread_name("codec");
+
     while (1)
     {
         result = read(ctx->child_out[READ_PIPE_INDEX], ctx->buffer, NETPW_IO_BUFFER_SIZE);
 
-        if (result < 0)
+        if (result <= 0)
         {
             break;
         }
 
-        ctx->callback(ctx->buffer, result);
+        TRACE_COUNTER("codec read bytes", result);
+
+        ctx->callback(ctx->userdata, ctx->buffer, result);
     }
 
     return NULL;
 }
 
-static struct coding_context* coding_init(int argc, char** argv, on_data_callback callback)
+static struct coding_context* coding_init(int argc, char** argv, on_data_callback callback, void* userdata)
 {
     int result;
 
     struct coding_context* ctx = malloc(sizeof(struct coding_context));
 
-    CHECK_ERRNO_FATAL(pipe(ctx->child_in));
-    CHECK_ERRNO_FATAL(pipe(ctx->child_out));
+    /* other children mustn't inherit these, or this child never sees the end of its input */
+    CHECK_ERRNO_FATAL(pipe2(ctx->child_in, O_CLOEXEC));
+    CHECK_ERRNO_FATAL(pipe2(ctx->child_out, O_CLOEXEC));
 
     ctx->child = fork();
 
@@ -88,6 +99,7 @@ static struct coding_context* coding_init(int argc, char** argv, on_data_callbac
         CHECK_ERRNO(close(ctx->child_out[WRITE_PIPE_INDEX]));
 
         ctx->callback = callback;
+        ctx->userdata = userdata;
         CHECK_ERROR_FATAL(pthread_create(&ctx->thread, NULL, coding_receive, ctx));
     }
 
@@ -100,7 +112,8 @@ struct coding_context* coding_init_audio_encoder(
     int depth,
     int encoder_argc,
     char** encoder_argv,
-    on_data_callback callback
+    on_data_callback callback,
+    void* userdata
 )
 {
     int argc = 9 + encoder_argc + 2;
@@ -125,7 +138,7 @@ struct coding_context* coding_init_audio_encoder(
     argv[argc - 2] = "-";
     argv[argc - 1] = NULL;
 
-    return coding_init(argc, argv, callback);
+    return coding_init(argc, argv, callback, userdata);
 }
 
 struct coding_context* coding_init_audio_decoder(
@@ -134,7 +147,8 @@ struct coding_context* coding_init_audio_decoder(
     int depth,
     int encoder_argc,
     char** encoder_argv,
-    on_data_callback callback
+    on_data_callback callback,
+    void* userdata
 )
 {
     int argc = 1 + encoder_argc + 12;
@@ -161,20 +175,21 @@ struct coding_context* coding_init_audio_decoder(
     argv[encoder_argc + 11] = "-";
     argv[encoder_argc + 12] = NULL;
 
-    return coding_init(argc, argv, callback);
+    return coding_init(argc, argv, callback, userdata);
 }
 
 void coding_destroy(struct coding_context* ctx)
 {
     int result;
 
+    /* a child started from a background thread may ignore SIGINT, the end of its input stops it either way */
+    CHECK_ERRNO(close(ctx->child_in[WRITE_PIPE_INDEX]));
     CHECK_ERRNO(kill(ctx->child, SIGINT));
 
     waitpid(ctx->child, NULL, 0);
 
     CHECK_ERROR(pthread_join(ctx->thread, NULL));
 
-    CHECK_ERRNO(close(ctx->child_in[WRITE_PIPE_INDEX]));
     CHECK_ERRNO(close(ctx->child_out[READ_PIPE_INDEX]));
 
     free(ctx);
@@ -184,5 +199,7 @@ void coding_send(struct coding_context* ctx, const unsigned char* data, int size
 {
     int result;
 
+    TRACE_BEGIN("codec write");
     CHECK_ERRNO(write(ctx->child_in[WRITE_PIPE_INDEX], data, size));
+    TRACE_END("codec write");
 }
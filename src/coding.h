@@ -29,7 +29,8 @@ struct coding_context* coding_init_audio_encoder(
     int depth,
     int encoder_argc,
     char** encoder_argv,
-    on_data_callback callback
+    on_data_callback callback,
+    void* userdata
 );
 struct coding_context* coding_init_audio_decoder(
     int frequency,
@@ -37,7 +38,8 @@ struct coding_context* coding_init_audio_decoder(
     int depth,
     int encoder_argc,
     char** encoder_argv,
-    on_data_callback callback
+    on_data_callback callback,
+    void* userdata
 );
 void coding_destroy(struct coding_context* ctx);
 
@@ -26,6 +26,109 @@ along with netpw. If not, see <https://www.gnu.org/licenses/>.
 
 #define NETPW_IO_BUFFER_SIZE 4096
 
+/* how long a metrics scrape may take to send its request or read the answer, in nanoseconds */
+#define NETPW_METRICS_TIMEOUT 1000000000
+
+#define NETPW_PACKET_MAX_SIZE NETPW_QUEUE_SIZE
+
+/* buffers negotiated for each PipeWire stream, one is processed by the graph while netpw fills or drains the other */
+#define NETPW_PIPEWIRE_BUFFER_COUNT 2
+
+/* largest payload of an integrity record, matching TLS */
+#define NETPW_TRANSPORT_RECORD_SIZE 16384
+
+/* in dB above the silence threshold */
+#define NETPW_SILENCE_HYSTERESIS 6
+#define NETPW_SILENCE_RUN_COUNT 64
+
+/* in nanoseconds */
+#define NETPW_PING_INTERVAL 1000000000
+#define NETPW_TIMESTAMP_INTERVAL 100000000
+#define NETPW_LATENCY_REPORT_INTERVAL 1000000000
+#define NETPW_CLOCK_SAMPLE_COUNT 8
+
+/* in nanoseconds */
+#define NETPW_RATE_REPORT_INTERVAL 1000000000
+/* queueing beyond which the send backlog counts as congestion */
+#define NETPW_RATE_QUEUE_DELAY 100000000
+/* round trip time beyond the lowest seen, or half of it if more, that counts as congestion */
+#define NETPW_RATE_RTT_MARGIN 10000000
+/* in bits per second */
+#define NETPW_RATE_MIN 16000
+#define NETPW_RATE_INCREASE 32000
+/* in percent of the delivered rate */
+#define NETPW_RATE_DECREASE 85
+
+/* unsent bytes the kernel holds per connection in latency-bounded mode */
+#define NETPW_NOTSENT_LOWAT 16384
+/* writes remembered per latency-bounded connection to date its oldest unacknowledged data */
+#define NETPW_SEND_BUDGET_HISTORY 1024
+
+#define NETPW_SERVER_BACKLOG 128
+#define NETPW_HANDSHAKE_WORKERS 4
+/* in nanoseconds */
+#define NETPW_HANDSHAKE_TIMEOUT 5000000000ULL
+/* how long accepting pauses when out of descriptors, in nanoseconds */
+#define NETPW_ACCEPT_BACKOFF 100000000
+/* how often the reaper checks whether senders have left an old view of the clients, in nanoseconds */
+#define NETPW_GRACE_PERIOD_POLL 1000000
+
+/* in bytes for each direction of a shared memory link, a power of two */
+#define NETPW_LOCAL_RING_SIZE (1024 * 1024)
+
+/* the most kept of an encoded stream for clients joining mid-stream, in bytes of headers and since the latest sync point */
+#define NETPW_CONTAINER_HEADER_SIZE (64 * 1024)
+#define NETPW_CONTAINER_BACKLOG_SIZE (256 * 1024)
+
+/* recordings are written in blocks of at least this size, aligned for O_DIRECT */
+#define NETPW_RECORD_WRITE_SIZE (256 * 1024)
+#define NETPW_RECORD_ALIGNMENT 4096
+/* how often the recorder drains its queue, in nanoseconds */
+#define NETPW_RECORD_INTERVAL 100000000
+
+/* in nanoseconds, how long a probe sends at the audio rate and how long each step of its throughput ramp lasts */
+#define NETPW_PROBE_DURATION 10000000000ULL
+#define NETPW_PROBE_STEP_DURATION 3000000000ULL
+#define NETPW_PROBE_PING_INTERVAL 10000000
+/* in bytes per second, the ramp stops here if the server is still keeping up */
+#define NETPW_PROBE_MAX_RATE (125 * 1000 * 1000)
+#define NETPW_PROBE_CHUNK_SIZE (64 * 1024)
+#define NETPW_PROBE_MAX_SAMPLES 16384
+/* bytes each packet costs beyond its payload in framing, TLS and TCP/IP headers */
+#define NETPW_PROBE_PACKET_OVERHEAD 80
+/* in frames, the range of buffer sizes recommended */
+#define NETPW_PROBE_MIN_BUFFER 64
+#define NETPW_PROBE_MAX_BUFFER 4096
+/* in kbit/s, the lower end of the recommended adaptive bitrate range */
+#define NETPW_PROBE_MIN_BITRATE 32
+
+/* tier announcements a client keeps until its playback stream exists, the server sends one on connect and one per request */
+#define NETPW_PENDING_TIER_COUNT 4
+
+/* netpw loadtest defaults, the duration is in seconds */
+#define NETPW_LOADTEST_CONNECTIONS 100
+#define NETPW_LOADTEST_THREADS 4
+#define NETPW_LOADTEST_DURATION 30
+/* latencies kept per connection, older ones are overwritten */
+#define NETPW_LOADTEST_MAX_SAMPLES 4096
+/* a gap between audio packets longer than this many quanta is a stall, or than the minimum in nanoseconds for encoded tiers whose packets are longer */
+#define NETPW_LOADTEST_STALL_QUANTA 4
+#define NETPW_LOADTEST_MIN_STALL 20000000
+#define NETPW_LOADTEST_MAX_EVENTS 64
+/* in milliseconds, how often a load test checks whether every connection is up */
+#define NETPW_LOADTEST_POLL_INTERVAL 10
+
+/* in frames, DSP ports are converted to and from the wire format in chunks of at most this size */
+#define NETPW_DSP_MAX_QUANTUM 8192
+
+/* in events per thread */
+#define NETPW_TRACE_RING_SIZE 16384
+/* rings of exited threads kept for the next dump */
+#define NETPW_TRACE_DEAD_RING_COUNT 8
+/* in nanoseconds */
+#define NETPW_TRACE_INCIDENT_INTERVAL 1000000000
+#define NETPW_TRACE_INCIDENT_DELAY 100000000
+
 #define READ_PIPE_INDEX 0
 #define WRITE_PIPE_INDEX 1
 
@@ -0,0 +1,540 @@
+/*
+Copyright 2025 Amini Allight
+
+This file is part of netpw.
+
+netpw is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+netpw is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with netpw. If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "container.h"
+#include "constants.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#define NETPW_TS_PACKET_SIZE 188
+#define NETPW_TS_PAT_PID 0
+#define NETPW_TS_MAX_STREAMS 16
+#define NETPW_OGG_HEADER_SIZE 27
+#define NETPW_ADTS_HEADER_SIZE 7
+
+enum container_format
+{
+    /* nothing seen since the last reset */
+    NETPW_CONTAINER_UNKNOWN,
+    NETPW_CONTAINER_PASSTHROUGH,
+    NETPW_CONTAINER_OGG,
+    NETPW_CONTAINER_TS,
+    NETPW_CONTAINER_ADTS
+};
+
+enum frame_kind
+{
+    NETPW_FRAME_HEADER,
+    NETPW_FRAME_SYNC,
+    NETPW_FRAME_OTHER
+};
+
+struct buffer
+{
+    unsigned char* data;
+    int size;
+    int capacity;
+};
+
+struct container
+{
+    enum container_format format;
+    int started;
+    /* non-zero if the last write was the first to complete any frames */
+    int starting;
+    /* the incomplete frame at the end of the last write */
+    struct buffer pending;
+    struct buffer frames;
+    const unsigned char* written;
+    int written_size;
+    /* codec and container headers followed by everything since the latest sync point */
+    struct buffer start;
+    int header_size;
+    /* set if the headers didn't fit, which leaves receivers to wait for the next stream */
+    int header_overflow;
+    int synced;
+    /* Ogg headers are the pages before the first carrying audio */
+    int ogg_in_headers;
+    /* MPEG-TS headers are the latest PAT and PMT, which name the audio streams */
+    unsigned char ts_pat[NETPW_TS_PACKET_SIZE];
+    unsigned char ts_pmt[NETPW_TS_PACKET_SIZE];
+    int ts_pmt_pid;
+    int ts_streams[NETPW_TS_MAX_STREAMS];
+    int ts_stream_count;
+};
+
+static void buffer_grow(struct buffer* buffer, int size)
+{
+    if (buffer->capacity < buffer->size + size)
+    {
+        buffer->capacity = buffer->capacity * 2 > buffer->size + size ? buffer->capacity * 2 : buffer->size + size;
+        buffer->data = realloc(buffer->data, buffer->capacity);
+    }
+
+    buffer->size += size;
+}
+
+static void buffer_append(struct buffer* buffer, const unsigned char* data, int size)
+{
+    buffer_grow(buffer, size);
+    memcpy(buffer->data + buffer->size - size, data, size);
+}
+
+static uint16_t read_u16(const unsigned char* data)
+{
+    return (data[0] << 8) | data[1];
+}
+
+static uint64_t read_u64_le(const unsigned char* data)
+{
+    uint64_t x = 0;
+
+    int i;
+    for (i = 7; i >= 0; i--)
+    {
+        x = (x << 8) | data[i];
+    }
+
+    return x;
+}
+
+static enum container_format container_detect(const unsigned char* data, int size)
+{
+    if (size >= 4 && memcmp(data, "OggS", 4) == 0)
+    {
+        return NETPW_CONTAINER_OGG;
+    }
+    else if (size >= 1 && data[0] == 0x47)
+    {
+        return NETPW_CONTAINER_TS;
+    }
+    else if (size >= 2 && data[0] == 0xff && (data[1] & 0xf6) == 0xf0)
+    {
+        return NETPW_CONTAINER_ADTS;
+    }
+
+    return NETPW_CONTAINER_PASSTHROUGH;
+}
+
+/* the offset of a TS packet's payload, or -1 if it has none */
+static int ts_payload(const unsigned char* packet)
+{
+    int adaptation = (packet[3] >> 4) & 0x3;
+    int offset = 4;
+
+    if (!(adaptation & 0x1))
+    {
+        return -1;
+    }
+
+    if (adaptation & 0x2)
+    {
+        offset += 1 + packet[4];
+    }
+
+    return offset < NETPW_TS_PACKET_SIZE ? offset : -1;
+}
+
+/* the start of the section in a packet beginning one, or NULL; size is set to the bytes of it in the packet */
+static const unsigned char* ts_section(const unsigned char* packet, int* size)
+{
+    int offset = ts_payload(packet);
+
+    if (offset < 0 || !(packet[1] & 0x40))
+    {
+        return NULL;
+    }
+
+    offset += 1 + packet[offset];
+
+    /* PSI tables are small enough that ffmpeg keeps each in one packet, longer ones are only partly parsed */
+    if (offset + 3 > NETPW_TS_PACKET_SIZE)
+    {
+        return NULL;
+    }
+
+    int section_size = 3 + (read_u16(packet + offset + 1) & 0xfff);
+
+    *size = section_size < NETPW_TS_PACKET_SIZE - offset ? section_size : NETPW_TS_PACKET_SIZE - offset;
+
+    return packet + offset;
+}
+
+static void ts_parse_pat(struct container* container, const unsigned char* packet)
+{
+    int size;
+    const unsigned char* section = ts_section(packet, &size);
+
+    if (!section || section[0] != 0x00)
+    {
+        return;
+    }
+
+    /* the first program is the one ffmpeg writes, entries end before the CRC */
+    int offset;
+    for (offset = 8; offset + 4 <= size - 4; offset += 4)
+    {
+        if (read_u16(section + offset) != 0)
+        {
+            container->ts_pmt_pid = read_u16(section + offset + 2) & 0x1fff;
+            break;
+        }
+    }
+
+    memcpy(container->ts_pat, packet, NETPW_TS_PACKET_SIZE);
+}
+
+static void ts_parse_pmt(struct container* container, const unsigned char* packet)
+{
+    int size;
+    const unsigned char* section = ts_section(packet, &size);
+
+    if (!section || section[0] != 0x02 || size < 12)
+    {
+        return;
+    }
+
+    container->ts_stream_count = 0;
+
+    int offset = 12 + (read_u16(section + 10) & 0xfff);
+
+    while (offset + 5 <= size - 4 && container->ts_stream_count < NETPW_TS_MAX_STREAMS)
+    {
+        container->ts_streams[container->ts_stream_count++] = read_u16(section + offset + 1) & 0x1fff;
+        offset += 5 + (read_u16(section + offset + 3) & 0xfff);
+    }
+
+    memcpy(container->ts_pmt, packet, NETPW_TS_PACKET_SIZE);
+}
+
+static void container_set_ts_header(struct container* container)
+{
+    int header_size = NETPW_TS_PACKET_SIZE * 2;
+
+    /* the audio seen since the last sync point stays valid, only the tables in front of it are replaced */
+    if (container->header_size != header_size)
+    {
+        int backlog = container->start.size - container->header_size;
+
+        buffer_grow(&container->start, header_size - container->header_size);
+        memmove(container->start.data + header_size, container->start.data + container->header_size, backlog);
+        container->header_size = header_size;
+    }
+
+    memcpy(container->start.data, container->ts_pat, NETPW_TS_PACKET_SIZE);
+    memcpy(container->start.data + NETPW_TS_PACKET_SIZE, container->ts_pmt, NETPW_TS_PACKET_SIZE);
+}
+
+/* the size of the frame at the start of the data, 0 if it is incomplete and -1 if the data doesn't start with one */
+static int container_frame(struct container* container, const unsigned char* data, int size, enum frame_kind* kind)
+{
+    *kind = NETPW_FRAME_OTHER;
+
+    switch (container->format)
+    {
+    case NETPW_CONTAINER_OGG :
+    {
+        if (size < NETPW_OGG_HEADER_SIZE)
+        {
+            return 0;
+        }
+        else if (memcmp(data, "OggS", 4) != 0)
+        {
+            return -1;
+        }
+
+        int segment_count = data[26];
+
+        if (size < NETPW_OGG_HEADER_SIZE + segment_count)
+        {
+            return 0;
+        }
+
+        int frame_size = NETPW_OGG_HEADER_SIZE + segment_count;
+
+        int i;
+        for (i = 0; i < segment_count; i++)
+        {
+            frame_size += data[NETPW_OGG_HEADER_SIZE + i];
+        }
+
+        if (size < frame_size)
+        {
+            return 0;
+        }
+
+        uint64_t granule = read_u64_le(data + 6);
+
+        /* a new stream starts with a page marked as its beginning, like after the encoder was replaced */
+        if (data[5] & 0x02)
+        {
+            container->ogg_in_headers = 1;
+            container->header_size = 0;
+            container->header_overflow = 0;
+            container->start.size = 0;
+            container->synced = 0;
+        }
+
+        /* header pages have no position of their own, or none yet if a header spans pages */
+        if (container->ogg_in_headers && (granule == 0 || granule == UINT64_MAX))
+        {
+            *kind = NETPW_FRAME_HEADER;
+        }
+        else
+        {
+            container->ogg_in_headers = 0;
+
+            /* a page continuing a packet from the previous one can't be decoded on its own */
+            *kind = data[5] & 0x01 ? NETPW_FRAME_OTHER : NETPW_FRAME_SYNC;
+        }
+
+        return frame_size;
+    }
+    case NETPW_CONTAINER_TS :
+    {
+        if (size < NETPW_TS_PACKET_SIZE)
+        {
+            return 0;
+        }
+        else if (data[0] != 0x47)
+        {
+            return -1;
+        }
+
+        int pid = read_u16(data + 1) & 0x1fff;
+
+        if (pid == NETPW_TS_PAT_PID)
+        {
+            ts_parse_pat(container, data);
+            *kind = NETPW_FRAME_HEADER;
+        }
+        else if (pid == container->ts_pmt_pid)
+        {
+            ts_parse_pmt(container, data);
+            *kind = NETPW_FRAME_HEADER;
+        }
+        else if (data[1] & 0x40)
+        {
+            /* each PES packet starts with a whole audio frame */
+            int i;
+            for (i = 0; i < container->ts_stream_count; i++)
+            {
+                if (container->ts_streams[i] == pid)
+                {
+                    *kind = NETPW_FRAME_SYNC;
+                    break;
+                }
+            }
+        }
+
+        return NETPW_TS_PACKET_SIZE;
+    }
+    case NETPW_CONTAINER_ADTS :
+    {
+        if (size < NETPW_ADTS_HEADER_SIZE)
+        {
+            return 0;
+        }
+        else if (data[0] != 0xff || (data[1] & 0xf6) != 0xf0)
+        {
+            return -1;
+        }
+
+        int frame_size = ((data[3] & 0x03) << 11) | (data[4] << 3) | (data[5] >> 5);
+
+        if (frame_size < NETPW_ADTS_HEADER_SIZE)
+        {
+            return -1;
+        }
+        else if (size < frame_size)
+        {
+            return 0;
+        }
+
+        /* every frame carries its own header */
+        *kind = NETPW_FRAME_SYNC;
+        return frame_size;
+    }
+    default :
+        return size;
+    }
+}
+
+static void container_add_frame(struct container* container, const unsigned char* data, int size, enum frame_kind kind)
+{
+    buffer_append(&container->frames, data, size);
+
+    switch (kind)
+    {
+    case NETPW_FRAME_HEADER :
+        if (container->format == NETPW_CONTAINER_TS)
+        {
+            /* both tables are needed before the audio can be found */
+            if (container->ts_pat[0] == 0x47 && container->ts_pmt[0] == 0x47)
+            {
+                container_set_ts_header(container);
+            }
+        }
+        else if (container->header_size + size <= NETPW_CONTAINER_HEADER_SIZE)
+        {
+            container->start.size = container->header_size;
+            buffer_append(&container->start, data, size);
+            container->header_size += size;
+        }
+        else
+        {
+            container->header_overflow = 1;
+        }
+        break;
+    case NETPW_FRAME_SYNC :
+        if (container->header_overflow)
+        {
+            break;
+        }
+
+        container->start.size = container->header_size;
+        container->synced = 1;
+        buffer_append(&container->start, data, size);
+        break;
+    case NETPW_FRAME_OTHER :
+        if (!container->synced)
+        {
+            break;
+        }
+
+        /* receivers wait for the next sync point rather than receiving too much at once */
+        if (container->start.size + size > container->header_size + NETPW_CONTAINER_BACKLOG_SIZE)
+        {
+            container->start.size = container->header_size;
+            container->synced = 0;
+            break;
+        }
+
+        buffer_append(&container->start, data, size);
+        break;
+    }
+}
+
+struct container* container_init()
+{
+    struct container* container = calloc(1, sizeof(struct container));
+
+    container_reset(container);
+
+    return container;
+}
+
+void container_destroy(struct container* container)
+{
+    free(container->pending.data);
+    free(container->frames.data);
+    free(container->start.data);
+    free(container);
+}
+
+void container_reset(struct container* container)
+{
+    container->format = NETPW_CONTAINER_UNKNOWN;
+    container->started = 0;
+    container->starting = 0;
+    container->pending.size = 0;
+    container->frames.size = 0;
+    container->start.size = 0;
+    container->header_size = 0;
+    container->header_overflow = 0;
+    container->synced = 0;
+    container->ogg_in_headers = 0;
+    memset(container->ts_pat, 0, sizeof(container->ts_pat));
+    memset(container->ts_pmt, 0, sizeof(container->ts_pmt));
+    container->ts_pmt_pid = 0;
+    container->ts_stream_count = 0;
+}
+
+int container_write(struct container* container, const unsigned char* data, int size, const unsigned char** frames)
+{
+    container->frames.size = 0;
+
+    if (container->format == NETPW_CONTAINER_UNKNOWN)
+    {
+        container->format = container_detect(data, size);
+    }
+
+    if (container->format == NETPW_CONTAINER_PASSTHROUGH)
+    {
+        container->written = data;
+        container->written_size = size;
+
+        *frames = data;
+        return size;
+    }
+
+    buffer_append(&container->pending, data, size);
+
+    int offset = 0;
+
+    while (offset < container->pending.size)
+    {
+        enum frame_kind kind;
+        int frame_size = container_frame(container, container->pending.data + offset, container->pending.size - offset, &kind);
+
+        if (frame_size == 0)
+        {
+            break;
+        }
+
+        /* bytes between frames are passed on but never start a receiver */
+        if (frame_size < 0)
+        {
+            frame_size = 1;
+            kind = NETPW_FRAME_OTHER;
+        }
+
+        container_add_frame(container, container->pending.data + offset, frame_size, kind);
+        offset += frame_size;
+    }
+
+    container->pending.size -= offset;
+    memmove(container->pending.data, container->pending.data + offset, container->pending.size);
+
+    container->starting = !container->started && container->frames.size;
+    container->started |= container->frames.size != 0;
+    container->written = container->frames.data;
+    container->written_size = container->frames.size;
+
+    *frames = container->frames.data;
+    return container->frames.size;
+}
+
+int container_join(struct container* container, const unsigned char** data)
+{
+    /* a receiver present from the start of the stream needs nothing else */
+    if (container->format == NETPW_CONTAINER_PASSTHROUGH || container->starting)
+    {
+        *data = container->written;
+        return container->written_size;
+    }
+    else if (!container->synced)
+    {
+        return -1;
+    }
+
+    *data = container->start.data;
+    return container->start.size;
+}
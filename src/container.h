@@ -0,0 +1,38 @@
+/*
+Copyright 2025 Amini Allight
+
+This file is part of netpw.
+
+netpw is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+netpw is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with netpw. If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef NETPW_CONTAINER_H
+#define NETPW_CONTAINER_H
+
+/*
+ * splits an encoder's output into whole frames of its container and keeps what a decoder joining mid-stream needs
+ * understands Ogg, MPEG-TS and ADTS, anything else is passed through unchanged
+ */
+struct container;
+
+struct container* container_init();
+void container_destroy(struct container* container);
+
+/* forgets everything seen so far, for when the next data begins a new stream */
+void container_reset(struct container* container);
+/* returns the size of the whole frames completed by the data, which stay valid until the next call */
+int container_write(struct container* container, const unsigned char* data, int size, const unsigned char** frames);
+/* what a receiver starting now gets in place of the frames last written, -1 if it has to wait for a sync point */
+int container_join(struct container* container, const unsigned char** data);
+
+#endif
@@ -20,12 +20,50 @@ along with netpw. If not, see <https://www.gnu.org/licenses/>.
 #include "constants.h"
 #include "error_handling.h"
 
+#include <stdlib.h>
+#include <string.h>
 #include <openssl/x509.h>
+#include <openssl/ec.h>
 #include <openssl/rand.h>
 #include <openssl/sha.h>
 #include <openssl/pem.h>
 
-void generate_rsa_key_pair(char** public_key, char** private_key)
+enum key_type key_type_from_name(const char* name)
+{
+    if (strcmp(name, "rsa") == 0)
+    {
+        return NETPW_KEY_TYPE_RSA;
+    }
+    else if (strcmp(name, "ed25519") == 0)
+    {
+        return NETPW_KEY_TYPE_ED25519;
+    }
+    else if (strcmp(name, "p256") == 0)
+    {
+        return NETPW_KEY_TYPE_P256;
+    }
+    else
+    {
+        return NETPW_KEY_TYPE_NONE;
+    }
+}
+
+const char* key_type_name(enum key_type type)
+{
+    switch (type)
+    {
+    default :
+        return "none";
+    case NETPW_KEY_TYPE_RSA :
+        return "rsa";
+    case NETPW_KEY_TYPE_ED25519 :
+        return "ed25519";
+    case NETPW_KEY_TYPE_P256 :
+        return "p256";
+    }
+}
+
+void generate_key_pair(enum key_type type, char** public_key, char** private_key)
 {
     int result;
 
@@ -35,11 +73,28 @@ void generate_rsa_key_pair(char** public_key, char** private_key)
     BIO* private_writer;
     CHECK_POINTER_FATAL(private_writer = BIO_new(BIO_s_mem()));
     EVP_PKEY_CTX* ctx;
-    CHECK_POINTER_FATAL(ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_RSA, NULL));
-
-    CHECK_OK_FATAL(EVP_PKEY_keygen_init(ctx));
 
-    CHECK_OK_FATAL(EVP_PKEY_CTX_set_rsa_keygen_bits(ctx, 4096));
+    switch (type)
+    {
+    default :
+        fprintf(stderr, "unsupported key type.\n");
+        exit(1);
+    case NETPW_KEY_TYPE_RSA :
+        CHECK_POINTER_FATAL(ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_RSA, NULL));
+        CHECK_OK_FATAL(EVP_PKEY_keygen_init(ctx));
+        CHECK_OK_FATAL(EVP_PKEY_CTX_set_rsa_keygen_bits(ctx, 4096));
+        break;
+    case NETPW_KEY_TYPE_ED25519 :
+        CHECK_POINTER_FATAL(ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_ED25519, NULL));
+        CHECK_OK_FATAL(EVP_PKEY_keygen_init(ctx));
+        break;
+    case NETPW_KEY_TYPE_P256 :
+        CHECK_POINTER_FATAL(ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, NULL));
+        CHECK_OK_FATAL(EVP_PKEY_keygen_init(ctx));
+        CHECK_OK_FATAL(EVP_PKEY_CTX_set_ec_paramgen_curve_nid(ctx, NID_X9_62_prime256v1));
+        CHECK_OK_FATAL(EVP_PKEY_CTX_set_ec_param_enc(ctx, OPENSSL_EC_NAMED_CURVE));
+        break;
+    }
 
     CHECK_OK_FATAL(EVP_PKEY_keygen(ctx, &keypair));
 
@@ -88,7 +143,10 @@ void x509_certificate_from_private_key(const char* private_key, char** certifica
 
     CHECK_OK_FATAL(X509_set_issuer_name(cert, name));
 
-    CHECK_OK_FATAL(X509_sign(cert, key, EVP_sha256()));
+    /* Ed25519 hashes internally and must be given no digest */
+    const EVP_MD* digest = EVP_PKEY_get_base_id(key) == EVP_PKEY_ED25519 ? NULL : EVP_sha256();
+
+    CHECK_OK_FATAL(X509_sign(cert, key, digest));
 
     CHECK_OK_FATAL(PEM_write_bio_X509(cert_writer, cert));
 
@@ -102,3 +160,25 @@ void x509_certificate_from_private_key(const char* private_key, char** certifica
     BIO_free_all(cert_writer);
     X509_free(cert);
 }
+
+int x509_certificate_valid(const char* certificate, const char* private_key)
+{
+    BIO* cert_reader;
+    CHECK_POINTER_FATAL(cert_reader = BIO_new_mem_buf(certificate, -1));
+    BIO* key_reader;
+    CHECK_POINTER_FATAL(key_reader = BIO_new_mem_buf(private_key, -1));
+
+    X509* cert = PEM_read_bio_X509(cert_reader, NULL, NULL, 0);
+    EVP_PKEY* key = PEM_read_bio_PrivateKey(key_reader, NULL, NULL, 0);
+
+    int valid = cert && key &&
+        X509_check_private_key(cert, key) == 1 &&
+        X509_cmp_current_time(X509_get0_notAfter(cert)) > 0;
+
+    EVP_PKEY_free(key);
+    X509_free(cert);
+    BIO_free_all(key_reader);
+    BIO_free_all(cert_reader);
+
+    return valid;
+}
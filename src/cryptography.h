@@ -19,7 +19,20 @@ along with netpw. If not, see <https://www.gnu.org/licenses/>.
 #ifndef NETPW_CRYPTOGRAPHY_H
 #define NETPW_CRYPTOGRAPHY_H
 
-void generate_rsa_key_pair(char** public_key, char** private_key);
+enum key_type
+{
+    NETPW_KEY_TYPE_NONE,
+    NETPW_KEY_TYPE_RSA,
+    NETPW_KEY_TYPE_ED25519,
+    NETPW_KEY_TYPE_P256
+};
+
+enum key_type key_type_from_name(const char* name);
+const char* key_type_name(enum key_type type);
+
+void generate_key_pair(enum key_type type, char** public_key, char** private_key);
 void x509_certificate_from_private_key(const char* private_key, char** certificate);
+/* returns non-zero if the certificate parses, holds the public half of the private key and has not expired */
+int x509_certificate_valid(const char* certificate, const char* private_key);
 
 #endif
@@ -0,0 +1,313 @@
+/*
+Copyright 2025 Amini Allight
+
+This file is part of netpw.
+
+netpw is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+netpw is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with netpw. If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "identity.h"
+#include "tools.h"
+#include "error_handling.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+static const char* certificate_marker = "-----BEGIN CERTIFICATE-----";
+
+static pthread_t generation_thread;
+static int generating = 0;
+static enum key_type generation_type;
+static char* generation_path = NULL;
+
+/* allocs and returns ownership */
+static char* identity_path(const char* directory, enum key_type type, const char* suffix)
+{
+    int size = snprintf(NULL, 0, "%s/%s%s", directory, key_type_name(type), suffix) + 1;
+    char* path = malloc(size);
+    snprintf(path, size, "%s/%s%s", directory, key_type_name(type), suffix);
+
+    return path;
+}
+
+static void identity_generate(enum key_type type, char** private_key, char** certificate)
+{
+    char* public_key;
+    generate_key_pair(type, &public_key, private_key);
+    x509_certificate_from_private_key(*private_key, certificate);
+    free(public_key);
+}
+
+/* returns zero and the identity and the time it was put into service if the file holds a usable identity */
+static int identity_read(const char* path, char** private_key, char** certificate, time_t* since)
+{
+    int fd = open(path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+
+    if (fd < 0)
+    {
+        if (errno != ENOENT)
+        {
+            fprintf(stderr, "failed to open identity %s: %s\n", path, strerror(errno));
+        }
+
+        return -1;
+    }
+
+    struct stat info;
+
+    if (fstat(fd, &info) < 0 || !S_ISREG(info.st_mode))
+    {
+        fprintf(stderr, "identity %s is not a regular file.\n", path);
+        close(fd);
+        return -1;
+    }
+
+    /* like ssh, refuse to use a key others may already have read rather than silently replace it */
+    if (info.st_uid != geteuid() || (info.st_mode & (S_IRWXG | S_IRWXO)))
+    {
+        fprintf(stderr, "identity %s must be owned by this user and inaccessible to others.\n", path);
+        exit(1);
+    }
+
+    char* data = malloc(info.st_size + 1);
+    off_t size = 0;
+
+    while (size < info.st_size)
+    {
+        ssize_t result = read(fd, data + size, info.st_size - size);
+
+        if (result < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        else if (result <= 0)
+        {
+            break;
+        }
+
+        size += result;
+    }
+
+    data[size] = 0;
+    close(fd);
+
+    char* split = strstr(data, certificate_marker);
+
+    if (!split)
+    {
+        fprintf(stderr, "identity %s is malformed.\n", path);
+        free(data);
+        return -1;
+    }
+
+    *certificate = strdup(split);
+    *split = 0;
+    *private_key = data;
+
+    if (!x509_certificate_valid(*certificate, *private_key))
+    {
+        fprintf(stderr, "identity %s is invalid or expired.\n", path);
+        free(*certificate);
+        free(*private_key);
+        return -1;
+    }
+
+    *since = info.st_mtime;
+
+    return 0;
+}
+
+/* replaces the file in one step so that a crash never leaves half an identity behind */
+static int identity_write(const char* path, mode_t mode, const char* data)
+{
+    int result;
+
+    char* temporary_path = concat_strings(path, ".tmp");
+
+    int fd;
+    CHECK_ERRNO(fd = open(temporary_path, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, mode));
+
+    if (fd < 0)
+    {
+        free(temporary_path);
+        return -1;
+    }
+
+    /* a temporary file left over by an earlier crash keeps its old mode */
+    CHECK_ERRNO(fchmod(fd, mode));
+
+    size_t size = strlen(data);
+    size_t written = 0;
+
+    while (result == 0 && written < size)
+    {
+        ssize_t count = write(fd, data + written, size - written);
+
+        if (count < 0 && errno != EINTR)
+        {
+            fprintf(stderr, "failed to write %s: %s\n", temporary_path, strerror(errno));
+            result = -1;
+        }
+        else if (count > 0)
+        {
+            written += count;
+        }
+    }
+
+    if (result == 0)
+    {
+        CHECK_ERRNO(fsync(fd));
+    }
+
+    close(fd);
+
+    if (result == 0)
+    {
+        CHECK_ERRNO(rename(temporary_path, path));
+    }
+
+    if (result < 0)
+    {
+        unlink(temporary_path);
+    }
+
+    free(temporary_path);
+
+    return result;
+}
+
+static int identity_store(const char* path, const char* private_key, const char* certificate)
+{
+    char* data = concat_strings(private_key, certificate);
+    int result = identity_write(path, S_IRUSR | S_IWUSR, data);
+    free(data);
+
+    return result;
+}
+
+static void* identity_pregenerate(void* userdata)
+{
+    char* private_key;
+    char* certificate;
+    identity_generate(generation_type, &private_key, &certificate);
+
+    if (identity_store(generation_path, private_key, certificate) == 0)
+    {
+        printf("pre-generated next %s identity.\n", key_type_name(generation_type));
+    }
+
+    free(private_key);
+    free(certificate);
+
+    return NULL;
+}
+
+void identity_load(const char* directory, enum key_type type, int rotation_days, char** private_key, char** certificate)
+{
+    int result;
+
+    result = mkdir(directory, S_IRWXU);
+
+    if (result < 0 && errno != EEXIST)
+    {
+        fprintf(stderr, "failed to create identity directory %s: %s\n", directory, strerror(errno));
+        exit(1);
+    }
+
+    char* path = identity_path(directory, type, ".pem");
+    char* next_path = identity_path(directory, type, ".next.pem");
+    char* certificate_path = identity_path(directory, type, ".crt");
+
+    char* next_private_key;
+    char* next_certificate;
+    time_t since;
+    time_t next_since;
+    int changed = 0;
+
+    if (identity_read(path, private_key, certificate, &since) == 0)
+    {
+        if (rotation_days > 0 &&
+            time(NULL) - since >= (time_t)rotation_days * 24 * 60 * 60 &&
+            identity_read(next_path, &next_private_key, &next_certificate, &next_since) == 0)
+        {
+            free(*private_key);
+            free(*certificate);
+            *private_key = next_private_key;
+            *certificate = next_certificate;
+            changed = 1;
+
+            printf("rotating to the pre-generated %s identity in %s.\n", key_type_name(type), directory);
+        }
+        else
+        {
+            printf("using the cached %s identity in %s.\n", key_type_name(type), directory);
+        }
+    }
+    else if (identity_read(next_path, private_key, certificate, &next_since) == 0)
+    {
+        changed = 1;
+
+        printf("using the pre-generated %s identity in %s.\n", key_type_name(type), directory);
+    }
+    else
+    {
+        printf("generating %s encryption keys.\n", key_type_name(type));
+        identity_generate(type, private_key, certificate);
+
+        identity_store(path, *private_key, *certificate);
+    }
+
+    if (changed)
+    {
+        CHECK_ERRNO(rename(next_path, path));
+
+        /* the rotation period counts from when an identity is put into service rather than generated */
+        CHECK_ERRNO(utimensat(AT_FDCWD, path, NULL, 0));
+    }
+
+    /* the certificate alone can be handed to clients to pin the server with --ca */
+    identity_write(certificate_path, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH, *certificate);
+
+    /* generated now so that the start which rotates does not have to wait for it */
+    if (rotation_days > 0 && access(next_path, F_OK) != 0)
+    {
+        generation_type = type;
+        generation_path = next_path;
+        next_path = NULL;
+
+        CHECK_ERROR_FATAL(pthread_create(&generation_thread, NULL, identity_pregenerate, NULL));
+        generating = 1;
+    }
+
+    free(certificate_path);
+    free(next_path);
+    free(path);
+}
+
+void identity_destroy()
+{
+    if (generating)
+    {
+        pthread_join(generation_thread, NULL);
+        generating = 0;
+    }
+
+    free(generation_path);
+    generation_path = NULL;
+}
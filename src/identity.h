@@ -0,0 +1,33 @@
+/*
+Copyright 2025 Amini Allight
+
+This file is part of netpw.
+
+netpw is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+netpw is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with netpw. If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef NETPW_IDENTITY_H
+#define NETPW_IDENTITY_H
+
+#include "cryptography.h"
+
+/*
+ * loads the server identity of the given key type cached in directory, generating and storing it if there is none
+ * with a non-zero rotation period in days a successor is generated in the background and replaces the identity on the first start after the period has passed
+ * allocs and returns ownership of the private key and certificate
+ */
+void identity_load(const char* directory, enum key_type type, int rotation_days, char** private_key, char** certificate);
+/* waits for a background generation to be written out */
+void identity_destroy();
+
+#endif
@@ -0,0 +1,863 @@
+/*
+Copyright 2025 Amini Allight
+
+This file is part of netpw.
+
+netpw is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+netpw is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with netpw. If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "loadtest.h"
+#include "client.h"
+#include "packet.h"
+#include "constants.h"
+#include "error_handling.h"
+#include "clock_sync.h"
+#include "rate_control.h"
+#include "trace.h"
+#include "tools.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+
+struct loadtest_connection
+{
+    struct loadtest* loadtest;
+    int index;
+    int socket;
+    /* NULL if the connection couldn't be made */
+    struct transport* transport;
+    struct packet_reader* reader;
+    struct clock_sync* clock_sync;
+    struct rate_control* rate_control;
+    int open;
+    uint64_t handshake_time;
+    /* zero unless the server closed the connection during the test */
+    uint64_t closed_time;
+    /* the rest is reset once every connection is up */
+    uint64_t received;
+    uint64_t last_audio;
+    int stall_count;
+    uint64_t longest_gap;
+    /* from capture on the server to receipt here, a ring of the latest */
+    uint64_t* latencies;
+    int latency_count;
+    int write_failures;
+};
+
+struct loadtest
+{
+    SSL_CTX* ssl_context;
+    struct addrinfo* address;
+    enum crypto_profile profile;
+    struct tcp_options tcp;
+    const char* tier;
+    uint64_t duration;
+    uint64_t stall_threshold;
+    /* workers done connecting, measuring starts once all are while the connections made so far keep being read */
+    int connected_workers;
+    int thread_count;
+};
+
+struct loadtest_worker
+{
+    struct loadtest* loadtest;
+    pthread_t thread;
+    int epoll;
+    struct loadtest_connection* connections;
+    int connection_count;
+    unsigned char buffer[NETPW_IO_BUFFER_SIZE];
+};
+
+/* the inode of a socket listening on port in /proc/net/tcp or tcp6, zero if there is none */
+static unsigned long listening_inode(const char* path, unsigned short port)
+{
+    FILE* file = fopen(path, "r");
+
+    if (!file)
+    {
+        return 0;
+    }
+
+    char line[512];
+    unsigned long inode = 0;
+
+    /* the first line is a header */
+    if (fgets(line, sizeof(line), file))
+    {
+        while (!inode && fgets(line, sizeof(line), file))
+        {
+            unsigned int local_port;
+            unsigned int state;
+            unsigned long candidate;
+
+            /* 0A is TCP_LISTEN */
+            if (sscanf(line, "%*s %*[0-9A-Fa-f]:%x %*s %x %*s %*s %*s %*s %*s %lu", &local_port, &state, &candidate) == 3
+                && local_port == port
+                && state == 0x0A)
+            {
+                inode = candidate;
+            }
+        }
+    }
+
+    fclose(file);
+
+    return inode;
+}
+
+/* the process holding a socket, zero if it belongs to a process this one isn't allowed to look into */
+static pid_t socket_owner(unsigned long inode)
+{
+    char target[64];
+    snprintf(target, sizeof(target), "socket:[%lu]", inode);
+
+    DIR* processes = opendir("/proc");
+
+    if (!processes)
+    {
+        return 0;
+    }
+
+    pid_t owner = 0;
+    struct dirent* process;
+
+    while (!owner && (process = readdir(processes)))
+    {
+        pid_t pid = atoi(process->d_name);
+
+        if (pid <= 0)
+        {
+            continue;
+        }
+
+        char path[64];
+        snprintf(path, sizeof(path), "/proc/%i/fd", pid);
+
+        DIR* fds = opendir(path);
+
+        if (!fds)
+        {
+            continue;
+        }
+
+        struct dirent* fd;
+
+        while (!owner && (fd = readdir(fds)))
+        {
+            char fd_path[64 + sizeof(fd->d_name)];
+            snprintf(fd_path, sizeof(fd_path), "%s/%s", path, fd->d_name);
+
+            char link[64];
+            ssize_t size = readlink(fd_path, link, sizeof(link) - 1);
+
+            if (size > 0)
+            {
+                link[size] = '\0';
+
+                if (strcmp(link, target) == 0)
+                {
+                    owner = pid;
+                }
+            }
+        }
+
+        closedir(fds);
+    }
+
+    closedir(processes);
+
+    return owner;
+}
+
+/* the server can only be found in /proc if it is on this host, which it is when both ends of a connection share an address */
+static pid_t find_server(int socket, unsigned short port)
+{
+    struct sockaddr_storage local;
+    struct sockaddr_storage remote;
+    socklen_t local_size = sizeof(local);
+    socklen_t remote_size = sizeof(remote);
+
+    if (getsockname(socket, (struct sockaddr*)&local, &local_size) < 0 || getpeername(socket, (struct sockaddr*)&remote, &remote_size) < 0)
+    {
+        return 0;
+    }
+
+    int same_host = 0;
+
+    if (local.ss_family == AF_INET && remote.ss_family == AF_INET)
+    {
+        same_host = ((struct sockaddr_in*)&local)->sin_addr.s_addr == ((struct sockaddr_in*)&remote)->sin_addr.s_addr;
+    }
+    else if (local.ss_family == AF_INET6 && remote.ss_family == AF_INET6)
+    {
+        same_host = memcmp(&((struct sockaddr_in6*)&local)->sin6_addr, &((struct sockaddr_in6*)&remote)->sin6_addr, sizeof(struct in6_addr)) == 0;
+    }
+
+    if (!same_host)
+    {
+        return 0;
+    }
+
+    unsigned long inode = listening_inode("/proc/net/tcp", port);
+
+    if (!inode)
+    {
+        inode = listening_inode("/proc/net/tcp6", port);
+    }
+
+    return inode ? socket_owner(inode) : 0;
+}
+
+/* in nanoseconds of user and system time, returns non-zero if the process can't be read */
+static int process_cpu_time(pid_t pid, uint64_t* time)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%i/stat", pid);
+
+    FILE* file = fopen(path, "r");
+
+    if (!file)
+    {
+        return 1;
+    }
+
+    char line[1024];
+    int failed = 1;
+
+    if (fgets(line, sizeof(line), file))
+    {
+        /* the name in parentheses can contain spaces, the fields after it can't */
+        char* fields = strrchr(line, ')');
+        unsigned long user;
+        unsigned long system;
+
+        if (fields && sscanf(fields + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &user, &system) == 2)
+        {
+            *time = (uint64_t)(user + system) * 1000000000 / sysconf(_SC_CLK_TCK);
+            failed = 0;
+        }
+    }
+
+    fclose(file);
+
+    return failed;
+}
+
+/* control packets are a few bytes a second, so the non-blocking socket always has room for them */
+static void loadtest_send(struct loadtest_connection* connection, int type, const unsigned char* data, int size)
+{
+    unsigned char packet[NETPW_PACKET_HEADER_SIZE + NETPW_PACKET_TIER_MAX_SIZE];
+
+    if (size < 0 || size > NETPW_PACKET_TIER_MAX_SIZE)
+    {
+        connection->write_failures++;
+        return;
+    }
+
+    int packet_size = packet_encode(packet, type, data, size);
+
+    if (transport_write(connection->transport, packet, packet_size) <= 0)
+    {
+        connection->write_failures++;
+    }
+}
+
+static void loadtest_ping(struct loadtest_connection* connection, uint64_t now)
+{
+    unsigned char ping[NETPW_PACKET_PING_SIZE];
+    packet_write_u64(ping, now);
+
+    loadtest_send(connection, NETPW_PACKET_PING, ping, sizeof(ping));
+}
+
+static void loadtest_audio(struct loadtest_connection* connection, uint64_t now)
+{
+    uint64_t gap = now - connection->last_audio;
+
+    if (gap > connection->loadtest->stall_threshold)
+    {
+        connection->stall_count++;
+    }
+
+    if (gap > connection->longest_gap)
+    {
+        connection->longest_gap = gap;
+    }
+
+    connection->last_audio = now;
+}
+
+/* answers the server the way a client's network layer would, so that the server treats these like any other client */
+static void loadtest_on_packet(void* userdata, int type, const unsigned char* data, int size)
+{
+    struct loadtest_connection* connection = userdata;
+
+    uint64_t now = get_time();
+
+    switch (type)
+    {
+    case NETPW_PACKET_AUDIO :
+    case NETPW_PACKET_SILENCE :
+        /* stalls are measured from the packets' arrival, the audio itself is dropped */
+        loadtest_audio(connection, now);
+        break;
+    case NETPW_PACKET_PING :
+        if (size == NETPW_PACKET_PING_SIZE)
+        {
+            unsigned char pong[NETPW_PACKET_PONG_SIZE];
+            memcpy(pong, data, NETPW_PACKET_PING_SIZE);
+            packet_write_u64(pong + NETPW_PACKET_PING_SIZE, now);
+
+            loadtest_send(connection, NETPW_PACKET_PONG, pong, sizeof(pong));
+        }
+        break;
+    case NETPW_PACKET_PONG :
+        if (size == NETPW_PACKET_PONG_SIZE)
+        {
+            clock_sync_update(connection->clock_sync, packet_read_u64(data), packet_read_u64(data + 8), now);
+        }
+        break;
+    case NETPW_PACKET_TIMESTAMP :
+        if (size == NETPW_PACKET_TIMESTAMP_SIZE && clock_sync_ready(connection->clock_sync))
+        {
+            unsigned char timestamp[NETPW_PACKET_LOCAL_TIMESTAMP_SIZE];
+            clock_sync_localize_timestamp(connection->clock_sync, data, timestamp, now);
+
+            uint64_t capture = packet_read_u64(timestamp);
+            uint64_t receive = packet_read_u64(timestamp + 24);
+
+            connection->latencies[connection->latency_count++ % NETPW_LOADTEST_MAX_SAMPLES] = receive > capture ? receive - capture : 0;
+        }
+        break;
+    }
+
+    if (clock_sync_ping_due(connection->clock_sync, now))
+    {
+        loadtest_ping(connection, now);
+    }
+
+    unsigned char report[NETPW_PACKET_REPORT_SIZE];
+
+    if (rate_control_report_due(connection->rate_control, now, report))
+    {
+        loadtest_send(connection, NETPW_PACKET_REPORT, report, sizeof(report));
+    }
+}
+
+static void loadtest_close(struct loadtest_worker* worker, struct loadtest_connection* connection)
+{
+    int result;
+
+    CHECK_ERRNO(epoll_ctl(worker->epoll, EPOLL_CTL_DEL, connection->socket, NULL));
+    connection->open = 0;
+    connection->closed_time = get_time();
+}
+
+/* reads until the socket is drained, TLS can hold records the socket no longer signals */
+static void loadtest_receive(struct loadtest_worker* worker, struct loadtest_connection* connection)
+{
+    while (connection->open)
+    {
+        int size = transport_read_nonblocking(connection->transport, worker->buffer, NETPW_IO_BUFFER_SIZE);
+
+        if (size == NETPW_TRANSPORT_WOULD_BLOCK)
+        {
+            break;
+        }
+        else if (size <= 0)
+        {
+            loadtest_close(worker, connection);
+            break;
+        }
+
+        connection->received += size;
+        rate_control_receive(connection->rate_control, size);
+
+        if (packet_reader_feed(connection->reader, worker->buffer, size))
+        {
+            fprintf(stderr, "connection %i received malformed packet.\n", connection->index);
+            loadtest_close(worker, connection);
+        }
+    }
+}
+
+/* handshakes block, only the streaming afterwards is multiplexed */
+static void loadtest_connect(struct loadtest_worker* worker, struct loadtest_connection* connection)
+{
+    struct loadtest* loadtest = worker->loadtest;
+
+    int result;
+
+    uint64_t start = get_time();
+
+    CHECK_ERRNO_FATAL(connection->socket = socket(loadtest->address->ai_family, SOCK_STREAM | SOCK_CLOEXEC, 0));
+
+    tcp_configure(connection->socket, &loadtest->tcp);
+
+    if (connect(connection->socket, loadtest->address->ai_addr, loadtest->address->ai_addrlen) < 0)
+    {
+        fprintf(stderr, "connection %i failed to connect: %i\n", connection->index, errno);
+        return;
+    }
+
+    connection->transport = transport_connect(loadtest->ssl_context, connection->socket, loadtest->profile);
+
+    if (!connection->transport)
+    {
+        fprintf(stderr, "connection %i failed its handshake.\n", connection->index);
+        return;
+    }
+
+    connection->handshake_time = get_time() - start;
+    connection->reader = packet_reader_init(loadtest_on_packet, connection);
+    connection->clock_sync = clock_sync_init();
+    connection->rate_control = rate_control_init();
+    connection->latencies = malloc(NETPW_LOADTEST_MAX_SAMPLES * sizeof(uint64_t));
+    connection->open = 1;
+
+    if (loadtest->tier)
+    {
+        loadtest_send(connection, NETPW_PACKET_TIER, (const unsigned char*)loadtest->tier, strlen(loadtest->tier));
+    }
+
+    /* further pings are sent as packets arrive */
+    uint64_t now = get_time();
+    clock_sync_ping_due(connection->clock_sync, now);
+    loadtest_ping(connection, now);
+
+    int flags;
+    CHECK_ERRNO_FATAL(flags = fcntl(connection->socket, F_GETFL));
+    CHECK_ERRNO_FATAL(fcntl(connection->socket, F_SETFL, flags | O_NONBLOCK));
+
+    struct epoll_event event = {
+        .events = EPOLLIN | EPOLLRDHUP,
+        .data.ptr = connection
+    };
+
+    CHECK_ERRNO_FATAL(epoll_ctl(worker->epoll, EPOLL_CTL_ADD, connection->socket, &event));
+}
+
+/* reads whatever is waiting, for up to timeout milliseconds */
+static void loadtest_poll(struct loadtest_worker* worker, int timeout)
+{
+    struct epoll_event events[NETPW_LOADTEST_MAX_EVENTS];
+
+    int count = epoll_wait(worker->epoll, events, NETPW_LOADTEST_MAX_EVENTS, timeout);
+
+    int i;
+    for (i = 0; i < count; i++)
+    {
+        struct loadtest_connection* connection = events[i].data.ptr;
+
+        loadtest_receive(worker, connection);
+
+        if (connection->open && (events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)))
+        {
+            loadtest_close(worker, connection);
+        }
+    }
+}
+
+static int loadtest_all_connected(struct loadtest* loadtest)
+{
+    return __atomic_load_n(&loadtest->connected_workers, __ATOMIC_ACQUIRE) == loadtest->thread_count;
+}
+
+static void* loadtest_work(void* arg)
+{
+    struct loadtest_worker* worker = arg;
+    struct loadtest* loadtest = worker->loadtest;
+
+    trace_thread_name("loadtest worker");
+
+    /* connections already made are read between handshakes, so the server never blocks on one left unread during the ramp */
+    int i;
+    for (i = 0; i < worker->connection_count; i++)
+    {
+        loadtest_connect(worker, &worker->connections[i]);
+        loadtest_poll(worker, 0);
+    }
+
+    __atomic_add_fetch(&loadtest->connected_workers, 1, __ATOMIC_RELEASE);
+
+    while (!loadtest_all_connected(loadtest))
+    {
+        loadtest_poll(worker, NETPW_LOADTEST_POLL_INTERVAL);
+    }
+
+    uint64_t start = get_time();
+    uint64_t end = start + loadtest->duration;
+
+    /* whatever queued while the other connections were being made isn't measured */
+    for (i = 0; i < worker->connection_count; i++)
+    {
+        struct loadtest_connection* connection = &worker->connections[i];
+
+        connection->received = 0;
+        connection->last_audio = start;
+        connection->stall_count = 0;
+        connection->longest_gap = 0;
+        connection->latency_count = 0;
+    }
+
+    while (1)
+    {
+        uint64_t now = get_time();
+
+        if (now >= end)
+        {
+            break;
+        }
+
+        loadtest_poll(worker, (end - now + 999999) / 1000000);
+    }
+
+    /* a connection that went quiet before the end stalled as well, the last wait can end after packets later than end were read */
+    uint64_t stop = get_time();
+
+    for (i = 0; i < worker->connection_count; i++)
+    {
+        struct loadtest_connection* connection = &worker->connections[i];
+
+        if (connection->open)
+        {
+            loadtest_audio(connection, stop);
+        }
+    }
+
+    return NULL;
+}
+
+/* each connection needs a descriptor and the soft limit is often only 1024 */
+static void raise_descriptor_limit(int connection_count)
+{
+    struct rlimit limit;
+
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max && limit.rlim_cur < (rlim_t)connection_count + 64)
+    {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+}
+
+static void loadtest_print_connection(const struct loadtest_connection* connection, uint64_t duration)
+{
+    if (!connection->transport)
+    {
+        printf("connection %i: failed to connect.\n", connection->index);
+        return;
+    }
+
+    int latency_count = min(connection->latency_count, NETPW_LOADTEST_MAX_SAMPLES);
+
+    printf("connection %i: handshake %.1f ms, %.1f kbit/s, ",
+        connection->index,
+        connection->handshake_time / 1000000.0,
+        connection->received * 8 * 1000000.0 / duration
+    );
+
+    if (latency_count > 0)
+    {
+        uint64_t median = percentile(connection->latencies, latency_count, 50);
+        uint64_t p99 = percentile(connection->latencies, latency_count, 99);
+
+        printf("latency median %.2f ms, 99th percentile %.2f ms, maximum %.2f ms, ",
+            median / 1000000.0,
+            p99 / 1000000.0,
+            connection->latencies[latency_count - 1] / 1000000.0
+        );
+    }
+    else
+    {
+        printf("no timestamps, ");
+    }
+
+    printf("%i stalls, longest gap %.1f ms%s.\n",
+        connection->stall_count,
+        connection->longest_gap / 1000000.0,
+        connection->open ? "" : ", disconnected"
+    );
+}
+
+int loadtest_run(
+    const char* host,
+    unsigned short port,
+    const char* ca_certificate,
+    const char* certificate,
+    const char* private_key,
+    enum crypto_profile profile,
+    const struct tcp_options* tcp,
+    const char* tier,
+    int connection_count,
+    int thread_count,
+    uint64_t duration,
+    int frequency,
+    int buffer_size
+)
+{
+    int result;
+
+    struct loadtest loadtest;
+
+    loadtest.ssl_context = client_context_init(ca_certificate, certificate, private_key, profile);
+    loadtest.address = NULL;
+    loadtest.profile = profile;
+    loadtest.tier = tier;
+    loadtest.duration = duration;
+
+    if (tcp)
+    {
+        loadtest.tcp = *tcp;
+    }
+    else
+    {
+        tcp_options_default(&loadtest.tcp);
+    }
+
+    uint64_t quantum_time = (uint64_t)buffer_size * 1000000000 / frequency;
+    loadtest.stall_threshold = NETPW_LOADTEST_STALL_QUANTA * quantum_time;
+
+    if (loadtest.stall_threshold < NETPW_LOADTEST_MIN_STALL)
+    {
+        loadtest.stall_threshold = NETPW_LOADTEST_MIN_STALL;
+    }
+
+    char port_string[6] = {0};
+    snprintf(port_string, 6, "%i", port);
+
+    CHECK_ERROR_FATAL(getaddrinfo(host, port_string, NULL, &loadtest.address));
+
+    raise_descriptor_limit(connection_count);
+
+    thread_count = max(min(thread_count, connection_count), 1);
+
+    struct loadtest_connection* connections = calloc(connection_count, sizeof(struct loadtest_connection));
+    struct loadtest_worker* workers = malloc(thread_count * sizeof(struct loadtest_worker));
+
+    loadtest.connected_workers = 0;
+    loadtest.thread_count = thread_count;
+
+    printf("opening %i connections to [%s]:%i on %i threads.\n", connection_count, host, port, thread_count);
+
+    int i;
+    for (i = 0; i < connection_count; i++)
+    {
+        connections[i].loadtest = &loadtest;
+        connections[i].index = i;
+        connections[i].socket = -1;
+    }
+
+    int first = 0;
+
+    for (i = 0; i < thread_count; i++)
+    {
+        struct loadtest_worker* worker = &workers[i];
+
+        /* the remainder goes to the first threads */
+        int count = connection_count / thread_count + (i < connection_count % thread_count);
+
+        worker->loadtest = &loadtest;
+        worker->connections = connections + first;
+        worker->connection_count = count;
+        CHECK_ERRNO_FATAL(worker->epoll = epoll_create1(EPOLL_CLOEXEC));
+        CHECK_ERROR_FATAL(pthread_create(&worker->thread, NULL, loadtest_work, worker));
+
+        first += count;
+    }
+
+    while (!loadtest_all_connected(&loadtest))
+    {
+        sleep_until(get_time() + NETPW_LOADTEST_POLL_INTERVAL * 1000000ULL);
+    }
+
+    uint64_t start = get_time();
+
+    int connected = 0;
+    pid_t server = 0;
+
+    for (i = 0; i < connection_count; i++)
+    {
+        if (connections[i].transport)
+        {
+            if (connected++ == 0)
+            {
+                server = find_server(connections[i].socket, port);
+            }
+        }
+    }
+
+    uint64_t server_start = 0;
+    uint64_t own_start = 0;
+
+    if (server && process_cpu_time(server, &server_start))
+    {
+        server = 0;
+    }
+
+    process_cpu_time(getpid(), &own_start);
+
+    if (connected > 0)
+    {
+        printf("%i connections up, measuring for %i seconds.\n", connected, (int)(duration / 1000000000));
+    }
+
+    for (i = 0; i < thread_count; i++)
+    {
+        CHECK_ERROR(pthread_join(workers[i].thread, NULL));
+        CHECK_ERRNO(close(workers[i].epoll));
+    }
+
+    uint64_t elapsed = get_time() - start;
+    uint64_t server_end = 0;
+    uint64_t own_end = 0;
+    /* the pid may even have been reused if the server is gone */
+    int server_exited = server && (process_cpu_time(server, &server_end) || server_end < server_start);
+
+    process_cpu_time(getpid(), &own_end);
+
+    int failed = connected == 0;
+
+    if (failed)
+    {
+        fprintf(stderr, "no connection to the server could be made.\n");
+    }
+    else
+    {
+        printf("\n");
+
+        uint64_t received = 0;
+        int disconnected = 0;
+        int stall_count = 0;
+        int stalled = 0;
+        uint64_t longest_gap = 0;
+        int latency_count = 0;
+
+        /* pooled across connections for the totals */
+        for (i = 0; i < connection_count; i++)
+        {
+            latency_count += min(connections[i].latency_count, NETPW_LOADTEST_MAX_SAMPLES);
+        }
+
+        uint64_t* latencies = malloc(max(latency_count, 1) * sizeof(uint64_t));
+        latency_count = 0;
+
+        for (i = 0; i < connection_count; i++)
+        {
+            struct loadtest_connection* connection = &connections[i];
+
+            loadtest_print_connection(connection, duration);
+
+            if (!connection->transport)
+            {
+                continue;
+            }
+
+            received += connection->received;
+            disconnected += !connection->open;
+            stall_count += connection->stall_count;
+            stalled += connection->stall_count > 0;
+
+            if (connection->longest_gap > longest_gap)
+            {
+                longest_gap = connection->longest_gap;
+            }
+
+            int count = min(connection->latency_count, NETPW_LOADTEST_MAX_SAMPLES);
+
+            memcpy(latencies + latency_count, connection->latencies, count * sizeof(uint64_t));
+            latency_count += count;
+        }
+
+        printf("\n");
+        printf("connections: %i of %i up, %i disconnected during the test.\n", connected, connection_count, disconnected);
+        printf("throughput: %.1f Mbit/s in total, %.1f kbit/s per connection.\n",
+            received * 8 * 1000.0 / duration,
+            received * 8 * 1000000.0 / duration / connected
+        );
+
+        if (latency_count > 0)
+        {
+            uint64_t median = percentile(latencies, latency_count, 50);
+            uint64_t p99 = percentile(latencies, latency_count, 99);
+
+            printf("latency: median %.2f ms, 99th percentile %.2f ms, maximum %.2f ms.\n",
+                median / 1000000.0,
+                p99 / 1000000.0,
+                latencies[latency_count - 1] / 1000000.0
+            );
+        }
+        else
+        {
+            printf("latency: the server sent no timestamps.\n");
+        }
+
+        printf("stalls: %i on %i connections, longest gap %.1f ms, a stall being a gap over %.1f ms.\n",
+            stall_count,
+            stalled,
+            longest_gap / 1000000.0,
+            loadtest.stall_threshold / 1000000.0
+        );
+        printf("loadtest CPU: %.1f%%.\n", (own_end - own_start) * 100.0 / elapsed);
+
+        if (server_exited)
+        {
+            printf("server CPU: not visible, the server exited during the test.\n");
+        }
+        else if (server)
+        {
+            printf("server CPU: %.1f%% (pid %i).\n", (server_end - server_start) * 100.0 / elapsed, server);
+        }
+        else
+        {
+            printf("server CPU: not visible, the server is on another host or run by another user.\n");
+        }
+
+        free(latencies);
+    }
+
+    for (i = 0; i < connection_count; i++)
+    {
+        struct loadtest_connection* connection = &connections[i];
+
+        if (connection->transport)
+        {
+            transport_destroy(connection->transport);
+            packet_reader_destroy(connection->reader);
+            clock_sync_destroy(connection->clock_sync);
+            rate_control_destroy(connection->rate_control);
+            free(connection->latencies);
+        }
+
+        if (connection->socket >= 0)
+        {
+            CHECK_ERRNO(close(connection->socket));
+        }
+    }
+
+    freeaddrinfo(loadtest.address);
+    SSL_CTX_free(loadtest.ssl_context);
+    free(workers);
+    free(connections);
+
+    return failed;
+}
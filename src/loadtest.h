@@ -0,0 +1,51 @@
+/*
+Copyright 2025 Amini Allight
+
+This file is part of netpw.
+
+netpw is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+netpw is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with netpw. If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef NETPW_LOADTEST_H
+#define NETPW_LOADTEST_H
+
+#include "tcp_tuning.h"
+#include "transport.h"
+
+#include <stdint.h>
+
+/*
+ * opens connection_count clients to a server from one process, spread over thread_count threads which each wait on all of theirs at once
+ * once every connection is up the streams are consumed for duration nanoseconds, then latency, throughput and stalls are printed for each connection and in total
+ * blocks until done and returns non-zero if no connection could be made
+ */
+int loadtest_run(
+    const char* host,
+    unsigned short port,
+    const char* ca_certificate,
+    const char* certificate,
+    const char* private_key,
+    enum crypto_profile profile,
+    /* NULL for the defaults */
+    const struct tcp_options* tcp,
+    /* NULL for the server's default tier */
+    const char* tier,
+    int connection_count,
+    int thread_count,
+    uint64_t duration,
+    /* the server's, to tell a stall from the gap between two quanta */
+    int frequency,
+    int buffer_size
+);
+
+#endif
@@ -0,0 +1,428 @@
+/*
+Copyright 2025 Amini Allight
+
+This file is part of netpw.
+
+netpw is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+netpw is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with netpw. If not, see <https://www.gnu.org/licenses/>.
+*/
+/* for memfd_create */
+#define _GNU_SOURCE
+
+#include "local_link.h"
+#include "error_handling.h"
+#include "constants.h"
+#include "tools.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+
+#define NETPW_LOCAL_LINK_MAGIC 0x6e657470776c6e6bULL
+#define NETPW_LOCAL_LINK_HEADER_SIZE 4096
+#define NETPW_LOCAL_LINK_SIZE (NETPW_LOCAL_LINK_HEADER_SIZE + 2 * NETPW_LOCAL_RING_SIZE)
+/* the memory followed by an eventfd each for data and space in both rings */
+#define NETPW_LOCAL_LINK_FD_COUNT 5
+
+/* the positions only ever grow, each is written by one side and kept on its own cache line */
+struct local_ring
+{
+    uint64_t head;
+    unsigned char head_padding[56];
+    uint64_t tail;
+    unsigned char tail_padding[56];
+    /* set by a side about to sleep, whoever moves the other position wakes it */
+    uint32_t reader_waiting;
+    unsigned char reader_padding[60];
+    uint32_t writer_waiting;
+    unsigned char writer_padding[60];
+};
+
+struct local_header
+{
+    uint64_t magic;
+    uint64_t ring_size;
+    /* the creating side writes the first */
+    struct local_ring rings[2];
+};
+
+struct local_link
+{
+    int socket;
+    struct local_header* header;
+    struct local_ring* send;
+    struct local_ring* receive;
+    unsigned char* send_data;
+    unsigned char* receive_data;
+    int fds[NETPW_LOCAL_LINK_FD_COUNT];
+    int send_data_event;
+    int send_space_event;
+    int receive_data_event;
+    int receive_space_event;
+};
+
+static void local_link_close_fds(int* fds, int count)
+{
+    int result;
+
+    int i;
+    for (i = 0; i < count; i++)
+    {
+        if (fds[i] >= 0)
+        {
+            CHECK_ERRNO(close(fds[i]));
+        }
+    }
+}
+
+static struct local_link* local_link_init(int socket, int* fds, int creator)
+{
+    struct local_link* link = malloc(sizeof(struct local_link));
+
+    link->socket = socket;
+    memcpy(link->fds, fds, sizeof(link->fds));
+
+    link->header = mmap(NULL, NETPW_LOCAL_LINK_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+
+    if (link->header == MAP_FAILED)
+    {
+        fprintf(stderr, "failed to map shared memory: %i\n", errno);
+        local_link_close_fds(fds, NETPW_LOCAL_LINK_FD_COUNT);
+        free(link);
+        return NULL;
+    }
+
+    unsigned char* rings = (unsigned char*)link->header + NETPW_LOCAL_LINK_HEADER_SIZE;
+
+    link->send = &link->header->rings[creator ? 0 : 1];
+    link->receive = &link->header->rings[creator ? 1 : 0];
+    link->send_data = rings + (creator ? 0 : NETPW_LOCAL_RING_SIZE);
+    link->receive_data = rings + (creator ? NETPW_LOCAL_RING_SIZE : 0);
+    link->send_data_event = fds[creator ? 1 : 3];
+    link->send_space_event = fds[creator ? 2 : 4];
+    link->receive_data_event = fds[creator ? 3 : 1];
+    link->receive_space_event = fds[creator ? 4 : 2];
+
+    return link;
+}
+
+struct local_link* local_link_create(int socket)
+{
+    int result;
+
+    int fds[NETPW_LOCAL_LINK_FD_COUNT];
+    memset(fds, -1, sizeof(fds));
+
+    CHECK_ERRNO(fds[0] = memfd_create("netpw", MFD_CLOEXEC | MFD_ALLOW_SEALING));
+
+    if (result < 0)
+    {
+        return NULL;
+    }
+
+    /* sealed so the peer can't shrink it and fault every access from this side */
+    CHECK_ERRNO(ftruncate(fds[0], NETPW_LOCAL_LINK_SIZE));
+
+    if (result == 0)
+    {
+        CHECK_ERRNO(fcntl(fds[0], F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL));
+    }
+
+    int i;
+    for (i = 1; i < NETPW_LOCAL_LINK_FD_COUNT && result >= 0; i++)
+    {
+        CHECK_ERRNO(fds[i] = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK));
+    }
+
+    if (result < 0)
+    {
+        local_link_close_fds(fds, NETPW_LOCAL_LINK_FD_COUNT);
+        return NULL;
+    }
+
+    struct local_link* link = local_link_init(socket, fds, 1);
+
+    if (!link)
+    {
+        return NULL;
+    }
+
+    /* a fresh memfd is already zeroed, so the rings start empty */
+    link->header->magic = NETPW_LOCAL_LINK_MAGIC;
+    link->header->ring_size = NETPW_LOCAL_RING_SIZE;
+
+    unsigned char byte = 0;
+    struct iovec part = { &byte, 1 };
+
+    union
+    {
+        struct cmsghdr header;
+        unsigned char data[CMSG_SPACE(sizeof(fds))];
+    } control;
+    memset(&control, 0, sizeof(control));
+
+    struct msghdr message = {0};
+    message.msg_iov = &part;
+    message.msg_iovlen = 1;
+    message.msg_control = control.data;
+    message.msg_controllen = sizeof(control.data);
+
+    struct cmsghdr* header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(header), fds, sizeof(fds));
+
+    CHECK_ERRNO(sendmsg(socket, &message, MSG_NOSIGNAL));
+
+    if (result < 0)
+    {
+        local_link_destroy(link);
+        return NULL;
+    }
+
+    return link;
+}
+
+struct local_link* local_link_open(int socket)
+{
+    int result;
+
+    int fds[NETPW_LOCAL_LINK_FD_COUNT];
+    memset(fds, -1, sizeof(fds));
+
+    unsigned char byte;
+    struct iovec part = { &byte, 1 };
+
+    union
+    {
+        struct cmsghdr header;
+        unsigned char data[CMSG_SPACE(sizeof(fds))];
+    } control;
+
+    struct msghdr message = {0};
+    message.msg_iov = &part;
+    message.msg_iovlen = 1;
+    message.msg_control = control.data;
+    message.msg_controllen = sizeof(control.data);
+
+    CHECK_ERRNO(recvmsg(socket, &message, MSG_CMSG_CLOEXEC));
+
+    if (result <= 0)
+    {
+        return NULL;
+    }
+
+    struct cmsghdr* header = CMSG_FIRSTHDR(&message);
+
+    if (!header || header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS || header->cmsg_len != CMSG_LEN(sizeof(fds)))
+    {
+        fprintf(stderr, "peer did not offer shared memory.\n");
+
+        /* whatever did arrive is closed rather than leaked */
+        if (header && header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_RIGHTS)
+        {
+            local_link_close_fds((int*)CMSG_DATA(header), (header->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+        }
+
+        return NULL;
+    }
+
+    memcpy(fds, CMSG_DATA(header), sizeof(fds));
+
+    /* the same protection the other side gives itself */
+    struct stat status;
+    int seals = fcntl(fds[0], F_GET_SEALS);
+
+    if (fstat(fds[0], &status) != 0 || status.st_size < NETPW_LOCAL_LINK_SIZE || seals < 0 || !(seals & F_SEAL_SHRINK))
+    {
+        fprintf(stderr, "peer offered unsuitable shared memory.\n");
+        local_link_close_fds(fds, NETPW_LOCAL_LINK_FD_COUNT);
+        return NULL;
+    }
+
+    struct local_link* link = local_link_init(socket, fds, 0);
+
+    if (!link)
+    {
+        return NULL;
+    }
+
+    if (link->header->magic != NETPW_LOCAL_LINK_MAGIC || link->header->ring_size != NETPW_LOCAL_RING_SIZE)
+    {
+        fprintf(stderr, "peer offered shared memory of another version.\n");
+        local_link_destroy(link);
+        return NULL;
+    }
+
+    return link;
+}
+
+static void local_link_signal(int event)
+{
+    uint64_t one = 1;
+
+    /* a full counter already means a wakeup is pending */
+    if (write(event, &one, sizeof(one)) < 0 && errno != EAGAIN)
+    {
+        fprintf(stderr, "failed to signal shared memory peer: %i\n", errno);
+    }
+}
+
+/* returns non-zero once the socket shows the link is closed */
+static int local_link_wait(struct local_link* link, int event)
+{
+    struct pollfd fds[2] = {
+        { event, POLLIN, 0 },
+        { link->socket, POLLIN, 0 }
+    };
+
+    while (poll(fds, 2, -1) < 0)
+    {
+        if (errno != EINTR)
+        {
+            return 1;
+        }
+    }
+
+    /* nothing is sent over the socket after the handover, so anything there is the end of it */
+    if (fds[1].revents)
+    {
+        return 1;
+    }
+
+    uint64_t count;
+    if (read(event, &count, sizeof(count)) < 0 && errno != EAGAIN)
+    {
+        return 1;
+    }
+
+    return 0;
+}
+
+int local_link_read(struct local_link* link, unsigned char* buffer, int size)
+{
+    struct local_ring* ring = link->receive;
+    uint64_t tail = ring->tail;
+
+    while (1)
+    {
+        uint64_t available = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) - tail;
+
+        /* the peer controls the positions, they can't be trusted to be sensible */
+        if (available > NETPW_LOCAL_RING_SIZE)
+        {
+            fprintf(stderr, "shared memory peer corrupted its ring.\n");
+            return -1;
+        }
+
+        if (available > 0)
+        {
+            int count = min(size, available);
+            int offset = tail % NETPW_LOCAL_RING_SIZE;
+            int first = min(count, NETPW_LOCAL_RING_SIZE - offset);
+
+            memcpy(buffer, link->receive_data + offset, first);
+            memcpy(buffer + first, link->receive_data, count - first);
+
+            __atomic_store_n(&ring->tail, tail + count, __ATOMIC_SEQ_CST);
+
+            if (__atomic_exchange_n(&ring->writer_waiting, 0, __ATOMIC_SEQ_CST))
+            {
+                local_link_signal(link->receive_space_event);
+            }
+
+            return count;
+        }
+
+        /* checked again after announcing the wait, so a write in between is never missed */
+        __atomic_store_n(&ring->reader_waiting, 1, __ATOMIC_SEQ_CST);
+
+        if (__atomic_load_n(&ring->head, __ATOMIC_SEQ_CST) != tail)
+        {
+            continue;
+        }
+
+        if (local_link_wait(link, link->receive_data_event))
+        {
+            return 0;
+        }
+    }
+}
+
+int local_link_write(struct local_link* link, const unsigned char* data, int size)
+{
+    struct local_ring* ring = link->send;
+    uint64_t head = ring->head;
+
+    int written = 0;
+
+    while (written < size)
+    {
+        uint64_t used = head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+        if (used > NETPW_LOCAL_RING_SIZE)
+        {
+            fprintf(stderr, "shared memory peer corrupted its ring.\n");
+            return -1;
+        }
+
+        if (used == NETPW_LOCAL_RING_SIZE)
+        {
+            __atomic_store_n(&ring->writer_waiting, 1, __ATOMIC_SEQ_CST);
+
+            if (head - __atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST) == NETPW_LOCAL_RING_SIZE && local_link_wait(link, link->send_space_event))
+            {
+                return -1;
+            }
+
+            continue;
+        }
+
+        int count = min(size - written, NETPW_LOCAL_RING_SIZE - used);
+        int offset = head % NETPW_LOCAL_RING_SIZE;
+        int first = min(count, NETPW_LOCAL_RING_SIZE - offset);
+
+        memcpy(link->send_data + offset, data + written, first);
+        memcpy(link->send_data, data + written + first, count - first);
+
+        head += count;
+        written += count;
+
+        __atomic_store_n(&ring->head, head, __ATOMIC_SEQ_CST);
+
+        if (__atomic_exchange_n(&ring->reader_waiting, 0, __ATOMIC_SEQ_CST))
+        {
+            local_link_signal(link->send_data_event);
+        }
+    }
+
+    return size;
+}
+
+void local_link_destroy(struct local_link* link)
+{
+    int result;
+
+    CHECK_ERRNO(munmap(link->header, NETPW_LOCAL_LINK_SIZE));
+    local_link_close_fds(link->fds, NETPW_LOCAL_LINK_FD_COUNT);
+    free(link);
+}
@@ -0,0 +1,39 @@
+/*
+Copyright 2025 Amini Allight
+
+This file is part of netpw.
+
+netpw is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+netpw is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with netpw. If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef NETPW_LOCAL_LINK_H
+#define NETPW_LOCAL_LINK_H
+
+/*
+ * a ring in each direction in memory shared between two processes on one host, handed over a Unix socket
+ * the socket stays open to notice when either side leaves
+ */
+struct local_link;
+
+/* the accepting side creates the memory, both return NULL on failure */
+struct local_link* local_link_create(int socket);
+struct local_link* local_link_open(int socket);
+
+/* return the number of bytes read or written, or zero or less once the link is closed or broken */
+int local_link_read(struct local_link* link, unsigned char* buffer, int size);
+int local_link_write(struct local_link* link, const unsigned char* data, int size);
+
+/* leaves the socket open */
+void local_link_destroy(struct local_link* link);
+
+#endif
@@ -50,4 +50,14 @@ int lockfree_spsc_queue_push(struct lockfree_spsc_queue* queue, const unsigned c
     return queue->queue.push(data, size);
 }
 
+int lockfree_spsc_queue_size(struct lockfree_spsc_queue* queue)
+{
+    return queue->queue.read_available();
+}
+
+int lockfree_spsc_queue_space(struct lockfree_spsc_queue* queue)
+{
+    return queue->queue.write_available();
+}
+
 }
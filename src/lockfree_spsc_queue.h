@@ -25,5 +25,9 @@ int lockfree_spsc_queue_init(struct lockfree_spsc_queue** queue);
 void lockfree_spsc_queue_destroy(struct lockfree_spsc_queue* queue);
 int lockfree_spsc_queue_pull(struct lockfree_spsc_queue* queue, unsigned char* data, int size);
 int lockfree_spsc_queue_push(struct lockfree_spsc_queue* queue, const unsigned char* data, int size);
+/* only accurate when called from the consumer */
+int lockfree_spsc_queue_size(struct lockfree_spsc_queue* queue);
+/* only accurate when called from the producer */
+int lockfree_spsc_queue_space(struct lockfree_spsc_queue* queue);
 
 #endif
@@ -24,20 +24,112 @@ along with netpw. If not, see <https://www.gnu.org/licenses/>.
 #include "audio_output.h"
 #include "coding.h"
 #include "cryptography.h"
+#include "packet.h"
+#include "silence.h"
+#include "metrics.h"
+#include "trace.h"
+#include "identity.h"
+#include "relay.h"
+#include "probe.h"
+#include "loadtest.h"
+#include "recorder.h"
+#include "error_handling.h"
 
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <getopt.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+
+enum latency_stage
+{
+    NETPW_LATENCY_CAPTURE,
+    NETPW_LATENCY_QUEUE,
+    NETPW_LATENCY_NETWORK,
+    NETPW_LATENCY_JITTER_BUFFER,
+    NETPW_LATENCY_PLAYBACK,
+    NETPW_LATENCY_STAGE_COUNT
+};
+
+static const char* latency_stage_names[NETPW_LATENCY_STAGE_COUNT] = {
+    "capture",
+    "queue",
+    "network",
+    "jitter buffer",
+    "playback"
+};
+
+static const char* latency_stage_labels[NETPW_LATENCY_STAGE_COUNT] = {
+    "capture",
+    "queue",
+    "network",
+    "jitter_buffer",
+    "playback"
+};
+
+struct connection
+{
+    char* name;
+    struct audio_output_stream* stream;
+    struct coding_context* coding_ctx;
+    /* the tier last announced by the server, NULL until the first announcement */
+    char* tier;
+    int tier_announcements;
+    uint64_t last_latency_report;
+    /* always PCM as it is recorded after decoding, NULL if not recording */
+    struct recorder* recorder;
+    struct metric* latency_metrics[NETPW_LATENCY_STAGE_COUNT];
+};
+
+/* a tier announcement received before the playback stream existed, as it arrived */
+struct pending_tier
+{
+    unsigned char data[NETPW_PACKET_TIER_MAX_SIZE];
+    int size;
+};
+
+struct tier;
+
+/* replaced by a new one whenever the bitrate is adapted */
+struct encoder
+{
+    struct tier* tier;
+    struct coding_context* coding_ctx;
+};
+
+/* one encoding of the captured audio, PCM if there are no coding options */
+struct tier
+{
+    const char* name;
+    int coding_argc;
+    char** coding_argv;
+    /* NULL for PCM, swapped with both locks held */
+    struct encoder* encoder;
+    /* held by the audio thread while feeding the encoder */
+    pthread_mutex_t coding_lock;
+    /* held by codec threads while sending, as an outgoing encoder may still be flushing */
+    pthread_mutex_t send_lock;
+    /* in kbit/s, zero if the coding options decide */
+    int bitrate;
+    uint64_t last_timestamp;
+    /* records what the tier sends, NULL if not recording */
+    struct recorder* recorder;
+};
 
 static struct server* server = NULL;
 static struct client* client = NULL;
+static struct relay* relay = NULL;
 static struct audio_input* audio_input = NULL;
 static struct audio_output* audio_output = NULL;
-static struct coding_context* coding_ctx = NULL;
+static struct silence_detector* silence_detector = NULL;
+static struct connection* playback = NULL;
 
 static const char* host;
 static unsigned short port = 8000;
+static const char* upstream_host = NULL;
+static unsigned short upstream_port = 8000;
 static const char* ca = NULL;
 static const char* privkey = NULL;
 static const char* cert = NULL;
@@ -45,151 +137,1042 @@ static int frequency = 48000;
 static int channels = 2;
 static int depth = 16;
 static int buffer_size = 512;
+static int silence_detection = 0;
+static double silence_threshold = -70;
+static int silence_hangover = 200;
+static int metrics_port = 0;
+static int latency_reporting = 0;
+static enum audio_backend audio_backend = NETPW_AUDIO_BACKEND_NONE;
+static const char* audio_file = NULL;
+static const char* trace_directory = NULL;
+static enum key_type key_type = NETPW_KEY_TYPE_ED25519;
+static const char* identity_directory = NULL;
+static int identity_rotation = 0;
+static enum crypto_profile crypto_profile = NETPW_CRYPTO_PROFILE_AUTO;
+static int allow_plaintext = 0;
+static struct server_limits server_limits;
+static struct tcp_options tcp_options;
+static uint64_t capture_time = 0;
+static uint64_t process_time = 0;
 static int coding_argc = 0;
 static char** coding_argv = NULL;
+static const char** tier_options = NULL;
+static int tier_option_count = 0;
+static struct tier* tiers = NULL;
+static int tier_count = 0;
+static const char* requested_tier = NULL;
+static int adaptive_bitrate = 0;
+static const char* record_directory = NULL;
+static uint64_t record_size = 0;
+static uint64_t record_duration = 0;
+static const char* local_path = NULL;
+static const char* probe_config_path = NULL;
+static int loadtest_connections = 0;
+static int loadtest_threads = 0;
+static int loadtest_duration = 0;
+static int min_bitrate = 0;
+static int max_bitrate = 0;
+static int adaptation_stopping = 0;
+static pthread_mutex_t adaptation_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t adaptation_condition;
+static pthread_t adaptation_thread;
+static struct metric* bitrate_metric = NULL;
 static int ready = 0;
+static pthread_mutex_t ready_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ready_condition = PTHREAD_COND_INITIALIZER;
+static pthread_t network_thread;
+static void (*network_setup)() = NULL;
+static uint64_t start_time = 0;
+static int first_audio = 0;
+static struct pending_tier pending_tiers[NETPW_PENDING_TIER_COUNT];
+static int pending_tier_count = 0;
+
+static int is_ready()
+{
+    return __atomic_load_n(&ready, __ATOMIC_ACQUIRE);
+}
+
+static void set_ready()
+{
+    pthread_mutex_lock(&ready_lock);
+    __atomic_store_n(&ready, 1, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&ready_condition);
+    pthread_mutex_unlock(&ready_lock);
+}
 
-static void on_audio_read(const unsigned char* data, int size)
+static void wait_until_ready()
 {
-    if (!ready)
+    pthread_mutex_lock(&ready_lock);
+    while (!is_ready())
+    {
+        pthread_cond_wait(&ready_condition, &ready_lock);
+    }
+    pthread_mutex_unlock(&ready_lock);
+}
+
+static void report_first_audio()
+{
+    if (__atomic_exchange_n(&first_audio, 1, __ATOMIC_RELAXED))
     {
         return;
     }
 
-    if (coding_ctx)
+    printf("first audio received %.1f ms after startup.\n", (get_time() - start_time) / 1000000.0);
+}
+
+static void network_send(int tier, int type, const unsigned char* data, int size)
+{
+    /* both stay NULL until the network comes up in parallel with the audio, until then input is dropped */
+    struct server* current_server = __atomic_load_n(&server, __ATOMIC_ACQUIRE);
+    struct client* current_client = __atomic_load_n(&client, __ATOMIC_ACQUIRE);
+
+    if (current_server)
     {
-        coding_send(coding_ctx, data, size);
+        server_send(current_server, tier, type, data, size);
     }
-    else
+    else if (current_client && type == NETPW_PACKET_AUDIO && !tiers[tier].coding_argv)
     {
-        if (server)
+        client_send_droppable(current_client, type, data, size);
+    }
+    else if (current_client)
+    {
+        client_send(current_client, type, data, size);
+    }
+}
+
+static void send_timestamp(struct tier* tier)
+{
+    uint64_t now = get_time();
+
+    if (now - tier->last_timestamp < NETPW_TIMESTAMP_INTERVAL)
+    {
+        return;
+    }
+
+    tier->last_timestamp = now;
+
+    unsigned char timestamp[NETPW_PACKET_TIMESTAMP_SIZE];
+    packet_write_u64(timestamp, __atomic_load_n(&capture_time, __ATOMIC_RELAXED));
+    packet_write_u64(timestamp + 8, __atomic_load_n(&process_time, __ATOMIC_RELAXED));
+    packet_write_u64(timestamp + 16, now);
+
+    network_send(tier - tiers, NETPW_PACKET_TIMESTAMP, timestamp, sizeof(timestamp));
+}
+
+static void on_audio_read(void* userdata, const unsigned char* data, int size)
+{
+    if (!is_ready())
+    {
+        return;
+    }
+
+    __atomic_store_n(&capture_time, audio_input_capture_time(audio_input), __ATOMIC_RELAXED);
+    __atomic_store_n(&process_time, audio_input_process_time(audio_input), __ATOMIC_RELAXED);
+
+    int silent = silence_detector && silence_detector_process(silence_detector, data, size);
+
+    /* encoded tiers are sent from their own codec threads, so each encoder can run on its own core */
+    int i;
+    for (i = 0; i < tier_count; i++)
+    {
+        struct tier* tier = &tiers[i];
+
+        /* encoded tiers record their encoder's output, silent input is recorded as it is */
+        if (tier->recorder && !tier->encoder)
+        {
+            recorder_write(tier->recorder, data, size);
+        }
+
+        if (tier->encoder)
+        {
+            pthread_mutex_lock(&tier->coding_lock);
+            coding_send(tier->encoder->coding_ctx, data, size);
+            pthread_mutex_unlock(&tier->coding_lock);
+        }
+        else if (silent)
         {
-            server_send(server, data, size);
+            unsigned char frames[4];
+            packet_write_u32(frames, size / (channels * (depth / 8)));
+
+            network_send(i, NETPW_PACKET_SILENCE, frames, sizeof(frames));
+        }
+        else
+        {
+            send_timestamp(tier);
+            network_send(i, NETPW_PACKET_AUDIO, data, size);
+        }
+    }
+}
+
+static void on_compressor_read(void* userdata, const unsigned char* data, int size)
+{
+    struct encoder* encoder = userdata;
+    struct tier* tier = encoder->tier;
+
+    if (!is_ready())
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&tier->send_lock);
+
+    /* the rest of a replaced encoder's output is dropped so the two streams never interleave */
+    if (tier->encoder == encoder)
+    {
+        /* the encoder's own delay can't be seen from here so it is left out of the queue stage */
+        send_timestamp(tier);
+        network_send(tier - tiers, NETPW_PACKET_AUDIO, data, size);
+
+        if (tier->recorder)
+        {
+            recorder_write(tier->recorder, data, size);
+        }
+    }
+
+    pthread_mutex_unlock(&tier->send_lock);
+}
+
+static struct encoder* encoder_init(struct tier* tier, int bitrate)
+{
+    struct encoder* encoder = malloc(sizeof(struct encoder));
+    encoder->tier = tier;
+
+    int argc = tier->coding_argc;
+    char** argv = malloc((argc + 2) * sizeof(char*));
+    memcpy(argv, tier->coding_argv, argc * sizeof(char*));
+
+    char rate[16] = {0};
+
+    /* FFmpeg uses the last of repeated options, so this overrides any bitrate in the coding options */
+    if (bitrate)
+    {
+        snprintf(rate, sizeof(rate), "%ik", bitrate);
+        argv[argc++] = "-b:a";
+        argv[argc++] = rate;
+    }
+
+    encoder->coding_ctx = coding_init_audio_encoder(
+        frequency,
+        channels,
+        depth,
+        argc,
+        argv,
+        on_compressor_read,
+        encoder
+    );
+
+    free(argv);
+
+    return encoder;
+}
+
+static void encoder_destroy(struct encoder* encoder)
+{
+    coding_destroy(encoder->coding_ctx);
+    free(encoder);
+}
+
+/* the new encoder is running before the old one stops, so the audio is never left without one */
+static void set_bitrate(struct tier* tier, int bitrate)
+{
+    struct encoder* encoder = encoder_init(tier, bitrate);
+
+    pthread_mutex_lock(&tier->coding_lock);
+    pthread_mutex_lock(&tier->send_lock);
+
+    struct encoder* previous = tier->encoder;
+    tier->encoder = encoder;
+    tier->bitrate = bitrate;
+
+    /* holding the send lock stands in for being the thread that sends the tier */
+    struct server* current_server = __atomic_load_n(&server, __ATOMIC_ACQUIRE);
+
+    if (current_server)
+    {
+        server_restart_stream(current_server, tier - tiers);
+    }
+
+    pthread_mutex_unlock(&tier->send_lock);
+    pthread_mutex_unlock(&tier->coding_lock);
+
+    encoder_destroy(previous);
+
+    metric_set(bitrate_metric, bitrate * 1000);
+    printf("encoder bitrate set to %i kbit/s.\n", bitrate);
+}
+
+static void* adapt_bitrate(void* arg)
+{
+    struct tier* tier = &tiers[0];
+
+    trace_thread_name("bitrate");
+
+    pthread_mutex_lock(&adaptation_lock);
+
+    while (!adaptation_stopping)
+    {
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += NETPW_RATE_REPORT_INTERVAL / 1000000000;
+
+        pthread_cond_timedwait(&adaptation_condition, &adaptation_lock, &deadline);
+
+        if (adaptation_stopping)
+        {
+            break;
         }
-        else if (client)
+
+        struct server* current_server = __atomic_load_n(&server, __ATOMIC_ACQUIRE);
+        struct client* current_client = __atomic_load_n(&client, __ATOMIC_ACQUIRE);
+
+        /* a server's single encoder has to suit its slowest client */
+        uint64_t available = 0;
+
+        if (current_server)
+        {
+            available = server_available_rate(current_server, 0);
+        }
+        else if (current_client)
+        {
+            available = client_available_rate(current_client);
+        }
+
+        if (available == 0)
+        {
+            continue;
+        }
+
+        /* a fifth is left for framing and for the estimate to probe upwards into */
+        int bitrate = (available * 4 / 5) / 1000;
+        bitrate = min(max(bitrate, min_bitrate), max_bitrate);
+
+        /* restarting the encoder costs a glitch, so small changes aren't worth it */
+        if (abs(bitrate - tier->bitrate) * 5 < tier->bitrate)
+        {
+            continue;
+        }
+
+        pthread_mutex_unlock(&adaptation_lock);
+        set_bitrate(tier, bitrate);
+        pthread_mutex_lock(&adaptation_lock);
+    }
+
+    pthread_mutex_unlock(&adaptation_lock);
+
+    return NULL;
+}
+
+static void start_adaptation()
+{
+    int result;
+
+    pthread_condattr_t attributes;
+    pthread_condattr_init(&attributes);
+    pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+    CHECK_ERROR_FATAL(pthread_cond_init(&adaptation_condition, &attributes));
+    pthread_condattr_destroy(&attributes);
+
+    bitrate_metric = metric_gauge_init("netpw_encoder_bits_per_second", "Bitrate the encoder was last started with.", NULL);
+    metric_set(bitrate_metric, tiers[0].bitrate * 1000);
+
+    CHECK_ERROR_FATAL(pthread_create(&adaptation_thread, NULL, adapt_bitrate, NULL));
+}
+
+static void stop_adaptation()
+{
+    pthread_mutex_lock(&adaptation_lock);
+    adaptation_stopping = 1;
+    pthread_cond_signal(&adaptation_condition);
+    pthread_mutex_unlock(&adaptation_lock);
+
+    pthread_join(adaptation_thread, NULL);
+    pthread_cond_destroy(&adaptation_condition);
+    metric_destroy(bitrate_metric);
+}
+
+static void on_decompressor_read(void* userdata, const unsigned char* data, int size)
+{
+    struct connection* connection = userdata;
+
+    if (!is_ready())
+    {
+        return;
+    }
+
+    audio_output_stream_send(connection->stream, data, size);
+
+    if (connection->recorder)
+    {
+        recorder_write(connection->recorder, data, size);
+    }
+}
+
+static void measure_latency(struct connection* connection, const unsigned char* data)
+{
+    uint64_t capture = packet_read_u64(data);
+    uint64_t process = packet_read_u64(data + 8);
+    uint64_t send = packet_read_u64(data + 16);
+    uint64_t receive = packet_read_u64(data + 24);
+
+    int64_t stages[NETPW_LATENCY_STAGE_COUNT] = {
+        process - capture,
+        send - process,
+        receive - send,
+        audio_output_stream_queue_latency(connection->stream),
+        audio_output_stream_playback_latency(connection->stream)
+    };
+
+    int64_t total = 0;
+
+    int i;
+    for (i = 0; i < NETPW_LATENCY_STAGE_COUNT; i++)
+    {
+        metric_set(connection->latency_metrics[i], stages[i] / 1000);
+        total += stages[i];
+    }
+
+    if (!latency_reporting || receive - connection->last_latency_report < NETPW_LATENCY_REPORT_INTERVAL)
+    {
+        return;
+    }
+
+    connection->last_latency_report = receive;
+
+    printf("latency from [%s]:", connection->name);
+
+    for (i = 0; i < NETPW_LATENCY_STAGE_COUNT; i++)
+    {
+        printf(" %s %.1f ms,", latency_stage_names[i], stages[i] / 1000000.0);
+    }
+
+    printf(" total %.1f ms.\n", total / 1000000.0);
+}
+
+/* the server announces the tier on connect and again after answering the request for one */
+static void receive_tier(struct connection* connection, int encoded, const char* name, int size)
+{
+    int changed = !connection->tier || strlen(connection->tier) != size || memcmp(connection->tier, name, size) != 0;
+    int restart = (connection->tier && changed) || encoded != (connection->coding_ctx != NULL);
+
+    free(connection->tier);
+    connection->tier = strndup(name, size);
+    connection->tier_announcements++;
+
+    if (requested_tier && strcmp(requested_tier, "auto") != 0 && connection->tier_announcements == 2 && strcmp(requested_tier, connection->tier) != 0)
+    {
+        printf("the server has no tier %s, receiving %s instead.\n", requested_tier, connection->tier);
+    }
+    else if (changed)
+    {
+        printf("receiving tier %s.\n", connection->tier);
+    }
+
+    if (!restart)
+    {
+        return;
+    }
+
+    /* a different tier may use a different codec, so its decoder starts afresh */
+    if (connection->coding_ctx)
+    {
+        coding_destroy(connection->coding_ctx);
+        connection->coding_ctx = NULL;
+    }
+
+    if (encoded)
+    {
+        connection->coding_ctx = coding_init_audio_decoder(
+            frequency,
+            channels,
+            depth,
+            coding_argc,
+            coding_argv,
+            on_decompressor_read,
+            connection
+        );
+    }
+}
+
+static void on_network_read(void* userdata, int type, const unsigned char* data, int size)
+{
+    /* the client may connect before its playback stream exists, so it has no userdata of its own */
+    struct connection* connection = userdata ? userdata : is_ready() ? playback : NULL;
+
+    if (!connection)
+    {
+        /* the server announces the tier on connect, usually before the stream exists, so announcements wait for it */
+        if (type == NETPW_PACKET_TIER && size >= 1 && size <= NETPW_PACKET_TIER_MAX_SIZE && pending_tier_count < NETPW_PENDING_TIER_COUNT)
+        {
+            memcpy(pending_tiers[pending_tier_count].data, data, size);
+            pending_tiers[pending_tier_count].size = size;
+            pending_tier_count++;
+        }
+        return;
+    }
+
+    /* only the client's one receive thread queues announcements, and it is the one handling them here */
+    if (!userdata && pending_tier_count > 0)
+    {
+        int i;
+        for (i = 0; i < pending_tier_count; i++)
+        {
+            receive_tier(connection, pending_tiers[i].data[0], (const char*)pending_tiers[i].data + 1, pending_tiers[i].size - 1);
+        }
+
+        pending_tier_count = 0;
+    }
+
+    /* only audio depends on the rest of the setup, control packets are handled as soon as there is a connection */
+    if (!is_ready() && type != NETPW_PACKET_TIER)
+    {
+        return;
+    }
+
+    switch (type)
+    {
+    case NETPW_PACKET_AUDIO :
+        report_first_audio();
+
+        if (connection->coding_ctx)
+        {
+            coding_send(connection->coding_ctx, data, size);
+        }
+        else
+        {
+            audio_output_stream_send(connection->stream, data, size);
+
+            if (connection->recorder)
+            {
+                recorder_write(connection->recorder, data, size);
+            }
+        }
+        break;
+    case NETPW_PACKET_SILENCE :
+    {
+        /* a longer run than the queue holds is refused outright, it could only stall playback */
+        int frames = packet_read_silence(data, size, channels * (depth / 8));
+
+        if (frames >= 0)
+        {
+            audio_output_stream_send_silence(connection->stream, frames);
+
+            if (connection->recorder)
+            {
+                recorder_write_silence(connection->recorder, frames);
+            }
+        }
+        break;
+    }
+    case NETPW_PACKET_TIMESTAMP :
+        if (size == NETPW_PACKET_LOCAL_TIMESTAMP_SIZE)
+        {
+            measure_latency(connection, data);
+        }
+        break;
+    case NETPW_PACKET_TIER :
+        if (size >= 1 && size <= NETPW_PACKET_TIER_MAX_SIZE)
+        {
+            receive_tier(connection, data[0], (const char*)data + 1, size - 1);
+        }
+        break;
+    }
+}
+
+static struct connection* connection_init(const char* name)
+{
+    struct connection* connection = malloc(sizeof(struct connection));
+
+    connection->name = strdup(name);
+    connection->stream = audio_output_stream_init(audio_output, name);
+    connection->coding_ctx = NULL;
+    connection->tier = NULL;
+    connection->tier_announcements = 0;
+    connection->last_latency_report = 0;
+    connection->recorder = NULL;
+
+    if (record_directory)
+    {
+        connection->recorder = recorder_init(record_directory, name, "wav", frequency, channels, depth, record_size, record_duration);
+    }
+
+    int i;
+    for (i = 0; i < NETPW_LATENCY_STAGE_COUNT; i++)
+    {
+        char labels[256];
+        snprintf(labels, sizeof(labels), "stream=\"%s\",stage=\"%s\"", name, latency_stage_labels[i]);
+
+        connection->latency_metrics[i] = metric_gauge_init("netpw_latency_microseconds", "Latest one-way latency of each stage between capture and playback.", labels);
+    }
+
+    if (coding_argv)
+    {
+        connection->coding_ctx = coding_init_audio_decoder(
+            frequency,
+            channels,
+            depth,
+            coding_argc,
+            coding_argv,
+            on_decompressor_read,
+            connection
+        );
+    }
+
+    return connection;
+}
+
+static void connection_destroy(struct connection* connection)
+{
+    if (connection->coding_ctx)
+    {
+        coding_destroy(connection->coding_ctx);
+    }
+
+    /* after the decoder, which may still be writing to it */
+    if (connection->recorder)
+    {
+        recorder_destroy(connection->recorder);
+    }
+
+    audio_output_stream_destroy(connection->stream);
+
+    int i;
+    for (i = 0; i < NETPW_LATENCY_STAGE_COUNT; i++)
+    {
+        metric_destroy(connection->latency_metrics[i]);
+    }
+
+    free(connection->tier);
+    free(connection->name);
+    free(connection);
+}
+
+static void* on_connect(void* userdata, const char* name)
+{
+    /* a client can arrive while the audio is still being set up */
+    wait_until_ready();
+
+    /* in output mode each remote source gets its own node */
+    if (!audio_output)
+    {
+        return NULL;
+    }
+
+    return connection_init(name);
+}
+
+static void on_disconnect(void* userdata, void* connection_userdata)
+{
+    struct connection* connection = connection_userdata;
+
+    if (!connection)
+    {
+        return;
+    }
+
+    connection_destroy(connection);
+}
+
+static void tier_init(struct tier* tier, const char* name, int coding_argc, char** coding_argv)
+{
+    int result;
+
+    tier->name = name;
+    tier->coding_argc = coding_argc;
+    tier->coding_argv = coding_argv;
+    tier->encoder = NULL;
+    CHECK_ERROR_FATAL(pthread_mutex_init(&tier->coding_lock, NULL));
+    CHECK_ERROR_FATAL(pthread_mutex_init(&tier->send_lock, NULL));
+    tier->bitrate = 0;
+    tier->last_timestamp = 0;
+    tier->recorder = NULL;
+}
+
+/* an input server defines its tiers with --tier, anything else names the tier to ask for with it */
+static void define_tiers(int defining)
+{
+    if (!defining && tier_option_count)
+    {
+        requested_tier = tier_options[tier_option_count - 1];
+
+        if (strlen(requested_tier) == 0 || strlen(requested_tier) >= NETPW_PACKET_TIER_MAX_SIZE)
+        {
+            fprintf(stderr, "tier names must be between 1 and %i characters long.\n", NETPW_PACKET_TIER_MAX_SIZE - 1);
+            exit(1);
+        }
+    }
+
+    if (!defining || tier_option_count == 0)
+    {
+        tiers = malloc(sizeof(struct tier));
+        tier_count = 1;
+
+        tier_init(&tiers[0], "default", coding_argc, coding_argv);
+        return;
+    }
+
+    if (coding_argv)
+    {
+        fprintf(stderr, "coding options after -- can't be combined with --tier, give each tier its own instead.\n");
+        exit(1);
+    }
+
+    tiers = malloc(tier_option_count * sizeof(struct tier));
+    tier_count = tier_option_count;
+
+    int i;
+    for (i = 0; i < tier_count; i++)
+    {
+        struct tier* tier = &tiers[i];
+
+        char* name = strdup(tier_options[i]);
+        char* options = strchr(name, '=');
+
+        tier_init(tier, name, 0, NULL);
+
+        if (options)
+        {
+            *options++ = '\0';
+
+            char* argument;
+            for (argument = strtok(options, " "); argument; argument = strtok(NULL, " "))
+            {
+                tier->coding_argv = realloc(tier->coding_argv, (tier->coding_argc + 1) * sizeof(char*));
+                tier->coding_argv[tier->coding_argc++] = argument;
+            }
+        }
+
+        if (strlen(name) == 0 || strlen(name) >= NETPW_PACKET_TIER_MAX_SIZE)
+        {
+            fprintf(stderr, "tier names must be between 1 and %i characters long.\n", NETPW_PACKET_TIER_MAX_SIZE - 1);
+            exit(1);
+        }
+
+        if (strcmp(name, "auto") == 0)
+        {
+            fprintf(stderr, "the tier name auto is reserved for clients that let the server choose.\n");
+            exit(1);
+        }
+
+        int j;
+        for (j = 0; j < i; j++)
+        {
+            if (strcmp(tiers[j].name, name) == 0)
+            {
+                fprintf(stderr, "tier %s is defined more than once.\n", name);
+                exit(1);
+            }
+        }
+    }
+}
+
+static void parse_arguments(int argc, char** argv)
+{
+    int defining_tiers = argc > 2 && strcmp(argv[1], "server") == 0 && strcmp(argv[2], "input") == 0;
+    /* a relay, a probe or a load test has no direction and no audio */
+    int relaying = strcmp(argv[1], "relay") == 0;
+    int probing = strcmp(argv[1], "probe") == 0;
+    int loadtesting = strcmp(argv[1], "loadtest") == 0;
+
+    argc -= relaying || probing || loadtesting ? 1 : 2;
+    argv += relaying || probing || loadtesting ? 1 : 2;
+
+    static const struct option options[] = {
+        { "host", required_argument, NULL, 'h' },
+        { "port", required_argument, NULL, 'p' },
+        { "ca", required_argument, NULL, 300 },
+        { "privkey", required_argument, NULL, 301 },
+        { "cert", required_argument, NULL, 302 },
+        { "frequency", required_argument, NULL, 'f' },
+        { "channels", required_argument, NULL, 'c' },
+        { "depth", required_argument, NULL, 'd' },
+        { "buffer", required_argument, NULL, 'b' },
+        { "silence-threshold", required_argument, NULL, 303 },
+        { "silence-hangover", required_argument, NULL, 304 },
+        { "metrics-port", required_argument, NULL, 305 },
+        { "latency", no_argument, NULL, 306 },
+        { "backend", required_argument, NULL, 307 },
+        { "file", required_argument, NULL, 308 },
+        { "trace", required_argument, NULL, 309 },
+        { "key-type", required_argument, NULL, 310 },
+        { "identity", required_argument, NULL, 311 },
+        { "identity-rotation", required_argument, NULL, 312 },
+        { "crypto", required_argument, NULL, 313 },
+        { "allow-plaintext", no_argument, NULL, 314 },
+        { "backlog", required_argument, NULL, 315 },
+        { "handshake-workers", required_argument, NULL, 316 },
+        { "max-clients", required_argument, NULL, 317 },
+        { "max-clients-per-address", required_argument, NULL, 318 },
+        { "handshake-rate", required_argument, NULL, 319 },
+        { "tier", required_argument, NULL, 320 },
+        { "adaptive-bitrate", required_argument, NULL, 321 },
+        { "latency-budget", required_argument, NULL, 322 },
+        { "congestion", required_argument, NULL, 323 },
+        { "upstream", required_argument, NULL, 324 },
+        { "record", required_argument, NULL, 325 },
+        { "record-size", required_argument, NULL, 326 },
+        { "record-duration", required_argument, NULL, 327 },
+        { "local", required_argument, NULL, 328 },
+        { "write-config", required_argument, NULL, 329 },
+        { "connections", required_argument, NULL, 330 },
+        { "threads", required_argument, NULL, 331 },
+        { "duration", required_argument, NULL, 332 },
+        { NULL, 0, NULL, 0 }
+    };
+
+    int result;
+
+    server_limits_default(&server_limits);
+    tcp_options_default(&tcp_options);
+
+    while (1)
+    {
+        result = getopt_long(argc, argv, "h:p:f:c:d:b:", options, NULL);
+
+        if (result < 0)
+        {
+            break;
+        }
+
+        switch (result)
+        {
+        case 'h' :
+            host = optarg;
+            break;
+        case 'p' :
+            port = atoi(optarg);
+            break;
+        case 300 :
+            ca = get_file(optarg);
+            break;
+        case 301 :
+            privkey = get_file(optarg);
+            break;
+        case 302 :
+            cert = get_file(optarg);
+            break;
+        case 'f' :
+            frequency = atoi(optarg);
+            break;
+        case 'c' :
+            channels = atoi(optarg);
+            break;
+        case 'd' :
+            depth = atoi(optarg);
+            break;
+        case 'b' :
+            buffer_size = atoi(optarg);
+            break;
+        case 303 :
+            silence_detection = 1;
+            silence_threshold = atof(optarg);
+            break;
+        case 304 :
+            silence_hangover = atoi(optarg);
+            break;
+        case 305 :
+            metrics_port = atoi(optarg);
+            break;
+        case 306 :
+            latency_reporting = 1;
+            break;
+        case 307 :
+            audio_backend = audio_backend_from_name(optarg);
+
+            if (audio_backend == NETPW_AUDIO_BACKEND_NONE)
+            {
+                fprintf(stderr, "unsupported audio backend: %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 308 :
+            audio_file = optarg;
+            break;
+        case 309 :
+            trace_directory = optarg;
+            break;
+        case 310 :
+            key_type = key_type_from_name(optarg);
+
+            if (key_type == NETPW_KEY_TYPE_NONE)
+            {
+                fprintf(stderr, "unsupported key type: %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 311 :
+            identity_directory = optarg;
+            break;
+        case 312 :
+            identity_rotation = atoi(optarg);
+            break;
+        case 313 :
+            crypto_profile = crypto_profile_from_name(optarg);
+
+            if (crypto_profile == NETPW_CRYPTO_PROFILE_NONE)
+            {
+                fprintf(stderr, "unsupported crypto profile: %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 314 :
+            allow_plaintext = 1;
+            break;
+        case 315 :
+            server_limits.backlog = max(atoi(optarg), 1);
+            break;
+        case 316 :
+            server_limits.handshake_workers = max(atoi(optarg), 1);
+            break;
+        case 317 :
+            server_limits.max_clients = atoi(optarg);
+            break;
+        case 318 :
+            server_limits.max_clients_per_address = atoi(optarg);
+            break;
+        case 319 :
+            server_limits.handshake_rate = atoi(optarg);
+            break;
+        case 320 :
+            tier_options = realloc(tier_options, (tier_option_count + 1) * sizeof(const char*));
+            tier_options[tier_option_count++] = optarg;
+            break;
+        case 321 :
+            if (sscanf(optarg, "%i-%i", &min_bitrate, &max_bitrate) != 2 || min_bitrate <= 0 || max_bitrate < min_bitrate)
+            {
+                fprintf(stderr, "the adaptive bitrate must be given as min-max in kbit/s.\n");
+                exit(1);
+            }
+
+            adaptive_bitrate = 1;
+            break;
+        case 322 :
+            tcp_options.latency_budget = (uint64_t)max(atoi(optarg), 0) * 1000000;
+            break;
+        case 323 :
+            tcp_options.congestion = optarg;
+            break;
+        case 324 :
+        {
+            char* separator = strrchr(optarg, ':');
+
+            if (separator)
+            {
+                *separator = '\0';
+                upstream_port = atoi(separator + 1);
+            }
+
+            upstream_host = optarg;
+            break;
+        }
+        case 325 :
+            record_directory = optarg;
+            break;
+        case 326 :
+            record_size = (uint64_t)max(atoi(optarg), 0) * 1024 * 1024;
+            break;
+        case 327 :
+            record_duration = (uint64_t)max(atoi(optarg), 0) * 1000000000;
+            break;
+        case 328 :
+            local_path = optarg;
+            break;
+        case 329 :
+            probe_config_path = optarg;
+            break;
+        case 330 :
+            loadtest_connections = max(atoi(optarg), 1);
+            break;
+        case 331 :
+            loadtest_threads = max(atoi(optarg), 1);
+            break;
+        case 332 :
+            loadtest_duration = max(atoi(optarg), 1);
+            break;
+        }
+    }
+
+    if (crypto_profile == NETPW_CRYPTO_PROFILE_PLAINTEXT && !allow_plaintext)
+    {
+        fprintf(stderr, "the plaintext profile sends audio unauthenticated and unencrypted, pass --allow-plaintext to confirm.\n");
+        exit(1);
+    }
+
+    if (audio_backend == NETPW_AUDIO_BACKEND_NONE)
+    {
+        audio_backend = audio_backend_default();
+    }
+
+    if (audio_backend == NETPW_AUDIO_BACKEND_NONE && !relaying && !probing && !loadtesting)
+    {
+        fprintf(stderr, "built without PipeWire, an audio backend must be specified.\n");
+        exit(1);
+    }
+
+    int i;
+    for (i = 0; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--") == 0)
         {
-            client_send(client, data, size);
+            coding_argc = argc - (i + 1);
+            coding_argv = argv + (i + 1);
+            break;
         }
     }
-}
 
-static void on_compressor_read(const unsigned char* data, int size)
-{
-    if (!ready)
-    {
-        return;
-    }
+    define_tiers(defining_tiers);
 
-    if (server)
+    if (relaying && !upstream_host)
     {
-        server_send(server, data, size);
+        fprintf(stderr, "a relay needs the upstream server given with --upstream.\n");
+        exit(1);
     }
-    else if (client)
+
+    if (relaying && local_path)
     {
-        client_send(client, data, size);
+        fprintf(stderr, "a relay only accepts clients over the network.\n");
+        exit(1);
     }
-}
 
-static void on_decompressor_read(const unsigned char* data, int size)
-{
-    if (!ready)
+    if (relaying && record_directory)
     {
-        return;
+        fprintf(stderr, "a relay can't record, record on one of its clients instead.\n");
+        exit(1);
     }
 
-    if (audio_output)
+    if (relaying && requested_tier && strcmp(requested_tier, "auto") == 0)
     {
-        audio_output_send(audio_output, data, size);
+        fprintf(stderr, "a relay passes one tier on unchanged, so it has to ask for it by name.\n");
+        exit(1);
     }
-}
 
-static void on_network_read(const unsigned char* data, int size)
-{
-    if (!ready)
+    if (probing && local_path)
     {
-        return;
+        fprintf(stderr, "a probe measures a network link, so it can't use --local.\n");
+        exit(1);
     }
 
-    if (coding_ctx)
+    if (probe_config_path && !probing)
     {
-        coding_send(coding_ctx, data, size);
+        fprintf(stderr, "--write-config only applies to a probe.\n");
+        exit(1);
     }
-    else if (audio_output)
+
+    if (loadtesting && local_path)
     {
-        audio_output_send(audio_output, data, size);
+        fprintf(stderr, "a load test measures a server's network clients, so it can't use --local.\n");
+        exit(1);
     }
-}
-
-static void parse_arguments(int argc, char** argv)
-{
-    argc -= 2;
-    argv += 2;
-
-    static const struct option options[] = {
-        { "host", required_argument, NULL, 'h' },
-        { "port", required_argument, NULL, 'p' },
-        { "ca", required_argument, NULL, 300 },
-        { "privkey", required_argument, NULL, 301 },
-        { "cert", required_argument, NULL, 302 },
-        { "frequency", required_argument, NULL, 'f' },
-        { "channels", required_argument, NULL, 'c' },
-        { "depth", required_argument, NULL, 'd' },
-        { "buffer", required_argument, NULL, 'b' },
-        { NULL, 0, NULL, 0 }
-    };
-
-    int result;
 
-    while (1)
+    if ((loadtest_connections || loadtest_threads || loadtest_duration) && !loadtesting)
     {
-        result = getopt_long(argc, argv, "h:p:f:c:d:b:", options, NULL);
-
-        if (result < 0)
-        {
-            break;
-        }
-
-        switch (result)
-        {
-        case 'h' :
-            host = optarg;
-            break;
-        case 'p' :
-            port = atoi(optarg);
-            break;
-        case 300 :
-            ca = get_file(optarg);
-            break;
-        case 301 :
-            privkey = get_file(optarg);
-            break;
-        case 302 :
-            cert = get_file(optarg);
-            break;
-        case 'f' :
-            frequency = atoi(optarg);
-            break;
-        case 'c' :
-            channels = atoi(optarg);
-            break;
-        case 'd' :
-            depth = atoi(optarg);
-            break;
-        case 'b' :
-            buffer_size = atoi(optarg);
-            break;
-        }
+        fprintf(stderr, "--connections, --threads and --duration only apply to a load test.\n");
+        exit(1);
     }
 
-    int i;
-    for (i = 0; i < argc; i++)
+    if (adaptive_bitrate && (tier_count != 1 || !tiers[0].coding_argv))
     {
-        if (strcmp(argv[i], "--") == 0)
-        {
-            coding_argc = argc - (i + 1);
-            coding_argv = argv + (i + 1);
-            break;
-        }
+        fprintf(stderr, "--adaptive-bitrate needs coding options after -- and can't be combined with --tier, use --tier auto on the clients instead.\n");
+        exit(1);
     }
 }
 
@@ -200,26 +1183,64 @@ static void display_help()
     fprintf(stderr, "This program comes with ABSOLUTELY NO WARRANTY; This is free software, and you are welcome to redistribute it under certain conditions. See the included license for further details.\n");
     fprintf(stderr, "\n");
     fprintf(stderr, "usage: netpw server|client input|output [options...] [-- coding-options...]\n");
+    fprintf(stderr, "       netpw relay --upstream host:port [options...]\n");
+    fprintf(stderr, "       netpw probe [options...]\n");
+    fprintf(stderr, "       netpw loadtest [options...]\n");
     fprintf(stderr, "\n");
     fprintf(stderr, "-h value\t--host value\t\tSpecify the network address to bind to or connect to.\n");
     fprintf(stderr, "-p value\t--port value\t\tSpecify the network port to bind to or connect to.\n");
+    fprintf(stderr, "\t\t--upstream value\tSpecify the server a relay receives from as host:port.\n");
+    fprintf(stderr, "\t\t--write-config value\tSpecify a file a probe writes its recommended options to.\n");
+    fprintf(stderr, "\t\t--connections value\tSpecify how many clients a load test opens. Defaults to %i.\n", NETPW_LOADTEST_CONNECTIONS);
+    fprintf(stderr, "\t\t--threads value\t\tSpecify how many threads a load test spreads its clients over. Defaults to %i.\n", NETPW_LOADTEST_THREADS);
+    fprintf(stderr, "\t\t--duration value\tSpecify for how many seconds a load test measures. Defaults to %i.\n", NETPW_LOADTEST_DURATION);
+    fprintf(stderr, "\t\t--local value\t\tSpecify a Unix socket at which a server also accepts, or through which a client connects to, peers on the same host over shared memory.\n");
     fprintf(stderr, "\n");
     fprintf(stderr, "\t\t--ca value\t\tSpecify the X.509 certificate authority certificate to use for TLS.\n");
-    fprintf(stderr, "\t\t--privkey value\t\tSpecify the RSA private key to use for TLS.\n");
+    fprintf(stderr, "\t\t--privkey value\t\tSpecify the private key to use for TLS.\n");
     fprintf(stderr, "\t\t--cert value\t\tSpecify the X.509 certificate to use for TLS.\n");
+    fprintf(stderr, "\t\t--key-type value\tSpecify the type of key generated when no certificate is given, one of ed25519, p256 or rsa. Defaults to ed25519.\n");
+    fprintf(stderr, "\t\t--identity value\tSpecify a directory in which to keep the generated key and certificate across restarts.\n");
+    fprintf(stderr, "\t\t--identity-rotation value\tSpecify after how many days a cached identity is replaced by one generated in the background.\n");
+    fprintf(stderr, "\t\t--crypto value\t\tSpecify the crypto profile, one of auto, aes, chacha, integrity or plaintext. Defaults to auto.\n");
+    fprintf(stderr, "\t\t--allow-plaintext\tConfirm that the plaintext profile may be used.\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "\t\t--backlog value\t\tSpecify how many connections may wait to be accepted or for their handshake. Defaults to 128.\n");
+    fprintf(stderr, "\t\t--handshake-workers value\tSpecify how many handshakes the server performs at once. Defaults to 4.\n");
+    fprintf(stderr, "\t\t--max-clients value\tSpecify how many clients the server accepts in total.\n");
+    fprintf(stderr, "\t\t--max-clients-per-address value\tSpecify how many clients the server accepts from each address.\n");
+    fprintf(stderr, "\t\t--handshake-rate value\tSpecify how many handshakes the server starts per second.\n");
+    fprintf(stderr, "\t\t--tier value\t\tDefine a tier of an input server as name or name=coding-options, may be repeated. Clients specify the tier to receive, or auto.\n");
+    fprintf(stderr, "\t\t--adaptive-bitrate value\tSpecify the range in kbit/s as min-max within which the encoder follows the available bandwidth.\n");
+    fprintf(stderr, "\t\t--latency-budget value\tSpecify in milliseconds how long uncompressed audio may queue on its way before it is dropped instead.\n");
+    fprintf(stderr, "\t\t--congestion value\tSpecify the TCP congestion control algorithm, such as bbr or cubic.\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "\t\t--record value\t\tSpecify a directory to record each tier sent or stream received to.\n");
+    fprintf(stderr, "\t\t--record-size value\tSpecify after how many MiB a recording continues in a new file.\n");
+    fprintf(stderr, "\t\t--record-duration value\tSpecify after how many seconds a recording continues in a new file.\n");
     fprintf(stderr, "\n");
     fprintf(stderr, "-f value\t--frequency value\tSpecify the audio sampling frequency.\n");
     fprintf(stderr, "-c value\t--channels value\tSpecify the audio channel count.\n");
     fprintf(stderr, "-d value\t--depth value\t\tSpecify the audio sample depth in bits.\n");
     fprintf(stderr, "-b value\t--buffer value\t\tSpecify the audio buffer in samples per channel.\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "\t\t--silence-threshold value\tSpecify the level in dBFS below which uncompressed input is sent as silence markers.\n");
+    fprintf(stderr, "\t\t--silence-hangover value\tSpecify how many milliseconds input must stay below the silence threshold before it is sent as silence markers.\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "\t\t--metrics-port value\tSpecify a local port on which to serve Prometheus metrics.\n");
+    fprintf(stderr, "\t\t--latency\t\tPrint a breakdown of the one-way latency of received audio every second.\n");
+    fprintf(stderr, "\t\t--trace value\t\tSpecify a directory to write Chrome traces of the realtime paths to on SIGUSR1 and after each xrun.\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "\t\t--backend value\t\tSpecify the audio backend, one of pipewire, pipewire-dsp, null, file or stdio.\n");
+    fprintf(stderr, "\t\t--file value\t\tSpecify the WAV or raw file read from or WAV file written to by the file backend.\n");
 }
 
 static void auto_generate_encryption_resources()
 {
-    printf("generating encryption keys.\n");
+    printf("generating %s encryption keys.\n", key_type_name(key_type));
     char* public_key;
     char* private_key;
-    generate_rsa_key_pair(&public_key, &private_key);
+    generate_key_pair(key_type, &public_key, &private_key);
     char* certificate;
     x509_certificate_from_private_key(private_key, &certificate);
     free(public_key);
@@ -228,53 +1249,251 @@ static void auto_generate_encryption_resources()
     cert = certificate;
 }
 
-static void setup_server()
+static void load_encryption_resources()
+{
+    char* private_key;
+    char* certificate;
+    identity_load(identity_directory, key_type, identity_rotation, &private_key, &certificate);
+
+    privkey = private_key;
+    cert = certificate;
+}
+
+static void setup_metrics()
+{
+    if (metrics_port)
+    {
+        metrics_serve("127.0.0.1", metrics_port);
+    }
+}
+
+static void setup_trace()
+{
+    if (trace_directory)
+    {
+        trace_init(trace_directory);
+    }
+}
+
+static void setup_server_identity()
 {
-    if (cert == NULL || privkey == NULL)
+    if (crypto_profile == NETPW_CRYPTO_PROFILE_PLAINTEXT)
+    {
+        /* no handshake, so no identity is needed */
+    }
+    else if ((cert == NULL || privkey == NULL) && identity_directory)
+    {
+        load_encryption_resources();
+    }
+    else if (cert == NULL || privkey == NULL)
     {
         auto_generate_encryption_resources();
     }
+}
+
+static void setup_server()
+{
+    setup_server_identity();
+
+    struct server_tier* server_tiers = malloc(tier_count * sizeof(struct server_tier));
+
+    int i;
+    for (i = 0; i < tier_count; i++)
+    {
+        server_tiers[i].name = tiers[i].name;
+        server_tiers[i].encoded = tiers[i].coding_argv != NULL;
+    }
 
-    server = server_init(host, port, ca, cert, privkey, on_network_read);
+    struct server* new_server = server_init(host, port, ca, cert, privkey, crypto_profile, &server_limits, &tcp_options, server_tiers, tier_count, on_network_read, on_connect, on_disconnect, NULL);
+
+    if (local_path)
+    {
+        server_listen_local(new_server, local_path);
+    }
+
+    __atomic_store_n(&server, new_server, __ATOMIC_RELEASE);
+
+    free(server_tiers);
 }
 
 static void setup_client()
 {
-    client = client_init(host, port, ca, cert, privkey, on_network_read);
+    struct client* new_client = local_path
+        ? client_init_local(local_path, on_network_read, NULL)
+        : client_init(host, port, ca, cert, privkey, crypto_profile, &tcp_options, on_network_read, NULL);
+
+    if (requested_tier)
+    {
+        client_send(new_client, NETPW_PACKET_TIER, (const unsigned char*)requested_tier, strlen(requested_tier));
+    }
+
+    __atomic_store_n(&client, new_client, __ATOMIC_RELEASE);
+}
+
+static void setup_relay()
+{
+    setup_server_identity();
+
+    relay = relay_init(
+        upstream_host,
+        upstream_port,
+        host,
+        port,
+        ca,
+        cert,
+        privkey,
+        crypto_profile,
+        &server_limits,
+        &tcp_options,
+        requested_tier,
+        latency_reporting
+    );
+}
+
+static int run_probe()
+{
+    struct probe_result measurement;
+
+    if (probe_run(host, port, ca, cert, privkey, crypto_profile, &tcp_options, frequency, channels, depth, buffer_size, &measurement))
+    {
+        return 1;
+    }
+
+    printf("\n");
+    probe_print(&measurement);
+
+    if (probe_config_path && probe_write_config(&measurement, probe_config_path))
+    {
+        return 1;
+    }
+
+    return 0;
+}
+
+static int run_loadtest()
+{
+    return loadtest_run(
+        host,
+        port,
+        ca,
+        cert,
+        privkey,
+        crypto_profile,
+        &tcp_options,
+        requested_tier,
+        loadtest_connections ? loadtest_connections : NETPW_LOADTEST_CONNECTIONS,
+        loadtest_threads ? loadtest_threads : NETPW_LOADTEST_THREADS,
+        (uint64_t)(loadtest_duration ? loadtest_duration : NETPW_LOADTEST_DURATION) * 1000000000,
+        frequency,
+        buffer_size
+    );
+}
+
+static void* setup_network(void* userdata)
+{
+    network_setup();
+
+    return NULL;
+}
+
+/* key generation, the handshake and the audio setup don't depend on each other so the network comes up alongside the audio */
+static void start_network(void (*setup)())
+{
+    int result;
+
+    network_setup = setup;
+
+    CHECK_ERROR_FATAL(pthread_create(&network_thread, NULL, setup_network, NULL));
+}
+
+static void finish_network()
+{
+    pthread_join(network_thread, NULL);
+}
+
+/* encoded recordings hold the container named by the coding options */
+static const char* recording_extension(struct tier* tier)
+{
+    if (!tier->coding_argv)
+    {
+        return "wav";
+    }
+
+    const char* format = "raw";
+
+    int i;
+    for (i = 0; i + 1 < tier->coding_argc; i++)
+    {
+        if (strcmp(tier->coding_argv[i], "-f") == 0)
+        {
+            format = tier->coding_argv[i + 1];
+        }
+    }
+
+    return format;
 }
 
 static void setup_audio_input()
 {
-    if (coding_argv)
+    int uncompressed = 0;
+
+    int i;
+    for (i = 0; i < tier_count; i++)
     {
-        coding_ctx = coding_init_audio_encoder(
-            frequency,
-            channels,
-            depth,
-            coding_argc,
-            coding_argv,
-            on_compressor_read
-        );
+        struct tier* tier = &tiers[i];
+
+        if (record_directory)
+        {
+            tier->recorder = recorder_init(record_directory, tier->name, recording_extension(tier), frequency, channels, depth, record_size, record_duration);
+        }
+
+        if (tier->coding_argv)
+        {
+            /* adaptation starts from the top of the range and backs off */
+            tier->bitrate = adaptive_bitrate ? max_bitrate : 0;
+            tier->encoder = encoder_init(tier, tier->bitrate);
+        }
+        else
+        {
+            uncompressed = 1;
+        }
+    }
+
+    if (uncompressed && silence_detection)
+    {
+        silence_detector = silence_detector_init(frequency, channels, depth, silence_threshold, silence_hangover);
     }
 
-    audio_input = audio_input_init(frequency, channels, depth, buffer_size, on_audio_read);
+    audio_input = audio_input_init(audio_backend, audio_file, frequency, channels, depth, buffer_size, on_audio_read, NULL);
 }
 
-static void setup_audio_output()
+static void destroy_audio_input()
 {
-    if (coding_argv)
+    audio_input_destroy(audio_input);
+
+    int i;
+    for (i = 0; i < tier_count; i++)
     {
-        coding_ctx = coding_init_audio_decoder(
-            frequency,
-            channels,
-            depth,
-            coding_argc,
-            coding_argv,
-            on_decompressor_read
-        );
+        if (tiers[i].encoder)
+        {
+            encoder_destroy(tiers[i].encoder);
+        }
+
+        if (tiers[i].recorder)
+        {
+            recorder_destroy(tiers[i].recorder);
+        }
     }
 
-    audio_output = audio_output_init(frequency, channels, depth, buffer_size);
+    if (silence_detector)
+    {
+        silence_detector_destroy(silence_detector);
+    }
+}
+
+static void setup_audio_output()
+{
+    audio_output = audio_output_init(audio_backend, audio_file, frequency, channels, depth, buffer_size);
 }
 
 int main(int argc, char** argv)
@@ -284,85 +1503,142 @@ int main(int argc, char** argv)
         display_help();
         return 0;
     }
-    else if (strcmp(argv[1], "server") == 0)
+
+    /* a peer disconnecting mid-write must surface as a write error rather than kill the process */
+    signal(SIGPIPE, SIG_IGN);
+
+    start_time = get_time();
+
+    if (strcmp(argv[1], "server") == 0)
     {
         host = "0.0.0.0";
         parse_arguments(argc, argv);
-        setup_server();
+        setup_metrics();
+        setup_trace();
 
         if (strcmp(argv[2], "input") == 0)
         {
+            start_network(setup_server);
             setup_audio_input();
 
-            ready = 1;
+            if (adaptive_bitrate)
+            {
+                start_adaptation();
+            }
+
+            set_ready();
             audio_input_run(audio_input);
+            finish_network();
 
-            audio_input_destroy(audio_input);
-            if (coding_ctx)
+            if (adaptive_bitrate)
             {
-                coding_destroy(coding_ctx);
+                stop_adaptation();
             }
+            destroy_audio_input();
+
+            server_destroy(server);
         }
         else if (strcmp(argv[2], "output") == 0)
         {
+            start_network(setup_server);
             setup_audio_output();
 
-            ready = 1;
+            set_ready();
             audio_output_run(audio_output);
+            finish_network();
 
+            /* destroys the per-connection streams, so must precede the output */
+            server_destroy(server);
             audio_output_destroy(audio_output);
-            if (coding_ctx)
-            {
-                coding_destroy(coding_ctx);
-            }
         }
         else
         {
             display_help();
             return 1;
         }
-
-        server_destroy(server);
     }
     else if (strcmp(argv[1], "client") == 0)
     {
         host = "127.0.0.1";
         parse_arguments(argc, argv);
-        setup_client();
+        setup_metrics();
+        setup_trace();
 
         if (strcmp(argv[2], "input") == 0)
         {
+            start_network(setup_client);
             setup_audio_input();
 
-            ready = 1;
+            if (adaptive_bitrate)
+            {
+                start_adaptation();
+            }
+
+            set_ready();
             audio_input_run(audio_input);
+            finish_network();
 
-            audio_input_destroy(audio_input);
-            if (coding_ctx)
+            if (adaptive_bitrate)
             {
-                coding_destroy(coding_ctx);
+                stop_adaptation();
             }
+            destroy_audio_input();
+
+            client_destroy(client);
         }
         else if (strcmp(argv[2], "output") == 0)
         {
+            start_network(setup_client);
             setup_audio_output();
+            playback = connection_init("Playback");
 
-            ready = 1;
+            set_ready();
             audio_output_run(audio_output);
+            finish_network();
 
+            client_destroy(client);
+            connection_destroy(playback);
             audio_output_destroy(audio_output);
-            if (coding_ctx)
-            {
-                coding_destroy(coding_ctx);
-            }
         }
         else
         {
             display_help();
             return 1;
         }
+    }
+    else if (strcmp(argv[1], "relay") == 0)
+    {
+        host = "0.0.0.0";
+        parse_arguments(argc, argv);
+        setup_metrics();
+        setup_trace();
+
+        /* nothing runs on this thread, it only waits to be stopped */
+        audio_backend_catch_signals();
+        setup_relay();
+        audio_backend_wait_for_quit();
+
+        relay_destroy(relay);
+    }
+    else if (strcmp(argv[1], "probe") == 0)
+    {
+        host = "127.0.0.1";
+        parse_arguments(argc, argv);
+
+        if (run_probe())
+        {
+            return 1;
+        }
+    }
+    else if (strcmp(argv[1], "loadtest") == 0)
+    {
+        host = "127.0.0.1";
+        parse_arguments(argc, argv);
 
-        client_destroy(client);
+        if (run_loadtest())
+        {
+            return 1;
+        }
     }
     else
     {
@@ -370,5 +1646,9 @@ int main(int argc, char** argv)
         return 1;
     }
 
+    metrics_stop();
+    identity_destroy();
+    trace_destroy();
+
     return 0;
 }
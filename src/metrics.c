@@ -0,0 +1,347 @@
+/*
+Copyright 2025 Amini Allight
+
+This file is part of netpw.
+
+netpw is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+netpw is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with netpw. If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "metrics.h"
+#include "constants.h"
+#include "error_handling.h"
+#include "tools.h"
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netdb.h>
+#include <pthread.h>
+
+enum metric_type
+{
+    NETPW_METRIC_COUNTER,
+    NETPW_METRIC_GAUGE,
+    NETPW_METRIC_HISTOGRAM
+};
+
+struct metric
+{
+    enum metric_type type;
+    char* name;
+    char* help;
+    char* labels;
+    int64_t value;
+    uint64_t sum;
+    uint64_t* bounds;
+    uint64_t* buckets;
+    int bound_count;
+    struct metric* next;
+};
+
+static struct metric* metrics = NULL;
+static pthread_mutex_t metrics_lock = PTHREAD_MUTEX_INITIALIZER;
+static int metrics_socket = -1;
+static int metrics_stopping = 0;
+static pthread_t metrics_thread;
+
+static struct metric* metric_init(enum metric_type type, const char* name, const char* help, const char* labels)
+{
+    struct metric* metric = malloc(sizeof(struct metric));
+
+    metric->type = type;
+    metric->name = strdup(name);
+    metric->help = strdup(help);
+    metric->labels = labels ? strdup(labels) : NULL;
+    metric->value = 0;
+    metric->sum = 0;
+    metric->bounds = NULL;
+    metric->buckets = NULL;
+    metric->bound_count = 0;
+
+    return metric;
+}
+
+static void metric_register(struct metric* metric)
+{
+    pthread_mutex_lock(&metrics_lock);
+
+    metric->next = metrics;
+    metrics = metric;
+
+    pthread_mutex_unlock(&metrics_lock);
+}
+
+struct metric* metric_counter_init(const char* name, const char* help, const char* labels)
+{
+    struct metric* metric = metric_init(NETPW_METRIC_COUNTER, name, help, labels);
+
+    metric_register(metric);
+
+    return metric;
+}
+
+struct metric* metric_gauge_init(const char* name, const char* help, const char* labels)
+{
+    struct metric* metric = metric_init(NETPW_METRIC_GAUGE, name, help, labels);
+
+    metric_register(metric);
+
+    return metric;
+}
+
+struct metric* metric_histogram_init(const char* name, const char* help, const char* labels, const uint64_t* bounds, int bound_count)
+{
+    struct metric* metric = metric_init(NETPW_METRIC_HISTOGRAM, name, help, labels);
+
+    metric->bounds = malloc(bound_count * sizeof(uint64_t));
+    memcpy(metric->bounds, bounds, bound_count * sizeof(uint64_t));
+    /* the final bucket is +Inf */
+    metric->buckets = calloc(bound_count + 1, sizeof(uint64_t));
+    metric->bound_count = bound_count;
+
+    metric_register(metric);
+
+    return metric;
+}
+
+void metric_destroy(struct metric* metric)
+{
+    pthread_mutex_lock(&metrics_lock);
+
+    struct metric** link;
+    for (link = &metrics; *link; link = &(*link)->next)
+    {
+        if (*link == metric)
+        {
+            *link = metric->next;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&metrics_lock);
+
+    free(metric->name);
+    free(metric->help);
+    free(metric->labels);
+    free(metric->bounds);
+    free(metric->buckets);
+    free(metric);
+}
+
+void metric_add(struct metric* metric, uint64_t x)
+{
+    __atomic_fetch_add(&metric->value, x, __ATOMIC_RELAXED);
+}
+
+void metric_set(struct metric* metric, int64_t x)
+{
+    __atomic_store_n(&metric->value, x, __ATOMIC_RELAXED);
+}
+
+void metric_observe(struct metric* metric, uint64_t x)
+{
+    int i;
+    for (i = 0; i < metric->bound_count; i++)
+    {
+        if (x <= metric->bounds[i])
+        {
+            break;
+        }
+    }
+
+    __atomic_fetch_add(&metric->buckets[i], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&metric->sum, x, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&metric->value, 1, __ATOMIC_RELAXED);
+}
+
+static const char* metric_type_name(enum metric_type type)
+{
+    switch (type)
+    {
+    default :
+    case NETPW_METRIC_COUNTER :
+        return "counter";
+    case NETPW_METRIC_GAUGE :
+        return "gauge";
+    case NETPW_METRIC_HISTOGRAM :
+        return "histogram";
+    }
+}
+
+static void metric_print(FILE* file, struct metric* metric)
+{
+    const char* labels = metric->labels ? metric->labels : "";
+    const char* separator = metric->labels ? "," : "";
+    const char* open = metric->labels ? "{" : "";
+    const char* close = metric->labels ? "}" : "";
+
+    if (metric->type != NETPW_METRIC_HISTOGRAM)
+    {
+        fprintf(file, "%s%s%s%s %lli\n", metric->name, open, labels, close, (long long)__atomic_load_n(&metric->value, __ATOMIC_RELAXED));
+        return;
+    }
+
+    uint64_t total = 0;
+
+    int i;
+    for (i = 0; i < metric->bound_count; i++)
+    {
+        total += __atomic_load_n(&metric->buckets[i], __ATOMIC_RELAXED);
+        fprintf(file, "%s_bucket{%s%sle=\"%llu\"} %llu\n", metric->name, labels, separator, (unsigned long long)metric->bounds[i], (unsigned long long)total);
+    }
+
+    total += __atomic_load_n(&metric->buckets[metric->bound_count], __ATOMIC_RELAXED);
+    fprintf(file, "%s_bucket{%s%sle=\"+Inf\"} %llu\n", metric->name, labels, separator, (unsigned long long)total);
+    fprintf(file, "%s_sum%s%s%s %llu\n", metric->name, open, labels, close, (unsigned long long)__atomic_load_n(&metric->sum, __ATOMIC_RELAXED));
+    fprintf(file, "%s_count%s%s%s %llu\n", metric->name, open, labels, close, (unsigned long long)total);
+}
+
+static void metrics_print(FILE* file)
+{
+    pthread_mutex_lock(&metrics_lock);
+
+    struct metric* metric;
+    for (metric = metrics; metric; metric = metric->next)
+    {
+        /* each family is printed once, at its first series */
+        struct metric* first;
+        for (first = metrics; strcmp(first->name, metric->name) != 0; first = first->next);
+
+        if (first != metric)
+        {
+            continue;
+        }
+
+        fprintf(file, "# HELP %s %s\n", metric->name, metric->help);
+        fprintf(file, "# TYPE %s %s\n", metric->name, metric_type_name(metric->type));
+
+        struct metric* series;
+        for (series = metric; series; series = series->next)
+        {
+            if (strcmp(series->name, metric->name) == 0)
+            {
+                metric_print(file, series);
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&metrics_lock);
+}
+
+static void* metrics_accept(void* arg)
+{
+    int result;
+
+    while (1)
+    {
+        int connection = accept(metrics_socket, NULL, NULL);
+
+        if (connection < 0)
+        {
+            if (__atomic_load_n(&metrics_stopping, __ATOMIC_ACQUIRE))
+            {
+                break;
+            }
+
+            /* one scraper's failed connection or a shortage of descriptors shouldn't end scraping for good */
+            sleep_until(get_time() + NETPW_METRICS_TIMEOUT / 10);
+            continue;
+        }
+
+        /* connections are served one at a time, so an idle or slow one may only hold the others up until the timeout */
+        struct timeval timeout = { NETPW_METRICS_TIMEOUT / 1000000000, (NETPW_METRICS_TIMEOUT % 1000000000) / 1000 };
+        CHECK_ERRNO(setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)));
+        CHECK_ERRNO(setsockopt(connection, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)));
+
+        char request[NETPW_IO_BUFFER_SIZE];
+
+        /* the request is always answered with the full set of metrics */
+        CHECK_ERRNO(read(connection, request, sizeof(request)));
+
+        if (result <= 0)
+        {
+            CHECK_ERRNO(close(connection));
+            continue;
+        }
+
+        FILE* file = fdopen(connection, "w");
+
+        if (!file)
+        {
+            CHECK_ERRNO(close(connection));
+            continue;
+        }
+
+        fprintf(file, "HTTP/1.0 200 OK\r\n");
+        fprintf(file, "Content-Type: text/plain; version=0.0.4\r\n");
+        fprintf(file, "Connection: close\r\n");
+        fprintf(file, "\r\n");
+        metrics_print(file);
+
+        fclose(file);
+    }
+
+    return NULL;
+}
+
+void metrics_serve(const char* host, unsigned short port)
+{
+    int result;
+
+    CHECK_ERRNO_FATAL(metrics_socket = socket(AF_INET, SOCK_STREAM, 0));
+
+    int reuse = 1;
+    CHECK_ERRNO(setsockopt(metrics_socket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)));
+
+    struct addrinfo* info = NULL;
+
+    char port_string[6] = {0};
+    snprintf(port_string, 6, "%i", port);
+
+    CHECK_ERROR_FATAL(getaddrinfo(host, port_string, NULL, &info));
+
+    CHECK_ERRNO_FATAL(bind(metrics_socket, info->ai_addr, info->ai_addrlen));
+
+    freeaddrinfo(info);
+
+    CHECK_ERRNO_FATAL(listen(metrics_socket, 16));
+
+    CHECK_ERROR_FATAL(pthread_create(&metrics_thread, NULL, metrics_accept, NULL));
+
+    printf("serving metrics at [%s]:%i.\n", host, port);
+}
+
+void metrics_stop()
+{
+    int result;
+
+    if (metrics_socket < 0)
+    {
+        return;
+    }
+
+    __atomic_store_n(&metrics_stopping, 1, __ATOMIC_RELEASE);
+
+    CHECK_ERRNO(shutdown(metrics_socket, SHUT_RDWR));
+    CHECK_ERROR(pthread_join(metrics_thread, NULL));
+    CHECK_ERRNO(close(metrics_socket));
+    metrics_socket = -1;
+}
+
+int metrics_enabled()
+{
+    return metrics_socket >= 0;
+}
@@ -0,0 +1,46 @@
+/*
+Copyright 2025 Amini Allight
+
+This file is part of netpw.
+
+netpw is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+netpw is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with netpw. If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef NETPW_METRICS_H
+#define NETPW_METRICS_H
+
+#include <stdint.h>
+
+struct metric;
+
+/*
+ * labels are in Prometheus syntax without the surrounding braces and may be NULL
+ * updates are lock-free and safe to make from realtime threads
+ */
+struct metric* metric_counter_init(const char* name, const char* help, const char* labels);
+struct metric* metric_gauge_init(const char* name, const char* help, const char* labels);
+/* bounds are the inclusive upper bounds of each bucket in ascending order */
+struct metric* metric_histogram_init(const char* name, const char* help, const char* labels, const uint64_t* bounds, int bound_count);
+void metric_destroy(struct metric* metric);
+
+void metric_add(struct metric* metric, uint64_t x);
+void metric_set(struct metric* metric, int64_t x);
+void metric_observe(struct metric* metric, uint64_t x);
+
+/* serves the Prometheus text format over HTTP */
+void metrics_serve(const char* host, unsigned short port);
+/* stops serving, does nothing if metrics_serve wasn't called */
+void metrics_stop();
+int metrics_enabled();
+
+#endif
@@ -0,0 +1,173 @@
+/*
+Copyright 2025 Amini Allight
+
+This file is part of netpw.
+
+netpw is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+netpw is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with netpw. If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "packet.h"
+#include "constants.h"
+#include "tools.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+struct packet_reader
+{
+    unsigned char* buffer;
+    int size;
+    int capacity;
+    on_packet_callback callback;
+    void* userdata;
+};
+
+struct packet_reader* packet_reader_init(on_packet_callback callback, void* userdata)
+{
+    struct packet_reader* reader = malloc(sizeof(struct packet_reader));
+
+    reader->capacity = NETPW_IO_BUFFER_SIZE;
+    reader->buffer = malloc(reader->capacity);
+    reader->size = 0;
+    reader->callback = callback;
+    reader->userdata = userdata;
+
+    return reader;
+}
+
+int packet_reader_feed(struct packet_reader* reader, const unsigned char* data, int size)
+{
+    while (size > 0)
+    {
+        /* fast path, whole packets straight out of the caller's buffer */
+        if (reader->size == 0 && size >= NETPW_PACKET_HEADER_SIZE)
+        {
+            unsigned int payload_size = packet_read_u32(data + 1);
+
+            if (payload_size > NETPW_PACKET_MAX_SIZE)
+            {
+                return 1;
+            }
+
+            if (size >= NETPW_PACKET_HEADER_SIZE + (int)payload_size)
+            {
+                reader->callback(reader->userdata, data[0], data + NETPW_PACKET_HEADER_SIZE, payload_size);
+
+                data += NETPW_PACKET_HEADER_SIZE + payload_size;
+                size -= NETPW_PACKET_HEADER_SIZE + payload_size;
+                continue;
+            }
+        }
+
+        /* slow path, accumulate a packet split across reads */
+        int needed;
+
+        if (reader->size < NETPW_PACKET_HEADER_SIZE)
+        {
+            needed = NETPW_PACKET_HEADER_SIZE - reader->size;
+        }
+        else
+        {
+            needed = NETPW_PACKET_HEADER_SIZE + packet_read_u32(reader->buffer + 1) - reader->size;
+        }
+
+        int copy_size = min(needed, size);
+
+        if (reader->size + copy_size > reader->capacity)
+        {
+            reader->capacity = reader->size + copy_size;
+            reader->buffer = realloc(reader->buffer, reader->capacity);
+        }
+
+        memcpy(reader->buffer + reader->size, data, copy_size);
+        reader->size += copy_size;
+        data += copy_size;
+        size -= copy_size;
+
+        if (reader->size < NETPW_PACKET_HEADER_SIZE)
+        {
+            continue;
+        }
+
+        unsigned int payload_size = packet_read_u32(reader->buffer + 1);
+
+        if (payload_size > NETPW_PACKET_MAX_SIZE)
+        {
+            return 1;
+        }
+
+        if (reader->size == NETPW_PACKET_HEADER_SIZE + (int)payload_size)
+        {
+            reader->callback(reader->userdata, reader->buffer[0], reader->buffer + NETPW_PACKET_HEADER_SIZE, payload_size);
+            reader->size = 0;
+        }
+    }
+
+    return 0;
+}
+
+void packet_reader_destroy(struct packet_reader* reader)
+{
+    free(reader->buffer);
+    free(reader);
+}
+
+int packet_encode(unsigned char* buffer, int type, const unsigned char* data, int size)
+{
+    buffer[0] = type;
+    packet_write_u32(buffer + 1, size);
+    memcpy(buffer + NETPW_PACKET_HEADER_SIZE, data, size);
+
+    return NETPW_PACKET_HEADER_SIZE + size;
+}
+
+int packet_read_silence(const unsigned char* data, int size, int stride)
+{
+    if (size != NETPW_PACKET_SILENCE_SIZE || stride <= 0)
+    {
+        return -1;
+    }
+
+    uint64_t frames = packet_read_u32(data);
+
+    if (frames * (uint64_t)stride > NETPW_QUEUE_SIZE)
+    {
+        return -1;
+    }
+
+    return frames;
+}
+
+void packet_write_u32(unsigned char* buffer, unsigned int x)
+{
+    buffer[0] = (x >> 24) & 0xff;
+    buffer[1] = (x >> 16) & 0xff;
+    buffer[2] = (x >> 8) & 0xff;
+    buffer[3] = x & 0xff;
+}
+
+unsigned int packet_read_u32(const unsigned char* buffer)
+{
+    return ((unsigned int)buffer[0] << 24) | ((unsigned int)buffer[1] << 16) | ((unsigned int)buffer[2] << 8) | buffer[3];
+}
+
+void packet_write_u64(unsigned char* buffer, uint64_t x)
+{
+    packet_write_u32(buffer, x >> 32);
+    packet_write_u32(buffer + 4, x & 0xffffffff);
+}
+
+uint64_t packet_read_u64(const unsigned char* buffer)
+{
+    return ((uint64_t)packet_read_u32(buffer) << 32) | packet_read_u32(buffer + 4);
+}
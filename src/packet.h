@@ -0,0 +1,85 @@
+/*
+Copyright 2025 Amini Allight
+
+This file is part of netpw.
+
+netpw is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+netpw is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with netpw. If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef NETPW_PACKET_H
+#define NETPW_PACKET_H
+
+#include "callback.h"
+
+#include <stdint.h>
+
+/* every packet is a one byte type, a four byte big-endian payload size and then the payload */
+#define NETPW_PACKET_HEADER_SIZE 5
+
+#define NETPW_PACKET_SILENCE_SIZE 4
+#define NETPW_PACKET_TIMESTAMP_SIZE 24
+#define NETPW_PACKET_LOCAL_TIMESTAMP_SIZE 32
+#define NETPW_PACKET_PING_SIZE 8
+#define NETPW_PACKET_PONG_SIZE 16
+/* a flag byte and the longest tier name */
+#define NETPW_PACKET_TIER_MAX_SIZE 64
+#define NETPW_PACKET_REPORT_SIZE 16
+
+enum packet_type
+{
+    /* PCM or encoder output */
+    NETPW_PACKET_AUDIO = 0,
+    /* four byte big-endian frame count to be played as silence */
+    NETPW_PACKET_SILENCE = 1,
+    /*
+     * capture, process and send times of the latest quantum as eight byte big-endian nanoseconds
+     * the receiving network layer converts these to its own clock and appends the receive time
+     */
+    NETPW_PACKET_TIMESTAMP = 2,
+    /* eight byte big-endian send time, answered with a pong by the network layer */
+    NETPW_PACKET_PING = 3,
+    /* the ping's send time followed by the time the ping was received */
+    NETPW_PACKET_PONG = 4,
+    /*
+     * from a client, the name of the tier it wants to receive
+     * from the server on connect and after each request, a flag byte that is non-zero if the tier carries encoder output followed by the name of the tier the client now receives
+     */
+    NETPW_PACKET_TIER = 5,
+    /* eight byte big-endian nanoseconds since the previous report and the bytes received in them, sent by the network layer */
+    NETPW_PACKET_REPORT = 6,
+    /* filler of any size sent by netpw probe to load the link, ignored on receipt */
+    NETPW_PACKET_PROBE = 7
+};
+
+struct packet_reader;
+
+struct packet_reader* packet_reader_init(on_packet_callback callback, void* userdata);
+/* returns non-zero if the stream is malformed */
+int packet_reader_feed(struct packet_reader* reader, const unsigned char* data, int size);
+void packet_reader_destroy(struct packet_reader* reader);
+
+/* buffer must have room for NETPW_PACKET_HEADER_SIZE + size, returns the encoded size */
+int packet_encode(unsigned char* buffer, int type, const unsigned char* data, int size);
+
+/*
+ * the frame count of a silence marker, or -1 if the payload is malformed or the run is longer than a playback queue holds at this stride
+ * markers come straight from the peer, so this is checked before anything is sized from them
+ */
+int packet_read_silence(const unsigned char* data, int size, int stride);
+
+void packet_write_u32(unsigned char* buffer, unsigned int x);
+unsigned int packet_read_u32(const unsigned char* buffer);
+void packet_write_u64(unsigned char* buffer, uint64_t x);
+uint64_t packet_read_u64(const unsigned char* buffer);
+
+#endif
@@ -0,0 +1,372 @@
+/*
+Copyright 2025 Amini Allight
+
+This file is part of netpw.
+
+netpw is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+netpw is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with netpw. If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "probe.h"
+#include "client.h"
+#include "packet.h"
+#include "constants.h"
+#include "error_handling.h"
+#include "tools.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <linux/tcp.h>
+
+struct probe
+{
+    pthread_mutex_t lock;
+    /* round trips and timestamps are only collected at the audio rate, not under the ramp's load */
+    int collecting;
+    uint64_t* rtts;
+    int rtt_count;
+    /* from the server's timestamps, only meaningful relative to each other since the clock offset is estimated */
+    uint64_t* delays;
+    int delay_count;
+    /* the first report of a step covers time before it, so it is skipped */
+    int report_count;
+    uint64_t report_time;
+    uint64_t report_bytes;
+};
+
+static void probe_on_packet(void* userdata, int type, const unsigned char* data, int size)
+{
+    struct probe* probe = userdata;
+
+    uint64_t now = get_time();
+
+    pthread_mutex_lock(&probe->lock);
+
+    switch (type)
+    {
+    case NETPW_PACKET_PONG :
+        if (probe->collecting && probe->rtt_count < NETPW_PROBE_MAX_SAMPLES)
+        {
+            probe->rtts[probe->rtt_count++] = now - packet_read_u64(data);
+        }
+        break;
+    case NETPW_PACKET_TIMESTAMP :
+        if (probe->collecting && size == NETPW_PACKET_LOCAL_TIMESTAMP_SIZE && probe->delay_count < NETPW_PROBE_MAX_SAMPLES)
+        {
+            probe->delays[probe->delay_count++] = packet_read_u64(data + 24) - packet_read_u64(data + 16);
+        }
+        break;
+    case NETPW_PACKET_REPORT :
+        if (probe->report_count++ > 0)
+        {
+            probe->report_time += packet_read_u64(data);
+            probe->report_bytes += packet_read_u64(data + 8);
+        }
+        break;
+    }
+
+    pthread_mutex_unlock(&probe->lock);
+}
+
+static void probe_ping(struct client* client, uint64_t now)
+{
+    unsigned char ping[NETPW_PACKET_PING_SIZE];
+    packet_write_u64(ping, now);
+
+    client_send(client, NETPW_PACKET_PING, ping, sizeof(ping));
+}
+
+/* one quantum of filler per quantum, the way audio would be sent, with pings in between */
+static void probe_audio_rate(struct client* client, const unsigned char* filler, int quantum_size, uint64_t quantum_time)
+{
+    uint64_t start = get_time();
+    uint64_t next_quantum = start;
+    uint64_t next_ping = start;
+
+    while (1)
+    {
+        uint64_t now = get_time();
+
+        if (now - start >= NETPW_PROBE_DURATION)
+        {
+            break;
+        }
+
+        if (now >= next_quantum)
+        {
+            client_send(client, NETPW_PACKET_PROBE, filler, quantum_size);
+            next_quantum += quantum_time;
+        }
+
+        if (now >= next_ping)
+        {
+            probe_ping(client, now);
+            next_ping += NETPW_PROBE_PING_INTERVAL;
+        }
+
+        sleep_until(next_quantum < next_ping ? next_quantum : next_ping);
+    }
+}
+
+/* returns the rate the server reported receiving during the step, in bytes per second */
+static uint64_t probe_step(struct probe* probe, struct client* client, const unsigned char* filler, uint64_t rate)
+{
+    pthread_mutex_lock(&probe->lock);
+    probe->report_count = 0;
+    probe->report_time = 0;
+    probe->report_bytes = 0;
+    pthread_mutex_unlock(&probe->lock);
+
+    int chunk_size = rate / 100 < NETPW_PROBE_CHUNK_SIZE ? max(rate / 100, 1) : NETPW_PROBE_CHUNK_SIZE;
+
+    uint64_t start = get_time();
+    uint64_t sent = 0;
+
+    /* once the link is full the sends block, which holds the rate down to what it carries */
+    while (get_time() - start < NETPW_PROBE_STEP_DURATION)
+    {
+        client_send(client, NETPW_PACKET_PROBE, filler, chunk_size);
+        sent += chunk_size;
+
+        sleep_until(start + sent * 1000000000 / rate);
+    }
+
+    pthread_mutex_lock(&probe->lock);
+    uint64_t delivered = probe->report_time != 0 ? probe->report_bytes * 1000000000 / probe->report_time : 0;
+    pthread_mutex_unlock(&probe->lock);
+
+    return delivered;
+}
+
+/* in bits per second, including what each packet costs beyond its payload */
+static uint64_t link_rate(int frequency, int stride, int buffer_size)
+{
+    return (uint64_t)(buffer_size * stride + NETPW_PROBE_PACKET_OVERHEAD) * 8 * frequency / buffer_size;
+}
+
+static void probe_recommend(struct probe_result* result, int frequency, int stride)
+{
+    /* if uncompressed audio can't fit at any buffer size it is going to be encoded, and then the packet rate matters less */
+    int uncompressed_possible = link_rate(frequency, stride, NETPW_PROBE_MAX_BUFFER) * 5 <= result->throughput * 4;
+
+    /* quanta shorter than the usual jitter cost packets without saving any latency, and uncompressed packets have to fit */
+    int buffer_size = NETPW_PROBE_MIN_BUFFER;
+
+    while (buffer_size < NETPW_PROBE_MAX_BUFFER
+        && ((uint64_t)buffer_size * 1000000000 / frequency < result->jitter_median
+            || (uncompressed_possible && link_rate(frequency, stride, buffer_size) * 5 > result->throughput * 4)))
+    {
+        buffer_size *= 2;
+    }
+
+    uint64_t quantum_time = (uint64_t)buffer_size * 1000000000 / frequency;
+
+    result->buffer_size = buffer_size;
+    result->jitter_target = result->jitter_p99 + quantum_time;
+    /* the budget is measured against acknowledgements, so it has to cover a slow round trip */
+    result->latency_budget = (result->rtt_p99 + quantum_time) * 5 / 4;
+    /* the same margin the adaptive bitrate leaves */
+    result->bitrate = result->throughput * 4 / 5 / 1000;
+    result->uncompressed_fits = link_rate(frequency, stride, buffer_size) * 5 <= result->throughput * 4;
+}
+
+int probe_run(
+    const char* host,
+    unsigned short port,
+    const char* ca_certificate,
+    const char* certificate,
+    const char* private_key,
+    enum crypto_profile profile,
+    const struct tcp_options* tcp,
+    int frequency,
+    int channels,
+    int depth,
+    int buffer_size,
+    struct probe_result* measurement
+)
+{
+    int result;
+
+    struct probe probe;
+
+    CHECK_ERROR_FATAL(pthread_mutex_init(&probe.lock, NULL));
+    probe.collecting = 1;
+    probe.rtts = malloc(NETPW_PROBE_MAX_SAMPLES * sizeof(uint64_t));
+    probe.rtt_count = 0;
+    probe.delays = malloc(NETPW_PROBE_MAX_SAMPLES * sizeof(uint64_t));
+    probe.delay_count = 0;
+    probe.report_count = 0;
+    probe.report_time = 0;
+    probe.report_bytes = 0;
+
+    memset(measurement, 0, sizeof(struct probe_result));
+
+    int stride = channels * (depth / 8);
+    int quantum_size = buffer_size * stride;
+    uint64_t quantum_time = (uint64_t)buffer_size * 1000000000 / frequency;
+
+    unsigned char* filler = calloc(max(quantum_size, NETPW_PROBE_CHUNK_SIZE), 1);
+
+    struct client* client = client_init(host, port, ca_certificate, certificate, private_key, profile, tcp, probe_on_packet, &probe);
+
+    printf("measuring at the audio rate for %i seconds.\n", (int)(NETPW_PROBE_DURATION / 1000000000));
+    probe_audio_rate(client, filler, quantum_size, quantum_time);
+
+    pthread_mutex_lock(&probe.lock);
+    probe.collecting = 0;
+    pthread_mutex_unlock(&probe.lock);
+
+    uint64_t rate = (uint64_t)frequency * stride * 2;
+
+    while (rate <= NETPW_PROBE_MAX_RATE)
+    {
+        printf("sending at %.1f Mbit/s.\n", rate * 8 / 1000000.0);
+
+        uint64_t delivered = probe_step(&probe, client, filler, rate);
+
+        if (delivered * 8 > measurement->throughput)
+        {
+            measurement->throughput = delivered * 8;
+        }
+
+        if (delivered * 4 < rate * 3)
+        {
+            measurement->saturated = 1;
+            break;
+        }
+
+        rate *= 2;
+    }
+
+    struct tcp_info info;
+    socklen_t info_size = sizeof(info);
+    memset(&info, 0, sizeof(info));
+
+    if (getsockopt(client_socket(client), IPPROTO_TCP, TCP_INFO, &info, &info_size) == 0)
+    {
+        measurement->segments_sent = info.tcpi_segs_out;
+        measurement->retransmits = info.tcpi_total_retrans;
+        measurement->reorderings = info.tcpi_reord_seen;
+    }
+
+    client_destroy(client);
+
+    int failed = 0;
+
+    pthread_mutex_lock(&probe.lock);
+
+    if (probe.rtt_count == 0)
+    {
+        fprintf(stderr, "the server never answered a ping.\n");
+        failed = 1;
+    }
+    else
+    {
+        measurement->rtt_median = percentile(probe.rtts, probe.rtt_count, 50);
+        measurement->rtt_p99 = percentile(probe.rtts, probe.rtt_count, 99);
+        measurement->rtt_min = probe.rtts[0];
+
+        int i;
+
+        if (probe.delay_count > 1)
+        {
+            uint64_t delay_min = percentile(probe.delays, probe.delay_count, 0);
+
+            for (i = 0; i < probe.delay_count; i++)
+            {
+                probe.delays[i] -= delay_min;
+            }
+
+            measurement->jitter_from_audio = 1;
+            measurement->jitter_median = percentile(probe.delays, probe.delay_count, 50);
+            measurement->jitter_p99 = percentile(probe.delays, probe.delay_count, 99);
+        }
+        else
+        {
+            /* half the spread of round trips stands in for the one-way jitter when the server sends no audio */
+            for (i = 0; i < probe.rtt_count; i++)
+            {
+                probe.rtts[i] = (probe.rtts[i] - measurement->rtt_min) / 2;
+            }
+
+            measurement->jitter_median = percentile(probe.rtts, probe.rtt_count, 50);
+            measurement->jitter_p99 = percentile(probe.rtts, probe.rtt_count, 99);
+        }
+
+        probe_recommend(measurement, frequency, stride);
+    }
+
+    pthread_mutex_unlock(&probe.lock);
+
+    free(filler);
+    free(probe.delays);
+    free(probe.rtts);
+    pthread_mutex_destroy(&probe.lock);
+
+    return failed;
+}
+
+void probe_print(const struct probe_result* result)
+{
+    printf("round trip time: minimum %.2f ms, median %.2f ms, 99th percentile %.2f ms.\n",
+        result->rtt_min / 1000000.0,
+        result->rtt_median / 1000000.0,
+        result->rtt_p99 / 1000000.0
+    );
+    printf("jitter (%s): median %.2f ms, 99th percentile %.2f ms.\n",
+        result->jitter_from_audio ? "from the server's audio" : "from round trips",
+        result->jitter_median / 1000000.0,
+        result->jitter_p99 / 1000000.0
+    );
+    printf("loss: %u of %u segments retransmitted (%.3f%%), %u reorderings seen.\n",
+        result->retransmits,
+        result->segments_sent,
+        result->segments_sent ? 100.0 * result->retransmits / result->segments_sent : 0,
+        result->reorderings
+    );
+    printf("throughput: %.1f Mbit/s%s.\n",
+        result->throughput / 1000000.0,
+        result->saturated ? "" : " (the server kept up with the fastest rate tried)"
+    );
+    printf("\n");
+    printf("recommended buffer: %i frames.\n", result->buffer_size);
+    printf("recommended jitter target: %.1f ms.\n", result->jitter_target / 1000000.0);
+    printf("recommended latency budget: %.1f ms.\n", result->latency_budget / 1000000.0);
+    printf("recommended bitrate: %i kbit/s%s.\n", result->bitrate, result->uncompressed_fits ? ", uncompressed audio fits" : "");
+}
+
+int probe_write_config(const struct probe_result* result, const char* path)
+{
+    FILE* file = fopen(path, "w");
+
+    if (!file)
+    {
+        fprintf(stderr, "failed to open probe config %s: %i\n", path, errno);
+        return 1;
+    }
+
+    fprintf(file, "--buffer %i\n", result->buffer_size);
+    fprintf(file, "--latency-budget %i\n", (int)((result->latency_budget + 999999) / 1000000));
+
+    /* encoding is only called for if uncompressed audio doesn't fit */
+    if (!result->uncompressed_fits && result->bitrate > NETPW_PROBE_MIN_BITRATE)
+    {
+        fprintf(file, "--adaptive-bitrate %i-%i\n", NETPW_PROBE_MIN_BITRATE, result->bitrate);
+    }
+
+    return fclose(file) != 0;
+}
@@ -0,0 +1,78 @@
+/*
+Copyright 2025 Amini Allight
+
+This file is part of netpw.
+
+netpw is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+netpw is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with netpw. If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef NETPW_PROBE_H
+#define NETPW_PROBE_H
+
+#include "tcp_tuning.h"
+#include "transport.h"
+
+#include <stdint.h>
+
+/* what a probe measured of the link to a server and what it recommends for it, times are in nanoseconds */
+struct probe_result
+{
+    uint64_t rtt_min;
+    uint64_t rtt_median;
+    uint64_t rtt_p99;
+    /* one-way, from the timestamps a sending server includes or else from the spread of round trip times */
+    uint64_t jitter_median;
+    uint64_t jitter_p99;
+    int jitter_from_audio;
+    /* as counted by the kernel on the way to the server */
+    uint32_t segments_sent;
+    uint32_t retransmits;
+    uint32_t reorderings;
+    /* in bits per second, the most the server reported receiving */
+    uint64_t throughput;
+    /* non-zero if the ramp ended because the server fell behind rather than at NETPW_PROBE_MAX_RATE */
+    int saturated;
+    /* in frames */
+    int buffer_size;
+    uint64_t jitter_target;
+    uint64_t latency_budget;
+    /* in kbit/s */
+    int bitrate;
+    /* non-zero if uncompressed audio fits in the throughput with a fifth to spare */
+    int uncompressed_fits;
+};
+
+/*
+ * connects to a server as a client, sends synthetic traffic at the audio rate while pinging it and then ramps the rate up until the server falls behind
+ * blocks until done and returns non-zero if the server couldn't be measured
+ */
+int probe_run(
+    const char* host,
+    unsigned short port,
+    const char* ca_certificate,
+    const char* certificate,
+    const char* private_key,
+    enum crypto_profile profile,
+    /* NULL for the defaults */
+    const struct tcp_options* tcp,
+    int frequency,
+    int channels,
+    int depth,
+    int buffer_size,
+    struct probe_result* measurement
+);
+void probe_print(const struct probe_result* result);
+/* writes the recommendations as command-line options, one per line, returns non-zero on failure */
+int probe_write_config(const struct probe_result* result, const char* path);
+
+#endif
@@ -0,0 +1,133 @@
+/*
+Copyright 2025 Amini Allight
+
+This file is part of netpw.
+
+netpw is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+netpw is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with netpw. If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "rate_control.h"
+#include "constants.h"
+#include "packet.h"
+
+#include <stdlib.h>
+
+struct rate_control
+{
+    uint64_t received;
+    uint64_t last_report;
+    uint64_t rate;
+    uint64_t min_rtt;
+    int last_backlog;
+};
+
+struct rate_control* rate_control_init()
+{
+    struct rate_control* control = malloc(sizeof(struct rate_control));
+
+    control->received = 0;
+    control->last_report = 0;
+    control->rate = 0;
+    control->min_rtt = 0;
+    control->last_backlog = 0;
+
+    return control;
+}
+
+void rate_control_destroy(struct rate_control* control)
+{
+    free(control);
+}
+
+void rate_control_receive(struct rate_control* control, int size)
+{
+    control->received += size;
+}
+
+int rate_control_report_due(struct rate_control* control, uint64_t now, unsigned char* report)
+{
+    /* the first report covers a full interval from the first packet */
+    if (control->last_report == 0)
+    {
+        control->last_report = now;
+        control->received = 0;
+        return 0;
+    }
+
+    if (now - control->last_report < NETPW_RATE_REPORT_INTERVAL)
+    {
+        return 0;
+    }
+
+    packet_write_u64(report, now - control->last_report);
+    packet_write_u64(report + 8, control->received);
+
+    control->last_report = now;
+    control->received = 0;
+
+    return 1;
+}
+
+uint64_t rate_control_update(struct rate_control* control, const unsigned char* report, int backlog, uint64_t rtt)
+{
+    uint64_t interval = packet_read_u64(report);
+    uint64_t received = packet_read_u64(report + 8);
+
+    if (interval == 0)
+    {
+        return control->rate;
+    }
+
+    uint64_t delivered = (uint64_t)(received * 8 * 1000000000.0 / interval);
+
+    if (rtt && (control->min_rtt == 0 || rtt < control->min_rtt))
+    {
+        control->min_rtt = rtt;
+    }
+
+    uint64_t rtt_margin = control->min_rtt / 2 > NETPW_RATE_RTT_MARGIN ? control->min_rtt / 2 : NETPW_RATE_RTT_MARGIN;
+
+    /* a backlog that keeps growing past what the link drains in the allowed queueing time, or pings that wait behind it */
+    int queueing = backlog > control->last_backlog && backlog * 8 * 1000000000.0 > (double)delivered * NETPW_RATE_QUEUE_DELAY;
+    int delayed = rtt && rtt > control->min_rtt + rtt_margin;
+
+    control->last_backlog = backlog;
+
+    if (queueing || delayed)
+    {
+        /* cutting from what actually arrived rather than the estimate reaches the real capacity in one step */
+        uint64_t base = control->rate && control->rate < delivered ? control->rate : delivered;
+        uint64_t rate = base * NETPW_RATE_DECREASE / 100;
+
+        control->rate = rate > NETPW_RATE_MIN ? rate : NETPW_RATE_MIN;
+    }
+    else if (control->rate == 0)
+    {
+        if (delivered >= NETPW_RATE_MIN)
+        {
+            control->rate = delivered;
+        }
+    }
+    /* probing stops at twice what is being sent, so quiet stretches can't inflate the estimate */
+    else if (control->rate + NETPW_RATE_INCREASE <= delivered * 2)
+    {
+        control->rate += NETPW_RATE_INCREASE;
+    }
+
+    return control->rate;
+}
+
+uint64_t rate_control_rate(struct rate_control* control)
+{
+    return control->rate;
+}
@@ -0,0 +1,42 @@
+/*
+Copyright 2025 Amini Allight
+
+This file is part of netpw.
+
+netpw is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+netpw is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with netpw. If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef NETPW_RATE_CONTROL_H
+#define NETPW_RATE_CONTROL_H
+
+#include <stdint.h>
+
+/*
+ * estimates the rate a connection can carry, not thread-safe
+ * the receiving end counts what arrives and reports it, the sending end combines the reports with its send backlog and round trip time
+ */
+struct rate_control;
+
+struct rate_control* rate_control_init();
+void rate_control_destroy(struct rate_control* control);
+
+/* receiving end, report_due returns non-zero and fills report when one should be sent */
+void rate_control_receive(struct rate_control* control, int size);
+int rate_control_report_due(struct rate_control* control, uint64_t now, unsigned char* report);
+
+/* sending end, returns the new estimate in bits per second */
+uint64_t rate_control_update(struct rate_control* control, const unsigned char* report, int backlog, uint64_t rtt);
+/* returns zero until a report showed enough traffic to estimate from */
+uint64_t rate_control_rate(struct rate_control* control);
+
+#endif
@@ -0,0 +1,385 @@
+/*
+Copyright 2025 Amini Allight
+
+This file is part of netpw.
+
+netpw is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+netpw is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with netpw. If not, see <https://www.gnu.org/licenses/>.
+*/
+/* for O_DIRECT */
+#define _GNU_SOURCE
+
+#include "recorder.h"
+#include "lockfree_spsc_queue.h"
+#include "error_handling.h"
+#include "constants.h"
+#include "metrics.h"
+#include "tools.h"
+#include "trace.h"
+#include "wav.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+
+struct recorder
+{
+    char* directory;
+    char* name;
+    char* extension;
+    int wav;
+    int frequency;
+    int channels;
+    int depth;
+    uint64_t max_size;
+    uint64_t max_duration;
+    struct lockfree_spsc_queue* queue;
+    /* negative while no file could be opened */
+    int fd;
+    int direct;
+    uint64_t file_start;
+    /* bytes written to the current file so far, always a multiple of the alignment */
+    uint64_t file_offset;
+    /* what has been drained from the queue but not yet written, the first block is kept for the WAV header */
+    unsigned char* buffer;
+    int buffered;
+    unsigned char* head;
+    int running;
+    pthread_t thread;
+    struct metric* written_metric;
+    struct metric* dropped_metric;
+};
+
+static void recorder_open(struct recorder* recorder)
+{
+    char timestamp[32];
+    time_t now = time(NULL);
+    strftime(timestamp, sizeof(timestamp), "%Y%m%d-%H%M%S", localtime(&now));
+
+    char path[4096];
+    int attempt;
+
+    /* rolling over by size can start several files within a second */
+    for (attempt = 0; attempt < 100; attempt++)
+    {
+        if (attempt == 0)
+        {
+            snprintf(path, sizeof(path), "%s/%s-%s.%s", recorder->directory, recorder->name, timestamp, recorder->extension);
+        }
+        else
+        {
+            snprintf(path, sizeof(path), "%s/%s-%s-%i.%s", recorder->directory, recorder->name, timestamp, attempt, recorder->extension);
+        }
+
+        /* bypassing the page cache keeps a long recording from evicting everything else, not every filesystem allows it */
+        recorder->direct = 1;
+        recorder->fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_DIRECT | O_CLOEXEC, 0644);
+
+        if (recorder->fd < 0 && errno == EINVAL)
+        {
+            recorder->direct = 0;
+            recorder->fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        }
+
+        if (recorder->fd >= 0 || errno != EEXIST)
+        {
+            break;
+        }
+    }
+
+    if (recorder->fd < 0)
+    {
+        fprintf(stderr, "failed to start recording %s: %i\n", path, errno);
+        return;
+    }
+
+    printf("recording to %s.\n", path);
+
+    recorder->file_start = get_time();
+    recorder->file_offset = 0;
+    recorder->buffered = 0;
+
+    /* the sizes are filled in once the file is finished */
+    if (recorder->wav)
+    {
+        wav_write_header(recorder->buffer, recorder->frequency, recorder->channels, recorder->depth, 0);
+        recorder->buffered = NETPW_WAV_HEADER_SIZE;
+    }
+}
+
+/* returns non-zero on failure, after which the file is abandoned */
+static int recorder_flush(struct recorder* recorder, int size)
+{
+    int offset = 0;
+
+    while (offset < size)
+    {
+        int result = pwrite(recorder->fd, recorder->buffer + offset, size - offset, recorder->file_offset + offset);
+
+        if (result < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        else if (result < 0)
+        {
+            fprintf(stderr, "recording write failed, discarding further data: %i\n", errno);
+            close(recorder->fd);
+            recorder->fd = -1;
+            /* nothing buffered can be written any more and the buffer is reused to count what is dropped */
+            recorder->buffered = 0;
+            return 1;
+        }
+
+        offset += result;
+    }
+
+    if (recorder->file_offset == 0)
+    {
+        memcpy(recorder->head, recorder->buffer, NETPW_RECORD_ALIGNMENT);
+    }
+
+    recorder->file_offset += size;
+
+    return 0;
+}
+
+/* writes what can be written in whole blocks and keeps the rest */
+static void recorder_write_blocks(struct recorder* recorder)
+{
+    int size = recorder->buffered - recorder->buffered % NETPW_RECORD_ALIGNMENT;
+
+    if (size == 0 || recorder_flush(recorder, size))
+    {
+        return;
+    }
+
+    recorder->buffered -= size;
+    memmove(recorder->buffer, recorder->buffer + size, recorder->buffered);
+}
+
+static void recorder_close(struct recorder* recorder)
+{
+    int result;
+
+    uint64_t size = recorder->file_offset + recorder->buffered;
+
+    /* the tail is padded to a whole block and cut off again afterwards */
+    int padded = (recorder->buffered + NETPW_RECORD_ALIGNMENT - 1) / NETPW_RECORD_ALIGNMENT * NETPW_RECORD_ALIGNMENT;
+    memset(recorder->buffer + recorder->buffered, 0, padded - recorder->buffered);
+
+    if (padded && recorder_flush(recorder, padded))
+    {
+        return;
+    }
+
+    recorder->buffered = 0;
+
+    if (recorder->wav)
+    {
+        /* past 4 GiB the sizes are left at their maximum, which most readers take to mean the rest of the file */
+        uint64_t data_size = size - NETPW_WAV_HEADER_SIZE;
+
+        if (data_size > UINT32_MAX - NETPW_WAV_HEADER_SIZE)
+        {
+            data_size = UINT32_MAX - NETPW_WAV_HEADER_SIZE;
+        }
+
+        wav_write_header(recorder->head, recorder->frequency, recorder->channels, recorder->depth, data_size);
+        CHECK_ERRNO(pwrite(recorder->fd, recorder->head, NETPW_RECORD_ALIGNMENT, 0));
+    }
+
+    CHECK_ERRNO(ftruncate(recorder->fd, size));
+    CHECK_ERRNO(close(recorder->fd));
+    recorder->fd = -1;
+}
+
+static void recorder_drain(struct recorder* recorder)
+{
+    int size;
+
+    /* without a file the queue is only pulled to keep it moving, into the start of the buffer whatever was left buffered */
+    if (recorder->fd < 0)
+    {
+        size = lockfree_spsc_queue_pull(recorder->queue, recorder->buffer, NETPW_QUEUE_SIZE);
+        metric_add(recorder->dropped_metric, size);
+        return;
+    }
+
+    size = lockfree_spsc_queue_pull(recorder->queue, recorder->buffer + recorder->buffered, NETPW_QUEUE_SIZE);
+
+    if (recorder->wav)
+    {
+        wav_convert_samples(recorder->buffer + recorder->buffered, size, recorder->depth);
+    }
+
+    recorder->buffered += size;
+    metric_add(recorder->written_metric, size);
+
+    if (recorder->buffered >= NETPW_RECORD_WRITE_SIZE)
+    {
+        recorder_write_blocks(recorder);
+    }
+}
+
+static void* recorder_run(void* arg)
+{
+    struct recorder* recorder = arg;
+
+    trace_thread_name("recorder");
+
+    while (__atomic_load_n(&recorder->running, __ATOMIC_ACQUIRE))
+    {
+        sleep_until(get_time() + NETPW_RECORD_INTERVAL);
+
+        recorder_drain(recorder);
+
+        if (recorder->fd < 0)
+        {
+            continue;
+        }
+
+        /* whole packets are queued at once, so a PCM file always ends on a frame */
+        uint64_t size = recorder->file_offset + recorder->buffered;
+
+        if ((recorder->max_size && size >= recorder->max_size) || (recorder->max_duration && get_time() - recorder->file_start >= recorder->max_duration))
+        {
+            recorder_close(recorder);
+            recorder_open(recorder);
+        }
+    }
+
+    recorder_drain(recorder);
+
+    if (recorder->fd >= 0)
+    {
+        recorder_close(recorder);
+    }
+
+    return NULL;
+}
+
+struct recorder* recorder_init(
+    const char* directory,
+    const char* name,
+    const char* extension,
+    int frequency,
+    int channels,
+    int depth,
+    uint64_t max_size,
+    uint64_t max_duration
+)
+{
+    int result;
+
+    struct recorder* recorder = malloc(sizeof(struct recorder));
+
+    recorder->directory = strdup(directory);
+    recorder->name = strdup(name);
+    recorder->extension = strdup(extension);
+    recorder->wav = strcmp(extension, "wav") == 0;
+    recorder->frequency = frequency;
+    recorder->channels = channels;
+    recorder->depth = depth;
+    recorder->max_size = max_size;
+    recorder->max_duration = max_duration;
+
+    /* stream names are addresses or tier names, neither may reach outside the directory */
+    char* c;
+    for (c = recorder->name; *c; c++)
+    {
+        if (*c == '/')
+        {
+            *c = '_';
+        }
+    }
+
+    CHECK_ERROR_FATAL(lockfree_spsc_queue_init(&recorder->queue));
+
+    /* room for a full queue on top of a partial block */
+    CHECK_ERROR_FATAL(posix_memalign((void**)&recorder->buffer, NETPW_RECORD_ALIGNMENT, NETPW_QUEUE_SIZE + NETPW_RECORD_WRITE_SIZE));
+    CHECK_ERROR_FATAL(posix_memalign((void**)&recorder->head, NETPW_RECORD_ALIGNMENT, NETPW_RECORD_ALIGNMENT));
+    recorder->buffered = 0;
+
+    char labels[256];
+    snprintf(labels, sizeof(labels), "recording=\"%s\"", recorder->name);
+
+    recorder->written_metric = metric_counter_init("netpw_recording_bytes_total", "Bytes taken from the stream into a recording.", labels);
+    recorder->dropped_metric = metric_counter_init("netpw_recording_dropped_bytes_total", "Bytes left out of a recording because the disk fell behind.", labels);
+
+    recorder_open(recorder);
+
+    recorder->running = 1;
+    CHECK_ERROR_FATAL(pthread_create(&recorder->thread, NULL, recorder_run, recorder));
+
+    return recorder;
+}
+
+void recorder_destroy(struct recorder* recorder)
+{
+    int result;
+
+    __atomic_store_n(&recorder->running, 0, __ATOMIC_RELEASE);
+    CHECK_ERROR(pthread_join(recorder->thread, NULL));
+
+    lockfree_spsc_queue_destroy(recorder->queue);
+    free(recorder->buffer);
+    free(recorder->head);
+    metric_destroy(recorder->written_metric);
+    metric_destroy(recorder->dropped_metric);
+    free(recorder->directory);
+    free(recorder->name);
+    free(recorder->extension);
+    free(recorder);
+}
+
+void recorder_write(struct recorder* recorder, const unsigned char* data, int size)
+{
+    /* a partial packet would leave the rest of a PCM recording misaligned */
+    if (lockfree_spsc_queue_space(recorder->queue) < size)
+    {
+        metric_add(recorder->dropped_metric, size);
+        return;
+    }
+
+    lockfree_spsc_queue_push(recorder->queue, data, size);
+}
+
+void recorder_write_silence(struct recorder* recorder, int frames)
+{
+    static const unsigned char zeros[NETPW_IO_BUFFER_SIZE] = {0};
+
+    int64_t size = (int64_t)frames * recorder->channels * (recorder->depth / 8);
+
+    if (size < 0)
+    {
+        return;
+    }
+
+    if (lockfree_spsc_queue_space(recorder->queue) < size)
+    {
+        metric_add(recorder->dropped_metric, size);
+        return;
+    }
+
+    while (size > 0)
+    {
+        int chunk = min(size, sizeof(zeros));
+
+        lockfree_spsc_queue_push(recorder->queue, zeros, chunk);
+        size -= chunk;
+    }
+}
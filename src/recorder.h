@@ -0,0 +1,48 @@
+/*
+Copyright 2025 Amini Allight
+
+This file is part of netpw.
+
+netpw is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+netpw is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with netpw. If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef NETPW_RECORDER_H
+#define NETPW_RECORDER_H
+
+#include <stdint.h>
+
+/*
+ * archives a stream to disk from a background thread, files are named after the stream and the time they were started
+ * writes never block, anything the disk can't keep up with is dropped and counted
+ */
+struct recorder;
+
+struct recorder* recorder_init(
+    const char* directory,
+    const char* name,
+    /* "wav" to write PCM as WAV files, anything else is the extension of files holding the bytes as written */
+    const char* extension,
+    int frequency,
+    int channels,
+    int depth,
+    /* a new file is started once either is exceeded, zero for no limit */
+    uint64_t max_size,
+    uint64_t max_duration
+);
+void recorder_destroy(struct recorder* recorder);
+
+/* only one thread at a time may write to a recorder */
+void recorder_write(struct recorder* recorder, const unsigned char* data, int size);
+void recorder_write_silence(struct recorder* recorder, int frames);
+
+#endif
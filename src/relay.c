@@ -0,0 +1,298 @@
+/*
+Copyright 2025 Amini Allight
+
+This file is part of netpw.
+
+netpw is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+netpw is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with netpw. If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "relay.h"
+#include "client.h"
+#include "error_handling.h"
+#include "constants.h"
+#include "packet.h"
+#include "metrics.h"
+#include "tools.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+enum relay_latency_stage
+{
+    NETPW_RELAY_LATENCY_CAPTURE,
+    NETPW_RELAY_LATENCY_QUEUE,
+    NETPW_RELAY_LATENCY_NETWORK,
+    NETPW_RELAY_LATENCY_FORWARD,
+    NETPW_RELAY_LATENCY_STAGE_COUNT
+};
+
+static const char* relay_latency_stage_names[NETPW_RELAY_LATENCY_STAGE_COUNT] = {
+    "capture",
+    "queue",
+    "network",
+    "forward"
+};
+
+struct relay
+{
+    struct client* client;
+    /* NULL until the upstream server has announced the tier, packets before that are dropped */
+    struct server* server;
+    /* announced by the upstream server, the tier is served under the same name */
+    char* tier;
+    int encoded;
+    int announcements;
+    int awaited_announcements;
+    pthread_mutex_t lock;
+    pthread_cond_t condition;
+    int latency_reporting;
+    uint64_t last_latency_report;
+    struct metric* latency_metrics[NETPW_RELAY_LATENCY_STAGE_COUNT];
+    struct metric* forwarded_metric;
+};
+
+static void on_downstream_packet(void* userdata, int type, const unsigned char* data, int size)
+{
+    /* clients of a relay only receive, anything they send beyond what the network layer handles is ignored */
+}
+
+static void relay_receive_tier(struct relay* relay, int encoded, const char* name, int size)
+{
+    pthread_mutex_lock(&relay->lock);
+
+    if (relay->server)
+    {
+        /* downstream clients keep the tier they were announced, so only a matching stream can be passed on */
+        if (encoded != relay->encoded)
+        {
+            fprintf(stderr, "upstream switched to tier %.*s, which is encoded differently from tier %s relayed so far.\n", size, name, relay->tier);
+        }
+        else if (strlen(relay->tier) != size || memcmp(relay->tier, name, size) != 0)
+        {
+            printf("upstream switched to tier %.*s, relaying it as %s.\n", size, name, relay->tier);
+        }
+    }
+    else
+    {
+        free(relay->tier);
+        relay->tier = strndup(name, size);
+        relay->encoded = encoded;
+        relay->announcements++;
+
+        pthread_cond_signal(&relay->condition);
+    }
+
+    pthread_mutex_unlock(&relay->lock);
+}
+
+/* the network layer already moved the timestamps to the local clock, so the upstream hop can be measured here */
+static void relay_forward_timestamp(struct relay* relay, struct server* server, const unsigned char* data)
+{
+    uint64_t capture = packet_read_u64(data);
+    uint64_t process = packet_read_u64(data + 8);
+    uint64_t send = packet_read_u64(data + 16);
+    uint64_t receive = packet_read_u64(data + 24);
+    uint64_t now = get_time();
+
+    /* the time spent upstream and in this relay reaches the next hop as queueing */
+    unsigned char timestamp[NETPW_PACKET_TIMESTAMP_SIZE];
+    packet_write_u64(timestamp, capture);
+    packet_write_u64(timestamp + 8, process);
+    packet_write_u64(timestamp + 16, now);
+
+    server_send(server, 0, NETPW_PACKET_TIMESTAMP, timestamp, sizeof(timestamp));
+
+    int64_t stages[NETPW_RELAY_LATENCY_STAGE_COUNT] = {
+        process - capture,
+        send - process,
+        receive - send,
+        now - receive
+    };
+
+    int64_t total = 0;
+
+    int i;
+    for (i = 0; i < NETPW_RELAY_LATENCY_STAGE_COUNT; i++)
+    {
+        metric_set(relay->latency_metrics[i], stages[i] / 1000);
+        total += stages[i];
+    }
+
+    if (!relay->latency_reporting || now - relay->last_latency_report < NETPW_LATENCY_REPORT_INTERVAL)
+    {
+        return;
+    }
+
+    relay->last_latency_report = now;
+
+    printf("latency from upstream:");
+
+    for (i = 0; i < NETPW_RELAY_LATENCY_STAGE_COUNT; i++)
+    {
+        printf(" %s %.1f ms,", relay_latency_stage_names[i], stages[i] / 1000000.0);
+    }
+
+    printf(" total %.1f ms.\n", total / 1000000.0);
+}
+
+static void on_upstream_packet(void* userdata, int type, const unsigned char* data, int size)
+{
+    struct relay* relay = userdata;
+
+    if (type == NETPW_PACKET_TIER)
+    {
+        if (size >= 1 && size <= NETPW_PACKET_TIER_MAX_SIZE)
+        {
+            relay_receive_tier(relay, data[0], (const char*)data + 1, size - 1);
+        }
+        return;
+    }
+
+    struct server* server = __atomic_load_n(&relay->server, __ATOMIC_ACQUIRE);
+
+    if (!server)
+    {
+        return;
+    }
+
+    /* payloads are passed on untouched, neither decoded nor resampled */
+    switch (type)
+    {
+    case NETPW_PACKET_AUDIO :
+    case NETPW_PACKET_SILENCE :
+        metric_add(relay->forwarded_metric, size);
+        server_send(server, 0, type, data, size);
+        break;
+    case NETPW_PACKET_TIMESTAMP :
+        if (size == NETPW_PACKET_LOCAL_TIMESTAMP_SIZE)
+        {
+            relay_forward_timestamp(relay, server, data);
+        }
+        break;
+    }
+}
+
+struct relay* relay_init(
+    const char* upstream_host,
+    unsigned short upstream_port,
+    const char* host,
+    unsigned short port,
+    const char* ca_certificate,
+    const char* certificate,
+    const char* private_key,
+    enum crypto_profile profile,
+    const struct server_limits* limits,
+    const struct tcp_options* tcp,
+    const char* tier,
+    int latency_reporting
+)
+{
+    int result;
+
+    struct relay* relay = malloc(sizeof(struct relay));
+
+    relay->server = NULL;
+    relay->tier = NULL;
+    relay->encoded = 0;
+    relay->announcements = 0;
+    /* the server announces its default tier on connect and the requested one after the request */
+    relay->awaited_announcements = tier ? 2 : 1;
+    CHECK_ERROR_FATAL(pthread_mutex_init(&relay->lock, NULL));
+    CHECK_ERROR_FATAL(pthread_cond_init(&relay->condition, NULL));
+    relay->latency_reporting = latency_reporting;
+    relay->last_latency_report = 0;
+
+    int i;
+    for (i = 0; i < NETPW_RELAY_LATENCY_STAGE_COUNT; i++)
+    {
+        char labels[64];
+        snprintf(labels, sizeof(labels), "stage=\"%s\"", relay_latency_stage_names[i]);
+
+        relay->latency_metrics[i] = metric_gauge_init("netpw_relay_latency_microseconds", "Latest one-way latency of each stage between the upstream capture and forwarding.", labels);
+    }
+
+    relay->forwarded_metric = metric_counter_init("netpw_relay_forwarded_bytes_total", "Audio payload bytes passed from upstream to the clients.", NULL);
+
+    relay->client = client_init(upstream_host, upstream_port, ca_certificate, certificate, private_key, profile, tcp, on_upstream_packet, relay);
+
+    if (tier)
+    {
+        client_send(relay->client, NETPW_PACKET_TIER, (const unsigned char*)tier, strlen(tier));
+    }
+
+    /* the downstream tier can only be described once the upstream one is known */
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += NETPW_HANDSHAKE_TIMEOUT / 1000000000;
+
+    pthread_mutex_lock(&relay->lock);
+
+    while (relay->announcements < relay->awaited_announcements)
+    {
+        if (pthread_cond_timedwait(&relay->condition, &relay->lock, &deadline) != 0)
+        {
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&relay->lock);
+
+    if (!relay->tier)
+    {
+        fprintf(stderr, "the upstream server announced no tier.\n");
+        exit(1);
+    }
+
+    if (tier && strcmp(tier, relay->tier) != 0)
+    {
+        printf("the upstream server has no tier %s, relaying %s instead.\n", tier, relay->tier);
+    }
+    else
+    {
+        printf("relaying tier %s.\n", relay->tier);
+    }
+
+    struct server_tier server_tier = { relay->tier, relay->encoded };
+
+    /* clients are only verified by upstream servers, the relay serves anyone like a server without --ca */
+    __atomic_store_n(
+        &relay->server,
+        server_init(host, port, NULL, certificate, private_key, profile, limits, tcp, &server_tier, 1, on_downstream_packet, NULL, NULL, relay),
+        __ATOMIC_RELEASE
+    );
+
+    return relay;
+}
+
+void relay_destroy(struct relay* relay)
+{
+    int result;
+
+    /* the upstream connection feeds the server, so it goes first */
+    client_destroy(relay->client);
+    server_destroy(relay->server);
+
+    int i;
+    for (i = 0; i < NETPW_RELAY_LATENCY_STAGE_COUNT; i++)
+    {
+        metric_destroy(relay->latency_metrics[i]);
+    }
+
+    metric_destroy(relay->forwarded_metric);
+    free(relay->tier);
+    CHECK_ERROR(pthread_mutex_destroy(&relay->lock));
+    CHECK_ERROR(pthread_cond_destroy(&relay->condition));
+    free(relay);
+}
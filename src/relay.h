@@ -0,0 +1,49 @@
+/*
+Copyright 2025 Amini Allight
+
+This file is part of netpw.
+
+netpw is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+netpw is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with netpw. If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef NETPW_RELAY_H
+#define NETPW_RELAY_H
+
+#include "server.h"
+#include "tcp_tuning.h"
+#include "transport.h"
+
+/* receives one tier from an upstream server and serves it unchanged to clients of its own */
+struct relay;
+
+struct relay* relay_init(
+    const char* upstream_host,
+    unsigned short upstream_port,
+    const char* host,
+    unsigned short port,
+    /* verifies the upstream server only */
+    const char* ca_certificate,
+    const char* certificate,
+    const char* private_key,
+    enum crypto_profile profile,
+    /* NULL for the defaults */
+    const struct server_limits* limits,
+    const struct tcp_options* tcp,
+    /* NULL for whichever tier the upstream server sends by default */
+    const char* tier,
+    /* non-zero to print the latency of the upstream hop every second */
+    int latency_reporting
+);
+void relay_destroy(struct relay* relay);
+
+#endif
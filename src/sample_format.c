@@ -0,0 +1,224 @@
+/*
+Copyright 2025 Amini Allight
+
+This file is part of netpw.
+
+netpw is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+netpw is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with netpw. If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "sample_format.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <endian.h>
+
+/*
+ * the loops are written to be vectorized by the compiler, each is specialized for mono and stereo so that the stride is a constant
+ * packing walks frames in the outer loop so that the interleaved stores are contiguous, unpacking walks each plane in turn
+ */
+
+/* rounds to nearest after clamping to the range of the depth */
+static inline __attribute__((always_inline)) int32_t sample_from_float(float sample, float scale, float maximum)
+{
+    float value = sample * scale;
+
+    value = value < maximum ? value : maximum;
+    value = value > -scale ? value : -scale;
+
+    return (int32_t)(value + copysignf(0.5f, value));
+}
+
+static inline __attribute__((always_inline)) void pack_8(const float* const* planes, int channels, int frames, unsigned char* restrict out)
+{
+    int i;
+    for (i = 0; i < frames; i++)
+    {
+        int c;
+        for (c = 0; c < channels; c++)
+        {
+            out[i * channels + c] = sample_from_float(planes[c][i], 128.0f, 127.0f);
+        }
+    }
+}
+
+static inline __attribute__((always_inline)) void pack_16(const float* const* planes, int channels, int frames, unsigned char* restrict out)
+{
+    int i;
+    for (i = 0; i < frames; i++)
+    {
+        int c;
+        for (c = 0; c < channels; c++)
+        {
+            uint16_t value = htole16(sample_from_float(planes[c][i], 32768.0f, 32767.0f));
+            memcpy(out + (i * channels + c) * 2, &value, 2);
+        }
+    }
+}
+
+static inline __attribute__((always_inline)) void pack_24(const float* const* planes, int channels, int frames, unsigned char* restrict out)
+{
+    int i;
+    for (i = 0; i < frames; i++)
+    {
+        int c;
+        for (c = 0; c < channels; c++)
+        {
+            int32_t value = sample_from_float(planes[c][i], 8388608.0f, 8388607.0f);
+            unsigned char* sample = out + (i * channels + c) * 3;
+            sample[0] = value;
+            sample[1] = value >> 8;
+            sample[2] = value >> 16;
+        }
+    }
+}
+
+/* 2147483520 is the largest float below 2^31 */
+static inline __attribute__((always_inline)) void pack_32(const float* const* planes, int channels, int frames, unsigned char* restrict out)
+{
+    int i;
+    for (i = 0; i < frames; i++)
+    {
+        int c;
+        for (c = 0; c < channels; c++)
+        {
+            uint32_t value = htole32(sample_from_float(planes[c][i], 2147483648.0f, 2147483520.0f));
+            memcpy(out + (i * channels + c) * 4, &value, 4);
+        }
+    }
+}
+
+static inline __attribute__((always_inline)) void unpack_8(const unsigned char* restrict in, int channels, int frames, float* const* planes)
+{
+    int c;
+    for (c = 0; c < channels; c++)
+    {
+        const unsigned char* restrict base = in + c;
+        float* restrict plane = planes[c];
+
+        int i;
+        for (i = 0; i < frames; i++)
+        {
+            plane[i] = (int8_t)base[i * channels] * (1.0f / 128.0f);
+        }
+    }
+}
+
+static inline __attribute__((always_inline)) void unpack_16(const unsigned char* restrict in, int channels, int frames, float* const* planes)
+{
+    int c;
+    for (c = 0; c < channels; c++)
+    {
+        const unsigned char* restrict base = in + c * 2;
+        float* restrict plane = planes[c];
+
+        int i;
+        for (i = 0; i < frames; i++)
+        {
+            int16_t value = base[i * channels * 2] | (base[i * channels * 2 + 1] << 8);
+            plane[i] = value * (1.0f / 32768.0f);
+        }
+    }
+}
+
+static inline __attribute__((always_inline)) void unpack_24(const unsigned char* restrict in, int channels, int frames, float* const* planes)
+{
+    int c;
+    for (c = 0; c < channels; c++)
+    {
+        const unsigned char* restrict base = in + c * 3;
+        float* restrict plane = planes[c];
+
+        int i;
+        for (i = 0; i < frames; i++)
+        {
+            uint32_t bits = base[i * channels * 3] | (base[i * channels * 3 + 1] << 8) | ((uint32_t)base[i * channels * 3 + 2] << 16);
+            /* the shift back down extends the sign */
+            int32_t value = (int32_t)(bits << 8) >> 8;
+            plane[i] = value * (1.0f / 8388608.0f);
+        }
+    }
+}
+
+static inline __attribute__((always_inline)) void unpack_32(const unsigned char* restrict in, int channels, int frames, float* const* planes)
+{
+    int c;
+    for (c = 0; c < channels; c++)
+    {
+        const unsigned char* restrict base = in + c * 4;
+        float* restrict plane = planes[c];
+
+        int i;
+        for (i = 0; i < frames; i++)
+        {
+            int32_t value = base[i * channels * 4]
+                | (base[i * channels * 4 + 1] << 8)
+                | (base[i * channels * 4 + 2] << 16)
+                | ((uint32_t)base[i * channels * 4 + 3] << 24);
+            plane[i] = value * (1.0f / 2147483648.0f);
+        }
+    }
+}
+
+/* expands one kernel for mono, stereo and any other channel count */
+#define NETPW_DISPATCH(kernel, a, channels, frames, b) \
+    switch (channels) \
+    { \
+    case 1 : \
+        kernel(a, 1, frames, b); \
+        break; \
+    case 2 : \
+        kernel(a, 2, frames, b); \
+        break; \
+    default : \
+        kernel(a, channels, frames, b); \
+        break; \
+    }
+
+void sample_format_pack(const float* const* planes, int channels, int frames, int depth, unsigned char* out)
+{
+    switch (depth)
+    {
+    case 8 :
+        NETPW_DISPATCH(pack_8, planes, channels, frames, out);
+        break;
+    case 16 :
+        NETPW_DISPATCH(pack_16, planes, channels, frames, out);
+        break;
+    case 24 :
+        NETPW_DISPATCH(pack_24, planes, channels, frames, out);
+        break;
+    case 32 :
+        NETPW_DISPATCH(pack_32, planes, channels, frames, out);
+        break;
+    }
+}
+
+void sample_format_unpack(const unsigned char* in, int channels, int frames, int depth, float* const* planes)
+{
+    switch (depth)
+    {
+    case 8 :
+        NETPW_DISPATCH(unpack_8, in, channels, frames, planes);
+        break;
+    case 16 :
+        NETPW_DISPATCH(unpack_16, in, channels, frames, planes);
+        break;
+    case 24 :
+        NETPW_DISPATCH(unpack_24, in, channels, frames, planes);
+        break;
+    case 32 :
+        NETPW_DISPATCH(unpack_32, in, channels, frames, planes);
+        break;
+    }
+}
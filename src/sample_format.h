@@ -0,0 +1,29 @@
+/*
+Copyright 2025 Amini Allight
+
+This file is part of netpw.
+
+netpw is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+netpw is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with netpw. If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef NETPW_SAMPLE_FORMAT_H
+#define NETPW_SAMPLE_FORMAT_H
+
+/*
+ * conversion between the planar 32 bit float samples of PipeWire DSP ports and the interleaved signed little-endian integers sent over the wire
+ * floats are in [-1, 1] and are clamped, every plane must hold at least frames samples
+ */
+void sample_format_pack(const float* const* planes, int channels, int frames, int depth, unsigned char* out);
+void sample_format_unpack(const unsigned char* in, int channels, int frames, int depth, float* const* planes);
+
+#endif
@@ -19,6 +19,15 @@ along with netpw. If not, see <https://www.gnu.org/licenses/>.
 #include "server.h"
 #include "error_handling.h"
 #include "constants.h"
+#include "packet.h"
+#include "metrics.h"
+#include "tools.h"
+#include "clock_sync.h"
+#include "rate_control.h"
+#include "trace.h"
+#include "transport.h"
+#include "tcp_tuning.h"
+#include "container.h"
 
 #include <unistd.h>
 #include <stdlib.h>
@@ -26,9 +35,12 @@ along with netpw. If not, see <https://www.gnu.org/licenses/>.
 #include <arpa/inet.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <linux/sockios.h>
 #include <netdb.h>
 #include <pthread.h>
-#include <semaphore.h>
 #include <openssl/bio.h>
 #include <openssl/ssl.h>
 #include <openssl/err.h>
@@ -37,46 +49,544 @@ along with netpw. If not, see <https://www.gnu.org/licenses/>.
 
 struct client
 {
-    SSL* ssl;
+    struct transport* transport;
     int socket;
     struct sockaddr_in addr;
     unsigned char buffer[NETPW_IO_BUFFER_SIZE];
-    on_data_callback callback;
+    struct packet_reader* reader;
+    struct server* server;
+    void* userdata;
+    struct clock_sync* clock_sync;
+    /* only used by the receive thread, the estimate is copied to available_rate for other threads */
+    struct rate_control* rate_control;
+    uint64_t available_rate;
+    pthread_mutex_t write_lock;
+    /* only used with the write lock held */
+    struct send_budget* send_budget;
+    /* only changed with the write lock held, so nothing from the previous tier follows its announcement */
+    int tier;
+    /* non-zero until the client was sent the start of its tier's stream, only used with the write lock held */
+    int joining;
+    /* non-zero if the server picks the tier from the available rate */
+    int automatic;
     int disconnected;
     pthread_t thread;
+    /* senders follow next without locking, previous and next_dead are only touched under the registry lock */
+    struct client* next;
+    struct client* previous;
+    struct client* next_dead;
+    struct metric* sent_metric;
+    struct metric* received_metric;
+    struct metric* write_failure_metric;
+    struct metric* backlog_metric;
+    struct metric* write_time_metric;
+    struct metric* rtt_metric;
+    struct metric* available_rate_metric;
+    struct metric* dropped_metric;
+};
+
+/* an accepted connection waiting for a handshake worker */
+struct handshake
+{
+    int socket;
+    struct sockaddr_in addr;
+    /* non-zero if accepted on the Unix socket */
+    int local;
+    struct handshake* next;
+};
+
+/* each tier is sent from its own thread, so each has its own buffer */
+struct tier
+{
+    char* name;
+    int encoded;
+    /* NULL for PCM, which can be joined anywhere */
+    struct container* container;
+    unsigned char* send_buffer;
+    int send_buffer_size;
+    unsigned char* join_buffer;
+    int join_buffer_size;
+    uint64_t window_start;
+    uint64_t window_bytes;
+    /* recent peak in bits per second, zero until measured */
+    uint64_t rate;
+};
+
+struct address_count
+{
+    in_addr_t address;
+    int count;
 };
 
 struct server
 {
     SSL_CTX* ssl_context;
+    enum crypto_profile profile;
+    struct server_limits limits;
+    struct tcp_options tcp;
+    struct tier* tiers;
+    int tier_count;
     int socket;
-    struct client** clients;
+    /* clients are published for server_send, which only announces itself in readers */
+    struct client* clients;
     int client_count;
-    sem_t client_lock;
-    on_data_callback callback;
+    int epoch;
+    int readers[2];
+    on_packet_callback callback;
+    on_connect_callback connect_callback;
+    on_disconnect_callback disconnect_callback;
+    void* userdata;
     pthread_t thread;
+    /* -1 unless listening for clients on the same host */
+    int local_socket;
+    char* local_path;
+    pthread_t local_thread;
+    pthread_t* handshake_threads;
+    pthread_mutex_t handshake_lock;
+    pthread_cond_t handshake_condition;
+    struct handshake* handshakes;
+    struct handshake** handshake_tail;
+    int handshake_count;
+    int stopping;
+    /* set before the listening sockets are shut down, so that the accept loops can tell their failure from a transient one */
+    int closing;
+    /* counts connections from admission until disconnect, including those still in their handshake */
+    pthread_mutex_t admission_lock;
+    struct address_count* addresses;
+    int address_count;
+    int admitted;
+    /* serialises changes to the clients, disconnected ones wait in dead_clients for the reaper */
+    pthread_mutex_t registry_lock;
+    pthread_cond_t reaper_condition;
+    struct client* dead_clients;
+    int reaper_stopping;
+    pthread_t reaper_thread;
+    struct metric* connection_metric;
+    struct metric* client_metric;
+    struct metric* pending_handshake_metric;
+    struct metric* handshake_time_metric;
+    struct metric* handshake_failure_metric;
+    struct metric* full_rejection_metric;
+    struct metric* address_rejection_metric;
+    struct metric* handshake_rejection_metric;
 };
 
+/* called with the write lock held */
+static void client_write_locked(struct client* client, const unsigned char* data, int size)
+{
+    int result;
+
+    uint64_t start = get_time();
+
+    TRACE_BEGIN("transport write");
+    result = transport_write(client->transport, data, size);
+    TRACE_END("transport write");
+
+    send_budget_written(client->send_budget, start);
+    metric_observe(client->write_time_metric, (get_time() - start) / 1000);
+
+    if (result > 0)
+    {
+        metric_add(client->sent_metric, result);
+    }
+    else
+    {
+        metric_add(client->write_failure_metric, 1);
+    }
+
+    if (metrics_enabled())
+    {
+        int backlog;
+
+        if (ioctl(client->socket, SIOCOUTQ, &backlog) == 0)
+        {
+            metric_set(client->backlog_metric, backlog);
+        }
+    }
+}
+
+static void client_write(struct client* client, const unsigned char* data, int size)
+{
+    /* pongs are sent from the receive thread */
+    pthread_mutex_lock(&client->write_lock);
+    client_write_locked(client, data, size);
+    pthread_mutex_unlock(&client->write_lock);
+}
+
+static void client_send(struct client* client, int type, const unsigned char* data, int size)
+{
+    /* the tier announcement is the largest packet the server generates itself */
+    unsigned char packet[NETPW_PACKET_HEADER_SIZE + NETPW_PACKET_TIER_MAX_SIZE];
+
+    client_write(client, packet, packet_encode(packet, type, data, size));
+}
+
+static void client_set_tier(struct client* client, int tier)
+{
+    const struct tier* state = &client->server->tiers[tier];
+
+    unsigned char announcement[NETPW_PACKET_TIER_MAX_SIZE];
+    int name_size = strlen(state->name);
+
+    announcement[0] = state->encoded;
+    memcpy(announcement + 1, state->name, name_size);
+
+    unsigned char packet[NETPW_PACKET_HEADER_SIZE + NETPW_PACKET_TIER_MAX_SIZE];
+    int packet_size = packet_encode(packet, NETPW_PACKET_TIER, announcement, 1 + name_size);
+
+    pthread_mutex_lock(&client->write_lock);
+
+    /* a decoder restarted for another tier has to be given that tier's headers */
+    if (tier != client->tier)
+    {
+        client->joining = 1;
+    }
+
+    __atomic_store_n(&client->tier, tier, __ATOMIC_RELAXED);
+    client_write_locked(client, packet, packet_size);
+    pthread_mutex_unlock(&client->write_lock);
+}
+
+static void client_request_tier(struct client* client, const unsigned char* data, int size)
+{
+    char host[INET6_ADDRSTRLEN] = {0};
+    inet_ntop(client->addr.sin_family, &client->addr.sin_addr, host, INET6_ADDRSTRLEN);
+    unsigned short port = ntohs(client->addr.sin_port);
+
+    if (size == 4 && memcmp(data, "auto", 4) == 0)
+    {
+        printf("[%s]:%i receives the tier its connection can carry.\n", host, port);
+        client->automatic = 1;
+        client_set_tier(client, client->tier);
+        return;
+    }
+
+    int i;
+    for (i = 0; i < client->server->tier_count; i++)
+    {
+        const char* name = client->server->tiers[i].name;
+
+        if (strlen(name) == size && memcmp(name, data, size) == 0)
+        {
+            printf("[%s]:%i receives tier %s.\n", host, port, name);
+            client->automatic = 0;
+            client_set_tier(client, i);
+            return;
+        }
+    }
+
+    /* the announcement tells the client which tier it gets instead */
+    printf("[%s]:%i asked for unknown tier %.*s.\n", host, port, size, (const char*)data);
+    client_set_tier(client, client->tier);
+}
+
+static void client_ping(struct client* client, uint64_t now)
+{
+    unsigned char ping[NETPW_PACKET_PING_SIZE];
+    packet_write_u64(ping, now);
+
+    client_send(client, NETPW_PACKET_PING, ping, sizeof(ping));
+}
+
+/* the highest tier that fits the estimate with a fifth to spare, or the lowest if none does, -1 until every tier has been measured */
+static int server_fitting_tier(struct server* server, uint64_t available)
+{
+    int best = -1;
+    uint64_t best_rate = 0;
+    int lowest = -1;
+    uint64_t lowest_rate = 0;
+
+    int i;
+    for (i = 0; i < server->tier_count; i++)
+    {
+        uint64_t rate = __atomic_load_n(&server->tiers[i].rate, __ATOMIC_RELAXED);
+
+        if (rate == 0)
+        {
+            return -1;
+        }
+
+        if (lowest < 0 || rate < lowest_rate)
+        {
+            lowest = i;
+            lowest_rate = rate;
+        }
+
+        if (rate * 5 <= available * 4 && rate > best_rate)
+        {
+            best = i;
+            best_rate = rate;
+        }
+    }
+
+    return best >= 0 ? best : lowest;
+}
+
+static void client_on_report(struct client* client, const unsigned char* report)
+{
+    int backlog = 0;
+    ioctl(client->socket, SIOCOUTQ, &backlog);
+
+    uint64_t rtt = clock_sync_ready(client->clock_sync) ? clock_sync_rtt(client->clock_sync) : 0;
+    uint64_t rate = rate_control_update(client->rate_control, report, backlog, rtt);
+
+    __atomic_store_n(&client->available_rate, rate, __ATOMIC_RELAXED);
+    metric_set(client->available_rate_metric, rate);
+
+    if (!client->automatic || rate == 0)
+    {
+        return;
+    }
+
+    int tier = server_fitting_tier(client->server, rate);
+
+    if (tier >= 0 && tier != client->tier)
+    {
+        client_set_tier(client, tier);
+    }
+}
+
+static void client_on_packet(void* userdata, int type, const unsigned char* data, int size)
+{
+    struct client* client = userdata;
+
+    uint64_t now = get_time();
+
+    switch (type)
+    {
+    case NETPW_PACKET_PING :
+        if (size == NETPW_PACKET_PING_SIZE)
+        {
+            unsigned char pong[NETPW_PACKET_PONG_SIZE];
+            memcpy(pong, data, NETPW_PACKET_PING_SIZE);
+            packet_write_u64(pong + NETPW_PACKET_PING_SIZE, now);
+
+            client_send(client, NETPW_PACKET_PONG, pong, sizeof(pong));
+        }
+        break;
+    case NETPW_PACKET_PONG :
+        if (size == NETPW_PACKET_PONG_SIZE)
+        {
+            clock_sync_update(client->clock_sync, packet_read_u64(data), packet_read_u64(data + 8), now);
+            metric_set(client->rtt_metric, clock_sync_rtt(client->clock_sync) / 1000);
+        }
+        break;
+    case NETPW_PACKET_TIMESTAMP :
+        if (size == NETPW_PACKET_TIMESTAMP_SIZE && clock_sync_ready(client->clock_sync))
+        {
+            unsigned char timestamp[NETPW_PACKET_LOCAL_TIMESTAMP_SIZE];
+            clock_sync_localize_timestamp(client->clock_sync, data, timestamp, now);
+
+            client->server->callback(client->userdata, type, timestamp, sizeof(timestamp));
+        }
+        break;
+    case NETPW_PACKET_TIER :
+        if (size < NETPW_PACKET_TIER_MAX_SIZE)
+        {
+            client_request_tier(client, data, size);
+        }
+        break;
+    case NETPW_PACKET_REPORT :
+        if (size == NETPW_PACKET_REPORT_SIZE)
+        {
+            client_on_report(client, data);
+        }
+        break;
+    default :
+        client->server->callback(client->userdata, type, data, size);
+        break;
+    }
+
+    if (clock_sync_ping_due(client->clock_sync, now))
+    {
+        client_ping(client, now);
+    }
+
+    unsigned char report[NETPW_PACKET_REPORT_SIZE];
+
+    if (rate_control_report_due(client->rate_control, now, report))
+    {
+        client_send(client, NETPW_PACKET_REPORT, report, sizeof(report));
+    }
+}
+
+/* returns the reason the connection is refused, or NULL after counting it against the limits */
+static const char* server_admit(struct server* server, in_addr_t address)
+{
+    const char* reason = NULL;
+
+    pthread_mutex_lock(&server->admission_lock);
+
+    struct address_count* entry = NULL;
+
+    int i;
+    for (i = 0; i < server->address_count; i++)
+    {
+        if (server->addresses[i].address == address)
+        {
+            entry = &server->addresses[i];
+            break;
+        }
+    }
+
+    if (server->limits.max_clients && server->admitted >= server->limits.max_clients)
+    {
+        reason = "server full";
+        metric_add(server->full_rejection_metric, 1);
+    }
+    else if (server->limits.max_clients_per_address && entry && entry->count >= server->limits.max_clients_per_address)
+    {
+        reason = "too many connections from this address";
+        metric_add(server->address_rejection_metric, 1);
+    }
+    else
+    {
+        if (!entry)
+        {
+            server->addresses = realloc(server->addresses, (server->address_count + 1) * sizeof(struct address_count));
+            entry = &server->addresses[server->address_count++];
+            entry->address = address;
+            entry->count = 0;
+        }
+
+        entry->count++;
+        server->admitted++;
+    }
+
+    pthread_mutex_unlock(&server->admission_lock);
+
+    return reason;
+}
+
+static void server_release(struct server* server, in_addr_t address)
+{
+    pthread_mutex_lock(&server->admission_lock);
+
+    int i;
+    for (i = 0; i < server->address_count; i++)
+    {
+        if (server->addresses[i].address == address)
+        {
+            if (--server->addresses[i].count == 0)
+            {
+                server->addresses[i] = server->addresses[--server->address_count];
+            }
+            break;
+        }
+    }
+
+    server->admitted--;
+
+    pthread_mutex_unlock(&server->admission_lock);
+}
+
+/* called with the registry lock held */
+static void registry_add(struct server* server, struct client* client)
+{
+    client->previous = NULL;
+    client->next = server->clients;
+
+    if (client->next)
+    {
+        client->next->previous = client;
+    }
+
+    /* the client is fully set up before a sender can see it */
+    __atomic_store_n(&server->clients, client, __ATOMIC_RELEASE);
+
+    server->client_count++;
+    metric_set(server->client_metric, server->client_count);
+}
+
+/* called with the registry lock held, the client keeps its next so a sender standing on it can move on */
+static void registry_remove(struct server* server, struct client* client)
+{
+    if (client->previous)
+    {
+        __atomic_store_n(&client->previous->next, client->next, __ATOMIC_RELEASE);
+    }
+    else
+    {
+        __atomic_store_n(&server->clients, client->next, __ATOMIC_RELEASE);
+    }
+
+    if (client->next)
+    {
+        client->next->previous = client->previous;
+    }
+
+    server->client_count--;
+    metric_set(server->client_metric, server->client_count);
+}
+
+/*
+ * a sender counting itself under an epoch that flipped in the meantime may have been missed by registry_synchronize,
+ * so it only proceeds once the epoch is seen unchanged after it has counted itself
+ */
+static int registry_read_begin(struct server* server)
+{
+    while (1)
+    {
+        int epoch = __atomic_load_n(&server->epoch, __ATOMIC_SEQ_CST);
+        int index = epoch & 1;
+        __atomic_add_fetch(&server->readers[index], 1, __ATOMIC_SEQ_CST);
+
+        if (__atomic_load_n(&server->epoch, __ATOMIC_SEQ_CST) == epoch)
+        {
+            return index;
+        }
+
+        __atomic_sub_fetch(&server->readers[index], 1, __ATOMIC_RELEASE);
+    }
+}
+
+static void registry_read_end(struct server* server, int index)
+{
+    __atomic_sub_fetch(&server->readers[index], 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * waits until no sender can still hold a client removed before the call.
+ * new senders count themselves under the flipped epoch, so only the ones already inside are waited for.
+ * a sender that read the old epoch but counted itself too late to be seen below sees the flip when it rechecks and counts itself again under the new epoch.
+ * only the reaper thread and server_destroy call this, never at the same time.
+ */
+static void registry_synchronize(struct server* server)
+{
+    int index = __atomic_fetch_add(&server->epoch, 1, __ATOMIC_SEQ_CST) & 1;
+
+    while (__atomic_load_n(&server->readers[index], __ATOMIC_ACQUIRE) != 0)
+    {
+        sleep_until(get_time() + NETPW_GRACE_PERIOD_POLL);
+    }
+}
+
 static void* client_receive(void* arg)
 {
     struct client* client = arg;
 
     int result;
 
+    trace_thread_name("server receive");
+
     while (1)
     {
-        result = SSL_read(client->ssl, client->buffer, NETPW_IO_BUFFER_SIZE);
+        result = transport_read(client->transport, client->buffer, NETPW_IO_BUFFER_SIZE);
 
-        if (!BIO_should_retry(SSL_get_rbio(client->ssl)))
+        if (result <= 0)
         {
             break;
         }
-        else
+
+        metric_add(client->received_metric, result);
+        rate_control_receive(client->rate_control, result);
+        TRACE_COUNTER("transport read bytes", result);
+
+        if (packet_reader_feed(client->reader, client->buffer, result))
         {
-            continue;
+            fprintf(stderr, "received malformed packet.\n");
+            break;
         }
-
-        client->callback(client->buffer, result);
     }
 
     char host[INET6_ADDRSTRLEN] = {0};
@@ -84,7 +594,24 @@ static void* client_receive(void* arg)
     unsigned short port = ntohs(client->addr.sin_port);
 
     printf("connection closed to [%s]:%i.\n", host, port);
-    client->disconnected = 1;
+
+    if (client->server->disconnect_callback)
+    {
+        client->server->disconnect_callback(client->server->userdata, client->userdata);
+    }
+
+    server_release(client->server, client->addr.sin_addr.s_addr);
+
+    __atomic_store_n(&client->disconnected, 1, __ATOMIC_RELEASE);
+
+    /* this thread can't join itself, the reaper frees the client */
+    pthread_mutex_lock(&client->server->registry_lock);
+
+    client->next_dead = client->server->dead_clients;
+    client->server->dead_clients = client;
+    pthread_cond_signal(&client->server->reaper_condition);
+
+    pthread_mutex_unlock(&client->server->registry_lock);
 
     return NULL;
 }
@@ -93,96 +620,421 @@ static void client_destroy(struct client* client)
 {
     int result;
 
-    CHECK_ERRNO(close(client->socket));
+    /* closing alone doesn't wake the receive thread, this fails harmlessly if the peer already left */
+    shutdown(client->socket, SHUT_RDWR);
     CHECK_ERROR(pthread_join(client->thread, NULL));
-    CHECK_SSL(SSL_shutdown(client->ssl), client->ssl);
-    SSL_free(client->ssl);
+    transport_destroy(client->transport);
+    CHECK_ERRNO(close(client->socket));
+    packet_reader_destroy(client->reader);
+    clock_sync_destroy(client->clock_sync);
+    rate_control_destroy(client->rate_control);
+    send_budget_destroy(client->send_budget);
+    CHECK_ERROR(pthread_mutex_destroy(&client->write_lock));
+    metric_destroy(client->sent_metric);
+    metric_destroy(client->received_metric);
+    metric_destroy(client->write_failure_metric);
+    metric_destroy(client->backlog_metric);
+    metric_destroy(client->write_time_metric);
+    metric_destroy(client->rtt_metric);
+    metric_destroy(client->available_rate_metric);
+    metric_destroy(client->dropped_metric);
     free(client);
 }
 
-static void* server_accept(void* arg)
+static void* server_reap(void* arg)
 {
     struct server* server = arg;
 
+    trace_thread_name("reaper");
+
+    while (1)
+    {
+        pthread_mutex_lock(&server->registry_lock);
+
+        while (!server->dead_clients && !server->reaper_stopping)
+        {
+            pthread_cond_wait(&server->reaper_condition, &server->registry_lock);
+        }
+
+        struct client* dead = server->dead_clients;
+        server->dead_clients = NULL;
+
+        struct client* client;
+        for (client = dead; client; client = client->next_dead)
+        {
+            registry_remove(server, client);
+        }
+
+        int stopping = server->reaper_stopping;
+
+        pthread_mutex_unlock(&server->registry_lock);
+
+        /* one grace period covers the whole batch, accepts carry on meanwhile */
+        if (dead)
+        {
+            registry_synchronize(server);
+        }
+
+        while (dead)
+        {
+            client = dead;
+            dead = client->next_dead;
+
+            client_destroy(client);
+        }
+
+        if (stopping)
+        {
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+static void set_socket_timeout(int socket, uint64_t timeout)
+{
     int result;
 
+    struct timeval time = { timeout / 1000000000, (timeout % 1000000000) / 1000 };
+
+    CHECK_ERRNO(setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, &time, sizeof(time)));
+    CHECK_ERRNO(setsockopt(socket, SOL_SOCKET, SO_SNDTIMEO, &time, sizeof(time)));
+}
+
+static void server_connect(struct server* server, int connection_socket, struct sockaddr_in addr, int local)
+{
+    int result;
+
+    char host[INET6_ADDRSTRLEN] = {0};
+    inet_ntop(addr.sin_family, &addr.sin_addr, host, INET6_ADDRSTRLEN);
+    unsigned short port = ntohs(addr.sin_port);
+
+    struct client* client = malloc(sizeof(struct client));
+
+    client->socket = connection_socket;
+
+    if (!local)
+    {
+        tcp_configure(client->socket, &server->tcp);
+    }
+
+    uint64_t start = get_time();
+
+    /*
+     * a peer that stalls or trickles its handshake only holds its worker until the deadline
+     * the local handover is a single send, so bounding that one call bounds it all
+     */
+    if (local)
+    {
+        set_socket_timeout(client->socket, NETPW_HANDSHAKE_TIMEOUT);
+        client->transport = transport_local_accept(client->socket);
+        set_socket_timeout(client->socket, 0);
+    }
+    else
+    {
+        client->transport = transport_accept(server->ssl_context, client->socket, server->profile, start + NETPW_HANDSHAKE_TIMEOUT);
+    }
+
+    metric_observe(server->handshake_time_metric, (get_time() - start) / 1000);
+
+    if (!client->transport)
+    {
+        fprintf(stderr, "handshake with [%s]:%i failed.\n", host, port);
+        metric_add(server->handshake_failure_metric, 1);
+        CHECK_ERRNO(close(client->socket));
+        free(client);
+        server_release(server, addr.sin_addr.s_addr);
+        return;
+    }
+
+    printf("received connection from [%s]:%i using %s.\n", host, port, transport_description(client->transport));
+
+    client->addr = addr;
+    client->server = server;
+    client->disconnected = 0;
+
+    if (server->connect_callback)
+    {
+        char name[INET6_ADDRSTRLEN + 7] = {0};
+        snprintf(name, sizeof(name), "%s:%i", host, port);
+
+        client->userdata = server->connect_callback(server->userdata, name);
+    }
+    else
+    {
+        client->userdata = server->userdata;
+    }
+
+    client->reader = packet_reader_init(client_on_packet, client);
+    client->clock_sync = clock_sync_init();
+    client->rate_control = rate_control_init();
+    client->available_rate = 0;
+    client->tier = 0;
+    client->joining = 1;
+    client->automatic = 0;
+    /* nothing queues between processes on one host */
+    client->send_budget = send_budget_init(client->socket, local ? 0 : server->tcp.latency_budget);
+    CHECK_ERROR(pthread_mutex_init(&client->write_lock, NULL));
+
+    static const uint64_t write_time_bounds[] = { 10, 50, 100, 500, 1000, 5000, 10000, 50000, 100000 };
+
+    char labels[INET6_ADDRSTRLEN + 32];
+    snprintf(labels, sizeof(labels), "client=\"%s:%i\"", host, port);
+
+    client->sent_metric = metric_counter_init("netpw_client_sent_bytes_total", "Bytes sent to a client, including framing.", labels);
+    client->received_metric = metric_counter_init("netpw_client_received_bytes_total", "Bytes received from a client, including framing.", labels);
+    client->write_failure_metric = metric_counter_init("netpw_client_write_failures_total", "Writes to a client that failed.", labels);
+    client->backlog_metric = metric_gauge_init("netpw_client_send_backlog_bytes", "Bytes sent to a client that the kernel has not yet had acknowledged.", labels);
+    client->write_time_metric = metric_histogram_init(
+        "netpw_client_write_microseconds",
+        "Time spent blocked in each write to a client.",
+        labels,
+        write_time_bounds,
+        sizeof(write_time_bounds) / sizeof(uint64_t)
+    );
+    client->rtt_metric = metric_gauge_init("netpw_client_rtt_microseconds", "Latest round trip time to a client.", labels);
+    client->available_rate_metric = metric_gauge_init("netpw_client_available_bits_per_second", "Estimated rate the connection to a client can carry.", labels);
+    client->dropped_metric = metric_counter_init("netpw_client_dropped_bytes_total", "Audio not sent to a client because its connection was over the latency budget.", labels);
+
+    metric_add(server->connection_metric, 1);
+
+    /* further pings are sent as packets arrive */
+    uint64_t now = get_time();
+    clock_sync_ping_due(client->clock_sync, now);
+    client_ping(client, now);
+
+    client_set_tier(client, 0);
+
+    /* added before the receive thread starts, which hands the client to the reaper once it disconnects */
+    pthread_mutex_lock(&server->registry_lock);
+    registry_add(server, client);
+    pthread_mutex_unlock(&server->registry_lock);
+
+    CHECK_ERROR(pthread_create(&client->thread, NULL, client_receive, client));
+}
+
+static void* server_handshake(void* arg)
+{
+    struct server* server = arg;
+
+    trace_thread_name("handshake");
+
     while (1)
     {
-        struct sockaddr_in addr;
-        socklen_t addr_size = sizeof(addr);
+        pthread_mutex_lock(&server->handshake_lock);
 
-        CHECK_ERRNO(accept(server->socket, (struct sockaddr*)&addr, &addr_size));
+        while (!server->handshakes && !server->stopping)
+        {
+            pthread_cond_wait(&server->handshake_condition, &server->handshake_lock);
+        }
 
-        if (result < 0)
+        struct handshake* handshake = server->handshakes;
+
+        if (handshake)
+        {
+            server->handshakes = handshake->next;
+            server->handshake_count--;
+
+            if (!server->handshakes)
+            {
+                server->handshake_tail = &server->handshakes;
+            }
+            metric_set(server->pending_handshake_metric, server->handshake_count);
+        }
+
+        pthread_mutex_unlock(&server->handshake_lock);
+
+        if (!handshake)
         {
             break;
         }
 
-        char host[INET6_ADDRSTRLEN] = {0};
-        inet_ntop(addr.sin_family, &addr.sin_addr, host, INET6_ADDRSTRLEN);
-        unsigned short port = ntohs(addr.sin_port);
+        server_connect(server, handshake->socket, handshake->addr, handshake->local);
+        free(handshake);
+    }
+
+    return NULL;
+}
+
+/* returns non-zero if the queue is full */
+static int server_queue_handshake(struct server* server, int connection_socket, struct sockaddr_in addr, int local)
+{
+    int full = 0;
 
-        struct client* client = malloc(sizeof(struct client));
+    pthread_mutex_lock(&server->handshake_lock);
 
-        CHECK_POINTER(client->ssl = SSL_new(server->ssl_context));
-        CHECK_OK(SSL_set_fd(client->ssl, result));
-        CHECK_SSL(SSL_accept(client->ssl), client->ssl);
+    if (server->handshake_count >= server->limits.backlog)
+    {
+        full = 1;
+    }
+    else
+    {
+        struct handshake* handshake = malloc(sizeof(struct handshake));
+        handshake->socket = connection_socket;
+        handshake->addr = addr;
+        handshake->local = local;
+        handshake->next = NULL;
+
+        *server->handshake_tail = handshake;
+        server->handshake_tail = &handshake->next;
+        server->handshake_count++;
+        metric_set(server->pending_handshake_metric, server->handshake_count);
+
+        pthread_cond_signal(&server->handshake_condition);
+    }
 
-        printf("received connection from [%s]:%i.\n", host, port);
+    pthread_mutex_unlock(&server->handshake_lock);
 
-        client->socket = result;
-        client->addr = addr;
-        client->callback = server->callback;
-        client->disconnected = 0;
-        CHECK_ERROR(pthread_create(&client->thread, NULL, client_receive, client));
+    return full;
+}
 
-        /* remove dead clients */
-        CHECK_ERRNO(sem_wait(&server->client_lock));
+static void server_accept_loop(struct server* server, int listen_socket, int local)
+{
+    int result;
 
-        int i;
-        for (i = 0; i < server->client_count;)
+    uint64_t next_handshake_time = 0;
+    unsigned short local_count = 0;
+
+    while (1)
+    {
+        /* connections beyond the rate wait in the kernel's backlog, a second's worth may arrive at once */
+        if (server->limits.handshake_rate > 0)
         {
-            if (server->clients[i]->disconnected)
+            uint64_t interval = 1000000000 / server->limits.handshake_rate;
+            uint64_t burst = 1000000000 - interval;
+            uint64_t now = get_time();
+
+            if (next_handshake_time < now)
             {
-                int next_index = i + 1;
-                memcpy(server->clients + i, server->clients + next_index, (server->client_count - next_index) * sizeof(struct client*));
-                server->client_count--;
+                next_handshake_time = now;
             }
-            else
+
+            if (next_handshake_time > now + burst)
             {
-                i++;
+                sleep_until(next_handshake_time - burst);
             }
+
+            next_handshake_time += interval;
         }
 
-        CHECK_ERRNO(sem_post(&server->client_lock));
+        struct sockaddr_in addr;
+        socklen_t addr_size = sizeof(addr);
+
+        int connection_socket = accept(listen_socket, local ? NULL : (struct sockaddr*)&addr, local ? NULL : &addr_size);
+
+        if (connection_socket < 0)
+        {
+            if (__atomic_load_n(&server->closing, __ATOMIC_ACQUIRE))
+            {
+                break;
+            }
 
-        /* add new client */
-        int next_client_count = server->client_count + 1;
-        struct client** next_clients = malloc(next_client_count * sizeof(struct client*));
+            switch (errno)
+            {
+            /* out of descriptors or memory, which a storm of connections causes and which passes as clients leave */
+            case EMFILE :
+            case ENFILE :
+            case ENOBUFS :
+            case ENOMEM :
+                fprintf(stderr, "failed to accept connection, retrying: %i\n", errno);
+                sleep_until(get_time() + NETPW_ACCEPT_BACKOFF);
+                continue;
+            /* the connection failed before it was accepted, the listening socket is fine */
+            case EINTR :
+            case ECONNABORTED :
+            case EPROTO :
+            case EPERM :
+            case ENETDOWN :
+            case ENOPROTOOPT :
+            case EHOSTDOWN :
+            case ENONET :
+            case EHOSTUNREACH :
+            case ENETUNREACH :
+                continue;
+            default :
+                fprintf(stderr, "failed to accept connections: %i\n", errno);
+                break;
+            }
+
+            break;
+        }
+
+        /* clients on the same host count as loopback, numbered in place of a port so each has its own name */
+        if (local)
+        {
+            memset(&addr, 0, sizeof(addr));
+            addr.sin_family = AF_INET;
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            addr.sin_port = htons(++local_count);
+        }
 
-        memcpy(next_clients, server->clients, server->client_count * sizeof(struct client*));
-        next_clients[server->client_count] = client;
+        const char* reason = server_admit(server, addr.sin_addr.s_addr);
 
-        /* replace clients */
-        CHECK_ERRNO(sem_wait(&server->client_lock));
+        if (!reason && server_queue_handshake(server, connection_socket, addr, local))
+        {
+            server_release(server, addr.sin_addr.s_addr);
+            reason = "too many pending handshakes";
+            metric_add(server->handshake_rejection_metric, 1);
+        }
 
-        free(server->clients);
-        server->clients = next_clients;
-        server->client_count = next_client_count;
+        if (reason)
+        {
+            char host[INET6_ADDRSTRLEN] = {0};
+            inet_ntop(addr.sin_family, &addr.sin_addr, host, INET6_ADDRSTRLEN);
 
-        CHECK_ERRNO(sem_post(&server->client_lock));
+            printf("refused connection from [%s]:%i, %s.\n", host, ntohs(addr.sin_port), reason);
+            CHECK_ERRNO(close(connection_socket));
+        }
     }
+}
+
+static void* server_accept(void* arg)
+{
+    struct server* server = arg;
+
+    trace_thread_name("accept");
+
+    server_accept_loop(server, server->socket, 0);
+
+    return NULL;
+}
+
+static void* server_accept_local(void* arg)
+{
+    struct server* server = arg;
+
+    trace_thread_name("accept local");
+
+    server_accept_loop(server, server->local_socket, 1);
 
     return NULL;
 }
 
+void server_limits_default(struct server_limits* limits)
+{
+    limits->backlog = NETPW_SERVER_BACKLOG;
+    limits->handshake_workers = NETPW_HANDSHAKE_WORKERS;
+    limits->max_clients = 0;
+    limits->max_clients_per_address = 0;
+    limits->handshake_rate = 0;
+}
+
 struct server* server_init(
     const char* host,
     unsigned short port,
     const char* ca_certificate,
     const char* certificate,
     const char* private_key,
-    on_data_callback callback
+    enum crypto_profile profile,
+    const struct server_limits* limits,
+    const struct tcp_options* tcp,
+    const struct server_tier* tiers,
+    int tier_count,
+    on_packet_callback callback,
+    on_connect_callback connect_callback,
+    on_disconnect_callback disconnect_callback,
+    void* userdata
 )
 {
     int result;
@@ -202,6 +1054,53 @@ struct server* server_init(
     SSL_CTX_set_min_proto_version(server->ssl_context, TLS1_3_VERSION);
     SSL_CTX_set_max_proto_version(server->ssl_context, 0);
 
+    transport_configure(server->ssl_context, profile, 1);
+    server->profile = profile;
+
+    if (limits)
+    {
+        server->limits = *limits;
+    }
+    else
+    {
+        server_limits_default(&server->limits);
+    }
+
+    if (tcp)
+    {
+        server->tcp = *tcp;
+    }
+    else
+    {
+        tcp_options_default(&server->tcp);
+    }
+
+    static const struct server_tier default_tier = { "default", 0 };
+
+    if (!tiers)
+    {
+        tiers = &default_tier;
+        tier_count = 1;
+    }
+
+    server->tiers = malloc(tier_count * sizeof(struct tier));
+    server->tier_count = tier_count;
+
+    int i;
+    for (i = 0; i < tier_count; i++)
+    {
+        server->tiers[i].name = strdup(tiers[i].name);
+        server->tiers[i].encoded = tiers[i].encoded;
+        server->tiers[i].container = tiers[i].encoded ? container_init() : NULL;
+        server->tiers[i].send_buffer = NULL;
+        server->tiers[i].send_buffer_size = 0;
+        server->tiers[i].join_buffer = NULL;
+        server->tiers[i].join_buffer_size = 0;
+        server->tiers[i].window_start = 0;
+        server->tiers[i].window_bytes = 0;
+        server->tiers[i].rate = 0;
+    }
+
     if (ca_certificate)
     {
         BIO* certificate_reader;
@@ -261,12 +1160,62 @@ struct server* server_init(
 
     freeaddrinfo(info);
 
-    CHECK_ERRNO_FATAL(listen(server->socket, 1));
+    CHECK_ERRNO_FATAL(listen(server->socket, server->limits.backlog));
 
     server->clients = NULL;
     server->client_count = 0;
-    CHECK_ERRNO_FATAL(sem_init(&server->client_lock, 0, 1));
+    server->epoch = 0;
+    server->readers[0] = 0;
+    server->readers[1] = 0;
     server->callback = callback;
+    server->connect_callback = connect_callback;
+    server->disconnect_callback = disconnect_callback;
+    server->userdata = userdata;
+    server->local_socket = -1;
+    server->local_path = NULL;
+    server->connection_metric = metric_counter_init("netpw_server_connections_total", "Connections accepted by the server.", NULL);
+    server->client_metric = metric_gauge_init("netpw_server_clients", "Clients currently connected to the server.", NULL);
+
+    static const uint64_t handshake_time_bounds[] = { 500, 1000, 2000, 5000, 10000, 50000, 100000, 500000, 1000000 };
+
+    server->pending_handshake_metric = metric_gauge_init("netpw_server_pending_handshakes", "Accepted connections waiting for a handshake worker.", NULL);
+    server->handshake_time_metric = metric_histogram_init(
+        "netpw_server_handshake_microseconds",
+        "Time taken by each handshake, successful or not.",
+        NULL,
+        handshake_time_bounds,
+        sizeof(handshake_time_bounds) / sizeof(uint64_t)
+    );
+    server->handshake_failure_metric = metric_counter_init("netpw_server_handshake_failures_total", "Handshakes that failed or timed out.", NULL);
+    server->full_rejection_metric = metric_counter_init("netpw_server_refused_connections_total", "Connections refused by admission control.", "reason=\"server_full\"");
+    server->address_rejection_metric = metric_counter_init("netpw_server_refused_connections_total", "Connections refused by admission control.", "reason=\"address_limit\"");
+    server->handshake_rejection_metric = metric_counter_init("netpw_server_refused_connections_total", "Connections refused by admission control.", "reason=\"handshake_queue\"");
+
+    CHECK_ERROR_FATAL(pthread_mutex_init(&server->handshake_lock, NULL));
+    CHECK_ERROR_FATAL(pthread_cond_init(&server->handshake_condition, NULL));
+    server->handshakes = NULL;
+    server->handshake_tail = &server->handshakes;
+    server->handshake_count = 0;
+    server->stopping = 0;
+    server->closing = 0;
+    CHECK_ERROR_FATAL(pthread_mutex_init(&server->admission_lock, NULL));
+    server->addresses = NULL;
+    server->address_count = 0;
+    server->admitted = 0;
+    CHECK_ERROR_FATAL(pthread_mutex_init(&server->registry_lock, NULL));
+    CHECK_ERROR_FATAL(pthread_cond_init(&server->reaper_condition, NULL));
+    server->dead_clients = NULL;
+    server->reaper_stopping = 0;
+
+    CHECK_ERROR_FATAL(pthread_create(&server->reaper_thread, NULL, server_reap, server));
+
+    /* handshakes run here so that a slow peer never holds up accepting the others */
+    server->handshake_threads = malloc(server->limits.handshake_workers * sizeof(pthread_t));
+
+    for (i = 0; i < server->limits.handshake_workers; i++)
+    {
+        CHECK_ERROR_FATAL(pthread_create(&server->handshake_threads[i], NULL, server_handshake, server));
+    }
 
     CHECK_ERROR_FATAL(pthread_create(&server->thread, NULL, server_accept, server));
 
@@ -275,43 +1224,277 @@ struct server* server_init(
     return server;
 }
 
-void server_send(struct server* server, const unsigned char* data, int size)
+void server_listen_local(struct server* server, const char* path)
 {
     int result;
 
-    CHECK_ERRNO(sem_wait(&server->client_lock));
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
 
-    int i;
-    for (i = 0; i < server->client_count; i++)
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "local socket path %s is too long.\n", path);
+        exit(1);
+    }
+
+    strcpy(addr.sun_path, path);
+
+    /* a socket left behind by a previous run would stop the bind, anything else at the path is left alone */
+    struct stat status;
+
+    if (lstat(path, &status) == 0 && S_ISSOCK(status.st_mode))
+    {
+        CHECK_ERRNO(unlink(path));
+    }
+
+    CHECK_ERRNO_FATAL(server->local_socket = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0));
+    CHECK_ERRNO_FATAL(bind(server->local_socket, (struct sockaddr*)&addr, sizeof(addr)));
+    CHECK_ERRNO_FATAL(listen(server->local_socket, server->limits.backlog));
+
+    server->local_path = strdup(path);
+
+    CHECK_ERROR_FATAL(pthread_create(&server->local_thread, NULL, server_accept_local, server));
+
+    printf("listening at %s.\n", path);
+}
+
+/* encoded output is only sent in whole frames, so a client joining mid-stream can be started on one */
+static void server_join(struct server* server, struct tier* state, struct client* client)
+{
+    const unsigned char* data;
+    int size = container_join(state->container, &data);
+
+    /* the client receives nothing until the next sync point */
+    if (size < 0)
+    {
+        return;
+    }
+
+    if (state->join_buffer_size < NETPW_PACKET_HEADER_SIZE + size)
+    {
+        state->join_buffer_size = NETPW_PACKET_HEADER_SIZE + size;
+        state->join_buffer = realloc(state->join_buffer, state->join_buffer_size);
+    }
+
+    client_write_locked(client, state->join_buffer, packet_encode(state->join_buffer, NETPW_PACKET_AUDIO, data, size));
+    client->joining = 0;
+}
+
+void server_send(struct server* server, int tier, int type, const unsigned char* data, int size)
+{
+    struct tier* state = &server->tiers[tier];
+
+    int framed = type == NETPW_PACKET_AUDIO && state->container;
+
+    if (framed)
+    {
+        size = container_write(state->container, data, size, &data);
+
+        if (size == 0)
+        {
+            return;
+        }
+    }
+
+    if (state->send_buffer_size < NETPW_PACKET_HEADER_SIZE + size)
+    {
+        state->send_buffer_size = NETPW_PACKET_HEADER_SIZE + size;
+        state->send_buffer = realloc(state->send_buffer, state->send_buffer_size);
+    }
+
+    TRACE_BEGIN("server send");
+
+    int packet_size = packet_encode(state->send_buffer, type, data, size);
+
+    /* measured as sent rather than configured, so automatic clients can compare the tiers */
+    uint64_t now = get_time();
+
+    state->window_bytes += packet_size;
+
+    if (state->window_start == 0)
+    {
+        state->window_start = now;
+    }
+    else if (now - state->window_start >= NETPW_RATE_REPORT_INTERVAL)
+    {
+        uint64_t measured = (uint64_t)(state->window_bytes * 8 * 1000000000.0 / (now - state->window_start));
+        uint64_t decayed = state->rate - state->rate / 8;
+
+        __atomic_store_n(&state->rate, measured > decayed ? measured : decayed, __ATOMIC_RELAXED);
+
+        state->window_start = now;
+        state->window_bytes = 0;
+    }
+
+    /* stale PCM is skipped rather than queued, compressed streams can't lose bytes without corrupting their container */
+    int droppable = type == NETPW_PACKET_AUDIO && !state->encoded;
+
+    /* accepts and disconnects never block this, removed clients stay valid until the reader count drops */
+    int index = registry_read_begin(server);
+
+    struct client* client;
+    for (client = __atomic_load_n(&server->clients, __ATOMIC_ACQUIRE); client; client = __atomic_load_n(&client->next, __ATOMIC_ACQUIRE))
+    {
+        if (__atomic_load_n(&client->disconnected, __ATOMIC_ACQUIRE) || __atomic_load_n(&client->tier, __ATOMIC_RELAXED) != tier)
+        {
+            continue;
+        }
+
+        /* checked again in case the client switched tiers since */
+        pthread_mutex_lock(&client->write_lock);
+
+        if (client->tier == tier)
+        {
+            if (droppable && send_budget_exceeded(client->send_budget, now))
+            {
+                metric_add(client->dropped_metric, packet_size);
+            }
+            else if (framed && client->joining)
+            {
+                server_join(server, state, client);
+            }
+            else
+            {
+                client_write_locked(client, state->send_buffer, packet_size);
+            }
+        }
+
+        pthread_mutex_unlock(&client->write_lock);
+    }
+
+    registry_read_end(server, index);
+
+    TRACE_END("server send");
+}
+
+void server_restart_stream(struct server* server, int tier)
+{
+    if (server->tiers[tier].container)
+    {
+        container_reset(server->tiers[tier].container);
+    }
+}
+
+uint64_t server_available_rate(struct server* server, int tier)
+{
+    uint64_t lowest = 0;
+
+    int index = registry_read_begin(server);
+
+    struct client* client;
+    for (client = __atomic_load_n(&server->clients, __ATOMIC_ACQUIRE); client; client = __atomic_load_n(&client->next, __ATOMIC_ACQUIRE))
     {
-        struct client* client = server->clients[i];
+        uint64_t rate = __atomic_load_n(&client->available_rate, __ATOMIC_RELAXED);
 
-        if (client->disconnected)
+        if (__atomic_load_n(&client->tier, __ATOMIC_RELAXED) != tier || rate == 0)
         {
             continue;
         }
 
-        CHECK_SSL(SSL_write(client->ssl, data, size), client->ssl);
+        if (lowest == 0 || rate < lowest)
+        {
+            lowest = rate;
+        }
     }
 
-    CHECK_ERRNO(sem_post(&server->client_lock));
+    registry_read_end(server, index);
+
+    return lowest;
 }
 
 void server_destroy(struct server* server)
 {
     int result;
 
-    CHECK_ERRNO(close(server->socket));
+    __atomic_store_n(&server->closing, 1, __ATOMIC_RELEASE);
+
+    CHECK_ERRNO(shutdown(server->socket, SHUT_RDWR));
     CHECK_ERROR(pthread_join(server->thread, NULL));
-    CHECK_ERRNO(sem_destroy(&server->client_lock));
+    CHECK_ERRNO(close(server->socket));
+
+    if (server->local_socket >= 0)
+    {
+        CHECK_ERRNO(shutdown(server->local_socket, SHUT_RDWR));
+        CHECK_ERROR(pthread_join(server->local_thread, NULL));
+        CHECK_ERRNO(close(server->local_socket));
+        CHECK_ERRNO(unlink(server->local_path));
+        free(server->local_path);
+    }
+
+    pthread_mutex_lock(&server->handshake_lock);
+    server->stopping = 1;
+    pthread_cond_broadcast(&server->handshake_condition);
+    pthread_mutex_unlock(&server->handshake_lock);
 
     int i;
-    for (i = 0; i < server->client_count; i++)
+    for (i = 0; i < server->limits.handshake_workers; i++)
+    {
+        CHECK_ERROR(pthread_join(server->handshake_threads[i], NULL));
+    }
+    free(server->handshake_threads);
+
+    while (server->handshakes)
     {
-        client_destroy(server->clients[i]);
+        struct handshake* handshake = server->handshakes;
+        server->handshakes = handshake->next;
+
+        CHECK_ERRNO(close(handshake->socket));
+        free(handshake);
+    }
+
+    /* no more clients are added, the reaper frees the ones that already left */
+    pthread_mutex_lock(&server->registry_lock);
+    server->reaper_stopping = 1;
+    pthread_cond_signal(&server->reaper_condition);
+    pthread_mutex_unlock(&server->registry_lock);
+
+    CHECK_ERROR(pthread_join(server->reaper_thread, NULL));
+
+    /* clients that leave from here on are queued for the reaper again, but they're still in the list and freed below */
+    pthread_mutex_lock(&server->registry_lock);
+    struct client* client = server->clients;
+    __atomic_store_n(&server->clients, NULL, __ATOMIC_RELEASE);
+    server->client_count = 0;
+    metric_set(server->client_metric, 0);
+    pthread_mutex_unlock(&server->registry_lock);
+
+    registry_synchronize(server);
+
+    while (client)
+    {
+        struct client* next = client->next;
+        client_destroy(client);
+        client = next;
     }
-    free(server->clients);
 
     SSL_CTX_free(server->ssl_context);
+
+    for (i = 0; i < server->tier_count; i++)
+    {
+        free(server->tiers[i].name);
+        free(server->tiers[i].send_buffer);
+        free(server->tiers[i].join_buffer);
+
+        if (server->tiers[i].container)
+        {
+            container_destroy(server->tiers[i].container);
+        }
+    }
+    free(server->tiers);
+    metric_destroy(server->connection_metric);
+    metric_destroy(server->client_metric);
+    metric_destroy(server->pending_handshake_metric);
+    metric_destroy(server->handshake_time_metric);
+    metric_destroy(server->handshake_failure_metric);
+    metric_destroy(server->full_rejection_metric);
+    metric_destroy(server->address_rejection_metric);
+    metric_destroy(server->handshake_rejection_metric);
+    free(server->addresses);
+    CHECK_ERROR(pthread_mutex_destroy(&server->handshake_lock));
+    CHECK_ERROR(pthread_cond_destroy(&server->handshake_condition));
+    CHECK_ERROR(pthread_mutex_destroy(&server->admission_lock));
+    CHECK_ERROR(pthread_mutex_destroy(&server->registry_lock));
+    CHECK_ERROR(pthread_cond_destroy(&server->reaper_condition));
     free(server);
 }
@@ -20,18 +20,61 @@ along with netpw. If not, see <https://www.gnu.org/licenses/>.
 #define NETPW_SERVER_H
 
 #include "callback.h"
+#include "transport.h"
+#include "tcp_tuning.h"
+
+#include <stdint.h>
 
 struct server;
 
+struct server_limits
+{
+    /* connections the kernel holds before they are accepted, also caps those waiting for a handshake worker */
+    int backlog;
+    int handshake_workers;
+    /* the remaining limits are disabled when zero */
+    int max_clients;
+    int max_clients_per_address;
+    /* handshakes started per second, connections beyond it wait in the backlog */
+    int handshake_rate;
+};
+
+void server_limits_default(struct server_limits* limits);
+
+struct server_tier
+{
+    const char* name;
+    /* non-zero if the tier carries encoder output rather than PCM */
+    int encoded;
+};
+
 struct server* server_init(
     const char* host,
     unsigned short port,
     const char* ca_certificate,
     const char* certificate,
     const char* private_key,
-    on_data_callback callback
+    enum crypto_profile profile,
+    /* NULL for the defaults */
+    const struct server_limits* limits,
+    /* NULL for the defaults */
+    const struct tcp_options* tcp,
+    /* clients receive the first tier until they ask for another, NULL for a single PCM tier */
+    const struct server_tier* tiers,
+    int tier_count,
+    on_packet_callback callback,
+    on_connect_callback connect_callback,
+    on_disconnect_callback disconnect_callback,
+    void* userdata
 );
-void server_send(struct server* server, const unsigned char* data, int size);
+/* also accept clients on the same host at a Unix socket, which then exchange audio through shared memory instead of TLS */
+void server_listen_local(struct server* server, const char* path);
+/* sends to the clients receiving the given tier, each tier must only be sent from one thread at a time */
+void server_send(struct server* server, int tier, int type, const unsigned char* data, int size);
+/* the next data sent on the tier begins a new stream, such as from a replaced encoder, only call it from the thread sending the tier */
+void server_restart_stream(struct server* server, int tier);
+/* the lowest estimate among the clients receiving the tier in bits per second, zero until there is one */
+uint64_t server_available_rate(struct server* server, int tier);
 void server_destroy(struct server* server);
 
 #endif
@@ -0,0 +1,165 @@
+/*
+Copyright 2025 Amini Allight
+
+This file is part of netpw.
+
+netpw is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+netpw is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with netpw. If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "silence.h"
+#include "constants.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+
+struct silence_detector
+{
+    int depth;
+    int stride;
+    unsigned int close_level;
+    unsigned int open_level;
+    int hangover_frames;
+    int quiet_frames;
+    int silent;
+};
+
+/* these loops are kept branch-free so the compiler can vectorize them */
+static unsigned int peak_s8(const int8_t* samples, int count)
+{
+    unsigned int peak = 0;
+
+    int i;
+    for (i = 0; i < count; i++)
+    {
+        int x = samples[i];
+        unsigned int level = x < 0 ? -x : x;
+        peak = level > peak ? level : peak;
+    }
+
+    return peak;
+}
+
+static unsigned int peak_s16(const int16_t* samples, int count)
+{
+    unsigned int peak = 0;
+
+    int i;
+    for (i = 0; i < count; i++)
+    {
+        int x = samples[i];
+        unsigned int level = x < 0 ? -x : x;
+        peak = level > peak ? level : peak;
+    }
+
+    return peak;
+}
+
+static unsigned int peak_s24(const unsigned char* samples, int count)
+{
+    unsigned int peak = 0;
+
+    int i;
+    for (i = 0; i < count; i++)
+    {
+        const unsigned char* sample = samples + i * 3;
+        int x = (int32_t)(((uint32_t)sample[0] << 8) | ((uint32_t)sample[1] << 16) | ((uint32_t)sample[2] << 24)) >> 8;
+        unsigned int level = x < 0 ? -x : x;
+        peak = level > peak ? level : peak;
+    }
+
+    return peak;
+}
+
+static unsigned int peak_s32(const int32_t* samples, int count)
+{
+    unsigned int peak = 0;
+
+    int i;
+    for (i = 0; i < count; i++)
+    {
+        int32_t x = samples[i];
+        unsigned int level = x < 0 ? -(uint32_t)x : (uint32_t)x;
+        peak = level > peak ? level : peak;
+    }
+
+    return peak;
+}
+
+static unsigned int peak(struct silence_detector* detector, const unsigned char* data, int size)
+{
+    switch (detector->depth)
+    {
+    default :
+    case 8 :
+        return peak_s8((const int8_t*)data, size);
+    case 16 :
+        return peak_s16((const int16_t*)data, size / 2);
+    case 24 :
+        return peak_s24(data, size / 3);
+    case 32 :
+        return peak_s32((const int32_t*)data, size / 4);
+    }
+}
+
+struct silence_detector* silence_detector_init(int frequency, int channels, int depth, double threshold, int hangover)
+{
+    struct silence_detector* detector = malloc(sizeof(struct silence_detector));
+
+    double full_scale = pow(2, depth - 1);
+
+    detector->depth = depth;
+    detector->stride = channels * (depth / 8);
+    detector->close_level = fmin(full_scale * pow(10, threshold / 20), full_scale);
+    detector->open_level = fmin(full_scale * pow(10, (threshold + NETPW_SILENCE_HYSTERESIS) / 20), full_scale);
+    detector->hangover_frames = (long)frequency * hangover / 1000;
+    detector->quiet_frames = 0;
+    detector->silent = 0;
+
+    return detector;
+}
+
+int silence_detector_process(struct silence_detector* detector, const unsigned char* data, int size)
+{
+    unsigned int level = peak(detector, data, size);
+
+    if (detector->silent)
+    {
+        /* require a louder signal to leave silence than to enter it */
+        if (level > detector->open_level)
+        {
+            detector->silent = 0;
+            detector->quiet_frames = 0;
+        }
+    }
+    else if (level <= detector->close_level)
+    {
+        detector->quiet_frames += size / detector->stride;
+
+        if (detector->quiet_frames >= detector->hangover_frames)
+        {
+            detector->silent = 1;
+        }
+    }
+    else
+    {
+        detector->quiet_frames = 0;
+    }
+
+    return detector->silent;
+}
+
+void silence_detector_destroy(struct silence_detector* detector)
+{
+    free(detector);
+}
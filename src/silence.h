@@ -0,0 +1,30 @@
+/*
+Copyright 2025 Amini Allight
+
+This file is part of netpw.
+
+netpw is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+netpw is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with netpw. If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef NETPW_SILENCE_H
+#define NETPW_SILENCE_H
+
+struct silence_detector;
+
+/* threshold is in dBFS, hangover is in milliseconds */
+struct silence_detector* silence_detector_init(int frequency, int channels, int depth, double threshold, int hangover);
+/* returns non-zero if the block can be replaced by a silence marker */
+int silence_detector_process(struct silence_detector* detector, const unsigned char* data, int size);
+void silence_detector_destroy(struct silence_detector* detector);
+
+#endif
@@ -0,0 +1,164 @@
+/*
+Copyright 2025 Amini Allight
+
+This file is part of netpw.
+
+netpw is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+netpw is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with netpw. If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "tcp_tuning.h"
+#include "error_handling.h"
+#include "constants.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <netinet/in.h>
+#include <linux/sockios.h>
+#include <linux/tcp.h>
+
+/* a write, as the position in the byte stream where it ended */
+struct send_record
+{
+    uint64_t end;
+    uint64_t time;
+};
+
+struct send_budget
+{
+    int socket;
+    uint64_t latency_budget;
+    struct send_record records[NETPW_SEND_BUDGET_HISTORY];
+    int first;
+    int count;
+};
+
+void tcp_options_default(struct tcp_options* options)
+{
+    options->latency_budget = 0;
+    options->congestion = NULL;
+}
+
+void tcp_configure(int socket, const struct tcp_options* options)
+{
+    int result;
+
+    /* audio is written in small quanta, which Nagle would hold back until the previous ones are acknowledged */
+    int enabled = 1;
+    CHECK_ERRNO(setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &enabled, sizeof(enabled)));
+
+    if (options->congestion)
+    {
+        CHECK_ERRNO(setsockopt(socket, IPPROTO_TCP, TCP_CONGESTION, options->congestion, strlen(options->congestion)));
+    }
+
+    /* keeps the kernel from taking on more than the budget could ever allow, anything beyond that stays with the sender to drop */
+    if (options->latency_budget)
+    {
+        int lowat = NETPW_NOTSENT_LOWAT;
+        CHECK_ERRNO(setsockopt(socket, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &lowat, sizeof(lowat)));
+    }
+}
+
+struct send_budget* send_budget_init(int socket, uint64_t latency_budget)
+{
+    struct send_budget* budget = malloc(sizeof(struct send_budget));
+
+    budget->socket = socket;
+    budget->latency_budget = latency_budget;
+    budget->first = 0;
+    budget->count = 0;
+
+    return budget;
+}
+
+void send_budget_destroy(struct send_budget* budget)
+{
+    free(budget);
+}
+
+static int send_budget_info(struct send_budget* budget, struct tcp_info* info)
+{
+    socklen_t size = sizeof(struct tcp_info);
+
+    /* older kernels fill less of the structure */
+    memset(info, 0, sizeof(struct tcp_info));
+
+    return getsockopt(budget->socket, IPPROTO_TCP, TCP_INFO, info, &size);
+}
+
+void send_budget_written(struct send_budget* budget, uint64_t now)
+{
+    if (!budget->latency_budget)
+    {
+        return;
+    }
+
+    struct tcp_info info;
+    int queued;
+
+    if (send_budget_info(budget, &info) < 0 || ioctl(budget->socket, SIOCOUTQ, &queued) < 0)
+    {
+        return;
+    }
+
+    uint64_t end = info.tcpi_bytes_acked + queued;
+
+    if (budget->count > 0 && budget->records[(budget->first + budget->count - 1) % NETPW_SEND_BUDGET_HISTORY].end >= end)
+    {
+        return;
+    }
+
+    /* losing the oldest record only makes the wait look shorter than it is */
+    if (budget->count == NETPW_SEND_BUDGET_HISTORY)
+    {
+        budget->first = (budget->first + 1) % NETPW_SEND_BUDGET_HISTORY;
+        budget->count--;
+    }
+
+    struct send_record* record = &budget->records[(budget->first + budget->count) % NETPW_SEND_BUDGET_HISTORY];
+    record->end = end;
+    record->time = now;
+    budget->count++;
+}
+
+int send_budget_exceeded(struct send_budget* budget, uint64_t now)
+{
+    if (!budget->latency_budget)
+    {
+        return 0;
+    }
+
+    struct tcp_info info;
+
+    if (send_budget_info(budget, &info) < 0)
+    {
+        return 0;
+    }
+
+    /* a write now would block until the kernel sent down to the low-water mark */
+    if (info.tcpi_notsent_bytes >= NETPW_NOTSENT_LOWAT)
+    {
+        return 1;
+    }
+
+    while (budget->count > 0 && budget->records[budget->first].end <= info.tcpi_bytes_acked)
+    {
+        budget->first = (budget->first + 1) % NETPW_SEND_BUDGET_HISTORY;
+        budget->count--;
+    }
+
+    /* whatever is written now waits at least as long as the oldest data still unacknowledged has */
+    return budget->count > 0 && now - budget->records[budget->first].time > budget->latency_budget;
+}
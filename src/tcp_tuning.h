@@ -0,0 +1,47 @@
+/*
+Copyright 2025 Amini Allight
+
+This file is part of netpw.
+
+netpw is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+netpw is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with netpw. If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef NETPW_TCP_TUNING_H
+#define NETPW_TCP_TUNING_H
+
+#include <stdint.h>
+
+/* applied to every connection, on both ends */
+struct tcp_options
+{
+    /* in nanoseconds, zero to let the kernel queue without limit */
+    uint64_t latency_budget;
+    /* NULL for the system default */
+    const char* congestion;
+};
+
+void tcp_options_default(struct tcp_options* options);
+void tcp_configure(int socket, const struct tcp_options* options);
+
+/* tracks how long written data waits to be acknowledged by the peer, not thread-safe */
+struct send_budget;
+
+struct send_budget* send_budget_init(int socket, uint64_t latency_budget);
+void send_budget_destroy(struct send_budget* budget);
+
+/* called after every write to the socket */
+void send_budget_written(struct send_budget* budget, uint64_t now);
+/* returns non-zero if data written now would wait longer than the budget, never without a budget */
+int send_budget_exceeded(struct send_budget* budget, uint64_t now);
+
+#endif
@@ -22,7 +22,10 @@ along with netpw. If not, see <https://www.gnu.org/licenses/>.
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#ifdef NETPW_PIPEWIRE
 #include <spa/param/audio/raw.h>
+#endif
 
 char* get_file(const char* path)
 {
@@ -57,6 +60,7 @@ int max(int a, int b)
     return a > b ? a : b;
 }
 
+#ifdef NETPW_PIPEWIRE
 int identify_spa_format(int bit_depth)
 {
     switch (bit_depth)
@@ -75,6 +79,45 @@ int identify_spa_format(int bit_depth)
     }
 }
 
+void identify_channel_position(int channels, int channel, char* name, int size)
+{
+    static const char* const stereo[] = { "FL", "FR" };
+    static const char* const quad[] = { "FL", "FR", "RL", "RR" };
+    static const char* const surround_51[] = { "FL", "FR", "FC", "LFE", "RL", "RR" };
+    static const char* const surround_71[] = { "FL", "FR", "FC", "LFE", "RL", "RR", "SL", "SR" };
+
+    const char* position = NULL;
+
+    switch (channels)
+    {
+    case 1 :
+        position = "MONO";
+        break;
+    case 2 :
+        position = stereo[channel];
+        break;
+    case 4 :
+        position = quad[channel];
+        break;
+    case 6 :
+        position = surround_51[channel];
+        break;
+    case 8 :
+        position = surround_71[channel];
+        break;
+    }
+
+    if (position)
+    {
+        snprintf(name, size, "%s", position);
+    }
+    else
+    {
+        snprintf(name, size, "AUX%i", channel);
+    }
+}
+#endif
+
 const char* identify_ffmpeg_format(int bit_depth)
 {
     switch (bit_depth)
@@ -114,3 +157,36 @@ char* int_to_string(int x)
 
     return result;
 }
+
+uint64_t get_time()
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+
+    return (uint64_t)time.tv_sec * 1000000000 + time.tv_nsec;
+}
+
+int sleep_until(uint64_t time)
+{
+    struct timespec deadline = {
+        .tv_sec = time / 1000000000,
+        .tv_nsec = time % 1000000000
+    };
+
+    return clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
+}
+
+static int compare_u64(const void* a, const void* b)
+{
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+
+    return x < y ? -1 : x > y;
+}
+
+uint64_t percentile(uint64_t* values, int count, int percent)
+{
+    qsort(values, count, sizeof(uint64_t), compare_u64);
+
+    return values[min((count * percent) / 100, count - 1)];
+}
@@ -19,12 +19,18 @@ along with netpw. If not, see <https://www.gnu.org/licenses/>.
 #ifndef NETPW_TOOLS_H
 #define NETPW_TOOLS_H
 
+#include <stdint.h>
+
 char* get_file(const char* path);
 
 int min(int a, int b);
 int max(int a, int b);
 
+#ifdef NETPW_PIPEWIRE
 int identify_spa_format(int bit_depth);
+/* writes the PipeWire channel position of one channel in the usual layout for the channel count, or an auxiliary position */
+void identify_channel_position(int channels, int channel, char* name, int size);
+#endif
 
 const char* identify_ffmpeg_format(int bit_depth);
 
@@ -34,4 +40,13 @@ char* concat_strings(const char* a, const char* b);
 /* allocs and returns ownership */
 char* int_to_string(int x);
 
+/* monotonic, in nanoseconds */
+uint64_t get_time();
+
+/* monotonic, in nanoseconds, returns non-zero if interrupted */
+int sleep_until(uint64_t time);
+
+/* sorts the values in place, count must be non-zero */
+uint64_t percentile(uint64_t* values, int count, int percent);
+
 #endif
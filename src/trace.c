@@ -0,0 +1,408 @@
+/*
+Copyright 2025 Amini Allight
+
+This file is part of netpw.
+
+netpw is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+netpw is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with netpw. If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "trace.h"
+#include "constants.h"
+#include "error_handling.h"
+#include "metrics.h"
+#include "tools.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/syscall.h>
+
+struct trace_record
+{
+    uint64_t time;
+    const char* name;
+    int64_t value;
+    char phase;
+};
+
+/* single producer, written only by its thread and read by the dumper without locking */
+struct trace_ring
+{
+    struct trace_record records[NETPW_TRACE_RING_SIZE];
+    uint64_t head;
+    int tid;
+    char name[32];
+    int alive;
+    struct trace_ring* next;
+};
+
+int trace_active = 0;
+
+static char* directory = NULL;
+static uint64_t start_time;
+static pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct trace_ring* rings = NULL;
+static int dead_ring_count = 0;
+static pthread_key_t ring_key;
+static __thread struct trace_ring* thread_ring = NULL;
+static sem_t dump_semaphore;
+static int dump_requested = 0;
+static int incident_pending = 0;
+static uint64_t last_incident = 0;
+static int quit = 0;
+static int dump_index = 0;
+static pthread_t dump_thread;
+static struct metric* incident_metric;
+
+/* keeps exited threads' events around for a while without letting connection churn grow memory use */
+static void trace_ring_release(void* arg)
+{
+    struct trace_ring* ring = arg;
+
+    pthread_mutex_lock(&rings_lock);
+
+    ring->alive = 0;
+    dead_ring_count++;
+
+    while (dead_ring_count > NETPW_TRACE_DEAD_RING_COUNT)
+    {
+        struct trace_ring** oldest = NULL;
+        struct trace_ring** link;
+
+        for (link = &rings; *link; link = &(*link)->next)
+        {
+            if (!(*link)->alive)
+            {
+                oldest = link;
+            }
+        }
+
+        struct trace_ring* dead = *oldest;
+        *oldest = dead->next;
+        free(dead);
+        dead_ring_count--;
+    }
+
+    pthread_mutex_unlock(&rings_lock);
+}
+
+static struct trace_ring* trace_ring_get()
+{
+    if (thread_ring)
+    {
+        return thread_ring;
+    }
+
+    struct trace_ring* ring = calloc(1, sizeof(struct trace_ring));
+
+    ring->tid = syscall(SYS_gettid);
+    snprintf(ring->name, sizeof(ring->name), "thread %i", ring->tid);
+    ring->alive = 1;
+
+    pthread_mutex_lock(&rings_lock);
+    ring->next = rings;
+    rings = ring;
+    pthread_mutex_unlock(&rings_lock);
+
+    pthread_setspecific(ring_key, ring);
+    thread_ring = ring;
+
+    return ring;
+}
+
+void trace_event(const char* name, char phase, int64_t value)
+{
+    struct trace_ring* ring = trace_ring_get();
+
+    uint64_t head = ring->head;
+    struct trace_record* record = &ring->records[head % NETPW_TRACE_RING_SIZE];
+
+    record->time = get_time();
+    record->name = name;
+    record->value = value;
+    record->phase = phase;
+
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+void trace_thread_name(const char* name)
+{
+    if (!trace_active)
+    {
+        return;
+    }
+
+    struct trace_ring* ring = trace_ring_get();
+
+    snprintf(ring->name, sizeof(ring->name), "%s", name);
+}
+
+static void trace_write_ring(FILE* file, struct trace_ring* ring, int pid, struct trace_record* records, int* first)
+{
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint64_t copied = head > NETPW_TRACE_RING_SIZE ? head - NETPW_TRACE_RING_SIZE : 0;
+    uint64_t begin = copied;
+
+    uint64_t i;
+    for (i = copied; i < head; i++)
+    {
+        records[i - copied] = ring->records[i % NETPW_TRACE_RING_SIZE];
+    }
+
+    /* anything the thread may have overwritten while it was being copied is dropped */
+    uint64_t overwritten = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+    if (overwritten + 1 > begin + NETPW_TRACE_RING_SIZE)
+    {
+        begin = overwritten + 1 - NETPW_TRACE_RING_SIZE;
+    }
+
+    fprintf(
+        file,
+        "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%i,\"tid\":%i,\"args\":{\"name\":\"%s\"}}",
+        *first ? "" : ",",
+        pid,
+        ring->tid,
+        ring->name
+    );
+    *first = 0;
+
+    for (i = begin; i < head; i++)
+    {
+        struct trace_record* record = &records[i - copied];
+        double timestamp = (int64_t)(record->time - start_time) / 1000.0;
+
+        switch (record->phase)
+        {
+        case 'C' :
+            fprintf(
+                file,
+                ",\n{\"name\":\"%s\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":%i,\"tid\":%i,\"args\":{\"value\":%lli}}",
+                record->name,
+                timestamp,
+                pid,
+                ring->tid,
+                (long long)record->value
+            );
+            break;
+        case 'i' :
+            fprintf(
+                file,
+                ",\n{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":%i,\"tid\":%i}",
+                record->name,
+                timestamp,
+                pid,
+                ring->tid
+            );
+            break;
+        default :
+            fprintf(
+                file,
+                ",\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%i,\"tid\":%i}",
+                record->name,
+                record->phase,
+                timestamp,
+                pid,
+                ring->tid
+            );
+            break;
+        }
+    }
+}
+
+static void trace_dump(const char* reason)
+{
+    int pid = getpid();
+
+    char name[64];
+    snprintf(name, sizeof(name), "/netpw-%i-%s-%i.json", pid, reason, dump_index++);
+
+    char* path = concat_strings(directory, name);
+
+    FILE* file = fopen(path, "w");
+
+    if (!file)
+    {
+        fprintf(stderr, "failed to open trace file %s: %i\n", path, errno);
+        free(path);
+        return;
+    }
+
+    struct trace_record* records = malloc(sizeof(struct trace_record) * NETPW_TRACE_RING_SIZE);
+    int first = 1;
+
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+    pthread_mutex_lock(&rings_lock);
+
+    struct trace_ring* ring;
+    for (ring = rings; ring; ring = ring->next)
+    {
+        trace_write_ring(file, ring, pid, records, &first);
+    }
+
+    pthread_mutex_unlock(&rings_lock);
+
+    fprintf(file, "\n]}\n");
+    fclose(file);
+    free(records);
+
+    fprintf(stderr, "wrote trace to %s.\n", path);
+    free(path);
+}
+
+static void* trace_dumper(void* arg)
+{
+    while (1)
+    {
+        if (sem_wait(&dump_semaphore) < 0)
+        {
+            continue;
+        }
+
+        if (__atomic_load_n(&quit, __ATOMIC_ACQUIRE))
+        {
+            break;
+        }
+
+        if (__atomic_exchange_n(&incident_pending, 0, __ATOMIC_ACQ_REL))
+        {
+            /* lets the trace capture the aftermath of the incident as well as the lead-up */
+            usleep(NETPW_TRACE_INCIDENT_DELAY / 1000);
+            trace_dump("incident");
+        }
+
+        if (__atomic_exchange_n(&dump_requested, 0, __ATOMIC_ACQ_REL))
+        {
+            trace_dump("trace");
+        }
+    }
+
+    return NULL;
+}
+
+static void on_dump_signal(int signal)
+{
+    __atomic_store_n(&dump_requested, 1, __ATOMIC_RELEASE);
+    sem_post(&dump_semaphore);
+}
+
+void trace_init(const char* trace_directory)
+{
+    int result;
+
+    directory = strdup(trace_directory);
+    start_time = get_time();
+
+    CHECK_ERROR_FATAL(pthread_key_create(&ring_key, trace_ring_release));
+    CHECK_ERRNO_FATAL(sem_init(&dump_semaphore, 0, 0));
+
+    incident_metric = metric_counter_init("netpw_watchdog_incidents_total", "Realtime callbacks that overran their quantum or started late.", NULL);
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = on_dump_signal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+
+    CHECK_ERRNO_FATAL(sigaction(SIGUSR1, &action, NULL));
+
+    CHECK_ERROR_FATAL(pthread_create(&dump_thread, NULL, trace_dumper, NULL));
+
+    __atomic_store_n(&trace_active, 1, __ATOMIC_RELEASE);
+
+    printf("tracing, send SIGUSR1 to write a trace to %s.\n", directory);
+}
+
+void trace_destroy()
+{
+    int result;
+
+    if (!trace_active)
+    {
+        return;
+    }
+
+    __atomic_store_n(&quit, 1, __ATOMIC_RELEASE);
+    sem_post(&dump_semaphore);
+    CHECK_ERROR(pthread_join(dump_thread, NULL));
+
+    metric_destroy(incident_metric);
+    free(directory);
+}
+
+static void trace_incident(const char* name)
+{
+    trace_event(name, 'i', 0);
+    metric_add(incident_metric, 1);
+
+    uint64_t now = get_time();
+    uint64_t last = __atomic_load_n(&last_incident, __ATOMIC_RELAXED);
+
+    /* bursts of incidents are covered by one trace */
+    if (now - last < NETPW_TRACE_INCIDENT_INTERVAL || !__atomic_compare_exchange_n(&last_incident, &last, now, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    {
+        return;
+    }
+
+    __atomic_store_n(&incident_pending, 1, __ATOMIC_RELEASE);
+    sem_post(&dump_semaphore);
+}
+
+void trace_watchdog_init(struct trace_watchdog* watchdog, const char* name)
+{
+    watchdog->name = name;
+    watchdog->start = 0;
+    watchdog->last_start = 0;
+}
+
+void trace_watchdog_begin(struct trace_watchdog* watchdog)
+{
+    if (!trace_active)
+    {
+        return;
+    }
+
+    watchdog->last_start = watchdog->start;
+    watchdog->start = get_time();
+
+    trace_event(watchdog->name, 'B', 0);
+}
+
+void trace_watchdog_end(struct trace_watchdog* watchdog, uint64_t budget)
+{
+    if (!trace_active)
+    {
+        return;
+    }
+
+    trace_event(watchdog->name, 'E', 0);
+
+    uint64_t now = get_time();
+
+    if (now - watchdog->start > budget)
+    {
+        trace_incident("watchdog: callback overran its quantum");
+    }
+
+    /* the callback itself was quick but the one before it was missed */
+    if (watchdog->last_start && watchdog->start - watchdog->last_start > 2 * budget)
+    {
+        trace_incident("watchdog: callback started late");
+    }
+}
@@ -0,0 +1,54 @@
+/*
+Copyright 2025 Amini Allight
+
+This file is part of netpw.
+
+netpw is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+netpw is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with netpw. If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef NETPW_TRACE_H
+#define NETPW_TRACE_H
+
+#include <stdint.h>
+
+/* set once by trace_init, checked inline so that disabled tracing costs one branch per event */
+extern int trace_active;
+
+/* names must be string literals, events are recorded into a lock-free ring owned by the calling thread */
+#define TRACE_BEGIN(_name) if (trace_active) trace_event((_name), 'B', 0)
+#define TRACE_END(_name) if (trace_active) trace_event((_name), 'E', 0)
+#define TRACE_COUNTER(_name, _value) if (trace_active) trace_event((_name), 'C', (_value))
+#define TRACE_INSTANT(_name) if (trace_active) trace_event((_name), 'i', 0)
+
+/* traces the callback of one realtime stream and flags it when it overruns or starts late */
+struct trace_watchdog
+{
+    const char* name;
+    uint64_t start;
+    uint64_t last_start;
+};
+
+/* traces are written to the directory as Chrome trace JSON on SIGUSR1 and shortly after each watchdog incident */
+void trace_init(const char* directory);
+void trace_destroy();
+
+void trace_event(const char* name, char phase, int64_t value);
+/* shown in the trace viewer in place of the thread id */
+void trace_thread_name(const char* name);
+
+void trace_watchdog_init(struct trace_watchdog* watchdog, const char* name);
+void trace_watchdog_begin(struct trace_watchdog* watchdog);
+/* the budget is the duration of the quantum in nanoseconds */
+void trace_watchdog_end(struct trace_watchdog* watchdog, uint64_t budget);
+
+#endif
@@ -0,0 +1,775 @@
+/*
+Copyright 2025 Amini Allight
+
+This file is part of netpw.
+
+netpw is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+netpw is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with netpw. If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "transport.h"
+#include "error_handling.h"
+#include "constants.h"
+#include "packet.h"
+#include "tools.h"
+#include "local_link.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <openssl/err.h>
+#include <openssl/evp.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#elif defined(__aarch64__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+/* integrity records are a four byte big-endian payload size, the payload and a tag over both */
+#define NETPW_INTEGRITY_HEADER_SIZE 4
+#define NETPW_INTEGRITY_TAG_SIZE 16
+#define NETPW_INTEGRITY_NONCE_SIZE 12
+#define NETPW_INTEGRITY_KEY_SIZE 32
+#define NETPW_INTEGRITY_RECORD_MAX_SIZE (NETPW_INTEGRITY_HEADER_SIZE + NETPW_TRANSPORT_RECORD_SIZE + NETPW_INTEGRITY_TAG_SIZE)
+
+static const char* exporter_label = "EXPORTER-netpw-integrity";
+
+/* in ALPN wire format, a length byte followed by the name */
+static const unsigned char tls_protocol[] = "\x05netpw";
+static const unsigned char integrity_protocol[] = "\x0fnetpw-integrity";
+
+static const char* aes_first_suites = "TLS_AES_128_GCM_SHA256:TLS_AES_256_GCM_SHA384:TLS_CHACHA20_POLY1305_SHA256";
+static const char* chacha_first_suites = "TLS_CHACHA20_POLY1305_SHA256:TLS_AES_128_GCM_SHA256:TLS_AES_256_GCM_SHA384";
+static const char* aes_suites = "TLS_AES_128_GCM_SHA256:TLS_AES_256_GCM_SHA384";
+static const char* chacha_suites = "TLS_CHACHA20_POLY1305_SHA256";
+
+struct integrity_direction
+{
+    EVP_CIPHER_CTX* context;
+    unsigned char iv[NETPW_INTEGRITY_NONCE_SIZE];
+    uint64_t sequence;
+};
+
+struct transport
+{
+    enum crypto_profile profile;
+    int socket;
+    SSL* ssl;
+    /* NULL unless the peer is on the same host, in which case nothing else is used */
+    struct local_link* link;
+    char description[128];
+    struct integrity_direction send;
+    struct integrity_direction receive;
+    unsigned char* input;
+    int input_start;
+    int input_end;
+    int record_size;
+    int payload_offset;
+    int payload_size;
+};
+
+enum crypto_profile crypto_profile_from_name(const char* name)
+{
+    if (strcmp(name, "auto") == 0)
+    {
+        return NETPW_CRYPTO_PROFILE_AUTO;
+    }
+    else if (strcmp(name, "aes") == 0)
+    {
+        return NETPW_CRYPTO_PROFILE_AES;
+    }
+    else if (strcmp(name, "chacha") == 0)
+    {
+        return NETPW_CRYPTO_PROFILE_CHACHA;
+    }
+    else if (strcmp(name, "integrity") == 0)
+    {
+        return NETPW_CRYPTO_PROFILE_INTEGRITY;
+    }
+    else if (strcmp(name, "plaintext") == 0)
+    {
+        return NETPW_CRYPTO_PROFILE_PLAINTEXT;
+    }
+    else
+    {
+        return NETPW_CRYPTO_PROFILE_NONE;
+    }
+}
+
+const char* crypto_profile_name(enum crypto_profile profile)
+{
+    switch (profile)
+    {
+    default :
+        return "none";
+    case NETPW_CRYPTO_PROFILE_AUTO :
+        return "auto";
+    case NETPW_CRYPTO_PROFILE_AES :
+        return "aes";
+    case NETPW_CRYPTO_PROFILE_CHACHA :
+        return "chacha";
+    case NETPW_CRYPTO_PROFILE_INTEGRITY :
+        return "integrity";
+    case NETPW_CRYPTO_PROFILE_PLAINTEXT :
+        return "plaintext";
+    }
+}
+
+/* without AES and carry-less multiply instructions ChaCha20-Poly1305 is several times faster than AES-GCM */
+static int cpu_accelerates_aes()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned int eax, ebx, ecx, edx;
+
+    return __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_AES) && (ecx & bit_PCLMUL);
+#elif defined(__aarch64__)
+    unsigned long capabilities = getauxval(AT_HWCAP);
+
+    return (capabilities & HWCAP_AES) && (capabilities & HWCAP_PMULL);
+#else
+    return 0;
+#endif
+}
+
+static const unsigned char* profile_protocol(enum crypto_profile profile)
+{
+    return profile == NETPW_CRYPTO_PROFILE_INTEGRITY ? integrity_protocol : tls_protocol;
+}
+
+static int select_protocol(
+    SSL* ssl,
+    const unsigned char** out,
+    unsigned char* out_size,
+    const unsigned char* in,
+    unsigned int in_size,
+    void* arg
+)
+{
+    const unsigned char* protocol = arg;
+
+    unsigned int i;
+    for (i = 0; i < in_size; i += in[i] + 1)
+    {
+        if (in[i] == protocol[0] && i + 1 + in[i] <= in_size && memcmp(in + i + 1, protocol + 1, protocol[0]) == 0)
+        {
+            *out = in + i + 1;
+            *out_size = in[i];
+            return SSL_TLSEXT_ERR_OK;
+        }
+    }
+
+    return SSL_TLSEXT_ERR_ALERT_FATAL;
+}
+
+void transport_configure(SSL_CTX* context, enum crypto_profile profile, int server)
+{
+    int result;
+
+    const char* suites;
+
+    switch (profile)
+    {
+    default :
+        suites = cpu_accelerates_aes() ? aes_first_suites : chacha_first_suites;
+        break;
+    case NETPW_CRYPTO_PROFILE_AES :
+        suites = aes_suites;
+        break;
+    case NETPW_CRYPTO_PROFILE_CHACHA :
+        suites = chacha_suites;
+        break;
+    }
+
+    CHECK_OK_FATAL(SSL_CTX_set_ciphersuites(context, suites));
+
+    if (server)
+    {
+        /* the server's order decides, except that a client listing ChaCha20 first is assumed to lack AES instructions */
+        SSL_CTX_set_options(context, SSL_OP_CIPHER_SERVER_PREFERENCE | SSL_OP_PRIORITIZE_CHACHA);
+        /* sessions are never resumed, and tickets sent after the handshake would be read as integrity records */
+        CHECK_OK_FATAL(SSL_CTX_set_num_tickets(context, 0));
+        SSL_CTX_set_alpn_select_cb(context, select_protocol, (void*)profile_protocol(profile));
+    }
+    else
+    {
+        const unsigned char* protocol = profile_protocol(profile);
+
+        CHECK_ERROR_FATAL(SSL_CTX_set_alpn_protos(context, protocol, protocol[0] + 1));
+    }
+}
+
+static int integrity_direction_init(struct integrity_direction* direction, const EVP_CIPHER* cipher, const unsigned char* material, int encrypt)
+{
+    direction->context = EVP_CIPHER_CTX_new();
+    memcpy(direction->iv, material + NETPW_INTEGRITY_KEY_SIZE, NETPW_INTEGRITY_NONCE_SIZE);
+    direction->sequence = 0;
+
+    if (!direction->context)
+    {
+        return -1;
+    }
+
+    return EVP_CipherInit_ex(direction->context, cipher, NULL, material, NULL, encrypt) == 1 ? 0 : -1;
+}
+
+/* as in TLS 1.3 the nonce is the static IV with the record sequence number mixed into its tail */
+static void integrity_nonce(struct integrity_direction* direction, unsigned char* nonce)
+{
+    memcpy(nonce, direction->iv, NETPW_INTEGRITY_NONCE_SIZE);
+
+    int i;
+    for (i = 0; i < 8; i++)
+    {
+        nonce[NETPW_INTEGRITY_NONCE_SIZE - 1 - i] ^= (direction->sequence >> (i * 8)) & 0xff;
+    }
+
+    direction->sequence++;
+}
+
+/* the payload is authenticated as additional data, so the AEAD only ever runs its MAC */
+static int integrity_tag(struct integrity_direction* direction, const unsigned char* record, int size, unsigned char* tag)
+{
+    unsigned char nonce[NETPW_INTEGRITY_NONCE_SIZE];
+    integrity_nonce(direction, nonce);
+
+    int length;
+
+    return EVP_EncryptInit_ex(direction->context, NULL, NULL, NULL, nonce) == 1 &&
+        EVP_EncryptUpdate(direction->context, NULL, &length, record, size) == 1 &&
+        EVP_EncryptFinal_ex(direction->context, NULL, &length) == 1 &&
+        EVP_CIPHER_CTX_ctrl(direction->context, EVP_CTRL_AEAD_GET_TAG, NETPW_INTEGRITY_TAG_SIZE, tag) == 1 ? 0 : -1;
+}
+
+static int integrity_verify(struct integrity_direction* direction, const unsigned char* record, int size, const unsigned char* tag)
+{
+    unsigned char nonce[NETPW_INTEGRITY_NONCE_SIZE];
+    integrity_nonce(direction, nonce);
+
+    int length;
+
+    return EVP_DecryptInit_ex(direction->context, NULL, NULL, NULL, nonce) == 1 &&
+        EVP_DecryptUpdate(direction->context, NULL, &length, record, size) == 1 &&
+        EVP_CIPHER_CTX_ctrl(direction->context, EVP_CTRL_AEAD_SET_TAG, NETPW_INTEGRITY_TAG_SIZE, (void*)tag) == 1 &&
+        EVP_DecryptFinal_ex(direction->context, NULL, &length) == 1 ? 0 : -1;
+}
+
+/* keys both directions from the handshake using the AEAD of the negotiated suite */
+static int integrity_init(struct transport* transport, int server)
+{
+    unsigned char material[2 * (NETPW_INTEGRITY_KEY_SIZE + NETPW_INTEGRITY_NONCE_SIZE)];
+    unsigned char* client_material = material;
+    unsigned char* server_material = material + NETPW_INTEGRITY_KEY_SIZE + NETPW_INTEGRITY_NONCE_SIZE;
+
+    if (SSL_export_keying_material(transport->ssl, material, sizeof(material), exporter_label, strlen(exporter_label), NULL, 0, 0) != 1)
+    {
+        return -1;
+    }
+
+    const EVP_CIPHER* cipher = EVP_get_cipherbynid(SSL_CIPHER_get_cipher_nid(SSL_get_current_cipher(transport->ssl)));
+
+    if (!cipher)
+    {
+        return -1;
+    }
+
+    int result = integrity_direction_init(&transport->send, cipher, server ? server_material : client_material, 1) ||
+        integrity_direction_init(&transport->receive, cipher, server ? client_material : server_material, 0);
+
+    OPENSSL_cleanse(material, sizeof(material));
+
+    if (result)
+    {
+        return -1;
+    }
+
+    /* room for a whole record at any offset, so that one read can pull in several small ones */
+    transport->input = malloc(2 * NETPW_INTEGRITY_RECORD_MAX_SIZE);
+
+    snprintf(transport->description, sizeof(transport->description), "integrity only with %s keys", SSL_get_cipher_name(transport->ssl));
+
+    return 0;
+}
+
+static struct transport* transport_init(int socket, enum crypto_profile profile)
+{
+    struct transport* transport = malloc(sizeof(struct transport));
+
+    transport->profile = profile;
+    transport->socket = socket;
+    transport->ssl = NULL;
+    transport->link = NULL;
+    strcpy(transport->description, crypto_profile_name(profile));
+    transport->send.context = NULL;
+    transport->receive.context = NULL;
+    transport->input = NULL;
+    transport->input_start = 0;
+    transport->input_end = 0;
+    transport->record_size = 0;
+    transport->payload_offset = 0;
+    transport->payload_size = 0;
+
+    return transport;
+}
+
+/* like SSL_accept, but gives up once deadline has passed however slowly the peer trickles its messages in */
+static int accept_before(SSL* ssl, int socket, uint64_t deadline)
+{
+    int result;
+
+    int flags;
+    CHECK_ERRNO(flags = fcntl(socket, F_GETFL));
+
+    if (result < 0)
+    {
+        return -1;
+    }
+
+    CHECK_ERRNO(fcntl(socket, F_SETFL, flags | O_NONBLOCK));
+
+    int outcome;
+
+    while (1)
+    {
+        int accepted = SSL_accept(ssl);
+
+        if (accepted > 0)
+        {
+            outcome = accepted;
+            break;
+        }
+
+        int error = SSL_get_error(ssl, accepted);
+
+        if (error != SSL_ERROR_WANT_READ && error != SSL_ERROR_WANT_WRITE)
+        {
+            fprintf(stderr, "'SSL_accept(ssl)' failed: %i\n", error);
+            outcome = -1;
+            break;
+        }
+
+        uint64_t now = get_time();
+
+        if (now >= deadline)
+        {
+            fprintf(stderr, "handshake timed out.\n");
+            outcome = -1;
+            break;
+        }
+
+        struct pollfd poll_fd = {
+            .fd = socket,
+            .events = error == SSL_ERROR_WANT_READ ? POLLIN : POLLOUT
+        };
+
+        poll(&poll_fd, 1, (deadline - now + 999999) / 1000000);
+    }
+
+    CHECK_ERRNO(fcntl(socket, F_SETFL, flags));
+
+    return result < 0 ? -1 : outcome;
+}
+
+static struct transport* transport_handshake(SSL_CTX* context, int socket, enum crypto_profile profile, int server, uint64_t deadline)
+{
+    int result;
+
+    struct transport* transport = transport_init(socket, profile);
+
+    if (profile == NETPW_CRYPTO_PROFILE_PLAINTEXT)
+    {
+        return transport;
+    }
+
+    CHECK_POINTER(transport->ssl = SSL_new(context));
+
+    if (!transport->ssl)
+    {
+        transport_destroy(transport);
+        return NULL;
+    }
+
+    CHECK_OK(SSL_set_fd(transport->ssl, socket));
+
+    if (server && deadline)
+    {
+        result = accept_before(transport->ssl, socket, deadline);
+    }
+    else if (server)
+    {
+        CHECK_SSL(SSL_accept(transport->ssl), transport->ssl);
+    }
+    else
+    {
+        CHECK_SSL(SSL_connect(transport->ssl), transport->ssl);
+    }
+
+    if (result <= 0)
+    {
+        transport_destroy(transport);
+        return NULL;
+    }
+
+    snprintf(transport->description, sizeof(transport->description), "%s", SSL_get_cipher_name(transport->ssl));
+
+    if (profile != NETPW_CRYPTO_PROFILE_INTEGRITY)
+    {
+        return transport;
+    }
+
+    /* an older peer that ignores ALPN would otherwise go on speaking TLS records */
+    const unsigned char* protocol;
+    unsigned int protocol_size;
+    SSL_get0_alpn_selected(transport->ssl, &protocol, &protocol_size);
+
+    if (protocol_size != integrity_protocol[0] || memcmp(protocol, integrity_protocol + 1, protocol_size) != 0)
+    {
+        fprintf(stderr, "peer did not agree to the integrity profile.\n");
+        transport_destroy(transport);
+        return NULL;
+    }
+
+    if (integrity_init(transport, server))
+    {
+        fprintf(stderr, "failed to derive integrity keys.\n");
+        transport_destroy(transport);
+        return NULL;
+    }
+
+    return transport;
+}
+
+struct transport* transport_accept(SSL_CTX* context, int socket, enum crypto_profile profile, uint64_t deadline)
+{
+    return transport_handshake(context, socket, profile, 1, deadline);
+}
+
+struct transport* transport_connect(SSL_CTX* context, int socket, enum crypto_profile profile)
+{
+    return transport_handshake(context, socket, profile, 0, 0);
+}
+
+static struct transport* transport_local(int socket, int server)
+{
+    struct local_link* link = server ? local_link_create(socket) : local_link_open(socket);
+
+    if (!link)
+    {
+        return NULL;
+    }
+
+    struct transport* transport = transport_init(socket, NETPW_CRYPTO_PROFILE_NONE);
+    transport->link = link;
+    strcpy(transport->description, "shared memory");
+
+    return transport;
+}
+
+struct transport* transport_local_accept(int socket)
+{
+    return transport_local(socket, 1);
+}
+
+struct transport* transport_local_connect(int socket)
+{
+    return transport_local(socket, 0);
+}
+
+SSL* transport_ssl(struct transport* transport)
+{
+    return transport->ssl;
+}
+
+const char* transport_description(struct transport* transport)
+{
+    return transport->description;
+}
+
+/* returns one when at least size bytes are buffered */
+static int integrity_fill(struct transport* transport, int size)
+{
+    if (transport->input_start + size > 2 * NETPW_INTEGRITY_RECORD_MAX_SIZE)
+    {
+        memmove(transport->input, transport->input + transport->input_start, transport->input_end - transport->input_start);
+        transport->input_end -= transport->input_start;
+        transport->input_start = 0;
+    }
+
+    while (transport->input_end - transport->input_start < size)
+    {
+        ssize_t result = recv(
+            transport->socket,
+            transport->input + transport->input_end,
+            2 * NETPW_INTEGRITY_RECORD_MAX_SIZE - transport->input_end,
+            0
+        );
+
+        if (result < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        else if (result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            /* only on a non-blocking socket, the partial record stays buffered for the next read */
+            return NETPW_TRANSPORT_WOULD_BLOCK;
+        }
+        else if (result <= 0)
+        {
+            return result;
+        }
+
+        transport->input_end += result;
+    }
+
+    return 1;
+}
+
+static int integrity_read(struct transport* transport, unsigned char* buffer, int size)
+{
+    int result;
+
+    if (transport->payload_offset == transport->payload_size)
+    {
+        transport->input_start += transport->record_size;
+        transport->record_size = 0;
+
+        result = integrity_fill(transport, NETPW_INTEGRITY_HEADER_SIZE);
+
+        if (result <= 0)
+        {
+            return result;
+        }
+
+        int payload_size = packet_read_u32(transport->input + transport->input_start);
+
+        if (payload_size > NETPW_TRANSPORT_RECORD_SIZE)
+        {
+            fprintf(stderr, "received oversized integrity record.\n");
+            return -1;
+        }
+
+        int record_size = NETPW_INTEGRITY_HEADER_SIZE + payload_size + NETPW_INTEGRITY_TAG_SIZE;
+
+        result = integrity_fill(transport, record_size);
+
+        if (result <= 0)
+        {
+            return result;
+        }
+
+        const unsigned char* record = transport->input + transport->input_start;
+
+        if (integrity_verify(&transport->receive, record, record_size - NETPW_INTEGRITY_TAG_SIZE, record + record_size - NETPW_INTEGRITY_TAG_SIZE))
+        {
+            fprintf(stderr, "received integrity record with a bad tag.\n");
+            return -1;
+        }
+
+        transport->record_size = record_size;
+        transport->payload_offset = 0;
+        transport->payload_size = payload_size;
+    }
+
+    int count = min(size, transport->payload_size - transport->payload_offset);
+
+    memcpy(buffer, transport->input + transport->input_start + NETPW_INTEGRITY_HEADER_SIZE + transport->payload_offset, count);
+    transport->payload_offset += count;
+
+    return count;
+}
+
+int transport_read(struct transport* transport, unsigned char* buffer, int size)
+{
+    int result;
+
+    if (transport->link)
+    {
+        return local_link_read(transport->link, buffer, size);
+    }
+
+    switch (transport->profile)
+    {
+    default :
+        while (1)
+        {
+            result = SSL_read(transport->ssl, buffer, size);
+
+            if (result > 0 || !BIO_should_retry(SSL_get_rbio(transport->ssl)))
+            {
+                return result;
+            }
+        }
+    case NETPW_CRYPTO_PROFILE_INTEGRITY :
+        return integrity_read(transport, buffer, size);
+    case NETPW_CRYPTO_PROFILE_PLAINTEXT :
+        while (1)
+        {
+            result = recv(transport->socket, buffer, size, 0);
+
+            if (result >= 0 || errno != EINTR)
+            {
+                return result;
+            }
+        }
+    }
+}
+
+/* writes every part, resuming after partial writes */
+static int send_parts(int socket, struct iovec* parts, int count)
+{
+    while (count > 0)
+    {
+        ssize_t result = writev(socket, parts, count);
+
+        if (result < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        else if (result < 0)
+        {
+            return -1;
+        }
+
+        while (count > 0 && (size_t)result >= parts->iov_len)
+        {
+            result -= parts->iov_len;
+            parts++;
+            count--;
+        }
+
+        if (count > 0)
+        {
+            parts->iov_base = (unsigned char*)parts->iov_base + result;
+            parts->iov_len -= result;
+        }
+    }
+
+    return 0;
+}
+
+static int integrity_write(struct transport* transport, const unsigned char* data, int size)
+{
+    unsigned char record[NETPW_INTEGRITY_RECORD_MAX_SIZE];
+
+    int written = 0;
+
+    while (written < size)
+    {
+        int payload_size = min(size - written, NETPW_TRANSPORT_RECORD_SIZE);
+
+        /* the header is authenticated along with the payload, a copy keeps both and the tag in one write */
+        packet_write_u32(record, payload_size);
+        memcpy(record + NETPW_INTEGRITY_HEADER_SIZE, data + written, payload_size);
+
+        int record_size = NETPW_INTEGRITY_HEADER_SIZE + payload_size;
+
+        if (integrity_tag(&transport->send, record, record_size, record + record_size))
+        {
+            return -1;
+        }
+
+        struct iovec part = { record, record_size + NETPW_INTEGRITY_TAG_SIZE };
+
+        if (send_parts(transport->socket, &part, 1))
+        {
+            return -1;
+        }
+
+        written += payload_size;
+    }
+
+    return size;
+}
+
+int transport_read_nonblocking(struct transport* transport, unsigned char* buffer, int size)
+{
+    int result;
+
+    switch (transport->profile)
+    {
+    default :
+        result = SSL_read(transport->ssl, buffer, size);
+
+        if (result > 0)
+        {
+            return result;
+        }
+
+        switch (SSL_get_error(transport->ssl, result))
+        {
+        case SSL_ERROR_WANT_READ :
+        case SSL_ERROR_WANT_WRITE :
+            return NETPW_TRANSPORT_WOULD_BLOCK;
+        case SSL_ERROR_ZERO_RETURN :
+            return 0;
+        default :
+            return -1;
+        }
+    case NETPW_CRYPTO_PROFILE_INTEGRITY :
+        return integrity_read(transport, buffer, size);
+    case NETPW_CRYPTO_PROFILE_PLAINTEXT :
+        result = recv(transport->socket, buffer, size, 0);
+
+        if (result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+        {
+            return NETPW_TRANSPORT_WOULD_BLOCK;
+        }
+
+        return result;
+    }
+}
+
+int transport_write(struct transport* transport, const unsigned char* data, int size)
+{
+    if (transport->link)
+    {
+        return local_link_write(transport->link, data, size);
+    }
+
+    switch (transport->profile)
+    {
+    default :
+        return SSL_write(transport->ssl, data, size);
+    case NETPW_CRYPTO_PROFILE_INTEGRITY :
+        return integrity_write(transport, data, size);
+    case NETPW_CRYPTO_PROFILE_PLAINTEXT :
+    {
+        struct iovec part = { (void*)data, size };
+
+        return send_parts(transport->socket, &part, 1) ? -1 : size;
+    }
+    }
+}
+
+void transport_destroy(struct transport* transport)
+{
+    if (transport->ssl)
+    {
+        SSL_free(transport->ssl);
+    }
+
+    if (transport->link)
+    {
+        local_link_destroy(transport->link);
+    }
+
+    EVP_CIPHER_CTX_free(transport->send.context);
+    EVP_CIPHER_CTX_free(transport->receive.context);
+    free(transport->input);
+    free(transport);
+}
@@ -0,0 +1,74 @@
+/*
+Copyright 2025 Amini Allight
+
+This file is part of netpw.
+
+netpw is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+netpw is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with netpw. If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef NETPW_TRANSPORT_H
+#define NETPW_TRANSPORT_H
+
+#include <openssl/ssl.h>
+#include <stdint.h>
+
+enum crypto_profile
+{
+    NETPW_CRYPTO_PROFILE_NONE,
+    /* TLS 1.3 preferring whichever AEAD this CPU accelerates */
+    NETPW_CRYPTO_PROFILE_AUTO,
+    NETPW_CRYPTO_PROFILE_AES,
+    NETPW_CRYPTO_PROFILE_CHACHA,
+    /* a TLS 1.3 handshake for authentication, then records which are tagged but not encrypted */
+    NETPW_CRYPTO_PROFILE_INTEGRITY,
+    /* no handshake, authentication or encryption at all */
+    NETPW_CRYPTO_PROFILE_PLAINTEXT
+};
+
+enum crypto_profile crypto_profile_from_name(const char* name);
+const char* crypto_profile_name(enum crypto_profile profile);
+
+struct transport;
+
+#define NETPW_TRANSPORT_WOULD_BLOCK (-2)
+
+/* orders the cipher suites and sets the application protocol so that peers with different profiles fail the handshake */
+void transport_configure(SSL_CTX* context, enum crypto_profile profile, int server);
+
+/* perform the handshake, if the profile has one, over a connected socket and return NULL if it fails */
+/* deadline is on the get_time clock, zero to wait as long as the peer takes */
+struct transport* transport_accept(SSL_CTX* context, int socket, enum crypto_profile profile, uint64_t deadline);
+struct transport* transport_connect(SSL_CTX* context, int socket, enum crypto_profile profile);
+
+/* exchange audio with a peer on the same host through shared memory handed over a connected Unix socket */
+struct transport* transport_local_accept(int socket);
+struct transport* transport_local_connect(int socket);
+
+/* NULL for plaintext */
+SSL* transport_ssl(struct transport* transport);
+/* names the profile and negotiated suite for logging */
+const char* transport_description(struct transport* transport);
+
+/* return the number of bytes read or written, or zero or less once the connection is closed or broken */
+int transport_read(struct transport* transport, unsigned char* buffer, int size);
+/*
+ * like transport_read but for a network socket set to O_NONBLOCK, returns NETPW_TRANSPORT_WOULD_BLOCK once nothing more can be read
+ * TLS may hold decrypted data the socket no longer signals, so callers read until then rather than once per wakeup
+ */
+int transport_read_nonblocking(struct transport* transport, unsigned char* buffer, int size);
+int transport_write(struct transport* transport, const unsigned char* data, int size);
+
+/* leaves the socket open */
+void transport_destroy(struct transport* transport);
+
+#endif
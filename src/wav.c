@@ -0,0 +1,161 @@
+/*
+Copyright 2025 Amini Allight
+
+This file is part of netpw.
+
+netpw is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+netpw is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with netpw. If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "wav.h"
+
+#include <string.h>
+#include <unistd.h>
+
+#define NETPW_WAV_FORMAT_PCM 1
+#define NETPW_WAV_FORMAT_EXTENSIBLE 0xfffe
+
+static uint32_t read_u32(const unsigned char* data)
+{
+    return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+static uint16_t read_u16(const unsigned char* data)
+{
+    return data[0] | (data[1] << 8);
+}
+
+static void write_u32(unsigned char* data, uint32_t x)
+{
+    data[0] = x & 0xff;
+    data[1] = (x >> 8) & 0xff;
+    data[2] = (x >> 16) & 0xff;
+    data[3] = (x >> 24) & 0xff;
+}
+
+static void write_u16(unsigned char* data, uint16_t x)
+{
+    data[0] = x & 0xff;
+    data[1] = (x >> 8) & 0xff;
+}
+
+static int read_exactly(int fd, unsigned char* data, int size)
+{
+    int offset = 0;
+
+    while (offset < size)
+    {
+        int result = read(fd, data + offset, size - offset);
+
+        if (result <= 0)
+        {
+            return -1;
+        }
+
+        offset += result;
+    }
+
+    return 0;
+}
+
+int wav_read_header(int fd, int* frequency, int* channels, int* depth)
+{
+    unsigned char riff[12];
+
+    if (read_exactly(fd, riff, sizeof(riff)) < 0 || memcmp(riff, "RIFF", 4) != 0 || memcmp(riff + 8, "WAVE", 4) != 0)
+    {
+        return lseek(fd, 0, SEEK_SET) < 0 ? -1 : 0;
+    }
+
+    int found_format = 0;
+
+    while (1)
+    {
+        unsigned char chunk[8];
+
+        if (read_exactly(fd, chunk, sizeof(chunk)) < 0)
+        {
+            return -1;
+        }
+
+        uint32_t size = read_u32(chunk + 4);
+
+        if (memcmp(chunk, "fmt ", 4) == 0)
+        {
+            unsigned char format[16];
+
+            if (size < sizeof(format) || read_exactly(fd, format, sizeof(format)) < 0)
+            {
+                return -1;
+            }
+
+            uint16_t tag = read_u16(format);
+
+            if (tag != NETPW_WAV_FORMAT_PCM && tag != NETPW_WAV_FORMAT_EXTENSIBLE)
+            {
+                return -1;
+            }
+
+            *channels = read_u16(format + 2);
+            *frequency = read_u32(format + 4);
+            *depth = read_u16(format + 14);
+            found_format = 1;
+
+            size -= sizeof(format);
+        }
+        else if (memcmp(chunk, "data", 4) == 0)
+        {
+            return found_format ? 1 : -1;
+        }
+
+        /* chunks are padded to an even size */
+        if (lseek(fd, size + (size & 1), SEEK_CUR) < 0)
+        {
+            return -1;
+        }
+    }
+}
+
+void wav_write_header(unsigned char* header, int frequency, int channels, int depth, uint32_t data_size)
+{
+    int stride = channels * (depth / 8);
+
+    memcpy(header, "RIFF", 4);
+    write_u32(header + 4, NETPW_WAV_HEADER_SIZE - 8 + data_size);
+    memcpy(header + 8, "WAVE", 4);
+
+    memcpy(header + 12, "fmt ", 4);
+    write_u32(header + 16, 16);
+    write_u16(header + 20, NETPW_WAV_FORMAT_PCM);
+    write_u16(header + 22, channels);
+    write_u32(header + 24, frequency);
+    write_u32(header + 28, frequency * stride);
+    write_u16(header + 32, stride);
+    write_u16(header + 34, depth);
+
+    memcpy(header + 36, "data", 4);
+    write_u32(header + 40, data_size);
+}
+
+void wav_convert_samples(unsigned char* data, int size, int depth)
+{
+    if (depth != 8)
+    {
+        return;
+    }
+
+    int i;
+    for (i = 0; i < size; i++)
+    {
+        data[i] ^= 0x80;
+    }
+}
@@ -0,0 +1,34 @@
+/*
+Copyright 2025 Amini Allight
+
+This file is part of netpw.
+
+netpw is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+netpw is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with netpw. If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef NETPW_WAV_H
+#define NETPW_WAV_H
+
+#include <stdint.h>
+
+#define NETPW_WAV_HEADER_SIZE 44
+
+/* returns 1 and leaves the file at the start of the samples if it is PCM WAV, 0 and rewinds it if it isn't WAV, negative on error */
+int wav_read_header(int fd, int* frequency, int* channels, int* depth);
+
+void wav_write_header(unsigned char* header, int frequency, int channels, int depth, uint32_t data_size);
+
+/* WAV stores 8 bit samples unsigned where the stream is signed, this converts in place either way and leaves other depths alone */
+void wav_convert_samples(unsigned char* data, int size, int depth);
+
+#endif
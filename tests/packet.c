@@ -0,0 +1,63 @@
+/*
+Copyright 2025 Amini Allight
+
+This file is part of netpw.
+
+netpw is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+netpw is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with netpw. If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "constants.h"
+#include "packet.h"
+
+#include <stdio.h>
+#include <stdint.h>
+
+/* checks for the packet payloads that are read straight off the wire, exits non-zero on the first failure */
+
+#define CHECK(condition) \
+if (!(condition)) \
+{ \
+    fprintf(stderr, "%s:%i: check failed: %s\n", __FILE__, __LINE__, #condition); \
+    return 1; \
+}
+
+static int silence(uint32_t frames, int size, int stride)
+{
+    unsigned char data[NETPW_PACKET_SILENCE_SIZE];
+    packet_write_u32(data, frames);
+
+    return packet_read_silence(data, size, stride);
+}
+
+int main(int argc, char** argv)
+{
+    int stride = 2 * 4;
+
+    CHECK(silence(480, NETPW_PACKET_SILENCE_SIZE, stride) == 480);
+    CHECK(silence(0, NETPW_PACKET_SILENCE_SIZE, stride) == 0);
+
+    /* exactly a full queue is accepted, one frame more is not */
+    CHECK(silence(NETPW_QUEUE_SIZE / stride, NETPW_PACKET_SILENCE_SIZE, stride) == NETPW_QUEUE_SIZE / stride);
+    CHECK(silence(NETPW_QUEUE_SIZE / stride + 1, NETPW_PACKET_SILENCE_SIZE, stride) < 0);
+
+    /* these overflow a 32 bit byte count */
+    CHECK(silence(0x80000000, NETPW_PACKET_SILENCE_SIZE, stride) < 0);
+    CHECK(silence(0xffffffff, NETPW_PACKET_SILENCE_SIZE, stride) < 0);
+    CHECK(silence(0xffffffff, NETPW_PACKET_SILENCE_SIZE, 1) < 0);
+
+    CHECK(silence(480, NETPW_PACKET_SILENCE_SIZE - 1, stride) < 0);
+    CHECK(silence(480, NETPW_PACKET_SILENCE_SIZE + 1, stride) < 0);
+    CHECK(silence(480, NETPW_PACKET_SILENCE_SIZE, 0) < 0);
+
+    return 0;
+}